@@ -0,0 +1,168 @@
+## @file
+#
+# Generates FV images for FfsBench to load on the emulator, with the BaseTools
+# GenSec, GenFfs and GenFv, which have to be on the PATH (run edksetup.sh).
+#
+# Each image is named Bench<N>.fv and holds N FREEFORM files with a UI section
+# and a RAW section of --size bytes, compressed if --compress is given. With
+# --nested, the first --nested of them are put in a volume nested in the image
+# instead. File GUIDs and contents only depend on the arguments, so that every
+# driver build is measured on the same images:
+#
+#   python GenBenchFv.py -o Build/EmulatorX64/DEBUG_GCC5/X64/FfsBenchFv -n 10 -n 1000
+#
+# Copyright 2011 Colin Drake. All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+#  1. Redistributions of source code must retain the above copyright notice,
+#     this list of conditions and the following disclaimer.
+#
+#  2. Redistributions in binary form must reproduce the above copyright notice,
+#     this list of conditions and the following disclaimer in the documentation
+#     and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+# IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+# EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+# 
+# The views and conclusions contained in the software and documentation are those
+# of the authors and should not be interpreted as representing official policies,
+# either expressed or implied, of Colin Drake.
+#
+
+import argparse
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+import uuid
+
+#
+# Namespace the file and volume GUIDs are derived from.
+#
+BENCH_NAMESPACE = uuid.UUID ('16e9d46e-9dfe-41d0-b2ca-efbb93473edd')
+
+FV_ATTRIBUTES = """[attributes]
+EFI_ERASE_POLARITY = 1
+EFI_WRITE_ENABLED_CAP = TRUE
+EFI_READ_ENABLED_CAP = TRUE
+EFI_READ_STATUS = TRUE
+EFI_WRITE_STATUS = TRUE
+EFI_LOCK_CAP = TRUE
+EFI_LOCK_STATUS = TRUE
+EFI_STICKY_WRITE = TRUE
+EFI_MEMORY_MAPPED = TRUE
+EFI_READ_LOCK_CAP = TRUE
+EFI_READ_LOCK_STATUS = TRUE
+EFI_WRITE_LOCK_CAP = TRUE
+EFI_WRITE_LOCK_STATUS = TRUE
+EFI_FVB2_ALIGNMENT_16 = TRUE
+"""
+
+def Run (Arguments):
+  """Runs a BaseTools command, failing the script if it does."""
+  subprocess.check_call (Arguments)
+
+def Payload (Generator, Size):
+  """Returns Size bytes that compress about two to one, like most code."""
+  Data = bytearray ()
+  while len (Data) < Size:
+    Data += bytes (Generator.getrandbits (8) for _ in range (32))
+    Data += bytes (32)
+  return bytes (Data[:Size])
+
+def GenFile (WorkDir, Name, Guid, Data, Compress):
+  """Builds a FREEFORM file holding Data and a UI section, returns its path."""
+  Base = os.path.join (WorkDir, Name)
+
+  with open (Base + '.bin', 'wb') as Output:
+    Output.write (Data)
+
+  Run (['GenSec', '-s', 'EFI_SECTION_RAW', '-o', Base + '.raw', Base + '.bin'])
+  Run (['GenSec', '-s', 'EFI_SECTION_USER_INTERFACE', '-n', Name, '-o', Base + '.ui'])
+
+  Section = Base + '.raw'
+  if Compress:
+    Run (['GenSec', '-s', 'EFI_SECTION_COMPRESSION', '-c', 'PI_STD', '-o', Base + '.cmp', Section])
+    Section = Base + '.cmp'
+
+  Run (['GenFfs', '-t', 'EFI_FV_FILETYPE_FREEFORM', '-g', str (Guid), '-o', Base + '.ffs',
+        '-i', Section, '-i', Base + '.ui'])
+  return Base + '.ffs'
+
+def GenFv (WorkDir, Name, Guid, Files, Output):
+  """Builds a volume out of FFS files. GenFv sizes it to fit them."""
+  Inf = os.path.join (WorkDir, Name + '.inf')
+
+  with open (Inf, 'w') as Description:
+    Description.write ('[options]\nEFI_BLOCK_SIZE = 0x1000\n\n')
+    Description.write (FV_ATTRIBUTES)
+    Description.write ('EFI_FV_GUID = %s\n\n[files]\n' % Guid)
+    for File in Files:
+      Description.write ('EFI_FILE_NAME = %s\n' % File)
+
+  Run (['GenFv', '-i', Inf, '-o', Output])
+
+def GenImage (WorkDir, Count, Arguments):
+  """Builds Bench<Count>.fv in the output directory."""
+  Name      = 'Bench%d' % Count
+  Generator = random.Random (Count)
+  Files     = []
+
+  for Index in range (Count):
+    FileName = '%s_%05d' % (Name, Index)
+    Guid     = uuid.uuid5 (BENCH_NAMESPACE, FileName)
+    Data     = Payload (Generator, Arguments.size)
+    Files.append (GenFile (WorkDir, FileName, Guid, Data, Arguments.compress))
+
+  Nested = min (Arguments.nested, Count)
+  if Nested != 0:
+    Inner = os.path.join (WorkDir, Name + '_Nested.fv')
+    GenFv (WorkDir, Name + '_Nested', uuid.uuid5 (BENCH_NAMESPACE, Name + '_Nested'), Files[:Nested], Inner)
+
+    Base = os.path.join (WorkDir, Name + '_Nested')
+    Run (['GenSec', '-s', 'EFI_SECTION_FIRMWARE_VOLUME_IMAGE', '-o', Base + '.sec', Inner])
+    Run (['GenFfs', '-t', 'EFI_FV_FILETYPE_FIRMWARE_VOLUME_IMAGE', '-g',
+          str (uuid.uuid5 (BENCH_NAMESPACE, Name + '_NestedFile')), '-o', Base + '.ffs', '-i', Base + '.sec'])
+    Files = [Base + '.ffs'] + Files[Nested:]
+
+  Output = os.path.join (Arguments.output, Name + '.fv')
+  GenFv (WorkDir, Name, uuid.uuid5 (BENCH_NAMESPACE, Name), Files, Output)
+  print ('%s: %d file(s), %d nested' % (Output, Count, Nested))
+
+def Main ():
+  Parser = argparse.ArgumentParser (description = 'Generates FV images for FfsBench.')
+  Parser.add_argument ('-o', '--output', required = True,
+                       help = 'directory to write the images to, FfsBenchFv next to FfsBench.efi')
+  Parser.add_argument ('-n', '--files', type = int, action = 'append',
+                       help = 'number of files in an image, once per image (default: 10, 100, 1000)')
+  Parser.add_argument ('--size', type = int, default = 4096, help = 'bytes of data in each file')
+  Parser.add_argument ('--compress', action = 'store_true', help = 'compress each file\'s data')
+  Parser.add_argument ('--nested', type = int, default = 0, help = 'files to put in a nested volume')
+  Arguments = Parser.parse_args ()
+
+  if not os.path.isdir (Arguments.output):
+    os.makedirs (Arguments.output)
+
+  for Count in (Arguments.files or [10, 100, 1000]):
+    WorkDir = tempfile.mkdtemp (prefix = 'GenBenchFv')
+    try:
+      GenImage (WorkDir, Count, Arguments)
+    finally:
+      shutil.rmtree (WorkDir)
+
+  return 0
+
+if __name__ == '__main__':
+  sys.exit (Main ())
@@ -0,0 +1,811 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include "FfsBench.h"
+
+//
+// Global data
+//
+
+///
+/// Chunk sizes every file is read back in, after being read whole.
+///
+UINTN  mFfsBenchChunkSizes[] = { 512, SIZE_4KB, SIZE_64KB };
+
+///
+/// Performance counter bounds, which tell whether it counts up or down.
+///
+UINT64 mFfsBenchCounterStart;
+UINT64 mFfsBenchCounterEnd;
+
+//
+// Misc. helper methods
+//
+
+/**
+  Works out how many ticks have passed since a performance counter reading,
+  allowing for counters that count down and for a single wrap.
+
+  @param  Start The earlier counter reading.
+
+  @retval The number of ticks since Start.
+
+**/
+UINT64
+FfsBenchElapsed (
+  IN UINT64 Start
+  )
+{
+  UINT64 Now;
+
+  Now = GetPerformanceCounter ();
+
+  if (mFfsBenchCounterEnd >= mFfsBenchCounterStart) {
+    if (Now >= Start) {
+      return Now - Start;
+    }
+
+    return (mFfsBenchCounterEnd - Start) + (Now - mFfsBenchCounterStart);
+  }
+
+  if (Start >= Now) {
+    return Start - Now;
+  }
+
+  return (Start - mFfsBenchCounterEnd) + (mFfsBenchCounterStart - Now);
+}
+
+/**
+  Appends an ASCII string to the output file.
+
+  @param  Output The output file.
+  @param  String The string to append.
+
+  @retval EFI_SUCCESS The string was written.
+  @retval other       The string could not be written.
+
+**/
+EFI_STATUS
+FfsBenchWrite (
+  IN EFI_FILE_PROTOCOL *Output,
+  IN CHAR8             *String
+  )
+{
+  UINTN Size;
+
+  Size = AsciiStrLen (String);
+
+  return Output->Write (Output, &Size, String);
+}
+
+/**
+  Tells whether a directory entry is a nested volume, which FfsDxe names
+  after the file holding it, with a ".fv" extension.
+
+  @param  Info The directory entry.
+
+  @retval TRUE  The entry is a nested volume.
+  @retval FALSE The entry is a file, or another kind of directory.
+
+**/
+BOOLEAN
+FfsBenchIsVolume (
+  IN EFI_FILE_INFO *Info
+  )
+{
+  UINTN Length;
+
+  Length = StrLen (Info->FileName);
+
+  return (BOOLEAN) ((Info->Attribute & EFI_FILE_DIRECTORY) != 0 &&
+                    Length > 3 &&
+                    StrCmp (Info->FileName + Length - 3, L".fv") == 0);
+}
+
+/**
+  Starts a measurement: snapshots the volume's counters, then reads the
+  performance counter last so that the snapshot is not timed.
+
+  @param  Context The run's context.
+
+**/
+VOID
+FfsBenchStart (
+  IN OUT FFS_BENCH_CONTEXT *Context
+  )
+{
+  if (Context->Statistics != NULL) {
+    Context->Statistics->GetStatistics (Context->Statistics, &Context->Before);
+
+    if (Context->Statistics->Revision >= FFS_BENCH_CACHE_REVISION) {
+      Context->Statistics->GetCacheStatistics (Context->Statistics, &Context->CacheBefore);
+    }
+  }
+
+  Context->Start = GetPerformanceCounter ();
+}
+
+/**
+  Ends a measurement and appends its row to the output file. Reading the
+  performance counter is done first, so neither the counters snapshot nor
+  the write is timed.
+
+  @param  Context   The run's context.
+  @param  Operation Name of the operation measured.
+  @param  FileName  Name of the file it was done on, or NULL for the volume.
+                    Either way, it is prefixed with the nested volume's path.
+  @param  ChunkSize Bytes asked for by each Read() call, or 0.
+  @param  Bytes     Bytes the operation returned.
+  @param  Status    Status the operation ended with.
+
+**/
+VOID
+FfsBenchEnd (
+  IN OUT FFS_BENCH_CONTEXT *Context,
+  IN     CHAR8             *Operation,
+  IN     CHAR16            *FileName,
+  IN     UINTN             ChunkSize,
+  IN     UINT64            Bytes,
+  IN     EFI_STATUS        Status
+  )
+{
+  UINT64                Ticks;
+  FFS_VOLUME_STATISTICS After;
+  UINT64                Fv2Calls;
+  UINT64                BytesDecoded;
+  FFS_CACHE_STATISTICS  CacheAfter;
+  UINT64                CacheHits;
+  UINT64                CacheMisses;
+  UINT64                PrefetchHits;
+  CHAR8                 Line[FFS_BENCH_LINE_SIZE];
+
+  Ticks        = FfsBenchElapsed (Context->Start);
+  Fv2Calls     = 0;
+  BytesDecoded = 0;
+  CacheHits    = 0;
+  CacheMisses  = 0;
+  PrefetchHits = 0;
+
+  if (Context->Statistics != NULL) {
+    Context->Statistics->GetStatistics (Context->Statistics, &After);
+
+    Fv2Calls     = (After.GetNextFileCalls - Context->Before.GetNextFileCalls) +
+                   (After.ReadFileCalls - Context->Before.ReadFileCalls) +
+                   (After.ReadSectionCalls - Context->Before.ReadSectionCalls);
+    BytesDecoded = After.BytesDecoded - Context->Before.BytesDecoded;
+
+    if (Context->Statistics->Revision >= FFS_BENCH_CACHE_REVISION) {
+      Context->Statistics->GetCacheStatistics (Context->Statistics, &CacheAfter);
+
+      CacheHits    = CacheAfter.Hits - Context->CacheBefore.Hits;
+      CacheMisses  = CacheAfter.Misses - Context->CacheBefore.Misses;
+      PrefetchHits = CacheAfter.PrefetchHits - Context->CacheBefore.PrefetchHits;
+    }
+  }
+
+  AsciiSPrint (
+    Line,
+    sizeof (Line),
+    "%d,%d,%a,%s%s,%d,%ld,%ld,%r,%ld,%ld,%ld,%ld,%ld,%d\r\n",
+    Context->Volume,
+    Context->Pass,
+    Operation,
+    Context->Path,
+    FileName == NULL ? L"" : FileName,
+    ChunkSize,
+    Bytes,
+    GetTimeInNanoSecond (Ticks),
+    Status,
+    Fv2Calls,
+    BytesDecoded,
+    CacheHits,
+    CacheMisses,
+    PrefetchHits,
+    Context->Cold);
+
+  if (!EFI_ERROR (FfsBenchWrite (Context->Output, Line))) {
+    Context->Rows++;
+  }
+}
+
+/**
+  Reads the next entry of a directory, growing the entry buffer if need be.
+
+  @param  Directory The directory being listed.
+  @param  Info      The entry buffer. May be reallocated.
+  @param  InfoSize  Size of the entry buffer. Updated if it is reallocated.
+  @param  Size      On output, the size of the entry read, or 0 at the end of
+                    the directory.
+
+  @retval EFI_SUCCESS          The entry was read, or the end was reached.
+  @retval EFI_OUT_OF_RESOURCES The entry buffer could not be grown.
+  @retval other                The directory could not be read.
+
+**/
+EFI_STATUS
+FfsBenchReadEntry (
+  IN     EFI_FILE_PROTOCOL *Directory,
+  IN OUT EFI_FILE_INFO     **Info,
+  IN OUT UINTN             *InfoSize,
+  OUT    UINTN             *Size
+  )
+{
+  EFI_STATUS    Status;
+  EFI_FILE_INFO *Bigger;
+
+  *Size  = *InfoSize;
+  Status = Directory->Read (Directory, Size, *Info);
+
+  if (Status == EFI_BUFFER_TOO_SMALL) {
+    Bigger = ReallocatePool (*InfoSize, *Size, *Info);
+
+    if (Bigger == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    *Info     = Bigger;
+    *InfoSize = *Size;
+    Status    = Directory->Read (Directory, Size, *Info);
+  }
+
+  return Status;
+}
+
+/**
+  Opens the file the results are written to: FFS_BENCH_OUTPUT_NAME in the
+  root of the first file system that was not produced by FfsDxe. The file is
+  created if need be, and rows are appended to it, so several runs, such as
+  one per driver build, end up in the same file. The CSV header is written
+  when the file is empty.
+
+  @param  Output On output, the opened file.
+  @param  Root   On output, the root directory of the file system it is on.
+
+  @retval EFI_SUCCESS   The file was opened.
+  @retval EFI_NOT_FOUND No other writable file system was found.
+
+**/
+EFI_STATUS
+FfsBenchOpenOutput (
+  OUT EFI_FILE_PROTOCOL **Output,
+  OUT EFI_FILE_PROTOCOL **Root
+  )
+{
+  EFI_STATUS                      Status;
+  EFI_HANDLE                      *Handles;
+  UINTN                           HandleCount;
+  UINTN                           Index;
+  VOID                            *Statistics;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *Sfs;
+  EFI_FILE_PROTOCOL               *Directory;
+  EFI_FILE_PROTOCOL               *File;
+  UINT64                          Position;
+
+  Status = gBS->LocateHandleBuffer (
+                  ByProtocol,
+                  &gEfiSimpleFileSystemProtocolGuid,
+                  NULL,
+                  &HandleCount,
+                  &Handles);
+
+  if (EFI_ERROR (Status)) {
+    return EFI_NOT_FOUND;
+  }
+
+  Status = EFI_NOT_FOUND;
+
+  for (Index = 0; Index < HandleCount; Index++) {
+    if (!EFI_ERROR (gBS->HandleProtocol (Handles[Index], &gFfsStatisticsProtocolGuid, &Statistics))) {
+      continue;
+    }
+
+    if (EFI_ERROR (gBS->HandleProtocol (Handles[Index], &gEfiSimpleFileSystemProtocolGuid, (VOID **) &Sfs)) ||
+        EFI_ERROR (Sfs->OpenVolume (Sfs, &Directory))) {
+      continue;
+    }
+
+    Status = Directory->Open (
+                          Directory,
+                          &File,
+                          FFS_BENCH_OUTPUT_NAME,
+                          EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+                          0);
+
+    if (EFI_ERROR (Status)) {
+      Directory->Close (Directory);
+      continue;
+    }
+
+    //
+    // Append to what earlier runs left, and start new files with the header.
+    //
+    File->SetPosition (File, FFS_BENCH_END_OF_FILE);
+    Status = File->GetPosition (File, &Position);
+
+    if (!EFI_ERROR (Status) && Position == 0) {
+      Status = FfsBenchWrite (File, FFS_BENCH_CSV_HEADER);
+    }
+
+    if (EFI_ERROR (Status)) {
+      File->Close (File);
+      Directory->Close (Directory);
+      continue;
+    }
+
+    *Output = File;
+    *Root   = Directory;
+    break;
+  }
+
+  FreePool (Handles);
+
+  if (Index == HandleCount) {
+    return EFI_NOT_FOUND;
+  }
+
+  return Status;
+}
+
+/**
+  Hands every FV image in the FFS_BENCH_FV_DIRECTORY directory of a file
+  system to the DXE core, which installs FV2 on each, so that FfsDxe mounts
+  them before they are measured. This is how generated images are measured
+  on the emulator, whose own FVs hold little. The images are kept for as
+  long as the volumes may be used, that is until the next reset.
+
+  @param  Root Root directory of the file system the images are on.
+
+  @retval The number of images processed.
+
+**/
+UINTN
+FfsBenchLoadVolumes (
+  IN EFI_FILE_PROTOCOL *Root
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *Directory;
+  EFI_FILE_PROTOCOL *File;
+  EFI_FILE_INFO     *Info;
+  UINTN             InfoSize;
+  UINTN             Size;
+  UINTN             Length;
+  VOID              *Image;
+  EFI_HANDLE        Handle;
+  UINTN             Loaded;
+
+  Loaded = 0;
+
+  if (EFI_ERROR (Root->Open (Root, &Directory, FFS_BENCH_FV_DIRECTORY, EFI_FILE_MODE_READ, 0))) {
+    return 0;
+  }
+
+  InfoSize = FFS_BENCH_INFO_SIZE;
+  Info     = AllocatePool (InfoSize);
+
+  if (Info == NULL) {
+    goto Done;
+  }
+
+  for (;;) {
+    Status = FfsBenchReadEntry (Directory, &Info, &InfoSize, &Size);
+
+    if (EFI_ERROR (Status) || Size == 0) {
+      break;
+    }
+
+    Length = StrLen (Info->FileName);
+
+    if ((Info->Attribute & EFI_FILE_DIRECTORY) != 0 ||
+        Length <= 3 || StrCmp (Info->FileName + Length - 3, L".fv") != 0 ||
+        Info->FileSize == 0) {
+      continue;
+    }
+
+    if (EFI_ERROR (Directory->Open (Directory, &File, Info->FileName, EFI_FILE_MODE_READ, 0))) {
+      continue;
+    }
+
+    //
+    // Pages keep the image aligned enough for the DXE core to use it in place.
+    //
+    Size  = (UINTN) Info->FileSize;
+    Image = AllocatePages (EFI_SIZE_TO_PAGES (Size));
+
+    if (Image != NULL) {
+      Status = File->Read (File, &Size, Image);
+
+      if (!EFI_ERROR (Status) && Size == Info->FileSize) {
+        Status = gDS->ProcessFirmwareVolume (Image, Size, &Handle);
+      } else if (!EFI_ERROR (Status)) {
+        Status = EFI_VOLUME_CORRUPTED;
+      }
+
+      if (EFI_ERROR (Status)) {
+        Print (L"FfsBench: %s\\%s not loaded: %r\n", FFS_BENCH_FV_DIRECTORY, Info->FileName, Status);
+        FreePages (Image, EFI_SIZE_TO_PAGES ((UINTN) Info->FileSize));
+      } else {
+        Loaded++;
+      }
+    }
+
+    File->Close (File);
+  }
+
+  FreePool (Info);
+
+Done:
+  Directory->Close (Directory);
+
+  return Loaded;
+}
+
+//
+// Measurements
+//
+
+/**
+  Measures opening a file by its GUID name, reading it whole, and reading it
+  again from the start in each of the chunk sizes.
+
+  @param  Context   The run's context.
+  @param  Directory Directory of the volume holding the file.
+  @param  Info      The file's directory entry.
+
+**/
+VOID
+FfsBenchFile (
+  IN OUT FFS_BENCH_CONTEXT *Context,
+  IN     EFI_FILE_PROTOCOL *Directory,
+  IN     EFI_FILE_INFO     *Info
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *File;
+  VOID              *Buffer;
+  UINTN             BufferSize;
+  UINTN             Index;
+  UINTN             Size;
+  UINT64            Total;
+
+  FfsBenchStart (Context);
+  Status = Directory->Open (Directory, &File, Info->FileName, EFI_FILE_MODE_READ, 0);
+  FfsBenchEnd (Context, "Open", Info->FileName, 0, 0, Status);
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  BufferSize = MAX ((UINTN) Info->FileSize, SIZE_64KB);
+  Buffer     = AllocatePool (BufferSize);
+
+  if (Buffer == NULL) {
+    goto Done;
+  }
+
+  //
+  // Whole-file read. On the cold pass this is the one that decodes the file;
+  // the chunked reads after it are served from the driver's cache.
+  //
+  Size = (UINTN) Info->FileSize;
+
+  FfsBenchStart (Context);
+  Status = File->Read (File, &Size, Buffer);
+  FfsBenchEnd (Context, "Read", Info->FileName, (UINTN) Info->FileSize, Size, Status);
+
+  for (Index = 0; Index < ARRAY_SIZE (mFfsBenchChunkSizes); Index++) {
+    File->SetPosition (File, 0);
+    Total = 0;
+
+    FfsBenchStart (Context);
+
+    do {
+      Size   = mFfsBenchChunkSizes[Index];
+      Status = File->Read (File, &Size, Buffer);
+      Total += Size;
+    } while (!EFI_ERROR (Status) && Size != 0);
+
+    FfsBenchEnd (Context, "ReadChunked", Info->FileName, mFfsBenchChunkSizes[Index], Total, Status);
+  }
+
+  FreePool (Buffer);
+
+Done:
+  File->Close (File);
+}
+
+VOID
+FfsBenchDirectory (
+  IN OUT FFS_BENCH_CONTEXT *Context,
+  IN     EFI_FILE_PROTOCOL *Directory
+  );
+
+/**
+  Measures opening a nested volume by its "<GUID>.fv" name, and then the
+  volume itself as done by FfsBenchDirectory. Its rows are named with the
+  volume's path, and charged to the statistics of the volume holding it,
+  which are the ones its FfsDxe instance shares.
+
+  @param  Context   The run's context.
+  @param  Directory Directory of the volume holding the nested one.
+  @param  Info      The nested volume's directory entry.
+
+**/
+VOID
+FfsBenchNested (
+  IN OUT FFS_BENCH_CONTEXT *Context,
+  IN     EFI_FILE_PROTOCOL *Directory,
+  IN     EFI_FILE_INFO     *Info
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *Nested;
+  UINTN             Length;
+
+  Length = StrLen (Context->Path);
+
+  if (Length + StrLen (Info->FileName) + 2 > FFS_BENCH_PATH_LENGTH) {
+    return;
+  }
+
+  FfsBenchStart (Context);
+  Status = Directory->Open (Directory, &Nested, Info->FileName, EFI_FILE_MODE_READ, 0);
+  FfsBenchEnd (Context, "Open", Info->FileName, 0, 0, Status);
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  StrCat (Context->Path, Info->FileName);
+  StrCat (Context->Path, L"\\");
+
+  FfsBenchDirectory (Context, Nested);
+
+  Context->Path[Length] = CHAR_NULL;
+  Nested->Close (Nested);
+}
+
+/**
+  Measures a volume's root directory: a full listing of it, then every file
+  in it as done by FfsBenchFile, and every nested volume in it as done by
+  FfsBenchNested. Other directories, such as the file type groups, only hold
+  files that are measured already.
+
+  @param  Context   The run's context.
+  @param  Directory Root directory of the volume.
+
+**/
+VOID
+FfsBenchDirectory (
+  IN OUT FFS_BENCH_CONTEXT *Context,
+  IN     EFI_FILE_PROTOCOL *Directory
+  )
+{
+  EFI_STATUS    Status;
+  EFI_FILE_INFO *Info;
+  UINTN         InfoSize;
+  UINTN         Size;
+  UINT64        Total;
+
+  InfoSize = FFS_BENCH_INFO_SIZE;
+  Info     = AllocatePool (InfoSize);
+
+  if (Info == NULL) {
+    return;
+  }
+
+  //
+  // Full listing of the directory. Bytes is the number of entries.
+  //
+  Total = 0;
+
+  FfsBenchStart (Context);
+
+  do {
+    Status = FfsBenchReadEntry (Directory, &Info, &InfoSize, &Size);
+    Total += (Size != 0) ? 1 : 0;
+  } while (!EFI_ERROR (Status) && Size != 0);
+
+  FfsBenchEnd (Context, "List", NULL, 0, Total, Status);
+
+  //
+  // Walk the directory again, untimed, and measure what is in it.
+  //
+  Directory->SetPosition (Directory, 0);
+
+  for (;;) {
+    Status = FfsBenchReadEntry (Directory, &Info, &InfoSize, &Size);
+
+    if (EFI_ERROR (Status) || Size == 0) {
+      break;
+    }
+
+    if ((Info->Attribute & EFI_FILE_DIRECTORY) == 0) {
+      FfsBenchFile (Context, Directory, Info);
+    } else if (FfsBenchIsVolume (Info)) {
+      FfsBenchNested (Context, Directory, Info);
+    }
+  }
+
+  FreePool (Info);
+}
+
+/**
+  Measures one pass over a volume: opening it, and then its root directory as
+  done by FfsBenchDirectory. The cold pass drops the volume's caches first.
+
+  @param  Context The run's context.
+  @param  Handle  Handle of the volume.
+
+**/
+VOID
+FfsBenchVolume (
+  IN OUT FFS_BENCH_CONTEXT *Context,
+  IN     EFI_HANDLE        Handle
+  )
+{
+  EFI_STATUS                      Status;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *Sfs;
+  EFI_FILE_PROTOCOL               *Root;
+
+  if (EFI_ERROR (gBS->HandleProtocol (Handle, &gEfiSimpleFileSystemProtocolGuid, (VOID **) &Sfs))) {
+    return;
+  }
+
+  if (EFI_ERROR (gBS->HandleProtocol (Handle, &gFfsStatisticsProtocolGuid, (VOID **) &Context->Statistics))) {
+    Context->Statistics = NULL;
+  }
+
+  //
+  // The cold pass starts from a volume that FfsDxe holds nothing of, as after
+  // a boot. An older driver can't drop its caches, and none can while someone
+  // else has a file open on the volume; such a pass is marked as not cold.
+  //
+  Context->Cold = FALSE;
+
+  if (Context->Pass == 0 &&
+      Context->Statistics != NULL &&
+      Context->Statistics->Revision >= FFS_BENCH_DROP_REVISION) {
+    Context->Cold = (BOOLEAN) !EFI_ERROR (Context->Statistics->DropCaches (Context->Statistics));
+  }
+
+  FfsBenchStart (Context);
+  Status = Sfs->OpenVolume (Sfs, &Root);
+  FfsBenchEnd (Context, "OpenVolume", NULL, 0, 0, Status);
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  FfsBenchDirectory (Context, Root);
+
+  Root->Close (Root);
+}
+
+//
+// Entry point
+//
+
+/**
+  Entry point of FfsBench. Loads the FV images found in FFS_BENCH_FV_DIRECTORY
+  next to the output file, then measures every file system produced by FfsDxe,
+  once cold and then FFS_BENCH_WARM_PASSES times warm, and appends the
+  results as CSV to FFS_BENCH_OUTPUT_NAME on another file system.
+
+  @param  ImageHandle The application's image handle.
+  @param  SystemTable The EFI system table.
+
+  @retval EFI_SUCCESS     The run completed.
+  @retval EFI_NOT_FOUND   There was no FfsDxe volume, or nowhere to write to.
+  @retval EFI_UNSUPPORTED The performance counter doesn't run.
+
+**/
+EFI_STATUS
+EFIAPI
+UefiMain (
+  IN EFI_HANDLE       ImageHandle,
+  IN EFI_SYSTEM_TABLE *SystemTable
+  )
+{
+  EFI_STATUS        Status;
+  EFI_HANDLE        *Handles;
+  UINTN             HandleCount;
+  EFI_FILE_PROTOCOL *OutputRoot;
+  UINTN             Loaded;
+  FFS_BENCH_CONTEXT Context;
+
+  //
+  // A null TimerLib reports a 0 Hz counter, which would make every time 0
+  // and ASSERT in DEBUG builds. Refuse to run rather than write such rows.
+  //
+  if (GetPerformanceCounterProperties (&mFfsBenchCounterStart, &mFfsBenchCounterEnd) == 0) {
+    Print (L"FfsBench: the performance counter doesn't run, map a real TimerLib\n");
+    return EFI_UNSUPPORTED;
+  }
+
+  ZeroMem (&Context, sizeof (Context));
+
+  Status = FfsBenchOpenOutput (&Context.Output, &OutputRoot);
+
+  if (EFI_ERROR (Status)) {
+    Print (L"FfsBench: no file system to write %s to\n", FFS_BENCH_OUTPUT_NAME);
+    return EFI_NOT_FOUND;
+  }
+
+  //
+  // FfsDxe mounts the images as they are processed, since it is notified of
+  // new FV2 instances at a higher TPL than this application's.
+  //
+  Loaded = FfsBenchLoadVolumes (OutputRoot);
+  OutputRoot->Close (OutputRoot);
+
+  //
+  // Every volume FfsDxe mounts carries its statistics protocol next to its
+  // SFS instance, which tells them apart from other file systems.
+  //
+  Status = gBS->LocateHandleBuffer (
+                  ByProtocol,
+                  &gFfsStatisticsProtocolGuid,
+                  NULL,
+                  &HandleCount,
+                  &Handles);
+
+  if (EFI_ERROR (Status)) {
+    Print (L"FfsBench: no FfsDxe volumes found\n");
+    Context.Output->Close (Context.Output);
+    return EFI_NOT_FOUND;
+  }
+
+  //
+  // The cold pass runs over every volume before any warm pass, so that none
+  // of the warm passes fills the content cache that the cold pass of the
+  // next volume shares.
+  //
+  for (Context.Pass = 0; Context.Pass <= FFS_BENCH_WARM_PASSES; Context.Pass++) {
+    for (Context.Volume = 0; Context.Volume < HandleCount; Context.Volume++) {
+      FfsBenchVolume (&Context, Handles[Context.Volume]);
+    }
+  }
+
+  Context.Output->Close (Context.Output);
+
+  Print (
+    L"FfsBench: %d volume(s), %d loaded from %s, %d row(s) written to %s\n",
+    HandleCount,
+    Loaded,
+    FFS_BENCH_FV_DIRECTORY,
+    Context.Rows,
+    FFS_BENCH_OUTPUT_NAME);
+
+  FreePool (Handles);
+
+  return Status;
+}
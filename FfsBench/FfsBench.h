@@ -0,0 +1,93 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#ifndef _FFS_BENCH_H_
+#define _FFS_BENCH_H_
+
+///
+/// Required file includes.
+///
+#include <Uefi.h>
+#include <Guid/FileInfo.h>
+#include <Protocol/SimpleFileSystem.h>
+#include <Protocol/FfsStatistics.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PrintLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiApplicationEntryPoint.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+//
+// Miscellaneous helpful macros.
+//
+#define FFS_BENCH_OUTPUT_NAME   L"FfsBench.csv"
+#define FFS_BENCH_FV_DIRECTORY  L"FfsBenchFv"
+#define FFS_BENCH_WARM_PASSES   3
+#define FFS_BENCH_LINE_SIZE     1024
+#define FFS_BENCH_PATH_LENGTH   256
+#define FFS_BENCH_INFO_SIZE     (SIZE_OF_EFI_FILE_INFO + sizeof (CHAR16) * 256)
+#define FFS_BENCH_END_OF_FILE   (0xFFFFFFFFFFFFFFFF)
+
+///
+/// First revision of the statistics protocol with GetCacheStatistics().
+///
+#define FFS_BENCH_CACHE_REVISION 0x00020000
+
+///
+/// First revision of the statistics protocol with DropCaches().
+///
+#define FFS_BENCH_DROP_REVISION 0x00030000
+
+#define FFS_BENCH_CSV_HEADER \
+  "Volume,Pass,Operation,File,ChunkSize,Bytes,Nanoseconds,Status,Fv2Calls,BytesDecoded," \
+  "CacheHits,CacheMisses,PrefetchHits,Cold\r\n"
+
+///
+/// State shared by every measurement of a run.
+///
+typedef struct {
+  EFI_FILE_PROTOCOL       *Output;                     ///< CSV file the rows are appended to.
+  UINTN                   Rows;                        ///< Number of rows written so far.
+  UINTN                   Volume;                      ///< Index of the volume being measured.
+  UINTN                   Pass;                        ///< Pass being run. Pass 0 is the cold one.
+  BOOLEAN                 Cold;                        ///< The volume's caches were dropped before this pass.
+  CHAR16                  Path[FFS_BENCH_PATH_LENGTH]; ///< Nested volume being measured, as "<GUID>.fv\\", or "".
+  FFS_STATISTICS_PROTOCOL *Statistics;                 ///< Counters of the volume being measured.
+  FFS_VOLUME_STATISTICS   Before;                      ///< The counters when the measurement started.
+  FFS_CACHE_STATISTICS    CacheBefore;                 ///< The cache's counters when the measurement started.
+  UINT64                  Start;                       ///< Performance counter when the measurement started.
+} FFS_BENCH_CONTEXT;
+
+#endif
@@ -45,13 +45,55 @@ FILE_SYSTEM_PRIVATE_DATA mFileSystemPrivateDataTemplate = {
     EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_REVISION,
     FfsOpenVolume
   },
-  NULL
+  {
+    FFS_STATISTICS_PROTOCOL_REVISION,
+    FfsGetStatistics,
+    FfsResetStatistics,
+    FfsGetCacheStatistics,
+    FfsDropCaches
+  },
+  NULL,
+  NULL,
+  0,
+  FALSE,
+  0,
+  0,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  0,
+  NULL,
+  {
+    { NULL, NULL, 0, NULL }
+  },
+  FALSE,
+  NULL,
+  NULL,
+  0,
+  FALSE,
+  NULL,
+  NULL,
+  0,
+  0,
+  FALSE,
+  NULL,
+  { 0, 0, 0, { 0 } },
+  NULL,
+  NULL,
+  NULL,
+  { NULL },
+  NULL,
+  NULL,
+  0,
+  { 0 }
 };
 
 FILE_PRIVATE_DATA mFilePrivateDataTemplate = {
   FILE_PRIVATE_DATA_SIGNATURE,
   {
-    EFI_FILE_PROTOCOL_REVISION,
+    EFI_FILE_PROTOCOL_REVISION2,
     FfsOpen,
     FfsClose,
     FfsDelete,
@@ -61,467 +103,2245 @@ FILE_PRIVATE_DATA mFilePrivateDataTemplate = {
     FfsSetPosition,
     FfsGetInfo,
     FfsSetInfo,
-    FfsFlush 
+    FfsFlush,
+    FfsOpenEx,
+    FfsReadEx,
+    FfsWriteEx,
+    FfsFlushEx
   },
   NULL,
+  0,
   NULL,
   FALSE,
   NULL,
   NULL,
+  0,
   0
 };
 
+CONST FV_TYPE_DIRECTORY mFvTypeDirectories[FV_NUM_TYPE_DIRECTORIES] = {
+  {
+    L"drivers",
+    FV_TYPE_BIT (EFI_FV_FILETYPE_DXE_CORE) |
+    FV_TYPE_BIT (EFI_FV_FILETYPE_DRIVER) |
+    FV_TYPE_BIT (EFI_FV_FILETYPE_COMBINED_PEIM_DRIVER) |
+    FV_TYPE_BIT (EFI_FV_FILETYPE_SMM) |
+    FV_TYPE_BIT (EFI_FV_FILETYPE_COMBINED_SMM_DXE) |
+    FV_TYPE_BIT (EFI_FV_FILETYPE_SMM_CORE)
+  },
+  {
+    L"apps",
+    FV_TYPE_BIT (EFI_FV_FILETYPE_APPLICATION)
+  },
+  {
+    L"raw",
+    FV_TYPE_BIT (EFI_FV_FILETYPE_RAW)
+  },
+  {
+    L"freeform",
+    FV_TYPE_BIT (EFI_FV_FILETYPE_FREEFORM)
+  },
+  {
+    L"peim",
+    FV_TYPE_BIT (EFI_FV_FILETYPE_PEI_CORE) |
+    FV_TYPE_BIT (EFI_FV_FILETYPE_PEIM) |
+    FV_TYPE_BIT (EFI_FV_FILETYPE_COMBINED_PEIM_DRIVER)
+  }
+};
+
+CONST FV_SECTION_KIND mFvSectionKinds[] = {
+  { EFI_SECTION_PE32,                  L"pe32"     },
+  { EFI_SECTION_PIC,                   L"pic"      },
+  { EFI_SECTION_TE,                    L"te"       },
+  { EFI_SECTION_DXE_DEPEX,             L"depex"    },
+  { EFI_SECTION_PEI_DEPEX,             L"peidepex" },
+  { EFI_SECTION_SMM_DEPEX,             L"smmdepex" },
+  { EFI_SECTION_VERSION,               L"version"  },
+  { EFI_SECTION_USER_INTERFACE,        L"ui"       },
+  { EFI_SECTION_COMPATIBILITY16,       L"compat16" },
+  { EFI_SECTION_FIRMWARE_VOLUME_IMAGE, L"fv"       },
+  { EFI_SECTION_FREEFORM_SUBTYPE_GUID, L"freeform" },
+  { EFI_SECTION_RAW,                   L"raw"      }
+};
+
 //
 // Misc. helper methods
 //
 
 /**
-  Gets the number of files on a given EFI_FIRMWARE_VOLUME2_PROTOCOL instance.
+  Determines if a file belongs in a virtual directory. Every file belongs in
+  the root, and the per-type directories hold the files of their types.
 
-  @param[in] Fv2 A pointer to the firmware volume to search.
+  @param  Directory The directory to check, or NULL for the root.
+  @param  Entry     Index entry for the file to check.
 
-  @return The number of files on the volume as an integer.
+  @retval TRUE  The file is listed in the directory.
+  @retval FALSE The file is not listed in the directory.
 
 **/
-UINTN
-FvGetNumberOfFiles (
-  IN EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2
+BOOLEAN
+FvDirectoryContains (
+  IN FV_DIRECTORY  *Directory,
+  IN FV_FILE_ENTRY *Entry
   )
 {
-  EFI_STATUS             Status;
-  VOID                   *Key;
-  EFI_FV_FILETYPE        FileType;
-  EFI_GUID               NameGuid;
-  EFI_FV_FILE_ATTRIBUTES FvAttributes;
-  UINTN                  Size, NumFiles;
+  if (Directory == NULL) {
+    return TRUE;
+  }
 
-  NumFiles = 0;
-  Key      = AllocateZeroPool (Fv2->KeySize);
+  return (BOOLEAN) (Entry->FileType < 32 &&
+                    (Directory->Type->TypeMask & FV_TYPE_BIT (Entry->FileType)) != 0);
+}
 
-  while (TRUE) {
-    //
-    // Grab the next file in the Fv2 volume.
-    //
-    FileType = EFI_FV_FILETYPE_ALL;
-    Status = Fv2->GetNextFile (
-                    Fv2, 
-                    Key,
-                    &FileType,
-                    &NameGuid,
-                    &FvAttributes,
-                    &Size);
+/**
+  Partitions a volume's file index into its virtual per-type directories, and
+  renders each directory's EFI_FILE_INFO into the slot that follows the files'
+  records. A file whose type is held by several directories is listed in each.
 
-    //
-    // Check exit condition. If Status is an error status, then the list of
-    // files tried has been exhausted. Break from the loop and return NULL.
-    //
-    if (Status == EFI_NOT_FOUND) {
-      break;
-    }
-    
-    NumFiles++;
-  }
+  @param  Fs Private data for a filesystem whose index has just been built.
+
+  @retval EFI_SUCCESS          The directories were built.
+  @retval EFI_OUT_OF_RESOURCES The directory members could not be allocated.
+
+**/
+EFI_STATUS
+FvBuildTypeDirectories (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  FV_DIRECTORY  *Directory;
+  FV_FILE_ENTRY **Members;
+  EFI_FILE_INFO *Info;
+  UINTN         DirIndex, Index, Total, DirSize;
 
   //
-  // Free all allocated memory and return number of files on the volume.
+  // Size every partition first so that they can share one allocation.
   //
-  DEBUG ((EFI_D_INFO, "FvGetNumberOfFiles: Directory has %d files\n", NumFiles));
-  FreePool (Key);
-  return NumFiles;
+  Total = 0;
+
+  for (DirIndex = 0; DirIndex < FV_NUM_TYPE_DIRECTORIES; DirIndex++) {
+    Directory             = &Fs->Directories[DirIndex];
+    Directory->Type       = &mFvTypeDirectories[DirIndex];
+    Directory->NumMembers = 0;
+
+    for (Index = 0; Index < Fs->NumFiles; Index++) {
+      if (FvDirectoryContains (Directory, &Fs->Files[Index])) {
+        Directory->NumMembers++;
+      }
+    }
+
+    Total += Directory->NumMembers;
+  }
+
+  Members = AllocatePool (MAX (Total, 1) * sizeof (FV_FILE_ENTRY *));
+
+  if (Members == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Fs->DirMembers = Members;
+
+  for (DirIndex = 0; DirIndex < FV_NUM_TYPE_DIRECTORIES; DirIndex++) {
+    Directory          = &Fs->Directories[DirIndex];
+    Directory->Members = Members;
+    DirSize            = 0;
+
+    for (Index = 0; Index < Fs->NumFiles; Index++) {
+      if (FvDirectoryContains (Directory, &Fs->Files[Index])) {
+        *Members++  = &Fs->Files[Index];
+        DirSize    += Fs->Files[Index].Size;
+      }
+    }
+
+    Info = (EFI_FILE_INFO *) (Fs->InfoRecords + (Fs->NumFiles + DirIndex) * FV_FILE_INFO_STRIDE);
+
+    Info->Size             = SIZE_OF_FILE_INFO;
+    Info->FileSize         = DirSize;
+    Info->PhysicalSize     = DirSize;
+    Info->CreateTime       = mModuleLoadTime;
+    Info->LastAccessTime   = mModuleLoadTime;
+    Info->ModificationTime = mModuleLoadTime;
+    Info->Attribute        = EFI_FILE_READ_ONLY | EFI_FILE_DIRECTORY;
+    StrCpy (Info->FileName, Directory->Type->Name);
+
+    Directory->Info = Info;
+  }
+
+  return EFI_SUCCESS;
 }
 
 /**
-  Determines if the file identified by FileGuid is executable on the current system.
+  Gets the description of a section type that is exposed in section
+  directories.
 
-  @param  Fv2      A pointer to the firmware volume to search.
-  @param  FileGuid A GUID naming the file that the system is trying to access.
+  @param  Type The section type.
 
-  @retval True or False if the file is executable.
+  @retval a kind The section type is exposed, and its description was returned.
+  @retval NULL   Sections of the type are not exposed.
 
 **/
-BOOLEAN
-IsFileExecutable (
-  IN EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2,
-  IN EFI_GUID                      *FileGuid
+CONST FV_SECTION_KIND *
+FvGetSectionKind (
+  IN EFI_SECTION_TYPE Type
   )
 {
-  EFI_STATUS       Status;
-  EFI_SECTION_TYPE SectionType;
-  VOID             *Buffer;
-  UINTN            MachineType,
-                   BufferSize,
-                   SectionInstance;
-  UINT32           AuthenticationStatus;
-  BOOLEAN          Executable;
-
-  SectionType     = EFI_SECTION_PE32;
-  Buffer          = NULL;
-  SectionInstance = 0;
-  BufferSize      = 0;
-
-  //
-  // Read the executable section of the file passed in.
-  //
-  Status = Fv2->ReadSection (Fv2,
-                             FileGuid,
-                             SectionType,
-                             SectionInstance,
-                             &Buffer,
-                             &BufferSize,
-                             &AuthenticationStatus);
+  UINTN Index;
 
-  //
-  // Return FALSE if there's an error reading the executable section.
-  //
-  if (EFI_ERROR (Status)) {
-    Executable = FALSE;
-  } else {
-    //
-    // Determine and return if the machine type is supported or not.
-    //
-    MachineType = PeCoffLoaderGetMachineType (Buffer);
-    Executable  = EFI_IMAGE_MACHINE_TYPE_SUPPORTED (MachineType);
+  for (Index = 0; Index < ARRAY_SIZE (mFvSectionKinds); Index++) {
+    if (mFvSectionKinds[Index].Type == Type) {
+      return &mFvSectionKinds[Index];
+    }
   }
 
-  return Executable;
+  return NULL;
 }
 
 /**
-  Gets the size of the file named by the provided GUID in FileGuid.
+  Appends a zeroed entry to a growing list of sections.
 
-  @param  Fv2      A pointer to the firmware volume to search.
-  @param  FileGuid A GUID representing the file that the system is trying to access.
+  @param  Sections    On input and output, the list. It is reallocated as it
+                      grows.
+  @param  NumSections On input and output, the number of entries in Sections.
+  @param  Capacity    On input and output, the capacity of Sections.
 
-  @retval The size of the file in bytes.
+  @retval The new entry, or NULL if the list could not be grown.
 
 **/
-UINTN
-FvFileGetSize (
-  IN EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2,
-  IN EFI_GUID                      *FileGuid
+FV_SECTION_ENTRY *
+FvAppendSection (
+  IN OUT FV_SECTION_ENTRY **Sections,
+  IN OUT UINTN            *NumSections,
+  IN OUT UINTN            *Capacity
   )
 {
-  UINTN                  BufferSize, SectionInstance;
-  UINT32                 AuthenticationStatus;
-  EFI_FV_FILETYPE        FoundType;
-  EFI_FV_FILE_ATTRIBUTES FileAttributes;
-  EFI_SECTION_TYPE       SectionType;
-  VOID                   *Buffer;
+  FV_SECTION_ENTRY *NewSections, *Section;
 
-  Buffer = NULL;
-  BufferSize = 0;
+  if (*NumSections == *Capacity) {
+    NewSections = ReallocatePool (
+                    *Capacity * sizeof (FV_SECTION_ENTRY),
+                    (*Capacity + FV_SECTION_LIST_GROWTH) * sizeof (FV_SECTION_ENTRY),
+                    *Sections);
 
-  if (IsFileExecutable (Fv2, FileGuid)) {
-    //
-    // When ReadSection is called with Buffer == NULL, the value returned in
-    // BufferSize will be the size of the section.
-    //
-    SectionType     = EFI_SECTION_PE32;
-    SectionInstance = 0;
-
-    Fv2->ReadSection (
-           Fv2,
-           FileGuid,
-           SectionType,
-           SectionInstance,
-           &Buffer,
-           &BufferSize,
-           &AuthenticationStatus);
-
-    FreePool (Buffer);
-  } else {
-    //
-    // When ReadFile is called with Buffer == NULL, the value returned in 
-    // BufferSize will be the size of the file.
-    //
-    Fv2->ReadFile (
-           Fv2,
-           FileGuid,
-           NULL,
-           &BufferSize,
-           &FoundType,
-           &FileAttributes,
-           &AuthenticationStatus);
+    if (NewSections == NULL) {
+      return NULL;
+    }
+
+    *Sections  = NewSections;
+    *Capacity += FV_SECTION_LIST_GROWTH;
   }
 
-  return BufferSize;
+  Section = &(*Sections)[(*NumSections)++];
+  ZeroMem (Section, sizeof (FV_SECTION_ENTRY));
+  return Section;
 }
 
 /**
-  Gets an EFI_GUID representing an FV2 file given stringified GUID name.
+  Determines if a file is made of sections, and so has a section directory
+  when section directories are enabled. Raw files hold no section stream.
 
-  @param  Fv2      A pointer to the firmware volume to search.
-  @param  FileName A string representing the file that the system is trying to access.
+  @param  Entry Index entry for the file to check.
 
-  @retval a GUID The file was found, and the associated GUID was returned.
-  @retval NULL   The file was not found.
+  @retval TRUE  The file has a section directory.
+  @retval FALSE The file has no section directory.
 
 **/
-EFI_GUID *
-FvGetFile (
-  IN EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2,
-  IN CHAR16                        *FileName
+BOOLEAN
+FvFileHasSections (
+  IN FV_FILE_ENTRY *Entry
   )
 {
-  EFI_STATUS             Status;
-  BOOLEAN                Found;
-  VOID                   *Key;
-  EFI_FV_FILETYPE        FileType;
-  EFI_GUID               NameGuid, *OutputGuid;
-  EFI_FV_FILE_ATTRIBUTES FvAttributes;
-  UINTN                  Size;
-  CHAR16                 *GuidAsString;
-
-  // Loop through all FV2 files.
-  Found        = FALSE;
-  GuidAsString = AllocateZeroPool (SIZE_OF_GUID);
-  OutputGuid   = AllocateZeroPool (sizeof (EFI_GUID));
-  Key          = AllocateZeroPool (Fv2->KeySize);
+  return (BOOLEAN) (FeaturePcdGet (PcdFfsSectionDirectories) &&
+                    Entry->FileType != EFI_FV_FILETYPE_RAW);
+}
 
-  while (TRUE) {
-    //
-    // Grab the next file in the Fv2 volume.
-    //
-    FileType = EFI_FV_FILETYPE_ALL;
-    Status = Fv2->GetNextFile (
-                    Fv2, 
-                    Key,
-                    &FileType,
-                    &NameGuid,
-                    &FvAttributes,
-                    &Size);
+/**
+  Determines if a file holds a nested firmware volume, and so is also listed
+  as a directory holding the volume's files.
 
-    //
-    // Check exit condition. If Status is an error status, then the list of
-    // files tried has been exhausted. Break from the loop and return NULL.
-    //
-    if (Status == EFI_NOT_FOUND) {
-      DEBUG ((EFI_D_INFO, "FvGetFile: At last file or ERROR found...\n"));
-      break;
-    }
+  @param  Entry Index entry for the file to check.
 
-    //
-    // Check for the file we're looking for by converting the found GUID to a
-    // string and testing with StrCmp(). If the GUID and FileName input string
-    // are equal, then the requested file was found.
-    //
-    UnicodeSPrint (GuidAsString, SIZE_OF_GUID, L"%g", &NameGuid);
+  @retval TRUE  The file has a nested volume directory.
+  @retval FALSE The file has no nested volume directory.
 
-    if (StrCmp (GuidAsString, FileName) == 0) {
-      Found = TRUE;
-      break;
-    }
+**/
+BOOLEAN
+FvFileIsVolume (
+  IN FV_FILE_ENTRY *Entry
+  )
+{
+  return (BOOLEAN) (Entry->FileType == EFI_FV_FILETYPE_FIRMWARE_VOLUME_IMAGE);
+}
+
+/**
+  Renders the EFI_FILE_INFO of every nested volume directory in a volume into
+  the slots that follow all other records. Each directory is named by its
+  file's GUID with a ".fv" extension, and is as large as the file's FFS
+  payload, so describing it never extracts the volume.
+
+  @param  Fs Private data for a filesystem whose index has just been built.
+
+**/
+VOID
+FvDescribeNestedVolumes (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  FV_FILE_ENTRY *Entry;
+  EFI_FILE_INFO *Info;
+  UINTN         Index, Slot;
+
+  Slot = Fs->NumFiles + FV_NUM_TYPE_DIRECTORIES;
+
+  if (FeaturePcdGet (PcdFfsSectionDirectories)) {
+    Slot += Fs->NumFiles;
   }
 
-  //
-  // Free all allocated memory.
-  //
-  FreePool (GuidAsString);
-  FreePool (Key);
+  for (Index = 0; Index < Fs->NumFiles; Index++) {
+    Entry = &Fs->Files[Index];
 
-  //
-  // Return either the GUID of a matching file or a pointer to NULL, indicating
-  // that the requested file was not found.
-  //
-  CopyMem (OutputGuid, &NameGuid, sizeof (EFI_GUID));
-  return (Found ? OutputGuid : NULL);
+    if (!FvFileIsVolume (Entry)) {
+      continue;
+    }
+
+    Info = (EFI_FILE_INFO *) (Fs->InfoRecords + Slot++ * FV_FILE_INFO_STRIDE);
+
+    Info->Size             = SIZE_OF_FILE_INFO;
+    Info->FileSize         = Entry->Size;
+    Info->PhysicalSize     = Entry->Size;
+    Info->CreateTime       = mModuleLoadTime;
+    Info->LastAccessTime   = mModuleLoadTime;
+    Info->ModificationTime = mModuleLoadTime;
+    Info->Attribute        = EFI_FILE_READ_ONLY | EFI_FILE_DIRECTORY;
+
+    UnicodeSPrint (Info->FileName, SIZE_OF_FILENAME, L"%g.fv", &Entry->NameGuid);
+
+    Entry->VolumeInfo = Info;
+  }
 }
 
 /**
-  Gets the EFI_GUID of the next file in the GetNextFile call chain.
+  Hashes a GUID for the file index's hash table. File GUIDs are random enough
+  that folding their words together spreads them evenly.
 
-  @param  PrivateFile Pointer to the FILE_PRIVATE_DATA instance representing
-                      the root directory.
+  @param  Guid The GUID to hash.
 
-  @retval a GUID A file was found, and the associated GUID was returned.
-  @retval NULL   End of directory listing.
+  @retval The hash of the GUID.
 
 **/
-EFI_GUID *
-RootGetNextFile (
-  IN OUT FILE_PRIVATE_DATA *PrivateFile
+UINT32
+FvHashGuid (
+  IN EFI_GUID *Guid
   )
 {
-  EFI_STATUS                    Status;
-  EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2;
-  EFI_FV_FILETYPE               FileType;
-  EFI_GUID                      NameGuid, *OutputGuid;
-  EFI_FV_FILE_ATTRIBUTES        FvAttributes;
-  UINTN                         Size;
+  return Guid->Data1 ^
+         ReadUnaligned32 ((UINT32 *) &Guid->Data2) ^
+         ReadUnaligned32 ((UINT32 *) &Guid->Data4[0]) ^
+         ReadUnaligned32 ((UINT32 *) &Guid->Data4[4]);
+}
 
-  Fv2        = PrivateFile->FileSystem->FirmwareVolume2;
-  OutputGuid = AllocateZeroPool (sizeof (EFI_GUID));
+/**
+  Converts a single hexadecimal digit to its value.
 
-  //
-  // Grab the next file in the Fv2 volume. The Key parameter in this function
-  // is preserved and set into PrivateFile->DirInfo->Key, so in the next call
-  // of this function, the next file will be found.
-  //
-  FileType = EFI_FV_FILETYPE_ALL;
-  Status = Fv2->GetNextFile (
-                  Fv2,
-                  PrivateFile->DirInfo->Key,
-                  &FileType,
-                  &NameGuid,
-                  &FvAttributes,
-                  &Size);
+  @param  Char  The digit to convert.
+  @param  Value On output, the value of the digit.
 
-  //
-  // Return either the GUID of a matching file or a pointer to NULL, indicating
-  // that the file was not found.
-  //
-  CopyMem (OutputGuid, &NameGuid, sizeof (EFI_GUID));
-  return (Status == EFI_NOT_FOUND ? NULL : OutputGuid);
+  @retval TRUE  Char is a hexadecimal digit.
+  @retval FALSE Char is not a hexadecimal digit.
+
+**/
+BOOLEAN
+HexDigitToValue (
+  IN  CHAR16 Char,
+  OUT UINT8  *Value
+  )
+{
+  if (Char >= L'0' && Char <= L'9') {
+    *Value = (UINT8) (Char - L'0');
+  } else if (Char >= L'a' && Char <= L'f') {
+    *Value = (UINT8) (Char - L'a' + 10);
+  } else if (Char >= L'A' && Char <= L'F') {
+    *Value = (UINT8) (Char - L'A' + 10);
+  } else {
+    return FALSE;
+  }
+
+  return TRUE;
 }
 
 /**
-  Sums the file sizes of all files in a firmware volume to find the total size
-  of the volume.
+  Parses a GUID in the registry format that file names use, being
+  "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx". Hex digits may be of either case.
 
-  @param  Fv2      A pointer to the firmware volume to calculate the size for.
+  @param  String The 36-character string to parse. Only those characters are
+                 examined.
+  @param  Guid   On output, the parsed GUID.
 
-  @retval The sum of all of the file sizes on a given volume.
+  @retval TRUE  The string holds a GUID.
+  @retval FALSE The string is not a GUID.
 
 **/
-UINTN
-FvGetVolumeSize (
-  IN EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2
+BOOLEAN
+StrToFileGuid (
+  IN  CHAR16   *String,
+  OUT EFI_GUID *Guid
   )
 {
-  EFI_STATUS             Status;
-  VOID                   *Key;
-  EFI_FV_FILETYPE        FileType;
-  EFI_GUID               NameGuid;
-  EFI_FV_FILE_ATTRIBUTES FvAttributes;
-  UINTN                  Size, TotalSize;
+  UINT8 Bytes[sizeof (EFI_GUID)];
+  UINT8 High, Low;
+  UINTN Index, ByteIndex;
 
-  TotalSize    = 0;
-  Key          = AllocateZeroPool (Fv2->KeySize);
+  ByteIndex = 0;
 
-  while (TRUE) {
-    //
-    // Grab the next file in the Fv2 volume.
-    //
-    FileType = EFI_FV_FILETYPE_ALL;
-    Status = Fv2->GetNextFile (
-                    Fv2, 
-                    Key,
-                    &FileType,
-                    &NameGuid,
-                    &FvAttributes,
-                    &Size);
+  for (Index = 0; Index < 36; Index += 2) {
+    if (Index == 8 || Index == 13 || Index == 18 || Index == 23) {
+      if (String[Index] != L'-') {
+        return FALSE;
+      }
 
-    TotalSize += Size;
+      Index--;
+      continue;
+    }
 
-    //
-    // Check exit condition. If Status is an error status, then the list of
-    // files tried has been exhausted. Break from the loop.
-    //
-    if (Status == EFI_NOT_FOUND) {
-      break;
+    if (!HexDigitToValue (String[Index], &High) ||
+        !HexDigitToValue (String[Index + 1], &Low)) {
+      return FALSE;
     }
+
+    Bytes[ByteIndex++] = (UINT8) ((High << 4) | Low);
   }
 
   //
-  // Free all allocated memory and return the Fv2's total size.
+  // The first three fields are written most significant byte first.
   //
-  FreePool (Key);
-  return TotalSize;
+  Guid->Data1 = ((UINT32) Bytes[0] << 24) | ((UINT32) Bytes[1] << 16) |
+                ((UINT32) Bytes[2] << 8)  |  (UINT32) Bytes[3];
+  Guid->Data2 = (UINT16) ((Bytes[4] << 8) | Bytes[5]);
+  Guid->Data3 = (UINT16) ((Bytes[6] << 8) | Bytes[7]);
+  CopyMem (Guid->Data4, &Bytes[8], sizeof (Guid->Data4));
+
+  return TRUE;
 }
 
 /**
-  Returns a FILE_PRIVATE_DATA instance for a GUID.
+  Determines if the file described by a file index entry is executable on the
+  current system, meaning that it is exposed as a .efi file holding its PE32
+  section. The classification never decodes the file:
 
-  @param  NameGuid   GUID representing the file to return.
-  @param  FileSystem The FILE_SYSTEM_PRIVATE_DATA that the new file is to be a
-                     part of.
+  - File types that cannot hold a PE32 section are rejected outright.
+  - If the PE32 section is stored in the volume as-is, only its section header
+    and the machine field of its image header are read.
+  - Otherwise the PE32 section is hidden in an encoded encapsulation, and the
+    file type decides: the types the PI specification requires to carry a
+    PE32 image are executable, everything else is not. Such guesses are
+    checked by FvConfirmExecutable() when the file is first decoded.
+
+  Executables found in place are also marked as directly readable.
 
-  @retval FILE_PRIVATE_DATA instance representing Fv2 file named by NameGuid.
+  @param  Fs    Private data for the filesystem the file is a part of.
+  @param  Entry Index entry for the file to classify.
+
+  @retval True or False if the file is executable.
 
 **/
-FILE_PRIVATE_DATA *
-GuidToFile (
-  IN EFI_GUID                 *NameGuid,
-  IN FILE_SYSTEM_PRIVATE_DATA *FileSystem
+BOOLEAN
+IsFileExecutable (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN OUT FV_FILE_ENTRY            *Entry
   )
 {
-  FILE_INFO *FileInfo;
-  FILE_PRIVATE_DATA *PrivateFile;
+  EFI_STATUS Status;
+  UINTN      ImageOffset, ImageSize;
+  UINT16     Machine;
+
+  //
+  // Skip files that cannot contain a PE32 section at all.
+  //
+  switch (Entry->FileType) {
+  case EFI_FV_FILETYPE_RAW:
+  case EFI_FV_FILETYPE_FFS_PAD:
+  case EFI_FV_FILETYPE_FIRMWARE_VOLUME_IMAGE:
+    return FALSE;
+  }
 
   //
-  // Allocate new file and file info instances and fill them out.
+  // Look for the PE32 section in the volume itself.
   //
-  PrivateFile = AllocateCopyPool (
-                  sizeof (FILE_PRIVATE_DATA),
-                  &mFilePrivateDataTemplate);
-  FileInfo    = AllocateZeroPool (sizeof (FILE_INFO));
+  if (Entry->HasData) {
+    Status = FvFindDirectSection (
+               Fs,
+               Entry->DataOffset,
+               Entry->Size,
+               0,
+               EFI_SECTION_PE32,
+               &ImageOffset,
+               &ImageSize);
+
+    if (Status == EFI_NOT_FOUND) {
+      return FALSE;
+    }
 
-  PrivateFile->DirInfo    = NULL;
-  PrivateFile->FileInfo   = FileInfo;
-  PrivateFile->FileSystem = FileSystem;
-  FileInfo->NameGuid      = *NameGuid;
-  FileInfo->IsExecutable  = IsFileExecutable(
-                              PrivateFile->FileSystem->FirmwareVolume2,
-                              NameGuid);
+    if (!EFI_ERROR (Status)) {
+      Status = FvGetImageMachine (Fs, ImageOffset, ImageSize, &Machine);
+
+      if (EFI_ERROR (Status) || !EFI_IMAGE_MACHINE_TYPE_SUPPORTED (Machine)) {
+        return FALSE;
+      }
+
+      Entry->HasDirect    = TRUE;
+      Entry->DirectOffset = ImageOffset;
+      Entry->DirectSize   = ImageSize;
+      return TRUE;
+    }
+  }
 
   //
-  // Generate filename.
+  // The PE32 section can't be seen without decoding the file, so go by the
+  // file type.
   //
-  PrivateFile->FileName = AllocateZeroPool (SIZE_OF_GUID);
+  switch (Entry->FileType) {
+  case EFI_FV_FILETYPE_DXE_CORE:
+  case EFI_FV_FILETYPE_COMBINED_PEIM_DRIVER:
+  case EFI_FV_FILETYPE_DRIVER:
+  case EFI_FV_FILETYPE_APPLICATION:
+  case EFI_FV_FILETYPE_SMM:
+  case EFI_FV_FILETYPE_COMBINED_SMM_DXE:
+  case EFI_FV_FILETYPE_SMM_CORE:
+    Entry->Guessed = TRUE;
+    return TRUE;
+
+  default:
+    return FALSE;
+  }
+}
+
+/**
+  Gets the machine type of a PE32 or TE image held in memory, the same way
+  FvGetImageMachine() does for one stored in a firmware volume.
+
+  @param  Image     The image.
+  @param  ImageSize Size of the image in bytes.
+  @param  Machine   On output, the machine type of the image.
+
+  @retval EFI_SUCCESS     The machine type was returned.
+  @retval EFI_UNSUPPORTED The image has no recognizable PE or TE header.
+
+**/
+EFI_STATUS
+GetImageMachine (
+  IN  UINT8  *Image,
+  IN  UINTN  ImageSize,
+  OUT UINT16 *Machine
+  )
+{
+  UINTN HeaderOffset;
+
+  HeaderOffset = 0;
+
+  if (ImageSize >= sizeof (EFI_IMAGE_DOS_HEADER) &&
+      ((EFI_IMAGE_DOS_HEADER *) Image)->e_magic == EFI_IMAGE_DOS_SIGNATURE) {
+    HeaderOffset = ((EFI_IMAGE_DOS_HEADER *) Image)->e_lfanew;
+  }
+
+  if (ImageSize < sizeof (UINT32) + sizeof (UINT16) ||
+      HeaderOffset > ImageSize - sizeof (UINT32) - sizeof (UINT16)) {
+    return EFI_UNSUPPORTED;
+  }
 
-  if (FileInfo->IsExecutable) {
-    UnicodeSPrint (PrivateFile->FileName, SIZE_OF_FILENAME, L"%g.efi", NameGuid);
+  if (ReadUnaligned16 ((UINT16 *) (Image + HeaderOffset)) == EFI_TE_IMAGE_HEADER_SIGNATURE) {
+    *Machine = ReadUnaligned16 ((UINT16 *) (Image + HeaderOffset + sizeof (UINT16)));
+  } else if (ReadUnaligned32 ((UINT32 *) (Image + HeaderOffset)) == EFI_IMAGE_NT_SIGNATURE) {
+    *Machine = ReadUnaligned16 ((UINT16 *) (Image + HeaderOffset + sizeof (UINT32)));
   } else {
-    UnicodeSPrint (PrivateFile->FileName, SIZE_OF_FILENAME, L"%g.ffs", NameGuid);
+    return EFI_UNSUPPORTED;
   }
 
-  return PrivateFile;
+  return EFI_SUCCESS;
 }
 
-/**
-  Returns a FILE_PRIVATE_DATA instance for a new instance of the root directory.
+/**
+  Confirms or overturns the guess that a file is executable, once its PE32
+  section has been decoded for the first time. A file without a PE32 section,
+  or whose image is for another machine, is exposed as a .ffs file holding its
+  raw FFS payload from then on. Nothing is changed when the file's class was
+  not guessed, or when decoding failed for some other reason.
+
+  @param  Fs        Private data for the filesystem the file is a part of.
+  @param  Entry     Index entry for the file.
+  @param  Status    Status of decoding the file's first PE32 section.
+  @param  Image     The decoded PE32 section, if Status is EFI_SUCCESS.
+  @param  ImageSize Size of Image in bytes.
+
+  @retval TRUE  The file is executable.
+  @retval FALSE The file is not executable.
+
+**/
+BOOLEAN
+FvConfirmExecutable (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN OUT FV_FILE_ENTRY            *Entry,
+  IN     EFI_STATUS               Status,
+  IN     VOID                     *Image,
+  IN     UINTN                    ImageSize
+  )
+{
+  UINT16 Machine;
+
+  if (!Entry->Guessed) {
+    return Entry->IsExecutable;
+  }
+
+  if (!EFI_ERROR (Status)) {
+    if (!EFI_ERROR (GetImageMachine (Image, ImageSize, &Machine)) &&
+        EFI_IMAGE_MACHINE_TYPE_SUPPORTED (Machine)) {
+      Entry->Guessed = FALSE;
+      return TRUE;
+    }
+  } else if (Status != EFI_NOT_FOUND) {
+    return TRUE;
+  }
+
+  DEBUG ((EFI_D_INFO, "FvConfirmExecutable: %g is not executable\n", &Entry->NameGuid));
+
+  //
+  // Expose the raw payload instead, exactly as indexing would have had it
+  // been classified correctly, and describe the file again when next asked.
+  //
+  Entry->Guessed      = FALSE;
+  Entry->IsExecutable = FALSE;
+  Entry->HasDirect    = Entry->HasData;
+  Entry->DirectOffset = Entry->DataOffset;
+  Entry->DirectSize   = Entry->Size;
+  Entry->SizeKnown    = TRUE;
+  Entry->ContentSize  = Entry->Size;
+  Entry->Info         = NULL;
+  return FALSE;
+}
+
+/**
+  Walks a volume with GetNextFile, recording the GUID, type, attributes and
+  size of every file in it.
+
+  @param  Fs       Private data for the filesystem to walk.
+  @param  Files    On output, the file index, or NULL if the volume is empty.
+  @param  NumFiles On output, the number of entries in Files.
+
+  @retval EFI_SUCCESS          The volume was walked.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to record the files.
+
+**/
+EFI_STATUS
+FvScanFiles (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  OUT FV_FILE_ENTRY            **Files,
+  OUT UINTN                    *NumFiles
+  )
+{
+  EFI_STATUS                    Status;
+  EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2;
+  VOID                          *Key;
+  EFI_FV_FILETYPE               FileType;
+  EFI_GUID                      NameGuid;
+  EFI_FV_FILE_ATTRIBUTES        FvAttributes;
+  FV_FILE_ENTRY                 *Entries, *NewEntries, *Entry;
+  UINTN                         Size, Count, Capacity;
+
+  Fv2 = Fs->FirmwareVolume2;
+  Key = AllocateZeroPool (Fv2->KeySize);
+
+  if (Key == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status   = EFI_SUCCESS;
+  Entries  = NULL;
+  Count    = 0;
+  Capacity = 0;
+
+  while (TRUE) {
+    //
+    // Grab the next file in the Fv2 volume.
+    //
+    FileType = EFI_FV_FILETYPE_ALL;
+    Status = FvGetNextFile (
+               Fs,
+               Key,
+               &FileType,
+               &NameGuid,
+               &FvAttributes,
+               &Size);
+
+    //
+    // Check exit condition. If Status is an error status, then the list of
+    // files has been exhausted.
+    //
+    if (EFI_ERROR (Status)) {
+      Status = EFI_SUCCESS;
+      break;
+    }
+
+    //
+    // Grow the index if it is full.
+    //
+    if (Count == Capacity) {
+      NewEntries = ReallocatePool (
+                     Capacity * sizeof (FV_FILE_ENTRY),
+                     (Capacity + FV_FILE_INDEX_GROWTH) * sizeof (FV_FILE_ENTRY),
+                     Entries);
+
+      if (NewEntries == NULL) {
+        Status = EFI_OUT_OF_RESOURCES;
+        break;
+      }
+
+      Entries   = NewEntries;
+      Capacity += FV_FILE_INDEX_GROWTH;
+    }
+
+    //
+    // Record the file's metadata.
+    //
+    Entry = &Entries[Count];
+    ZeroMem (Entry, sizeof (FV_FILE_ENTRY));
+    CopyGuid (&Entry->NameGuid, &NameGuid);
+
+    Entry->FileType   = FileType;
+    Entry->Attributes = FvAttributes;
+    Entry->Size       = Size;
+
+    Count++;
+  }
+
+  FreePool (Key);
+
+  if (EFI_ERROR (Status)) {
+    if (Entries != NULL) {
+      FreePool (Entries);
+    }
+
+    return Status;
+  }
+
+  *Files    = Entries;
+  *NumFiles = Count;
+  return EFI_SUCCESS;
+}
+
+/**
+  Builds the file index for a filesystem instance. The index holds the GUID,
+  type, attributes, size and executable flag of every file in the volume, and
+  is built with a single pass over GetNextFile the first time it is needed.
+  When PcdFfsMetadataCache is set, a top-level memory-mapped volume is
+  instead indexed from the metadata saved on an earlier boot, as long as the
+  volume has not changed since.
+
+  @param  Fs Private data for the filesystem to index.
+
+  @retval EFI_SUCCESS          The index was built, or was already valid.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to build the index.
+
+**/
+EFI_STATUS
+FvBuildFileIndex (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  EFI_STATUS           Status;
+  FV_FILE_ENTRY        *Files, *Entry;
+  UINTN                NumFiles, TotalSize, Index;
+  UINT8                *InfoRecords;
+  EFI_FILE_INFO        *RootInfo;
+  EFI_FILE_SYSTEM_INFO *FsInfo;
+  FV_FILE_ENTRY        **HashTable;
+  UINTN                HashSlots, Slot, NumRecords, NumVolumes;
+  BOOLEAN              HasDirect, UseMetadata, Loaded;
+  FFS_METADATA_KEY     MetadataKey;
+  CHAR16               VariableName[FFS_METADATA_NAME_LENGTH];
+  CHAR16               **Names;
+
+  if (Fs->IndexValid) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Work out up front whether the volume can be read directly. Nested volumes
+  // are only readable through it, so it is needed before walking the files.
+  //
+  HasDirect = (BOOLEAN) !EFI_ERROR (FvLocateDirectAccess (Fs));
+
+  //
+  // Reuse the metadata saved on an earlier boot if the volume is unchanged,
+  // and otherwise walk the volume.
+  //
+  Files    = NULL;
+  NumFiles = 0;
+  Names    = NULL;
+  Loaded   = FALSE;
+
+  UseMetadata = (BOOLEAN) (FeaturePcdGet (PcdFfsMetadataCache) &&
+                           HasDirect &&
+                           Fs->MappedBase != NULL &&
+                           Fs->Parent == NULL &&
+                           !EFI_ERROR (FvGetMetadataKey (Fs, &MetadataKey, VariableName)));
+
+  if (UseMetadata) {
+    Status = FvLoadMetadata (Fs, &MetadataKey, VariableName, &Files, &NumFiles, &Names);
+
+    if (Status == EFI_OUT_OF_RESOURCES) {
+      return Status;
+    }
+
+    Loaded = (BOOLEAN) !EFI_ERROR (Status);
+  }
+
+  if (!Loaded) {
+    Status = FvScanFiles (Fs, &Files, &NumFiles);
+
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  TotalSize  = 0;
+  NumVolumes = 0;
+
+  for (Index = 0; Index < NumFiles; Index++) {
+    TotalSize += Files[Index].Size;
+
+    if (FvFileIsVolume (&Files[Index])) {
+      NumVolumes++;
+    }
+  }
+
+  //
+  // Set aside room for the EFI_FILE_INFO of every file, which is rendered the
+  // first time the file is described, and for the records of the per-type
+  // directories and the volume itself. Section directories get a record of
+  // their own after the per-type directories' records, and nested volume
+  // directories get one after those.
+  //
+  HashSlots = FV_HASH_MIN_SLOTS;
+
+  while (HashSlots < NumFiles * 2) {
+    HashSlots *= 2;
+  }
+
+  NumRecords = NumFiles + FV_NUM_TYPE_DIRECTORIES;
+
+  if (FeaturePcdGet (PcdFfsSectionDirectories)) {
+    NumRecords += NumFiles;
+  }
+
+  NumRecords += NumVolumes;
+
+  InfoRecords = AllocateZeroPool (NumRecords * FV_FILE_INFO_STRIDE);
+  RootInfo    = AllocateZeroPool (SIZE_OF_FILE_INFO);
+  FsInfo      = AllocateZeroPool (SIZE_OF_FS_INFO);
+  HashTable   = AllocateZeroPool (HashSlots * sizeof (FV_FILE_ENTRY *));
+
+  if (InfoRecords == NULL || RootInfo == NULL || FsInfo == NULL || HashTable == NULL) {
+    if (Files != NULL) {
+      FreePool (Files);
+    }
+
+    if (Names != NULL) {
+      FvFreeNames (Names, NumFiles);
+    }
+
+    if (InfoRecords != NULL) {
+      FreePool (InfoRecords);
+    }
+
+    if (RootInfo != NULL) {
+      FreePool (RootInfo);
+    }
+
+    if (FsInfo != NULL) {
+      FreePool (FsInfo);
+    }
+
+    if (HashTable != NULL) {
+      FreePool (HashTable);
+    }
+
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Hash every file by GUID, so that opening a file is a probe rather than a
+  // scan. Files are inserted in index order, so the first of any duplicate
+  // GUIDs is the one that is found.
+  //
+  for (Index = 0; Index < NumFiles; Index++) {
+    Slot = FvHashGuid (&Files[Index].NameGuid) & (HashSlots - 1);
+
+    while (HashTable[Slot] != NULL) {
+      Slot = (Slot + 1) & (HashSlots - 1);
+    }
+
+    HashTable[Slot] = &Files[Index];
+  }
+
+  //
+  // Publish the completed index on the filesystem instance.
+  //
+  Fs->Files       = Files;
+  Fs->NumFiles    = NumFiles;
+  Fs->VolumeSize  = TotalSize;
+  Fs->InfoRecords = InfoRecords;
+  Fs->RootInfo    = RootInfo;
+  Fs->FsInfo      = FsInfo;
+  Fs->HashTable   = HashTable;
+  Fs->HashMask    = HashSlots - 1;
+  Fs->IndexValid  = TRUE;
+
+  //
+  // If the volume can be read directly, record where each file's payload
+  // lives so that reads can bypass FV2 and touch only the requested bytes.
+  // Saved metadata already records all of this.
+  //
+  if (HasDirect && !Loaded) {
+    FvIndexFileData (Fs);
+  }
+
+  //
+  // Classify every file once for the life of the mount, and work out the
+  // sizes that its metadata already gives away.
+  //
+  for (Index = 0; Index < NumFiles && !Loaded; Index++) {
+    Entry               = &Files[Index];
+    Entry->IsExecutable = IsFileExecutable (Fs, Entry);
+
+    if (!Entry->IsExecutable) {
+      //
+      // Non-executable files expose their whole payload, so GetNextFile has
+      // already reported their size.
+      //
+      Entry->HasDirect    = Entry->HasData;
+      Entry->DirectOffset = Entry->DataOffset;
+      Entry->DirectSize   = Entry->Size;
+      Entry->SizeKnown    = TRUE;
+      Entry->ContentSize  = Entry->Size;
+    } else if (Entry->HasDirect) {
+      //
+      // The PE32 section's header gives the executable's size.
+      //
+      Entry->SizeKnown    = TRUE;
+      Entry->ContentSize  = Entry->DirectSize;
+    }
+  }
+
+  //
+  // Partition the files into the virtual per-type directories.
+  //
+  Status = FvBuildTypeDirectories (Fs);
+
+  if (EFI_ERROR (Status)) {
+    if (Names != NULL) {
+      FvFreeNames (Names, NumFiles);
+    }
+
+    FvFreeFileIndex (Fs);
+    return Status;
+  }
+
+  //
+  // Describe the nested volume directories now, since doing so never has to
+  // extract the volumes themselves.
+  //
+  FvDescribeNestedVolumes (Fs);
+
+  //
+  // Saved metadata may carry the UI names too, so that the name index can be
+  // built without reading a single UI section. Otherwise it is simply built
+  // on demand as usual, and the names saved once it has been.
+  //
+  if (Names != NULL) {
+    FvInternNames (Fs, Names);
+  } else if (Loaded) {
+    Fs->NamesPending = TRUE;
+  }
+
+  //
+  // The root directory and the volume never change, so describe them now.
+  //
+  RootInfo->Size             = SIZE_OF_FILE_INFO;
+  RootInfo->FileSize         = TotalSize;
+  RootInfo->PhysicalSize     = TotalSize;
+  RootInfo->CreateTime       = mModuleLoadTime;
+  RootInfo->LastAccessTime   = mModuleLoadTime;
+  RootInfo->ModificationTime = mModuleLoadTime;
+  RootInfo->Attribute        = EFI_FILE_READ_ONLY | EFI_FILE_DIRECTORY;
+
+  //
+  // The volume label is of the format "FV2@0x...", where the location in
+  // memory of the Fv2 instance replaces "...".
+  //
+  FsInfo->Size       = SIZE_OF_FS_INFO;
+  FsInfo->ReadOnly   = TRUE;
+  FsInfo->VolumeSize = TotalSize;
+  FsInfo->FreeSpace  = 0;
+  FsInfo->BlockSize  = 512;
+
+  UnicodeSPrint (
+    FsInfo->VolumeLabel,
+    SIZE_OF_FV_LABEL,
+    L"FV2@0x%x",
+    &Fs->FirmwareVolume2);
+
+  //
+  // Save what was just learnt about a changed volume for the next boot.
+  //
+  if (UseMetadata && !Loaded) {
+    FvSaveMetadata (Fs, &MetadataKey, VariableName);
+  }
+
+  DEBUG ((EFI_D_INFO, "FvBuildFileIndex: Indexed %d files\n", NumFiles));
+  return EFI_SUCCESS;
+}
+
+/**
+  Releases a volume's file index and everything derived from it, so that it
+  is rebuilt from the FV2 instance the next time the volume is opened.
+
+  @param  Fs Private data for the filesystem whose index is to be released.
+
+**/
+VOID
+FvFreeFileIndex (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  UINTN Index;
+
+  if (!Fs->IndexValid) {
+    return;
+  }
+
+  FvFreeNameIndex (Fs);
+
+  for (Index = 0; Index < Fs->NumFiles; Index++) {
+    if (Fs->Files[Index].Sections != NULL) {
+      FreePool (Fs->Files[Index].Sections);
+    }
+  }
+
+  FreePool (Fs->Files);
+  FreePool (Fs->InfoRecords);
+  FreePool (Fs->RootInfo);
+  FreePool (Fs->FsInfo);
+  FreePool (Fs->HashTable);
+
+  if (Fs->DirMembers != NULL) {
+    FreePool (Fs->DirMembers);
+  }
+
+  ZeroMem (Fs->Directories, sizeof (Fs->Directories));
+
+  Fs->IndexValid  = FALSE;
+  Fs->NumFiles    = 0;
+  Fs->VolumeSize  = 0;
+  Fs->Files       = NULL;
+  Fs->InfoRecords = NULL;
+  Fs->RootInfo    = NULL;
+  Fs->FsInfo      = NULL;
+  Fs->HashTable   = NULL;
+  Fs->HashMask    = 0;
+  Fs->DirMembers  = NULL;
+  Fs->Fvb         = NULL;
+  Fs->MappedBase  = NULL;
+  Fs->FvLength    = 0;
+  Fs->BlockSize   = 0;
+
+  Fs->NamesPending = FALSE;
+}
+
+/**
+  Determines if a handle was opened before its volume's FV2 interface was
+  last reinstalled. Such a handle refers to metadata that no longer exists,
+  and may only be closed.
+
+  @param  PrivateFile The handle to check.
+
+  @retval TRUE  The handle is stale.
+  @retval FALSE The handle is current.
+
+**/
+BOOLEAN
+FileIsStale (
+  IN FILE_PRIVATE_DATA *PrivateFile
+  )
+{
+  return (BOOLEAN) (PrivateFile->Generation != PrivateFile->FileSystem->Generation);
+}
+
+/**
+  Gets the size of the file described by a file index entry, as it is exposed
+  through the filesystem. Sizes are taken from metadata: the size reported by
+  GetNextFile, or the PE32 section header found while indexing. The PE32
+  section is only extracted when it is hidden inside an encoded encapsulation,
+  and the result is remembered for the life of the mount.
+
+  @param  Fs    Private data for the filesystem the file is a part of.
+  @param  Entry Index entry for the file that the system is trying to access.
+
+  @retval The size of the file in bytes.
+
+**/
+UINTN
+FvFileGetSize (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN FV_FILE_ENTRY            *Entry
+  )
+{
+  EFI_STATUS Status;
+  UINTN      BufferSize;
+  UINT32     AuthenticationStatus;
+  VOID       *Buffer;
+
+  if (Entry->SizeKnown) {
+    return Entry->ContentSize;
+  }
+
+  //
+  // No header reports the size, so the PE32 section has to be extracted.
+  //
+  Buffer     = NULL;
+  BufferSize = 0;
+
+  Status = FvReadSection (
+             Fs,
+             &Entry->NameGuid,
+             EFI_SECTION_PE32,
+             0,
+             &Buffer,
+             &BufferSize,
+             &AuthenticationStatus);
+
+  //
+  // A file that was only guessed to be executable may turn out not to be,
+  // in which case its size is the one GetNextFile reported.
+  //
+  FvConfirmExecutable (Fs, Entry, Status, Buffer, BufferSize);
+
+  if (Buffer != NULL) {
+    FvFreeBuffer (Fs, Buffer);
+  }
+
+  if (!Entry->IsExecutable) {
+    return Entry->ContentSize;
+  }
+
+  if (EFI_ERROR (Status)) {
+    return 0;
+  }
+
+  Entry->SizeKnown   = TRUE;
+  Entry->ContentSize = BufferSize;
+  return BufferSize;
+}
+
+/**
+  Gets the file index entry for a file named by GUID, by probing the volume's
+  GUID hash table.
+
+  @param  Fs       Private data for the filesystem to search.
+  @param  NameGuid The GUID naming the file in its FV2 instance.
+
+  @retval an entry The file was found, and its index entry was returned.
+  @retval NULL     The file was not found.
+
+**/
+FV_FILE_ENTRY *
+FvGetFile (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN EFI_GUID                 *NameGuid
+  )
+{
+  FV_FILE_ENTRY *Entry;
+  UINTN         Slot;
+
+  Slot = FvHashGuid (NameGuid) & Fs->HashMask;
+
+  //
+  // The table is never full, so an empty slot always ends the probe.
+  //
+  while ((Entry = Fs->HashTable[Slot]) != NULL) {
+    if (CompareGuid (&Entry->NameGuid, NameGuid)) {
+      return Entry;
+    }
+
+    Slot = (Slot + 1) & Fs->HashMask;
+  }
+
+  return NULL;
+}
+
+/**
+  Works out which section holds the contents exposed for a file or one of its
+  sections, which is also what the contents are cached under. An executable's
+  contents are the same as its first PE32 section file, so the two share a
+  cache entry.
+
+  @param  Entry       Index entry for the file.
+  @param  Section     The section exposed, or NULL for the whole file.
+  @param  SectionType On output, the section's type, or EFI_SECTION_ALL for the
+                      file's raw FFS payload.
+  @param  Instance    On output, the section's instance.
+
+**/
+VOID
+FvGetContentsKey (
+  IN  FV_FILE_ENTRY    *Entry,
+  IN  FV_SECTION_ENTRY *Section,
+  OUT EFI_SECTION_TYPE *SectionType,
+  OUT UINTN            *Instance
+  )
+{
+  if (Section != NULL) {
+    *SectionType = Section->Type;
+    *Instance    = Section->Instance;
+  } else if (Entry->IsExecutable) {
+    *SectionType = EFI_SECTION_PE32;
+    *Instance    = 0;
+  } else {
+    *SectionType = EFI_SECTION_ALL;
+    *Instance    = 0;
+  }
+}
+
+/**
+  Decodes the contents of a file, or of one of its sections, through the
+  volume's FV2 instance.
+
+  @param  Fs           Private data for the filesystem the file is a part of.
+  @param  NameGuid     Name of the file in its FV2 instance.
+  @param  SectionType  Type of the section, or EFI_SECTION_ALL for the file.
+  @param  Instance     Instance of the section.
+  @param  Contents     On output, a pool buffer holding the decoded contents.
+  @param  ContentsSize On output, the size of the decoded contents in bytes.
+
+  @retval EFI_SUCCESS The contents were decoded.
+  @retval other       The contents could not be read from the FV2 instance.
+
+**/
+EFI_STATUS
+FvDecodeContents (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  EFI_GUID                 *NameGuid,
+  IN  EFI_SECTION_TYPE         SectionType,
+  IN  UINTN                    Instance,
+  OUT VOID                     **Contents,
+  OUT UINTN                    *ContentsSize
+  )
+{
+  EFI_STATUS             Status;
+  EFI_FV_FILETYPE        FoundType;
+  EFI_FV_FILE_ATTRIBUTES FileAttributes;
+  UINT32                 AuthenticationStatus;
+
+  *Contents     = NULL;
+  *ContentsSize = 0;
+
+  if (SectionType != EFI_SECTION_ALL) {
+    //
+    // Read executable section, or the section the handle exposes.
+    //
+    Status = FvReadSection (
+               Fs,
+               NameGuid,
+               SectionType,
+               Instance,
+               Contents,
+               ContentsSize,
+               &AuthenticationStatus);
+  } else {
+    //
+    // Read from whole file.
+    //
+    Status = FvReadFile (
+               Fs,
+               NameGuid,
+               Contents,
+               ContentsSize,
+               &FoundType,
+               &FileAttributes,
+               &AuthenticationStatus);
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_INFO, "FvDecodeContents: Read failed with %r\n", Status));
+  }
+
+  return Status;
+}
+
+/**
+  Attaches a file's decoded contents to its handle when they are already in
+  the shared content cache.
+
+  @param  PrivateFile The file whose contents are wanted.
+
+  @retval TRUE  The contents are attached to the handle.
+  @retval FALSE The contents have yet to be decoded.
+
+**/
+BOOLEAN
+FileFindCachedContents (
+  IN OUT FILE_PRIVATE_DATA *PrivateFile
+  )
+{
+  FILE_INFO        *FileInfo;
+  FFS_CACHE_ENTRY  *Cached;
+  EFI_SECTION_TYPE SectionType;
+  UINTN            Instance;
+
+  FileInfo = PrivateFile->FileInfo;
+
+  if (FileInfo->Cached != NULL) {
+    return TRUE;
+  }
+
+  FvGetContentsKey (FileInfo->Entry, FileInfo->Section, &SectionType, &Instance);
+  Cached = FfsCacheLookup (PrivateFile->FileSystem, &FileInfo->NameGuid, SectionType, Instance);
+
+  if (Cached == NULL) {
+    return FALSE;
+  }
+
+  FileInfo->Cached       = Cached;
+  FileInfo->Contents     = Cached->Contents;
+  FileInfo->ContentsSize = Cached->ContentsSize;
+  return TRUE;
+}
+
+/**
+  Loads the decoded contents of a file into its FILE_INFO so that they can be
+  served to every subsequent read on the handle. Executable files expose their
+  PE32 section, section files expose just their own section, and all other
+  files expose their raw FFS payload. The contents come from the shared
+  content cache when another handle has already decoded them, and the handle's
+  reference is dropped by FfsClose().
+
+  @param  PrivateFile The file whose contents are to be loaded.
+
+  @retval EFI_SUCCESS The contents are loaded.
+  @retval other       The contents could not be read from the FV2 instance.
+
+**/
+EFI_STATUS
+FileLoadContents (
+  IN OUT FILE_PRIVATE_DATA *PrivateFile
+  )
+{
+  EFI_STATUS                    Status;
+  FILE_INFO                     *FileInfo;
+  FFS_CACHE_ENTRY               *Cached;
+  VOID                          *Contents;
+  UINTN                         ContentsSize;
+  EFI_SECTION_TYPE              SectionType;
+  UINTN                         Instance;
+
+  //
+  // Share the contents if any handle has decoded them already.
+  //
+  if (FileFindCachedContents (PrivateFile)) {
+    return EFI_SUCCESS;
+  }
+
+  FileInfo = PrivateFile->FileInfo;
+  FvGetContentsKey (FileInfo->Entry, FileInfo->Section, &SectionType, &Instance);
+
+  FFS_PERF_START (FFS_PERF_DECODE);
+  Status = FvDecodeContents (
+             PrivateFile->FileSystem,
+             &FileInfo->NameGuid,
+             SectionType,
+             Instance,
+             &Contents,
+             &ContentsSize);
+  FFS_PERF_END (FFS_PERF_DECODE);
+
+  //
+  // Check a guessed executable against its PE32 section. If it has none the
+  // handle can't be served, but the file can be opened again as a .ffs file.
+  //
+  if (FileInfo->Section == NULL && FileInfo->IsExecutable &&
+      !FvConfirmExecutable (PrivateFile->FileSystem, FileInfo->Entry, Status, Contents, ContentsSize)) {
+    if (Contents != NULL) {
+      FvFreeBuffer (PrivateFile->FileSystem, Contents);
+    }
+
+    return EFI_NOT_FOUND;
+  }
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = FfsCacheInsert (
+             PrivateFile->FileSystem,
+             &FileInfo->NameGuid,
+             SectionType,
+             Instance,
+             Contents,
+             ContentsSize,
+             &Cached);
+
+  if (EFI_ERROR (Status)) {
+    FvFreeBuffer (PrivateFile->FileSystem, Contents);
+    return Status;
+  }
+
+  FileInfo->Cached       = Cached;
+  FileInfo->Contents     = Contents;
+  FileInfo->ContentsSize = ContentsSize;
+
+  //
+  // Remember the decoded size so that sizing the file never decodes it again.
+  //
+  if (FileInfo->Section == NULL) {
+    FileInfo->Entry->SizeKnown   = TRUE;
+    FileInfo->Entry->ContentSize = ContentsSize;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Returns a FILE_PRIVATE_DATA instance for a file index entry, or for one of
+  the file's sections.
+
+  @param  Entry      Index entry representing the file to return.
+  @param  Section    The section of the file to return, or NULL for the whole
+                     file.
+  @param  FileSystem The FILE_SYSTEM_PRIVATE_DATA that the new file is to be a
+                     part of.
+
+  @retval FILE_PRIVATE_DATA instance representing Fv2 file named by Entry, or
+          NULL if no handle could be allocated.
+
+**/
+FILE_PRIVATE_DATA *
+GuidToFile (
+  IN FV_FILE_ENTRY            *Entry,
+  IN FV_SECTION_ENTRY         *Section OPTIONAL,
+  IN FILE_SYSTEM_PRIVATE_DATA *FileSystem
+  )
+{
+  FILE_INFO *FileInfo;
+  FILE_PRIVATE_DATA *PrivateFile;
+
+  //
+  // Take a new file handle from the volume's slabs and fill it out.
+  //
+  PrivateFile = FfsAllocateHandle (FileSystem, FALSE);
+
+  if (PrivateFile == NULL) {
+    return NULL;
+  }
+
+  FileInfo               = PrivateFile->FileInfo;
+  FileInfo->NameGuid     = Entry->NameGuid;
+  FileInfo->IsExecutable = Entry->IsExecutable;
+  FileInfo->Entry        = Entry;
+  FileInfo->Section      = Section;
+
+  //
+  // Generate filename.
+  //
+  if (Section != NULL) {
+    StrCpy (PrivateFile->FileName, Section->Info->FileName);
+  } else if (FileInfo->IsExecutable) {
+    UnicodeSPrint (PrivateFile->FileName, SIZE_OF_FILENAME, L"%g.efi", &Entry->NameGuid);
+  } else {
+    UnicodeSPrint (PrivateFile->FileName, SIZE_OF_FILENAME, L"%g.ffs", &Entry->NameGuid);
+  }
+
+  return PrivateFile;
+}
+
+/**
+  Gets the EFI_FILE_INFO for a file in the index, rendering it into the
+  volume's info records the first time the file is described. Rendering may
+  have to decode the file if its size is not known yet.
+
+  @param  Fs    The filesystem the file is a part of.
+  @param  Entry Index entry for the file to describe.
+
+  @retval The file's EFI_FILE_INFO, SIZE_OF_FILE_INFO bytes long.
+
+**/
+EFI_FILE_INFO *
+FvEntryGetFileInfo (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN OUT FV_FILE_ENTRY            *Entry
+  )
+{
+  EFI_FILE_INFO *FileInfo;
+
+  if (Entry->Info != NULL) {
+    return Entry->Info;
+  }
+
+  FileInfo = (EFI_FILE_INFO *) (Fs->InfoRecords + (Entry - Fs->Files) * FV_FILE_INFO_STRIDE);
+
+  FileInfo->Size             = SIZE_OF_FILE_INFO;
+  FileInfo->FileSize         = FvFileGetSize (Fs, Entry);
+  FileInfo->PhysicalSize     = FileInfo->FileSize;
+  FileInfo->CreateTime       = mModuleLoadTime;
+  FileInfo->LastAccessTime   = mModuleLoadTime;
+  FileInfo->ModificationTime = mModuleLoadTime;
+  FileInfo->Attribute        = EFI_FILE_READ_ONLY;
+
+  UnicodeSPrint (
+    FileInfo->FileName,
+    SIZE_OF_FILENAME,
+    Entry->IsExecutable ? L"%g.efi" : L"%g.ffs",
+    &Entry->NameGuid);
+
+  Entry->Info = FileInfo;
+  return FileInfo;
+}
+
+/**
+  Gets the EFI_FILE_INFO for a file's section directory, rendering it into the
+  volume's info records the first time the directory is described. The
+  directory is named by the file's GUID alone, and is as large as the file's
+  FFS payload, so describing it never lists the file's sections.
+
+  @param  Fs    The filesystem the file is a part of.
+  @param  Entry Index entry for a file that has a section directory.
+
+  @retval The directory's EFI_FILE_INFO, SIZE_OF_FILE_INFO bytes long.
+
+**/
+EFI_FILE_INFO *
+FvEntryGetDirInfo (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN OUT FV_FILE_ENTRY            *Entry
+  )
+{
+  EFI_FILE_INFO *DirInfo;
+  UINTN         Slot;
+
+  if (Entry->DirInfo != NULL) {
+    return Entry->DirInfo;
+  }
+
+  Slot    = Fs->NumFiles + FV_NUM_TYPE_DIRECTORIES + (Entry - Fs->Files);
+  DirInfo = (EFI_FILE_INFO *) (Fs->InfoRecords + Slot * FV_FILE_INFO_STRIDE);
+
+  DirInfo->Size             = SIZE_OF_FILE_INFO;
+  DirInfo->FileSize         = Entry->Size;
+  DirInfo->PhysicalSize     = Entry->Size;
+  DirInfo->CreateTime       = mModuleLoadTime;
+  DirInfo->LastAccessTime   = mModuleLoadTime;
+  DirInfo->ModificationTime = mModuleLoadTime;
+  DirInfo->Attribute        = EFI_FILE_READ_ONLY | EFI_FILE_DIRECTORY;
+
+  UnicodeSPrint (DirInfo->FileName, SIZE_OF_FILENAME, L"%g", &Entry->NameGuid);
+
+  Entry->DirInfo = DirInfo;
+  return DirInfo;
+}
+
+/**
+  Lists a file's sections by asking FV2 for every instance of every exposed
+  section type in turn. This is only needed when some sections are hidden in
+  an encoded encapsulation; the FV2 producer decodes the file once and keeps
+  the decoded stream for the later requests.
+
+  @param  Fs          Private data for the filesystem the file is a part of.
+  @param  Entry       Index entry for the file whose sections are listed.
+  @param  Sections    On input, an empty list. On output, the file's sections.
+  @param  NumSections On output, the number of entries in Sections.
+  @param  Capacity    On input and output, the capacity of Sections.
+
+  @retval EFI_SUCCESS          The sections were listed.
+  @retval EFI_OUT_OF_RESOURCES Sections could not be grown.
+
+**/
+EFI_STATUS
+FvProbeSections (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     FV_FILE_ENTRY            *Entry,
+  IN OUT FV_SECTION_ENTRY         **Sections,
+  OUT    UINTN                    *NumSections,
+  IN OUT UINTN                    *Capacity
+  )
+{
+  EFI_STATUS       Status;
+  FV_SECTION_ENTRY *Section;
+  VOID             *Buffer;
+  UINTN            BufferSize, KindIndex, Instance;
+  UINT32           AuthenticationStatus;
+
+  *NumSections = 0;
+
+  for (KindIndex = 0; KindIndex < ARRAY_SIZE (mFvSectionKinds); KindIndex++) {
+    for (Instance = 0; ; Instance++) {
+      Buffer     = NULL;
+      BufferSize = 0;
+
+      Status = FvReadSection (
+                 Fs,
+                 &Entry->NameGuid,
+                 mFvSectionKinds[KindIndex].Type,
+                 Instance,
+                 &Buffer,
+                 &BufferSize,
+                 &AuthenticationStatus);
+
+      if (Buffer != NULL) {
+        FvFreeBuffer (Fs, Buffer);
+      }
+
+      if (EFI_ERROR (Status)) {
+        break;
+      }
+
+      Section = FvAppendSection (Sections, NumSections, Capacity);
+
+      if (Section == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+      }
+
+      Section->Type     = mFvSectionKinds[KindIndex].Type;
+      Section->Instance = Instance;
+      Section->Size     = BufferSize;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Lists a file's sections the first time its section directory is opened,
+  and renders an EFI_FILE_INFO for each of them. Sections that are stored in
+  the volume as-is are found by reading section headers alone, and can later
+  be read without FV2; otherwise the file has to be decoded once.
+
+  @param  Fs    Private data for the filesystem the file is a part of.
+  @param  Entry Index entry for a file that has a section directory.
+
+  @retval EFI_SUCCESS          The sections are listed.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to list them.
+
+**/
+EFI_STATUS
+FvLoadSections (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN OUT FV_FILE_ENTRY            *Entry
+  )
+{
+  EFI_STATUS       Status;
+  FV_SECTION_ENTRY *Found, *Sections;
+  UINTN            NumFound, Capacity, Index, Prior, RecordsOffset;
+  EFI_FILE_INFO    *Info;
+
+  if (Entry->Sections != NULL) {
+    return EFI_SUCCESS;
+  }
+
+  Found    = NULL;
+  NumFound = 0;
+  Capacity = 0;
+  Status   = EFI_UNSUPPORTED;
+
+  if (Entry->HasData) {
+    Status = FvFindDirectSections (
+               Fs,
+               Entry->DataOffset,
+               Entry->Size,
+               0,
+               &Found,
+               &NumFound,
+               &Capacity);
+
+    //
+    // Stream order is instance order, so number each section by the number
+    // of sections of its type that come before it.
+    //
+    for (Index = 0; !EFI_ERROR (Status) && Index < NumFound; Index++) {
+      for (Prior = 0; Prior < Index; Prior++) {
+        if (Found[Prior].Type == Found[Index].Type) {
+          Found[Index].Instance++;
+        }
+      }
+    }
+  }
+
+  if (Status == EFI_UNSUPPORTED) {
+    Status = FvProbeSections (Fs, Entry, &Found, &NumFound, &Capacity);
+  }
+
+  //
+  // Keep the sections and their records in a single allocation that lives
+  // as long as the file index. The records follow the sections, aligned like
+  // those of the volume's info records.
+  //
+  Sections      = NULL;
+  RecordsOffset = ALIGN_VALUE (NumFound * sizeof (FV_SECTION_ENTRY), 8);
+
+  if (!EFI_ERROR (Status)) {
+    Sections = AllocateZeroPool (MAX (RecordsOffset + NumFound * FV_FILE_INFO_STRIDE, 1));
+
+    if (Sections == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  if (EFI_ERROR (Status)) {
+    if (Found != NULL) {
+      FreePool (Found);
+    }
+
+    return Status;
+  }
+
+  for (Index = 0; Index < NumFound; Index++) {
+    CopyMem (&Sections[Index], &Found[Index], sizeof (FV_SECTION_ENTRY));
+
+    Info = (EFI_FILE_INFO *) ((UINT8 *) Sections + RecordsOffset + Index * FV_FILE_INFO_STRIDE);
+
+    Info->Size             = SIZE_OF_FILE_INFO;
+    Info->FileSize         = Sections[Index].Size;
+    Info->PhysicalSize     = Sections[Index].Size;
+    Info->CreateTime       = mModuleLoadTime;
+    Info->LastAccessTime   = mModuleLoadTime;
+    Info->ModificationTime = mModuleLoadTime;
+    Info->Attribute        = EFI_FILE_READ_ONLY;
+
+    UnicodeSPrint (
+      Info->FileName,
+      SIZE_OF_FILENAME,
+      L"%s.%d",
+      FvGetSectionKind (Sections[Index].Type)->Name,
+      Sections[Index].Instance);
+
+    Sections[Index].Info = Info;
+  }
+
+  if (Found != NULL) {
+    FreePool (Found);
+  }
+
+  Entry->Sections    = Sections;
+  Entry->NumSections = NumFound;
+
+  DEBUG ((EFI_D_INFO, "FvLoadSections: %g has %d sections\n", &Entry->NameGuid, NumFound));
+  return EFI_SUCCESS;
+}
+
+/**
+  Copies an information record into a caller's buffer, provided it fits.
+
+  @param  Record     The record to copy.
+  @param  RecordSize Size of the record in bytes.
+  @param  BufferSize On input, the size of Buffer. On output, the size of the
+                     record, whether or not it was copied.
+  @param  Buffer     The buffer to copy into.
+
+  @retval EFI_SUCCESS          The record was copied.
+  @retval EFI_BUFFER_TOO_SMALL The BufferSize is too small to hold the record.
+
+**/
+EFI_STATUS
+CopyInfoRecord (
+  IN     VOID  *Record,
+  IN     UINTN RecordSize,
+  IN OUT UINTN *BufferSize,
+  OUT    VOID  *Buffer
+  )
+{
+  if (*BufferSize < RecordSize) {
+    *BufferSize = RecordSize;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  CopyMem (Buffer, Record, RecordSize);
+  *BufferSize = RecordSize;
+  return EFI_SUCCESS;
+}
+
+/**
+  Returns a FILE_PRIVATE_DATA instance for a new instance of a directory.
+
+  @param  Fs        Private data for the filesystem the directory is to be a
+                    part of.
+  @param  Directory The virtual directory to open, or NULL for the root. For a
+                    section directory, the virtual directory it was opened in.
+  @param  File      The file whose section directory to open, or NULL.
+
+  @return FILE_PRIVATE_DATA instance representing the directory, or NULL if no
+          handle could be allocated.
+
+**/
+FILE_PRIVATE_DATA *
+AllocateNewDirectory (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN FV_DIRECTORY             *Directory,
+  IN FV_FILE_ENTRY            *File
+  )
+{
+  FILE_PRIVATE_DATA *PrivateFile;
+
+  //
+  // Take a new directory handle from the volume's slabs. Its listing starts
+  // at the first entry.
+  //
+  PrivateFile = FfsAllocateHandle (Fs, TRUE);
+
+  if (PrivateFile == NULL) {
+    return NULL;
+  }
+
+  PrivateFile->DirInfo->Directory = Directory;
+  PrivateFile->DirInfo->File      = File;
+
+  if (File != NULL) {
+    UnicodeSPrint (PrivateFile->FileName, SIZE_OF_FILENAME, L"%g", &File->NameGuid);
+  } else if (Directory != NULL) {
+    StrCpy (PrivateFile->FileName, Directory->Type->Name);
+  } else if (Fs->Parent != NULL) {
+    UnicodeSPrint (PrivateFile->FileName, SIZE_OF_FILENAME, L"%g.fv", &Fs->ParentFile);
+  }
+
+  return PrivateFile;
+}
+
+/**
+  Gets the EFI_FILE_INFO of the next entry in a directory listing. The root
+  lists its per-type directories ahead of every file in the volume, and the
+  per-type directories list their members. When section directories are
+  enabled, each file is followed by its section directory, if it has one.
+  Files holding a nested volume are followed by the volume's directory.
+  Section directories list the file's sections.
+
+  @param  PrivateFile Pointer to the FILE_PRIVATE_DATA instance representing
+                      the directory.
+
+  @retval a record An entry was found, and its EFI_FILE_INFO was returned.
+  @retval NULL     End of directory listing.
+
+**/
+EFI_FILE_INFO *
+DirGetNextInfo (
+  IN OUT FILE_PRIVATE_DATA *PrivateFile
+  )
+{
+  FILE_SYSTEM_PRIVATE_DATA *Fs;
+  DIR_INFO                 *DirInfo;
+  FV_FILE_ENTRY            *Entry;
+  UINTN                    Cursor, First, Stride, NumFiles, Index, Position;
+
+  //
+  // The directory's cursor is the position of the next entry to return.
+  // Running off the end is the end of the directory listing.
+  //
+  Fs      = PrivateFile->FileSystem;
+  DirInfo = PrivateFile->DirInfo;
+  Cursor  = DirInfo->Cursor;
+
+  if (DirInfo->File != NULL) {
+    if (Cursor >= DirInfo->File->NumSections) {
+      return NULL;
+    }
+
+    DirInfo->Cursor++;
+    return DirInfo->File->Sections[Cursor].Info;
+  }
+
+  if (DirInfo->Directory == NULL && Cursor < FV_NUM_TYPE_DIRECTORIES) {
+    DirInfo->Cursor++;
+    return Fs->Directories[Cursor].Info;
+  }
+
+  //
+  // Each file takes up a position for itself, one for its section directory
+  // when those are enabled, and one for its nested volume directory.
+  // Positions of directories that don't exist are skipped here, so that the
+  // cursor always rests on an entry that is returned.
+  //
+  First    = (DirInfo->Directory == NULL) ? FV_NUM_TYPE_DIRECTORIES : 0;
+  Stride   = FeaturePcdGet (PcdFfsSectionDirectories) ? 3 : 2;
+  NumFiles = (DirInfo->Directory == NULL) ? Fs->NumFiles : DirInfo->Directory->NumMembers;
+
+  while (TRUE) {
+    Index = (DirInfo->Cursor - First) / Stride;
+
+    if (Index >= NumFiles) {
+      return NULL;
+    }
+
+    if (DirInfo->Directory == NULL) {
+      Entry = &Fs->Files[Index];
+    } else {
+      Entry = DirInfo->Directory->Members[Index];
+    }
+
+    Position = (DirInfo->Cursor - First) % Stride;
+    DirInfo->Cursor++;
+
+    if (Position == 0) {
+      FfsPrefetchNextFiles (PrivateFile, Index, NumFiles);
+      return FvEntryGetFileInfo (Fs, Entry);
+    }
+
+    if (Position == Stride - 1) {
+      if (FvFileIsVolume (Entry)) {
+        return Entry->VolumeInfo;
+      }
+    } else if (FvFileHasSections (Entry)) {
+      return FvEntryGetDirInfo (Fs, Entry);
+    }
+  }
+}
+
+/**
+  Finds the file named by a single path component in a directory. The name
+  must be the file's GUID or the name in its UI section, followed by the
+  extension for its contents, ".efi" for executables and ".ffs" for
+  everything else.
+
+  @param  Fs        Private data for the filesystem to search.
+  @param  Directory The directory to search, or NULL for the root.
+  @param  Name      The name of the file to find.
+
+  @retval an entry The file was found, and its index entry was returned.
+  @retval NULL     The file is not in the directory.
+
+**/
+FV_FILE_ENTRY *
+FvNameToEntry (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN FV_DIRECTORY             *Directory,
+  IN CHAR16                   *Name
+  )
+{
+  FV_FILE_ENTRY *Entry;
+  CHAR16        *Ext;
+  EFI_GUID      NameGuid;
+  UINTN         Length;
+
+  //
+  // Perform basic checks to ensure we don't go through a lot of code for
+  // nothing. First of all, ensure there is a name ahead of the extension.
+  //
+  Length = StrLen (Name);
+
+  if (Length <= 4) {
+    DEBUG ((EFI_D_INFO, "Filename is too short\n"));
+    return NULL;
+  }
+
+  //
+  // Ensure the file extension is either .ffs or .efi.
+  //
+  Ext = Name + Length - 4;
+
+  if (StrCmp (Ext, L".ffs") != 0 && StrCmp (Ext, L".efi") != 0) {
+    DEBUG ((EFI_D_INFO, "Invalid extension (not ffs or efi)\n"));
+    return NULL;
+  }
+
+  //
+  // Names that are a GUID are looked up in the file index, and anything else
+  // is taken to be a UI name. Either way, make sure the file is in the
+  // directory being searched.
+  //
+  if (Length == LENGTH_OF_FILENAME && StrToFileGuid (Name, &NameGuid)) {
+    DEBUG ((EFI_D_INFO, "Looking for %g\n", &NameGuid));
+    Entry = FvGetFile (Fs, &NameGuid);
+  } else {
+    Entry = FvFindFileByName (Fs, Name, Length - 4);
+  }
+
+  if (Entry == NULL || !FvDirectoryContains (Directory, Entry)) {
+    DEBUG ((EFI_D_INFO, "File not found\n"));
+    return NULL;
+  }
+
+  //
+  // Check that the file has the correct extension for its contents.
+  //
+  if ((StrCmp (Ext, L".ffs") == 0 &&  Entry->IsExecutable) ||
+      (StrCmp (Ext, L".efi") == 0 && !Entry->IsExecutable)) {
+    DEBUG ((EFI_D_INFO, "Invalid extension for contents\n"));
+    return NULL;
+  }
+
+  return Entry;
+}
+
+/**
+  Finds the file whose section directory is named by a single path component
+  in a directory. The name must be the file's GUID alone.
+
+  @param  Fs        Private data for the filesystem to search.
+  @param  Directory The directory to search, or NULL for the root.
+  @param  Name      The name of the section directory to find.
+
+  @retval an entry The section directory was found, and the index entry of its
+                   file was returned.
+  @retval NULL     The directory holds no such section directory.
+
+**/
+FV_FILE_ENTRY *
+FvNameToSectionDir (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN FV_DIRECTORY             *Directory,
+  IN CHAR16                   *Name
+  )
+{
+  FV_FILE_ENTRY *Entry;
+  EFI_GUID      NameGuid;
+
+  if (!FeaturePcdGet (PcdFfsSectionDirectories) ||
+      StrLen (Name) != LENGTH_OF_FILENAME - 4 ||
+      !StrToFileGuid (Name, &NameGuid)) {
+    return NULL;
+  }
+
+  Entry = FvGetFile (Fs, &NameGuid);
+
+  if (Entry == NULL || !FvDirectoryContains (Directory, Entry) || !FvFileHasSections (Entry)) {
+    return NULL;
+  }
+
+  return Entry;
+}
+
+/**
+  Finds the file whose nested volume directory is named by a single path
+  component in a directory. The name must be the file's GUID or the name in
+  its UI section, followed by ".fv".
+
+  @param  Fs        Private data for the filesystem to search.
+  @param  Directory The directory to search, or NULL for the root.
+  @param  Name      The name of the nested volume directory to find.
+
+  @retval an entry The nested volume directory was found, and the index entry
+                   of its file was returned.
+  @retval NULL     The directory holds no such nested volume directory.
+
+**/
+FV_FILE_ENTRY *
+FvNameToVolume (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN FV_DIRECTORY             *Directory,
+  IN CHAR16                   *Name
+  )
+{
+  FV_FILE_ENTRY *Entry;
+  EFI_GUID      NameGuid;
+  UINTN         Length;
+
+  Length = StrLen (Name);
+
+  if (Length <= 3 || StrCmp (Name + Length - 3, L".fv") != 0) {
+    return NULL;
+  }
+
+  if (Length == LENGTH_OF_FILENAME - 1 && StrToFileGuid (Name, &NameGuid)) {
+    Entry = FvGetFile (Fs, &NameGuid);
+  } else {
+    Entry = FvFindFileByName (Fs, Name, Length - 3);
+  }
+
+  if (Entry == NULL || !FvDirectoryContains (Directory, Entry) || !FvFileIsVolume (Entry)) {
+    return NULL;
+  }
+
+  return Entry;
+}
+
+/**
+  Finds the section named by a single path component in a file's section
+  directory.
+
+  @param  Entry Index entry for a file whose sections are listed.
+  @param  Name  The name of the section to find.
+
+  @retval a section The section was found.
+  @retval NULL      The file has no section of that name.
+
+**/
+FV_SECTION_ENTRY *
+FvNameToSection (
+  IN FV_FILE_ENTRY *Entry,
+  IN CHAR16        *Name
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < Entry->NumSections; Index++) {
+    if (StrCmp (Entry->Sections[Index].Info->FileName, Name) == 0) {
+      return &Entry->Sections[Index];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Finds the virtual per-type directory with a given name.
+
+  @param  Fs   Private data for the filesystem to search.
+  @param  Name The name of the directory to find.
+
+  @retval a directory The directory was found.
+  @retval NULL        No per-type directory has that name.
+
+**/
+FV_DIRECTORY *
+FvFindTypeDirectory (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN CHAR16                   *Name
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < FV_NUM_TYPE_DIRECTORIES; Index++) {
+    if (StrCmp (Fs->Directories[Index].Type->Name, Name) == 0) {
+      return &Fs->Directories[Index];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Walks a cleaned-up path one component at a time, starting from a given
+  directory. Per-type directories are found in the root, section directories
+  and nested volume directories are found next to their files, ".." leads
+  back out of any of them, and the last component may name a file or a
+  section. Entering a nested volume directory mounts the volume the first
+  time, and carries on the walk in the nested volume's root.
+
+  @param  Fs         On input, private data for the filesystem to start in.
+                     On output, private data for the filesystem the path
+                     leads to.
+  @param  Path       The cleaned-up path to walk. It is split up in place.
+  @param  Directory  On input, the directory to start at, or NULL for the root.
+                     On output, the directory the path leads to or holds the
+                     file.
+  @param  SectionDir On input, the file whose section directory to start at,
+                     or NULL. On output, the file whose section directory the
+                     path leads to or holds the section, or NULL.
+  @param  Entry      On output, the index entry of the file the path leads to,
+                     or NULL if it leads to a directory.
+  @param  Section    On output, the section of Entry the path leads to, or NULL
+                     if it leads to a whole file or to a directory.
+
+  @retval EFI_SUCCESS   The path was resolved.
+  @retval EFI_NOT_FOUND Some component of the path does not exist.
+  @retval other         The sections of a file could not be listed, or a
+                        nested volume could not be mounted.
+
+**/
+EFI_STATUS
+FvResolvePath (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA **Fs,
+  IN OUT CHAR16                   *Path,
+  IN OUT FV_DIRECTORY             **Directory,
+  IN OUT FV_FILE_ENTRY            **SectionDir,
+  OUT    FV_FILE_ENTRY            **Entry,
+  OUT    FV_SECTION_ENTRY         **Section
+  )
+{
+  EFI_STATUS               Status;
+  CHAR16                   *Component, *Next;
+  FV_DIRECTORY             *Found;
+  FV_FILE_ENTRY            *Owner;
+  FILE_SYSTEM_PRIVATE_DATA *Nested;
+
+  *Entry    = NULL;
+  *Section  = NULL;
+  Component = Path;
+
+  while (*Component != CHAR_NULL) {
+    //
+    // Split off the next component. Nothing can follow a file.
+    //
+    for (Next = Component; *Next != CHAR_NULL && *Next != L'\\'; Next++) {
+    }
+
+    if (*Next == L'\\') {
+      *Next++ = CHAR_NULL;
+    }
+
+    if (*Entry != NULL) {
+      return EFI_NOT_FOUND;
+    }
+
+    if (*Component == CHAR_NULL || StrCmp (Component, L".") == 0) {
+      //
+      // Stay in the same directory.
+      //
+    } else if (StrCmp (Component, L"..") == 0) {
+      //
+      // Section directories lead back to the directory holding their file,
+      // the root of a nested volume leads back to the root of the volume
+      // holding it, and the top-level root has no parent.
+      //
+      if (*SectionDir != NULL) {
+        *SectionDir = NULL;
+      } else if (*Directory != NULL) {
+        *Directory = NULL;
+      } else if ((*Fs)->Parent != NULL) {
+        *Fs = (*Fs)->Parent;
+      } else {
+        DEBUG ((EFI_D_INFO, "FvResolvePath: Root has no parent\n"));
+        return EFI_NOT_FOUND;
+      }
+    } else if (*SectionDir != NULL) {
+      *Section = FvNameToSection (*SectionDir, Component);
 
-  @param  Fs Private data for the filesystem the directory is to be a part of.
+      if (*Section == NULL) {
+        return EFI_NOT_FOUND;
+      }
 
-  @return FILE_PRIVATE_DATA instance representing the root directory.
+      *Entry = *SectionDir;
+    } else if (*Directory == NULL &&
+               (Found = FvFindTypeDirectory (*Fs, Component)) != NULL) {
+      *Directory = Found;
+    } else if ((Owner = FvNameToSectionDir (*Fs, *Directory, Component)) != NULL) {
+      //
+      // List the file's sections the first time its directory is entered.
+      //
+      Status = FvLoadSections (*Fs, Owner);
 
-**/
-FILE_PRIVATE_DATA *
-AllocateNewRoot (
-  IN FILE_SYSTEM_PRIVATE_DATA *Fs
-  )
-{
-  FILE_PRIVATE_DATA *PrivateFile;
-  DIR_INFO          *RootInfo;
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
 
-  //
-  // Copy data from the template to a new private file instance.
-  //
-  PrivateFile = NULL;
-  PrivateFile = AllocateCopyPool (
-                  sizeof (FILE_PRIVATE_DATA),
-                  (VOID *) &mFilePrivateDataTemplate
-                  );
+      *SectionDir = Owner;
+    } else if ((Owner = FvNameToVolume (*Fs, *Directory, Component)) != NULL) {
+      //
+      // Carry on in the root of the nested volume, mounting it the first
+      // time its directory is entered.
+      //
+      Status = FvMountNestedVolume (*Fs, Owner, &Nested);
 
-  if (PrivateFile == NULL) {
-    goto RootDone;
-  }
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
 
-  RootInfo      = AllocateZeroPool (sizeof (DIR_INFO));
-  RootInfo->Key = AllocateZeroPool (sizeof (Fs->FirmwareVolume2->KeySize));
+      *Fs        = Nested;
+      *Directory = NULL;
+    } else {
+      *Entry = FvNameToEntry (*Fs, *Directory, Component);
 
-  //
-  // Fill out the rest of the private file data and assign it's File attribute
-  // to Root.
-  //
-  PrivateFile->FileSystem  = Fs;
-  PrivateFile->FileName    = L"";
-  PrivateFile->IsDirectory = TRUE;
-  PrivateFile->DirInfo     = RootInfo;
+      if (*Entry == NULL) {
+        return EFI_NOT_FOUND;
+      }
+    }
 
-RootDone:
+    Component = Next;
+  }
 
-  return PrivateFile;
+  return EFI_SUCCESS;
 }
 
 /**
@@ -633,6 +2453,219 @@ PathCleanUpDirectories(
   return (Path);
 }
 
+/**
+  Reads data from a file or directory handle on behalf of Read() and ReadEx().
+  The caller holds mFfsLock and has completed the handle's queued requests.
+
+  @param  PrivateFile The handle to read from.
+  @param  BufferSize  On input, the size of Buffer. On output, the amount of data
+                      returned in Buffer.
+  @param  Buffer      The buffer into which the data is read.
+
+  @retval EFI_SUCCESS          Data was read.
+  @retval EFI_MEDIA_CHANGED    The handle's volume was reinstalled since it was opened.
+  @retval EFI_DEVICE_ERROR     The file could not be decoded, or the position is past EOF.
+  @retval EFI_BUFFER_TOO_SMALL The buffer is too small for the next directory entry.
+
+**/
+EFI_STATUS
+FileRead (
+  IN OUT FILE_PRIVATE_DATA *PrivateFile,
+  IN OUT UINTN             *BufferSize,
+  OUT    VOID              *Buffer
+  )
+{
+  EFI_STATUS                    Status;
+  UINTN                         ReadStart, FileSize;
+  FV_FILE_ENTRY                 *Entry;
+  FV_SECTION_ENTRY              *Section;
+  BOOLEAN                       HasDirect;
+  UINTN                         DirectOffset, DirectSize;
+  EFI_FILE_INFO                 *NextInfo;
+  UINT8                         *FileContents;
+
+  Status = EFI_SUCCESS;
+
+  //
+  // Determine the starting location to read from.
+  //
+  ReadStart = (UINTN) PrivateFile->Position;
+
+  if (FileIsStale (PrivateFile)) {
+    Status = EFI_MEDIA_CHANGED;
+    goto ReadDone;
+  }
+
+  DEBUG ((EFI_D_INFO, "*** FileRead: Start reading from %d ***\n", ReadStart));
+
+  // Check filetype.
+  if (PrivateFile->IsDirectory) {
+    DEBUG ((EFI_D_INFO, "*** FileRead: Called on directory ***\n"));
+
+    //
+    // Grab the next file in the directory. Running out of entries is the end
+    // of the directory listing, which is reported as a zero-sized read.
+    //
+    NextInfo = DirGetNextInfo (PrivateFile);
+
+    if (NextInfo == NULL) {
+      DEBUG ((EFI_D_INFO, "*** FileRead: At end of directory listing\n"));
+      *BufferSize = 0;
+      Status = EFI_SUCCESS;
+      goto ReadDone;
+    }
+
+    //
+    // Describe the entry straight into the caller's buffer. If it doesn't
+    // fit, step the cursor back so that the same entry is returned next time.
+    //
+    Status = CopyInfoRecord (NextInfo, SIZE_OF_FILE_INFO, BufferSize, Buffer);
+
+    if (EFI_ERROR (Status)) {
+      DEBUG ((EFI_D_INFO, "*** FileRead: Need a larger buffer\n"));
+      PrivateFile->DirInfo->Cursor--;
+      goto ReadDone;
+    }
+  } else {
+    DEBUG ((EFI_D_INFO, "*** FileRead: Called on file ***\n"));
+
+    Entry   = PrivateFile->FileInfo->Entry;
+    Section = PrivateFile->FileInfo->Section;
+
+    if (Section != NULL) {
+      HasDirect    = Section->HasDirect;
+      DirectOffset = Section->DirectOffset;
+      DirectSize   = Section->Size;
+    } else {
+      HasDirect    = Entry->HasDirect;
+      DirectOffset = Entry->DirectOffset;
+      DirectSize   = Entry->DirectSize;
+    }
+
+    //
+    // A .efi handle on a file that has since turned out not to be executable
+    // can't be served. The file can be opened again as a .ffs file.
+    //
+    if (Section == NULL && PrivateFile->FileInfo->IsExecutable && !Entry->IsExecutable) {
+      Status = EFI_DEVICE_ERROR;
+      goto ReadDone;
+    }
+
+    //
+    // Once the rest of the file has been read ahead, serve it from memory.
+    //
+    if (HasDirect && PrivateFile->FileInfo->ReadAheadReady) {
+      PrivateFile->FileInfo->ReadAheadReady = FALSE;
+      FileFindCachedContents (PrivateFile);
+    }
+
+    if (HasDirect && PrivateFile->FileInfo->Cached == NULL) {
+      //
+      // The file's contents are stored uncompressed in the volume, so read
+      // just the requested range straight out of it.
+      //
+      Status = FileReadRange (
+                 PrivateFile->FileSystem,
+                 DirectOffset,
+                 DirectSize,
+                 PrivateFile->Position,
+                 BufferSize,
+                 Buffer);
+
+      if (EFI_ERROR (Status)) {
+        goto ReadDone;
+      }
+    } else {
+      //
+      // Load the file's contents into the handle the first time it is read.
+      // Every later read is served from the same cached buffer.
+      //
+      Status = FileLoadContents (PrivateFile);
+
+      if (EFI_ERROR (Status)) {
+        Status = EFI_DEVICE_ERROR;
+        goto ReadDone;
+      }
+
+      //
+      // Reading from beyond the end of the file is an error.
+      //
+      FileContents = PrivateFile->FileInfo->Contents;
+      FileSize     = PrivateFile->FileInfo->ContentsSize;
+
+      if (PrivateFile->Position > FileSize) {
+        DEBUG ((EFI_D_INFO, "*** FileRead: Position is past EOF ***\n"));
+        Status = EFI_DEVICE_ERROR;
+        goto ReadDone;
+      }
+
+      //
+      // Cap off the amount of data read so we don't go past the EOF.
+      //
+      if (*BufferSize > FileSize - ReadStart) {
+        DEBUG ((EFI_D_INFO, "Decreasing buffersize for read...\n"));
+        *BufferSize = FileSize - ReadStart;
+      }
+
+      //
+      // Copy the requested segment of data from the file's contents.
+      //
+      FFS_PERF_START (FFS_PERF_COPY);
+      CopyMem (Buffer, FileContents + ReadStart, *BufferSize);
+      FFS_PERF_END (FFS_PERF_COPY);
+    }
+
+    //
+    // Update the file's position to be the original location added to the
+    // number of bytes read.
+    //
+    PrivateFile->Position = ReadStart + *BufferSize;
+    FfsReadAheadNoteRead (PrivateFile);
+  }
+
+  DEBUG ((EFI_D_INFO, "*** FileRead: End of reading %s ***\n", PrivateFile->FileName));
+
+ReadDone:
+
+  if (!EFI_ERROR (Status)) {
+    FvCounters (PrivateFile->FileSystem)->BytesCopied += *BufferSize;
+  }
+
+  return Status;
+}
+
+/**
+  Determines whether reading from a handle has to decode its file first, in
+  which case a ReadEx() request is worth completing in the background.
+
+  @param  PrivateFile The handle to be read from.
+
+  @retval TRUE  The file's contents have yet to be decoded.
+  @retval FALSE The read can be served from the volume or from memory.
+
+**/
+BOOLEAN
+FileReadNeedsDecoding (
+  IN FILE_PRIVATE_DATA *PrivateFile
+  )
+{
+  FILE_INFO *FileInfo;
+
+  if (PrivateFile->IsDirectory || FileIsStale (PrivateFile)) {
+    return FALSE;
+  }
+
+  FileInfo = PrivateFile->FileInfo;
+
+  if (FileInfo->Cached != NULL) {
+    return FALSE;
+  } else if (FileInfo->Section != NULL) {
+    return !FileInfo->Section->HasDirect;
+  } else {
+    return !FileInfo->Entry->HasDirect;
+  }
+}
+
 //
 // SimpleFileSystem and File protocol functions
 //
@@ -667,14 +2700,47 @@ FfsOpenVolume (
   EFI_STATUS               Status;
   FILE_SYSTEM_PRIVATE_DATA *PrivateFileSystem;
   FILE_PRIVATE_DATA        *PrivateFile;
-  
+  UINT64                   TraceStart;
+
+  TraceStart = FfsTraceStart ();
   DEBUG ((EFI_D_INFO, "FfsOpenVolume: Start\n"));
+  FFS_PERF_START (FFS_PERF_OPEN_VOLUME);
+  EfiAcquireLock (&mFfsLock);
 
   //
-  // Get private structure for This and allocate a new root instance.
+  // Get private structure for This. Volumes are installed without looking at
+  // them, so the FV2 interface is only picked up, and the file index built,
+  // the first time the volume is opened.
   //
   PrivateFileSystem = FILE_SYSTEM_PRIVATE_DATA_FROM_THIS (This);
-  PrivateFile       = AllocateNewRoot (PrivateFileSystem);
+
+  if (PrivateFileSystem->FirmwareVolume2 == NULL) {
+    Status = gBS->HandleProtocol (
+                    PrivateFileSystem->Handle,
+                    &gEfiFirmwareVolume2ProtocolGuid,
+                    (VOID **)&PrivateFileSystem->FirmwareVolume2
+                    );
+
+    if (EFI_ERROR (Status)) {
+      DEBUG ((EFI_D_ERROR, "FfsOpenVolume: FV2 is gone from the handle: %r\n", Status));
+      PrivateFileSystem->FirmwareVolume2 = NULL;
+      Status = EFI_NO_MEDIA;
+      goto OpenVolumeDone;
+    }
+  }
+
+  FFS_PERF_START (FFS_PERF_INDEX);
+  Status = FvBuildFileIndex (PrivateFileSystem);
+  FFS_PERF_END (FFS_PERF_INDEX);
+
+  if (EFI_ERROR (Status)) {
+    goto OpenVolumeDone;
+  }
+
+  //
+  // Allocate a new root instance.
+  //
+  PrivateFile = AllocateNewDirectory (PrivateFileSystem, NULL, NULL);
 
   if (PrivateFile == NULL) {
     //
@@ -690,6 +2756,12 @@ FfsOpenVolume (
   }
 
   DEBUG ((EFI_D_INFO, "FfsOpenVolume: End of func\n"));
+
+OpenVolumeDone:
+
+  FfsTraceRecord (FfsTraceOpenVolume, NULL, 0, 0, Status, TraceStart);
+  EfiReleaseLock (&mFfsLock);
+  FFS_PERF_END (FFS_PERF_OPEN_VOLUME);
   return Status;
 }
 
@@ -734,12 +2806,20 @@ FfsOpen (
   )
 {
   EFI_STATUS               Status;
+  FILE_SYSTEM_PRIVATE_DATA *Fs;
   FILE_PRIVATE_DATA        *PrivateFile, *NewPrivateFile;
-  EFI_GUID                 *Guid;
-  CHAR16                   *CleanPath, *Ext, *GuidAsString;
-
-  Status = EFI_SUCCESS;
+  FV_FILE_ENTRY            *Entry, *SectionDir;
+  FV_SECTION_ENTRY         *Section;
+  FV_DIRECTORY             *Directory;
+  CHAR16                   *Path, *CleanPath;
+  UINT64                   TraceStart;
+
+  TraceStart     = FfsTraceStart ();
+  Status         = EFI_SUCCESS;
+  NewPrivateFile = NULL;
   DEBUG ((EFI_D_INFO, "FfsOpen: Start\n"));
+  FFS_PERF_START (FFS_PERF_OPEN);
+  EfiAcquireLock (&mFfsLock);
 
   //
   // Check for a valid OpenMode parameter. Since this is a read-only filesystem
@@ -758,97 +2838,80 @@ FfsOpen (
 
   DEBUG ((EFI_D_INFO, "FfsOpen: Opening: %s\n", FileName));
   PrivateFile = FILE_PRIVATE_DATA_FROM_THIS (This);
-  CleanPath = PathCleanUpDirectories (FileName);
-  DEBUG ((EFI_D_INFO, "FfsOpen: Path reconstructed as: %s\n", CleanPath));
+
+  if (FileIsStale (PrivateFile)) {
+    Status = EFI_MEDIA_CHANGED;
+    goto OpenDone;
+  }
 
   //
-  // Check the filename that was specified to open.
+  // Work on a copy of the path, since cleaning it up edits it in place.
   //
-  if (StrCmp (CleanPath, L"\\") == 0 ||
-             (StrCmp (CleanPath, L".") == 0 && PrivateFile->IsDirectory)) {
-    //
-    // Open the root directory.
-    //
-    DEBUG ((EFI_D_INFO, "FfsOpen: Open root\n"));
+  Path = FvAllocateBuffer (PrivateFile->FileSystem, StrSize (FileName));
 
-    NewPrivateFile = AllocateNewRoot (PrivateFile->FileSystem);
-    *NewHandle = &(NewPrivateFile->File);
-  } else if (StrCmp (CleanPath, L"..") == 0) {
-    //
-    // Open the parent directory. This is invalid on the filesystem.
-    //
-    DEBUG ((EFI_D_INFO, "FfsOpen: Open parent\n"));
-    Status = EFI_NOT_FOUND;
-  } else {
-    //
-    // Perform basic checks to ensure we don't go through a lot of code for
-    // nothing. First of all, ensure the filename length is ok.
-    //
-    if (StrLen(CleanPath) != LENGTH_OF_FILENAME) {
-      DEBUG ((EFI_D_INFO, "Filename isn't 40 characters\n"));
-      Status = EFI_NOT_FOUND;
-      goto OpenDone;
-    }
+  if (Path == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto OpenDone;
+  }
 
-    //
-    // Ensure the file extension is either .ffs or .efi.
-    //
-    Ext = CleanPath + LENGTH_OF_FILENAME - 4;
+  StrCpy (Path, FileName);
+
+  //
+  // Absolute paths start at the top-level root, even from inside a nested
+  // volume. Relative paths start at the directory This refers to, or at the
+  // root of its volume when This is a file.
+  //
+  Fs         = PrivateFile->FileSystem;
+  Directory  = NULL;
+  SectionDir = NULL;
 
-    if (StrCmp (Ext, L".ffs") != 0 && StrCmp (Ext, L".efi") != 0) {
-      DEBUG ((EFI_D_INFO, "Invalid extension (not ffs or efi)\n"));
-      Status = EFI_NOT_FOUND;
-      goto OpenDone;
+  if (Path[0] == L'\\') {
+    while (Fs->Parent != NULL) {
+      Fs = Fs->Parent;
     }
-      
-    //
-    // Check everything up until the extension to make sure it is a GUID used
-    // in this specific FV2.
-    //
-    GuidAsString = AllocateZeroPool (SIZE_OF_GUID);
-    CopyMem (GuidAsString, CleanPath, SIZE_OF_GUID);
-    GuidAsString[36] = '\0';
+  } else if (PrivateFile->IsDirectory) {
+    Directory  = PrivateFile->DirInfo->Directory;
+    SectionDir = PrivateFile->DirInfo->File;
+  }
 
-    DEBUG ((EFI_D_INFO, "Looking for %s\n", GuidAsString));
-    Guid = FvGetFile (PrivateFile->FileSystem->FirmwareVolume2, GuidAsString);
+  CleanPath = PathCleanUpDirectories (Path);
+  DEBUG ((EFI_D_INFO, "FfsOpen: Path reconstructed as: %s\n", CleanPath));
 
-    //
-    // Grab the file.
-    //
-    if (Guid != NULL) {
-      //
-      // Found file.
-      //
+  FFS_PERF_START (FFS_PERF_RESOLVE);
+  Status = FvResolvePath (
+             &Fs,
+             CleanPath,
+             &Directory,
+             &SectionDir,
+             &Entry,
+             &Section);
+  FFS_PERF_END (FFS_PERF_RESOLVE);
+
+  if (!EFI_ERROR (Status)) {
+    if (Entry == NULL) {
+      DEBUG ((EFI_D_INFO, "FfsOpen: Open directory\n"));
+      NewPrivateFile = AllocateNewDirectory (Fs, Directory, SectionDir);
+    } else {
       DEBUG ((EFI_D_INFO, "FfsOpen: File found\n"));
-      NewPrivateFile = GuidToFile (Guid, PrivateFile->FileSystem);
+      NewPrivateFile = GuidToFile (Entry, Section, Fs);
+    }
 
-      //
-      // Check that the file we got has the correct extension for its contents.
-      //
-      if ((StrCmp (Ext, L".ffs") == 0 && !NewPrivateFile->FileInfo->IsExecutable) ||
-          (StrCmp (Ext, L".efi") == 0 &&  NewPrivateFile->FileInfo->IsExecutable)) {
-        *NewHandle = &(NewPrivateFile->File);
-      } else {
-        DEBUG ((EFI_D_INFO, "Invalid extension for contents\n"));
-        Status = EFI_NOT_FOUND;
-      }
-      
-      FreePool (Guid);
+    if (NewPrivateFile == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
     } else {
-      //
-      // File not found.
-      //
-      DEBUG ((EFI_D_INFO, "FfsOpen: File not found\n"));
-      Status = EFI_NOT_FOUND;
+      *NewHandle = &(NewPrivateFile->File);
     }
-
-    FreePool (GuidAsString);
   }
 
+  FvFreeBuffer (Fs, Path);
+
   DEBUG ((EFI_D_INFO, "FfsOpen: End of func\n"));
 
 OpenDone:
 
+  FfsTraceRecord (FfsTraceOpen, NewPrivateFile, 0, 0, Status, TraceStart);
+  EfiReleaseLock (&mFfsLock);
+  FFS_PERF_END (FFS_PERF_OPEN);
   return Status;
 }
 
@@ -866,7 +2929,9 @@ EFIAPI
 FfsClose (IN EFI_FILE_PROTOCOL *This)
 {
   FILE_PRIVATE_DATA *PrivateFile;
+  UINT64            TraceStart;
 
+  TraceStart = FfsTraceStart ();
   DEBUG ((EFI_D_INFO, "*** FfsClose: Start of func ***\n"));
 
   //
@@ -875,15 +2940,24 @@ FfsClose (IN EFI_FILE_PROTOCOL *This)
   PrivateFile = FILE_PRIVATE_DATA_FROM_THIS (This);
 
   //
-  // Free up all of the private data.
+  // Complete the handle's queued ReadEx() requests, and forget its read-ahead,
+  // before it goes away.
   //
-  if (PrivateFile->IsDirectory) {
-    FreePool (PrivateFile->DirInfo);
-  } else {
-    FreePool (PrivateFile->FileInfo);
+  EfiAcquireLock (&mFfsLock);
+  FfsIoDrain (PrivateFile);
+  FfsPrefetchCancel (PrivateFile);
+
+  //
+  // Drop the handle's reference to its cached contents and return it to the
+  // volume's slabs.
+  //
+  if (!PrivateFile->IsDirectory && PrivateFile->FileInfo->Cached != NULL) {
+    FfsCacheRelease (PrivateFile->FileInfo->Cached);
   }
 
-  FreePool (PrivateFile);
+  FfsTraceRecord (FfsTraceClose, PrivateFile, PrivateFile->Position, 0, EFI_SUCCESS, TraceStart);
+  FfsFreeHandle (PrivateFile);
+  EfiReleaseLock (&mFfsLock);
 
   DEBUG ((EFI_D_INFO, "*** FfsClose: End of func ***\n"));
   return EFI_SUCCESS;
@@ -904,7 +2978,13 @@ EFIAPI
 FfsDelete (IN EFI_FILE_PROTOCOL *This)
 {
   DEBUG ((EFI_D_INFO, "*** FfsDelete: Unsupported ***\n"));
-  return EFI_UNSUPPORTED;
+
+  //
+  // Nothing can be deleted from a firmware volume, but the handle must still
+  // be closed so that it doesn't leak.
+  //
+  FfsClose (This);
+  return EFI_WARN_DELETE_FAILURE;
 }
 
 /**
@@ -929,149 +3009,36 @@ FfsDelete (IN EFI_FILE_PROTOCOL *This)
 **/
 EFI_STATUS
 EFIAPI
-FfsRead (
-  IN EFI_FILE_PROTOCOL *This,
-  IN OUT UINTN *BufferSize,
-  OUT VOID *Buffer
-  )
-{
-  EFI_STATUS                    Status;
-  FILE_PRIVATE_DATA             *PrivateFile, *NextFile;
-  UINTN                         ReadStart, FileSize, SectionInstance;
-  EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2;
-  EFI_GUID                      *NextFileGuid;
-  VOID                          *FileContents, *FileReadStart;
-  EFI_FV_FILETYPE               FoundType;
-  EFI_FV_FILE_ATTRIBUTES        FileAttributes;
-  EFI_SECTION_TYPE              SectionType;
-  UINT32                        AuthenticationStatus;
-
-  Status = EFI_SUCCESS;
-  DEBUG ((EFI_D_INFO, "*** FfsRead: Start of func ***\n"));
-
-  //
-  // Grab private data and determine the starting location to read from.
-  //
-  PrivateFile = FILE_PRIVATE_DATA_FROM_THIS (This);
-  Fv2         = PrivateFile->FileSystem->FirmwareVolume2;
-  ReadStart   = (UINTN) PrivateFile->Position;
-
-  DEBUG ((EFI_D_INFO, "*** FfsRead: Start reading from %d ***\n", ReadStart));
-
-  // Check filetype.
-  if (PrivateFile->IsDirectory) {
-    DEBUG ((EFI_D_INFO, "*** FfsRead: Called on directory ***\n"));
-
-    //
-    // Ensure that Buffer is large enough to hold the EFI_FILE_INFO struct.
-    //
-    if (*BufferSize < SIZE_OF_EFI_FILE_INFO + SIZE_OF_GUID) {
-      DEBUG ((EFI_D_INFO, "*** FfsRead: Need a larger buffer\n"));
-      *BufferSize = SIZE_OF_EFI_FILE_INFO + SIZE_OF_GUID;
-      Status = EFI_BUFFER_TOO_SMALL;
-      goto ReadDone;
-    }
-
-    //
-    // Ensure we're not at the end of the directory.
-    //
-    if (FvGetNumberOfFiles(PrivateFile->FileSystem->FirmwareVolume2) <= ReadStart) {
-      DEBUG ((EFI_D_INFO, "*** FfsRead: At end of directory listing\n"));
-      *BufferSize = 0;
-      Status = EFI_SUCCESS;
-      goto ReadDone;
-    }
-
-    //
-    // Grab the next file in the directory and get its EFI_FILE_INFO.
-    //
-    NextFileGuid = AllocateZeroPool (sizeof(EFI_GUID));
-    NextFileGuid = RootGetNextFile (PrivateFile);
-    NextFile     = GuidToFile (NextFileGuid, PrivateFile->FileSystem);
-
-    NextFile->File.GetInfo (
-                     &(NextFile->File),
-                     &gEfiFileInfoGuid,
-                     BufferSize,
-                     Buffer);
-
-    //
-    // Update the current position to the next directory entry.
-    //
-    PrivateFile->Position += 1;
-  } else {
-    DEBUG ((EFI_D_INFO, "*** FfsRead: Called on file ***\n"));
-
-    //
-    // Determine how many bytes we will actually read. If the read request is
-    // going to go out of bounds, change it to read only to the EOF.
-    //
-    FileSize = FvFileGetSize (
-                 PrivateFile->FileSystem->FirmwareVolume2,
-                 &(PrivateFile->FileInfo->NameGuid));
-
-    //
-    // Cap off the amount of data read so we don't go past the EOF.
-    //
-    if (ReadStart + *BufferSize > FileSize) {
-      DEBUG ((EFI_D_INFO, "Increasing buffersize for read...\n"));
-      *BufferSize = FileSize - ReadStart;
-    }
-
-    //
-    // Allocate a buffer to use to hold the file's contents.
-    //
-    FileContents = AllocateZeroPool (FileSize);
+FfsRead (
+  IN EFI_FILE_PROTOCOL *This,
+  IN OUT UINTN *BufferSize,
+  OUT VOID *Buffer
+  )
+{
+  EFI_STATUS        Status;
+  FILE_PRIVATE_DATA *PrivateFile;
+  UINT64            TraceStart, Position, Size;
 
-    // Read the data.
-    if (IsFileExecutable (
-          PrivateFile->FileSystem->FirmwareVolume2,
-          &(PrivateFile->FileInfo->NameGuid))) {
-      //
-      // Read executable section.
-      //       
-      SectionType     = EFI_SECTION_PE32;
-      SectionInstance = 0;
-
-      Fv2->ReadSection (
-             Fv2,
-             &(PrivateFile->FileInfo->NameGuid),
-             SectionType,
-             SectionInstance,
-             &FileContents,
-             &FileSize,
-             &AuthenticationStatus);
-    } else {
-      //
-      // Read from whole file.
-      //
-      Fv2->ReadFile (
-             Fv2,
-             &(PrivateFile->FileInfo->NameGuid),
-             &FileContents,
-             &FileSize,
-             &FoundType,
-             &FileAttributes,
-             &AuthenticationStatus);
-    }
+  TraceStart = FfsTraceStart ();
+  DEBUG ((EFI_D_INFO, "*** FfsRead: Start of func ***\n"));
 
-    //
-    // Copy the requested segment of data from the file's contents.
-    //
-    FileReadStart = FileContents + ReadStart;
-    CopyMem (Buffer, FileReadStart, *BufferSize);
-    FreePool (FileContents);
+  //
+  // Grab private data and let any ReadEx() requests still queued on the
+  // handle finish first, so that reads complete in the order they were issued.
+  //
+  PrivateFile = FILE_PRIVATE_DATA_FROM_THIS (This);
 
-    //
-    // Update the file's position to be the original location added to the
-    // number of bytes read.
-    //
-    PrivateFile->Position = ReadStart + *BufferSize;
-  }
+  FFS_PERF_START (FFS_PERF_READ);
+  EfiAcquireLock (&mFfsLock);
+  FfsIoDrain (PrivateFile);
 
-  DEBUG ((EFI_D_INFO, "*** FfsRead: End of reading %s ***\n", PrivateFile->FileName));
+  Position = PrivateFile->Position;
+  Size     = *BufferSize;
+  Status   = FileRead (PrivateFile, BufferSize, Buffer);
 
-ReadDone:
+  FfsTraceRecord (FfsTraceRead, PrivateFile, Position, Size, Status, TraceStart);
+  EfiReleaseLock (&mFfsLock);
+  FFS_PERF_END (FFS_PERF_READ);
 
   return Status;
 }
@@ -1129,8 +3096,10 @@ FfsGetPosition (
 {
   EFI_STATUS        Status;
   FILE_PRIVATE_DATA *PrivateFile;
+  UINT64            TraceStart;
 
-  Status = EFI_SUCCESS;
+  TraceStart = FfsTraceStart ();
+  Status     = EFI_SUCCESS;
   DEBUG ((EFI_D_INFO, "*** FfsGetPosition: Start of func ***\n"));
 
   //
@@ -1138,6 +3107,14 @@ FfsGetPosition (
   //
   PrivateFile = FILE_PRIVATE_DATA_FROM_THIS (This);
 
+  EfiAcquireLock (&mFfsLock);
+  FfsIoDrain (PrivateFile);
+
+  if (FileIsStale (PrivateFile)) {
+    Status = EFI_MEDIA_CHANGED;
+    goto GetPosDone;
+  }
+
   //
   // Ensure that this function is not called on a directory.
   //
@@ -1151,6 +3128,8 @@ FfsGetPosition (
 
 GetPosDone:
 
+  FfsTraceRecord (FfsTraceGetPosition, PrivateFile, PrivateFile->Position, 0, Status, TraceStart);
+  EfiReleaseLock (&mFfsLock);
   return Status;
 }
 
@@ -1176,13 +3155,24 @@ FfsSetPosition (
 {
   EFI_STATUS        Status;
   FILE_PRIVATE_DATA *PrivateFile;
+  UINT64            TraceStart;
 
+  TraceStart = FfsTraceStart ();
   DEBUG ((EFI_D_INFO, "*** FfsSetPosition: Start of func ***\n"));
 
   //
   // Grab private data associated with This.
   //
   PrivateFile = FILE_PRIVATE_DATA_FROM_THIS (This);
+  Status      = EFI_SUCCESS;
+
+  EfiAcquireLock (&mFfsLock);
+  FfsIoDrain (PrivateFile);
+
+  if (FileIsStale (PrivateFile)) {
+    Status = EFI_MEDIA_CHANGED;
+    goto SetPosDone;
+  }
 
   //
   // Check for the invalid condition that This is a directory and the position
@@ -1194,12 +3184,24 @@ FfsSetPosition (
     goto SetPosDone;
   }
 
-  if (Position == END_OF_FILE_POSITION) {
+  //
+  // Seeking starts the count of sequential reads over.
+  //
+  if (!PrivateFile->IsDirectory) {
+    PrivateFile->FileInfo->SequentialReads = 0;
+  }
+
+  if (Position == END_OF_FILE_POSITION && PrivateFile->FileInfo->Section != NULL) {
+    //
+    // Set to the end of the section.
+    //
+    PrivateFile->Position = PrivateFile->FileInfo->Section->Size;
+  } else if (Position == END_OF_FILE_POSITION) {
     //
     // Set to the end-of-file position.
     //
-    PrivateFile->Position = FvFileGetSize (PrivateFile->FileSystem->FirmwareVolume2,
-                                           &(PrivateFile->FileInfo->NameGuid));
+    PrivateFile->Position = FvFileGetSize (PrivateFile->FileSystem,
+                                           PrivateFile->FileInfo->Entry);
   } else {
     //
     // Set the position normally.
@@ -1207,12 +3209,10 @@ FfsSetPosition (
     PrivateFile->Position = Position;
 
     //
-    // Reset the key for GetNextFile as well as setting the position if need be.
+    // Rewind the directory cursor as well as setting the position if need be.
     //
     if (PrivateFile->IsDirectory && Position == 0) {
-      ZeroMem (
-        PrivateFile->DirInfo->Key,
-        PrivateFile->FileSystem->FirmwareVolume2->KeySize);
+      PrivateFile->DirInfo->Cursor = 0;
     }
   }
 
@@ -1220,7 +3220,9 @@ FfsSetPosition (
 
 SetPosDone:
 
-  return EFI_SUCCESS;
+  FfsTraceRecord (FfsTraceSetPosition, PrivateFile, Position, 0, Status, TraceStart);
+  EfiReleaseLock (&mFfsLock);
+  return Status;
 }
 
 /**
@@ -1252,145 +3254,57 @@ FfsGetInfo (
   OUT VOID *Buffer
   )
 {
-  EFI_STATUS           Status;
-  EFI_FILE_INFO        *FileInfo;
-  EFI_FILE_SYSTEM_INFO *FsInfo;
-  FILE_PRIVATE_DATA    *PrivateFile;
-  UINTN                DataSize;
-  CHAR16               *VolumeLabel, *FileName;
+  EFI_STATUS               Status;
+  EFI_FILE_INFO            *FileInfo;
+  FILE_PRIVATE_DATA        *PrivateFile;
+  FILE_SYSTEM_PRIVATE_DATA *Fs;
+  UINT64                   TraceStart, Size;
 
+  TraceStart = FfsTraceStart ();
   DEBUG ((EFI_D_INFO, "*** FfsGetInfo: Start of func ***\n"));
 
   //
   // Grab the associated private data.
   //
   PrivateFile = FILE_PRIVATE_DATA_FROM_THIS (This);
+  Fs          = PrivateFile->FileSystem;
+  Size        = *BufferSize;
+
+  EfiAcquireLock (&mFfsLock);
+
+  if (FileIsStale (PrivateFile)) {
+    FfsTraceRecord (FfsTraceGetInfo, PrivateFile, PrivateFile->Position, Size, EFI_MEDIA_CHANGED, TraceStart);
+    EfiReleaseLock (&mFfsLock);
+    return EFI_MEDIA_CHANGED;
+  }
+
+  FFS_PERF_START (FFS_PERF_GET_INFO);
 
   //
-  // Check InformationType to determine what kind of data to return.
+  // Check InformationType to determine what kind of data to return. Every
+  // record is rendered once and kept with the volume's index, so answering
+  // is just a copy.
   //
   if (CompareGuid (InformationType, &gEfiFileInfoGuid)) {
     DEBUG ((EFI_D_INFO, "*** FfsGetInfo: EFI_FILE_INFO request ***\n"));
 
-    //
-    // Determine if the size of Buffer is adequate, and if not, break so we can
-    // return an error and calculate the needed size;
-    //
-    DataSize = SIZE_OF_EFI_FILE_INFO + SIZE_OF_FILENAME;
-
-    if (*BufferSize < DataSize) {
-      //
-      // Error condition. The buffer size is too small.
-      //
-      *BufferSize = DataSize;
-      Status = EFI_BUFFER_TOO_SMALL;
+    if (PrivateFile->IsDirectory && PrivateFile->DirInfo->File != NULL) {
+      FileInfo = FvEntryGetDirInfo (Fs, PrivateFile->DirInfo->File);
+    } else if (PrivateFile->IsDirectory && PrivateFile->DirInfo->Directory != NULL) {
+      FileInfo = PrivateFile->DirInfo->Directory->Info;
+    } else if (PrivateFile->IsDirectory) {
+      FileInfo = Fs->RootInfo;
+    } else if (PrivateFile->FileInfo->Section != NULL) {
+      FileInfo = PrivateFile->FileInfo->Section->Info;
     } else {
-      //
-      // Allocate and fill out an EFI_FILE_INFO instance for this file.
-      //
-      FileInfo                   = AllocateZeroPool (DataSize);
-      FileInfo->Size             = DataSize;
-      FileInfo->CreateTime       = mModuleLoadTime;
-      FileInfo->LastAccessTime   = mModuleLoadTime;
-      FileInfo->ModificationTime = mModuleLoadTime;
-      FileInfo->Attribute        = EFI_FILE_READ_ONLY;
-
-      //
-      // Copy in the file name from private data.
-      //
-      FileName = AllocateZeroPool (SIZE_OF_FILENAME);
-      UnicodeSPrint (FileName,
-                     SIZE_OF_FILENAME,
-                     L"%s",
-                     PrivateFile->FileName);
-      StrCpy (FileInfo->FileName, FileName);
-      FreePool (FileName);
-
-      //
-      // Set the next params based on whether the file is a directory or not.
-      //
-      if (PrivateFile->IsDirectory) {
-        //
-        // Calculate size of the directory by summing the filesizes of each
-        // file.
-        //
-        FileInfo->FileSize = FvGetVolumeSize (
-                               PrivateFile->FileSystem->FirmwareVolume2);
-
-        //
-        // Update the Attributes field to reflect that this file is also a
-        // directory.
-        //
-        FileInfo->Attribute |= EFI_FILE_DIRECTORY;
-      } else {
-        FileInfo->FileSize = FvFileGetSize (
-                               PrivateFile->FileSystem->FirmwareVolume2,
-                               &(PrivateFile->FileInfo->NameGuid));
-      }
-
-      //
-      // Use the same value for PhysicalSize as FileSize calculated beforehand.
-      // PhysicalSize is just an analogue of FileSize.
-      //
-      FileInfo->PhysicalSize = FileInfo->FileSize;
-
-      //
-      // Copy the memory to Buffer, set the output value of BufferSize, and
-      // free the temporary data structure.
-      //
-      CopyMem (Buffer, FileInfo, DataSize);
-      *BufferSize = DataSize;
-      FreePool (FileInfo);
-      Status = EFI_SUCCESS;
+      FileInfo = FvEntryGetFileInfo (Fs, PrivateFile->FileInfo->Entry);
     }
+
+    Status = CopyInfoRecord (FileInfo, SIZE_OF_FILE_INFO, BufferSize, Buffer);
   } else if (CompareGuid (InformationType, &gEfiFileSystemInfoGuid)) {
     DEBUG ((EFI_D_INFO, "*** FfsGetInfo: EFI_FILE_SYSTEM_INFO request ***\n"));
 
-    //
-    // Determine if the size of Buffer is adequate, and if not, break so we can
-    // return an error and calculate the needed size.
-    //
-    DataSize = SIZE_OF_EFI_FILE_SYSTEM_INFO + SIZE_OF_FILENAME;
-
-    if (*BufferSize < DataSize) {
-      //
-      // Error condition. The buffer passed in is too small to be used by this
-      // function. Set the required minimal buffer size and return.
-      //
-      *BufferSize = DataSize;
-      Status = EFI_BUFFER_TOO_SMALL;
-    } else {
-      //
-      // Allocate and fill out an EFI_FILE_INFO instance for this file.
-      //
-      FsInfo = AllocateZeroPool (DataSize);
-      FsInfo->Size = DataSize;
-      FsInfo->ReadOnly = TRUE;
-      FsInfo->VolumeSize = FvGetVolumeSize (PrivateFile->FileSystem->FirmwareVolume2);
-      FsInfo->FreeSpace = 0;
-      FsInfo->BlockSize = 512;
-
-      //
-      // Generate the volume name. This is of the format "FV2@0x...", where the
-      // location in memory of the Fv2 instance replaces "...".
-      //
-      VolumeLabel = AllocateZeroPool (SIZE_OF_FV_LABEL);
-      UnicodeSPrint (VolumeLabel,
-                     SIZE_OF_FV_LABEL,
-                     L"FV2@0x%x",
-                     &(PrivateFile->FileSystem->FirmwareVolume2));
-      StrCpy (FsInfo->VolumeLabel, VolumeLabel);
-      FreePool (VolumeLabel);
-      
-      //
-      // Copy the memory to Buffer, set the output value of BufferSize, and
-      // free the temporary data structure.
-      //
-      CopyMem (Buffer, FsInfo, DataSize);
-      *BufferSize = DataSize;
-      FreePool (FsInfo);
-      Status = EFI_SUCCESS;
-    }
+    Status = CopyInfoRecord (Fs->FsInfo, SIZE_OF_FS_INFO, BufferSize, Buffer);
   } else {
     //
     // Invalid InformationType GUID, return that the call is unsupported.
@@ -1399,6 +3313,13 @@ FfsGetInfo (
     Status = EFI_UNSUPPORTED;
   }
 
+  if (!EFI_ERROR (Status)) {
+    FvCounters (Fs)->BytesCopied += *BufferSize;
+  }
+
+  FFS_PERF_END (FFS_PERF_GET_INFO);
+  FfsTraceRecord (FfsTraceGetInfo, PrivateFile, PrivateFile->Position, Size, Status, TraceStart);
+  EfiReleaseLock (&mFfsLock);
   return Status;
 }
 
@@ -1472,102 +3393,297 @@ FfsFlush (IN EFI_FILE_PROTOCOL *This)
   return EFI_ACCESS_DENIED;
 }
 
+/**
+  Opens a new file relative to the source file's location. Opening never
+  waits on the device, so a non-blocking request is completed, and its event
+  signalled, before returning.
+
+  @param  This       A pointer to the EFI_FILE_PROTOCOL instance that is the file
+                     handle to the source location.
+  @param  NewHandle  A pointer to the location to return the opened handle for the new
+                     file.
+  @param  FileName   The Null-terminated string of the name of the file to be opened.
+  @param  OpenMode   The mode to open the file.
+  @param  Attributes Only valid for EFI_FILE_MODE_CREATE.
+  @param  Token      A pointer to the token associated with the transaction.
+
+  @retval EFI_SUCCESS For a non-blocking request, the request was completed and
+                      Token->Status holds the result. Otherwise, the file was opened.
+  @retval other       See Open().
+
+**/
+EFI_STATUS
+EFIAPI
+FfsOpenEx (
+  IN EFI_FILE_PROTOCOL     *This,
+  OUT EFI_FILE_PROTOCOL    **NewHandle,
+  IN CHAR16                *FileName,
+  IN UINT64                OpenMode,
+  IN UINT64                Attributes,
+  IN OUT EFI_FILE_IO_TOKEN *Token
+  )
+{
+  DEBUG ((EFI_D_INFO, "*** FfsOpenEx: Start of func ***\n"));
+
+  Token->Status = FfsOpen (This, NewHandle, FileName, OpenMode, Attributes);
+
+  if (Token->Event == NULL) {
+    return Token->Status;
+  }
+
+  gBS->SignalEvent (Token->Event);
+  return EFI_SUCCESS;
+}
+
+/**
+  Reads data from a file. A non-blocking read that has to decode the file is
+  queued and completed in the background at TPL_CALLBACK. Any other read is
+  completed before returning.
+
+  @param  This  A pointer to the EFI_FILE_PROTOCOL instance that is the file
+                handle to read data from.
+  @param  Token A pointer to the token associated with the transaction.
+
+  @retval EFI_SUCCESS          For a non-blocking request, the request was queued or
+                               completed and Token->Status will hold the result.
+                               Otherwise, data was read.
+  @retval EFI_OUT_OF_RESOURCES The request could not be queued.
+  @retval other                See Read().
+
+**/
+EFI_STATUS
+EFIAPI
+FfsReadEx (
+  IN EFI_FILE_PROTOCOL     *This,
+  IN OUT EFI_FILE_IO_TOKEN *Token
+  )
+{
+  EFI_STATUS        Status;
+  FILE_PRIVATE_DATA *PrivateFile;
+  UINT64            TraceStart, Position, Size;
+
+  TraceStart = FfsTraceStart ();
+  DEBUG ((EFI_D_INFO, "*** FfsReadEx: Start of func ***\n"));
+
+  PrivateFile = FILE_PRIVATE_DATA_FROM_THIS (This);
+
+  EfiAcquireLock (&mFfsLock);
+
+  Position = PrivateFile->Position;
+  Size     = Token->BufferSize;
+
+  //
+  // Decoding is left to the background worker. Everything else is a copy
+  // from the volume or from memory, and is done right away unless earlier
+  // requests on the handle are still queued.
+  //
+  if (Token->Event != NULL &&
+      (PrivateFile->PendingIo > 0 || FileReadNeedsDecoding (PrivateFile))) {
+    Status = FfsIoQueueRead (PrivateFile, Token);
+    goto ReadExDone;
+  }
+
+  FfsIoDrain (PrivateFile);
+  Token->Status = FileRead (PrivateFile, &Token->BufferSize, Token->Buffer);
+
+  if (Token->Event == NULL) {
+    Status = Token->Status;
+  } else {
+    gBS->SignalEvent (Token->Event);
+    Status = EFI_SUCCESS;
+  }
+
+ReadExDone:
+
+  FfsTraceRecord (FfsTraceReadEx, PrivateFile, Position, Size, Status, TraceStart);
+  EfiReleaseLock (&mFfsLock);
+  return Status;
+}
+
+/**
+  Writes data to a file.
+
+  @param  This  A pointer to the EFI_FILE_PROTOCOL instance that is the file
+                handle to write data to.
+  @param  Token A pointer to the token associated with the transaction.
+
+  @retval EFI_ACCESS_DENIED The file was opened read-only.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsWriteEx (
+  IN EFI_FILE_PROTOCOL     *This,
+  IN OUT EFI_FILE_IO_TOKEN *Token
+  )
+{
+  DEBUG ((EFI_D_INFO, "*** FfsWriteEx: Unsupported ***\n"));
+  return EFI_ACCESS_DENIED;
+}
+
+/**
+  Flushes all modified data associated with a file to a device.
+
+  @param  This  A pointer to the EFI_FILE_PROTOCOL instance that is the file
+                handle to flush.
+  @param  Token A pointer to the token associated with the transaction.
+
+  @retval EFI_ACCESS_DENIED The file was opened read-only.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsFlushEx (
+  IN EFI_FILE_PROTOCOL     *This,
+  IN OUT EFI_FILE_IO_TOKEN *Token
+  )
+{
+  DEBUG ((EFI_D_INFO, "*** FfsFlushEx: Unsupported ***\n"));
+  return EFI_ACCESS_DENIED;
+}
+
 //
 // Global functions
 //
 
 /**
-  Callback function, notified when new FV2 volumes are mounted in the system.
+  Invalidates a mounted volume after its FV2 interface has been reinstalled.
+  The file index and the volume's cached contents are dropped, to be rebuilt
+  from the new FV2 instance the next time the volume is opened, and the
+  generation moves on so that handles opened before now return
+  EFI_MEDIA_CHANGED. Volumes nested in it are invalidated along with it.
 
-  @param Event   The EFI_EVENT that triggered this function call.
-  @param Context The context in which this function was called.
+  @param  Fs Private data for the filesystem to invalidate.
 
-  @return Nothing.
+**/
+VOID
+FfsRemountVolume (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  DEBUG ((EFI_D_INFO, "FfsRemountVolume: FV2 reinstalled, invalidating volume\n"));
+
+  //
+  // The new FV2 interface is picked up by the next OpenVolume().
+  //
+  Fs->FirmwareVolume2 = NULL;
+  FvInvalidateVolume (Fs);
+}
+
+/**
+  Installs SimpleFileSystem on a newly registered FV2 handle. Nothing is read
+  from the volume here: the FV2 interface is picked up, and the volume
+  scanned, the first time it is opened. Handles that already carry one of our
+  SimpleFileSystem instances have had their FV2 interface reinstalled, and
+  are invalidated instead. Handles carrying somebody else's are left alone.
+
+  @param  Handle The FV2 handle to mount.
 
 **/
 VOID
-EFIAPI
-FfsNotificationEvent (
-  IN EFI_EVENT Event,
-  IN VOID      *Context
+FfsMountVolume (
+  IN EFI_HANDLE Handle
   )
 {
-  UINTN                           BufferSize;
   EFI_STATUS                      Status;
-  EFI_HANDLE                      HandleBuffer;
   EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *SimpleFileSystem;
   FILE_SYSTEM_PRIVATE_DATA        *Private;
 
-  while (TRUE) {
-    //
-    // Grab the next FV2. If this is there are no more in the buffer, exit the
-    // while loop and return.
-    //
-    BufferSize = sizeof (HandleBuffer);
-    Status = gBS->LocateHandle (
-                    ByRegisterNotify,
-                    &gEfiFirmwareVolume2ProtocolGuid,
-                    mFfsRegistration,
-                    &BufferSize,
-                    &HandleBuffer
-                    );
+  Status = gBS->HandleProtocol (
+                  Handle,
+                  &gEfiSimpleFileSystemProtocolGuid,
+                  (VOID **)&SimpleFileSystem
+                  );
 
-    if (EFI_ERROR (Status)) {
-      break;
+  if (!EFI_ERROR (Status)) {
+    if (SimpleFileSystem->OpenVolume == FfsOpenVolume) {
+      FfsRemountVolume (FILE_SYSTEM_PRIVATE_DATA_FROM_THIS (SimpleFileSystem));
     }
 
-    //
-    // Check to see if SimpleFileSystem is already installed on this handle. If
-    // the protocol is already installed, skip to the next entry.
-    //
-    Status = gBS->HandleProtocol (
-                    HandleBuffer,
-                    &gEfiSimpleFileSystemProtocolGuid,
-                    (VOID **)&SimpleFileSystem
-                    );
+    return;
+  }
 
-    if (!EFI_ERROR (Status)) {
-      continue;
-    }
+  Private = AllocateCopyPool (
+              sizeof (FILE_SYSTEM_PRIVATE_DATA),
+              &mFileSystemPrivateDataTemplate
+              );
 
-    //
-    // Allocate space for the private data structure. If this fails, move on to
-    // the next entry.
-    //
-    Private = AllocateCopyPool (
-                sizeof (FILE_SYSTEM_PRIVATE_DATA),
-                &mFileSystemPrivateDataTemplate
-                );
+  if (Private == NULL) {
+    DEBUG ((EFI_D_ERROR, "FfsMountVolume: Out of resources\n"));
+    return;
+  }
 
-    if (Private == NULL) {
-      continue;
-    }
+  Private->Handle = Handle;
 
-    //
-    // Retrieve the FV2 protocol.
-    //
-    Status = gBS->HandleProtocol (
-                    HandleBuffer,
-                    &gEfiFirmwareVolume2ProtocolGuid,
-                    (VOID **)&Private->FirmwareVolume2
-                    );
+  Status = gBS->InstallMultipleProtocolInterfaces (
+                  &Private->Handle,
+                  &gEfiSimpleFileSystemProtocolGuid,
+                  &Private->SimpleFileSystem,
+                  &gFfsStatisticsProtocolGuid,
+                  &Private->Statistics,
+                  NULL
+                  );
 
-    ASSERT_EFI_ERROR (Status);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "FfsMountVolume: Installing SFS failed with %r\n", Status));
+    FreePool (Private);
+    return;
+  }
 
-    //
-    // Install SimpleFileSystem on the handle.
-    //
-    Status = gBS->InstallMultipleProtocolInterfaces (
-                    &HandleBuffer,
-                    &gEfiSimpleFileSystemProtocolGuid,
-                    &Private->SimpleFileSystem,
-                    NULL
-                    );
+  DEBUG ((EFI_D_INFO, "FfsMountVolume: Installed SFS on FV2!\n"));
+}
+
+/**
+  Callback function, notified when new FV2 volumes are mounted in the system.
+  Every handle registered since the last notification is collected first,
+  FFS_MOUNT_BATCH_SIZE at a time, and the batch is then mounted in one pass.
+
+  @param Event   The EFI_EVENT that triggered this function call.
+  @param Context The context in which this function was called.
 
-    ASSERT_EFI_ERROR (Status);
+  @return Nothing.
 
-    DEBUG ((EFI_D_INFO, "FfsNotificationEvent: Installed SFS on FV2!\n"));
-  }
+**/
+VOID
+EFIAPI
+FfsNotificationEvent (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  )
+{
+  EFI_STATUS Status;
+  EFI_HANDLE Handles[FFS_MOUNT_BATCH_SIZE];
+  UINTN      NumHandles, BufferSize, Index;
+
+  do {
+    //
+    // Collect the newly registered FV2 handles. LocateHandle() hands them
+    // out one at a time for a registration.
+    //
+    for (NumHandles = 0; NumHandles < FFS_MOUNT_BATCH_SIZE; NumHandles++) {
+      BufferSize = sizeof (EFI_HANDLE);
+      Status = gBS->LocateHandle (
+                      ByRegisterNotify,
+                      &gEfiFirmwareVolume2ProtocolGuid,
+                      mFfsRegistration,
+                      &BufferSize,
+                      &Handles[NumHandles]
+                      );
+
+      if (EFI_ERROR (Status)) {
+        break;
+      }
+    }
+
+    DEBUG ((EFI_D_INFO, "FfsNotificationEvent: Mounting %d FV2 handles\n", NumHandles));
+    FFS_PERF_START (FFS_PERF_MOUNT);
+
+    for (Index = 0; Index < NumHandles; Index++) {
+      FfsMountVolume (Handles[Index]);
+    }
+
+    FFS_PERF_END (FFS_PERF_MOUNT);
+  } while (NumHandles == FFS_MOUNT_BATCH_SIZE);
 }
 
 /**
@@ -1586,6 +3702,24 @@ InitializeFfsFileSystem (
   IN EFI_SYSTEM_TABLE *SystemTable
   )
 {
+  EFI_STATUS Status;
+
+  //
+  // Background completion of ReadEx() requests has to be available before
+  // any volume is mounted.
+  //
+  Status = FfsIoInitialize ();
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = FfsTraceInitialize (ImageHandle);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
   EfiCreateProtocolNotifyEvent (
     &gEfiFirmwareVolume2ProtocolGuid,
     TPL_CALLBACK,
@@ -41,17 +41,23 @@ either expressed or implied, of Colin Drake.
 #include <Guid/FileSystemVolumeLabelInfo.h>
 #include <Protocol/SimpleFileSystem.h>
 #include <Protocol/FirmwareVolume2.h>
+#include <Protocol/FirmwareVolumeBlock.h>
+#include <Protocol/FfsStatistics.h>
+#include <Protocol/FfsTrace.h>
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
-#include <Library/PeCoffGetEntryPointLib.h>
 #include <Library/PrintLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiDriverEntryPoint.h>
 #include <Library/UefiLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/PerformanceLib.h>
+#include <Library/TimerLib.h>
 #include <Uefi/UefiBaseType.h>
+#include <IndustryStandard/PeImage.h>
 
 //
 // Miscellaneous helpful macros.
@@ -61,6 +67,8 @@ either expressed or implied, of Colin Drake.
 #define SIZE_OF_FILENAME     (SIZE_OF_GUID + sizeof (CHAR16) * 4)
 #define LENGTH_OF_FILENAME   (40)
 #define SIZE_OF_FV_LABEL     (sizeof (CHAR16) * 15)
+#define SIZE_OF_FILE_INFO    (SIZE_OF_EFI_FILE_INFO + SIZE_OF_FILENAME)
+#define SIZE_OF_FS_INFO      (SIZE_OF_EFI_FILE_SYSTEM_INFO + SIZE_OF_FILENAME)
 
 //
 // Forward-declared typedefs for later data structures.
@@ -69,79 +77,1897 @@ typedef struct _FILE_SYSTEM_PRIVATE_DATA FILE_SYSTEM_PRIVATE_DATA;
 typedef struct _FILE_PRIVATE_DATA        FILE_PRIVATE_DATA;
 typedef struct _DIR_INFO                 DIR_INFO;
 typedef struct _FILE_INFO                FILE_INFO;
+typedef struct _FV_FILE_ENTRY            FV_FILE_ENTRY;
+typedef struct _FFS_CACHE_ENTRY          FFS_CACHE_ENTRY;
+typedef struct _FFS_CACHE_COUNTERS       FFS_CACHE_COUNTERS;
+typedef struct _FFS_HANDLE               FFS_HANDLE;
+typedef struct _FFS_HANDLE_SLAB          FFS_HANDLE_SLAB;
+typedef struct _FV_TYPE_DIRECTORY        FV_TYPE_DIRECTORY;
+typedef struct _FV_DIRECTORY             FV_DIRECTORY;
+typedef struct _FV_SECTION_KIND          FV_SECTION_KIND;
+typedef struct _FV_SECTION_ENTRY         FV_SECTION_ENTRY;
+typedef struct _FFS_IO_REQUEST           FFS_IO_REQUEST;
+typedef struct _FFS_PREFETCH_JOB         FFS_PREFETCH_JOB;
+typedef struct _FFS_METADATA_KEY         FFS_METADATA_KEY;
+typedef struct _FFS_METADATA_HEADER      FFS_METADATA_HEADER;
+typedef struct _FFS_METADATA_RECORD      FFS_METADATA_RECORD;
+
+///
+/// Number of entries a volume's file index grows by each time it fills up.
+///
+#define FV_FILE_INDEX_GROWTH (64)
+
+///
+/// Deepest nesting of encapsulation sections that is searched without FV2.
+///
+#define FV_MAX_SECTION_DEPTH (8)
+
+///
+/// Number of newly registered FV2 handles collected before they are mounted.
+///
+#define FFS_MOUNT_BATCH_SIZE (16)
+
+///
+/// Number of file handles carved out of each handle slab.
+///
+#define FFS_HANDLES_PER_SLAB (32)
+
+///
+/// Distance between the EFI_FILE_INFO records a volume renders for its files,
+/// keeping each record's 64-bit fields aligned.
+///
+#define FV_FILE_INFO_STRIDE (ALIGN_VALUE (SIZE_OF_FILE_INFO, 8))
+
+///
+/// Smallest number of slots in a volume's GUID hash table. Tables are sized to
+/// a power of two at least twice the number of files, so probes stay short.
+///
+#define FV_HASH_MIN_SLOTS (16)
+
+///
+/// Number of virtual per-type directories in the root of every volume.
+///
+#define FV_NUM_TYPE_DIRECTORIES (5)
+
+///
+/// Bit representing a file type in an FV_TYPE_DIRECTORY's TypeMask. Only the
+/// file types below 32 can be placed in a per-type directory.
+///
+#define FV_TYPE_BIT(a) ((UINT32) 1 << (a))
+
+///
+/// Number of entries a file's section list grows by each time it fills up.
+///
+#define FV_SECTION_LIST_GROWTH (8)
+
+///
+/// Number of consecutive reads on a file handle, without seeking, after which
+/// the rest of the file is read ahead in the background.
+///
+#define FFS_READ_AHEAD_TRIGGER (2)
+
+///
+/// Performance measurement tokens, one for each entry point and one for each
+/// phase of the work done inside them, as reported by dp.
+///
+#define FFS_PERF_MOUNT       "FfsMount"
+#define FFS_PERF_OPEN_VOLUME "FfsOpenVolume"
+#define FFS_PERF_OPEN        "FfsOpen"
+#define FFS_PERF_READ        "FfsRead"
+#define FFS_PERF_GET_INFO    "FfsGetInfo"
+#define FFS_PERF_INDEX       "FfsIndex"
+#define FFS_PERF_RESOLVE     "FfsResolve"
+#define FFS_PERF_DECODE      "FfsDecode"
+#define FFS_PERF_COPY        "FfsCopy"
+
+///
+/// Start and end a performance measurement against the driver's image handle.
+/// Both compile away entirely unless PcdFfsPerformance is set.
+///
+#define FFS_PERF_START(Token) \
+  do { \
+    if (FeaturePcdGet (PcdFfsPerformance)) { \
+      PERF_START (gImageHandle, Token, NULL, 0); \
+    } \
+  } while (FALSE)
+
+#define FFS_PERF_END(Token) \
+  do { \
+    if (FeaturePcdGet (PcdFfsPerformance)) { \
+      PERF_END (gImageHandle, Token, NULL, 0); \
+    } \
+  } while (FALSE)
+
+///
+/// Section kind description. Every leaf section whose type has one of these is
+/// exposed as a file in its FFS file's section directory.
+///
+struct _FV_SECTION_KIND {
+  EFI_SECTION_TYPE Type;  ///< The section type.
+  CHAR16           *Name; ///< Name that section files of the type start with.
+};
+
+///
+/// Section entry datatype. A file's sections are listed the first time its
+/// section directory is opened, and are kept for the life of the mount.
+///
+struct _FV_SECTION_ENTRY {
+  EFI_SECTION_TYPE Type;         ///< The section type.
+  UINTN            Instance;     ///< Instance of the type that ReadSection knows the section as.
+  UINTN            Size;         ///< Size of the section's contents, as ReadSection returns them.
+
+  BOOLEAN          HasDirect;    ///< Determines if the contents can be read without FV2.
+  UINTN            DirectOffset; ///< Offset of the contents from the start of the FV.
+
+  EFI_FILE_INFO    *Info;        ///< Rendered EFI_FILE_INFO for the section.
+};
+
+///
+/// File index entry datatype. Each mounted volume keeps one of these for every
+/// file in its FV2 instance, in GetNextFile order, so that metadata questions
+/// can be answered without walking the firmware volume again.
+///
+struct _FV_FILE_ENTRY {
+  EFI_GUID               NameGuid;     ///< The EFI_GUID that names the file in its FV2 instance.
+  EFI_FV_FILETYPE        FileType;     ///< The file type reported by GetNextFile.
+  BOOLEAN                IsExecutable; ///< Determines if the file has an executable section or not.
+  BOOLEAN                Guessed;      ///< Determines if IsExecutable was guessed from the file type, and is yet to be confirmed.
+  EFI_FV_FILE_ATTRIBUTES Attributes;   ///< The file attributes reported by GetNextFile.
+  UINTN                  Size;         ///< The file size reported by GetNextFile.
+
+  BOOLEAN                SizeKnown;    ///< Determines if ContentSize has been worked out yet.
+  UINTN                  ContentSize;  ///< Size of the file as exposed by the filesystem.
+
+  BOOLEAN                HasData;      ///< Determines if the file's FFS payload was found in the FV.
+  UINTN                  DataOffset;   ///< Offset of the file's FFS payload from the start of the FV.
+
+  BOOLEAN                HasDirect;    ///< Determines if the file's contents can be read without FV2.
+  UINTN                  DirectOffset; ///< Offset of the file's contents from the start of the FV.
+  UINTN                  DirectSize;   ///< Size of the file's contents in the FV.
+
+  EFI_FILE_INFO          *Info;        ///< Rendered EFI_FILE_INFO for the file, or NULL until first needed.
+  EFI_FILE_INFO          *DirInfo;     ///< Rendered EFI_FILE_INFO for the file's section directory, or NULL.
+  EFI_FILE_INFO          *VolumeInfo;  ///< Rendered EFI_FILE_INFO for the file's nested volume directory, or NULL.
+
+  FV_SECTION_ENTRY       *Sections;    ///< The file's sections, or NULL until they are first listed.
+  UINTN                  NumSections;  ///< Number of entries in Sections.
+
+  CHAR16                 *UiName;      ///< The file's UI section name in the name index, or NULL.
+};
+
+///
+/// Virtual per-type directory description. The root of every volume lists one
+/// directory for each of these, holding the files whose type is in TypeMask.
+///
+struct _FV_TYPE_DIRECTORY {
+  CHAR16 *Name;    ///< Name of the directory in the root.
+  UINT32 TypeMask; ///< FV_TYPE_BIT of each file type the directory holds.
+};
+
+///
+/// Virtual per-type directory datatype. Each mounted volume partitions its
+/// file index into one of these for every FV_TYPE_DIRECTORY, so that listing
+/// a directory only touches its own members.
+///
+struct _FV_DIRECTORY {
+  CONST FV_TYPE_DIRECTORY *Type;      ///< Description of the directory.
+  FV_FILE_ENTRY           **Members;  ///< Index entries of the files in the directory.
+  UINTN                   NumMembers; ///< Number of entries in Members.
+  EFI_FILE_INFO           *Info;      ///< Rendered EFI_FILE_INFO for the directory.
+};
 
 ///
 /// Signature to identify FILE_SYSTEM_PRIVATE_DATA instances.
 ///
 #define FILE_SYSTEM_PRIVATE_DATA_SIGNATURE (SIGNATURE_32 ('f', 'f', 's', 't'))
 
-///
-/// Private data structure for filesystem instances. For each mounted
-/// EFI_SIMPLE_FILE_SYSTEM_PROTOCOL instance in the filesystem, there will be
-/// one corresponding FILE_SYSTEM_PRIVATE_DATA instance to hold associated data.
-///
-struct _FILE_SYSTEM_PRIVATE_DATA {
-  UINT32                          Signature;        ///< Datatype signature.
+///
+/// Private data structure for filesystem instances. For each mounted
+/// EFI_SIMPLE_FILE_SYSTEM_PROTOCOL instance in the filesystem, there will be
+/// one corresponding FILE_SYSTEM_PRIVATE_DATA instance to hold associated data.
+///
+struct _FILE_SYSTEM_PRIVATE_DATA {
+  UINT32                             Signature;        ///< Datatype signature.
+
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL    SimpleFileSystem; ///< Holds the SFS interface.
+  FFS_STATISTICS_PROTOCOL            Statistics;       ///< Holds the statistics interface.
+  EFI_FIRMWARE_VOLUME2_PROTOCOL      *FirmwareVolume2; ///< Pointer to the filesystem's FV2 instance.
+  EFI_HANDLE                         Handle;           ///< Handle the FV2 and SFS instances are installed on.
+  UINTN                              Generation;       ///< Moves each time the FV2 interface is reinstalled.
+
+  BOOLEAN                            IndexValid;       ///< Determines if the file index has been built.
+  UINTN                              NumFiles;         ///< Number of entries in the file index.
+  UINTN                              VolumeSize;       ///< Sum of the sizes of all files in the index.
+  FV_FILE_ENTRY                      *Files;           ///< File index for the volume, in GetNextFile order.
+  UINT8                              *InfoRecords;     ///< Storage for the rendered EFI_FILE_INFO of every file and directory.
+  EFI_FILE_INFO                      *RootInfo;        ///< Rendered EFI_FILE_INFO for the root directory.
+  EFI_FILE_SYSTEM_INFO               *FsInfo;          ///< Rendered EFI_FILE_SYSTEM_INFO for the volume.
+  FV_FILE_ENTRY                      **HashTable;      ///< Open-addressed table of index entries, keyed by GUID.
+  UINTN                              HashMask;         ///< Number of slots in HashTable, less one.
+  FV_FILE_ENTRY                      **DirMembers;     ///< Storage for the Members of every per-type directory.
+  FV_DIRECTORY                       Directories[FV_NUM_TYPE_DIRECTORIES]; ///< Virtual per-type directories in the root.
+
+  BOOLEAN                            NameIndexValid;   ///< Determines if the UI name index has been built.
+  CHAR16                             *NameArena;       ///< Storage for every interned UI section name.
+  FV_FILE_ENTRY                      **NameTable;      ///< Open-addressed table of index entries, keyed by UI name.
+  UINTN                              NameMask;         ///< Number of slots in NameTable, less one.
+  BOOLEAN                            NamesPending;     ///< Determines if the volume's metadata was saved before its UI names were known.
+
+  EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL *Fvb;             ///< FVB instance for direct access, or NULL if there is none.
+  UINT8                              *MappedBase;      ///< Base of the memory-mapped FV, or NULL if it isn't mapped.
+  UINTN                              FvLength;         ///< Length of the FV in bytes, when it has direct access.
+  UINTN                              BlockSize;        ///< Size of each FVB block, when the FV isn't mapped.
+  BOOLEAN                            ErasePolarity;    ///< Determines if erased bits read as 1, when the FV has direct access.
+
+  FILE_SYSTEM_PRIVATE_DATA           *Parent;          ///< Volume whose file holds this nested volume, or NULL for a top-level volume.
+  EFI_GUID                           ParentFile;       ///< The EFI_GUID that names the file holding this nested volume in Parent.
+  FILE_SYSTEM_PRIVATE_DATA           *NestedVolumes;   ///< Nested volumes mounted from this volume's files.
+  FILE_SYSTEM_PRIVATE_DATA           *NextNested;      ///< Next nested volume mounted from Parent.
+  VOID                               *Image;           ///< In-memory image of a nested volume, or NULL while it isn't mounted.
+  EFI_FIRMWARE_VOLUME2_PROTOCOL      NestedFv2;        ///< FV2 interface over Image, for nested volumes.
+
+  FFS_HANDLE_SLAB                    *Slabs;           ///< Slabs that the volume's file handles are carved from.
+  FFS_HANDLE                         *FreeHandles;     ///< Free list of handles ready for reuse.
+  UINTN                              OpenHandles;      ///< Number of handles currently open on the volume.
+
+  FFS_VOLUME_STATISTICS              Counters;         ///< Work done for the volume and its nested volumes, if it is top-level.
+};
+
+///
+/// Macro to grab the FILE_SYSTEM_PRIVATE_DATA instance associated with a given
+/// pointer to an EFI_SIMPLE_FILE_SYSTEM_PROTOCOL.
+///
+#define FILE_SYSTEM_PRIVATE_DATA_FROM_THIS(a) CR (a, FILE_SYSTEM_PRIVATE_DATA, SimpleFileSystem, FILE_SYSTEM_PRIVATE_DATA_SIGNATURE)
+
+///
+/// Macro to grab the FILE_SYSTEM_PRIVATE_DATA instance associated with a given
+/// pointer to an FFS_STATISTICS_PROTOCOL.
+///
+#define FILE_SYSTEM_PRIVATE_DATA_FROM_STATISTICS(a) CR (a, FILE_SYSTEM_PRIVATE_DATA, Statistics, FILE_SYSTEM_PRIVATE_DATA_SIGNATURE)
+
+///
+/// Macro to grab the FILE_SYSTEM_PRIVATE_DATA instance of a nested volume
+/// associated with a given pointer to its EFI_FIRMWARE_VOLUME2_PROTOCOL.
+///
+#define FILE_SYSTEM_PRIVATE_DATA_FROM_FV2(a) CR (a, FILE_SYSTEM_PRIVATE_DATA, NestedFv2, FILE_SYSTEM_PRIVATE_DATA_SIGNATURE)
+
+///
+/// Signature to identify FILE_PRIVATE_DATA instances.
+///
+#define FILE_PRIVATE_DATA_SIGNATURE (SIGNATURE_32 ('f', 'f', 's', 'f'))
+
+///
+/// Private data structure for file instances. For each EFI_FILE_PROTOCOL instance
+/// created in the filesystem, there will be one corresponding FILE_PRIVATE_DATA
+/// instance to hold associated data.
+///
+struct _FILE_PRIVATE_DATA {
+  UINT32                   Signature;   ///< Datatype signature.
+
+  EFI_FILE_PROTOCOL        File;        ///< Holds the EFI_FILE_PROTOCOL interface.
+  FILE_SYSTEM_PRIVATE_DATA *FileSystem; ///< Pointer to the file's filesystem instance.
+  UINTN                    Generation;  ///< Filesystem generation the handle was opened in.
+
+  CHAR16                   *FileName;   ///< String name used to reference the file.
+
+  BOOLEAN                  IsDirectory; ///< Determines if the file is a directory or not.
+  DIR_INFO                 *DirInfo;    ///< Associated information for directories.
+  FILE_INFO                *FileInfo;   ///< Associated information for files.
+
+  UINT64                   Position;    ///< Number of bytes to offset calls to Read() by.
+  UINTN                    PendingIo;   ///< Number of ReadEx() requests still queued on the handle.
+};
+
+///
+/// Macro to grab the FILE_PRIVATE_DATA instance associated with a given
+/// pointer to an EFI_FILE_PROTOCOL.
+///
+#define FILE_PRIVATE_DATA_FROM_THIS(a) CR (a, FILE_PRIVATE_DATA, File, FILE_PRIVATE_DATA_SIGNATURE)
+
+///
+/// Directory information datatype. This data structure has members that give
+/// more specific information about FILE_PRIVATE_DATA instances that are
+/// directories rather than files.
+///
+struct _DIR_INFO {
+  FV_DIRECTORY  *Directory; ///< Virtual directory the handle refers to, or NULL for the root.
+  FV_FILE_ENTRY *File;      ///< File whose sections the handle lists, or NULL.
+  UINTN         Cursor;     ///< Index of the next entry to return when listing.
+  UINTN         Prefetched; ///< Number of files from the start of the listing queued for prefetch.
+};
+
+///
+/// File information datatype. This data structure has members that give more
+/// specific information about FILE_PRIVATE_DATA instances that are files rather
+/// than directories.
+///
+struct _FILE_INFO {
+  BOOLEAN          IsExecutable;    ///< Determines if the file has an executable section or not.
+  EFI_GUID         NameGuid;        ///< The EFI_GUID that represents the file in it's FV2 instance.
+  FV_FILE_ENTRY    *Entry;          ///< The file's entry in its volume's file index.
+  FV_SECTION_ENTRY *Section;        ///< The section the handle exposes, or NULL for the whole file.
+
+  FFS_CACHE_ENTRY  *Cached;         ///< Referenced cache entry holding the decoded contents, or NULL.
+  VOID             *Contents;       ///< Decoded file contents, loaded on first read and kept until close.
+  UINTN            ContentsSize;    ///< Size of the buffer in Contents, in bytes.
+
+  UINTN            SequentialReads; ///< Number of reads since the handle was opened or last seeked.
+  BOOLEAN          ReadAheadReady;  ///< Determines if a read-ahead of the contents has completed.
+};
+
+///
+/// File handle datatype. Every FILE_PRIVATE_DATA instance lives in one of
+/// these, together with the directory or file information and the file name it
+/// points to, so that opening a file takes a single fixed-size object from its
+/// filesystem's handle slabs.
+///
+struct _FFS_HANDLE {
+  FFS_HANDLE        *NextFree;                        ///< Next handle in the free list, while unused.
+  FILE_PRIVATE_DATA Private;                          ///< The handle's private data.
+  DIR_INFO          DirInfo;                          ///< Storage for Private.DirInfo.
+  FILE_INFO         FileInfo;                         ///< Storage for Private.FileInfo.
+  CHAR16            FileName[LENGTH_OF_FILENAME + 1]; ///< Storage for Private.FileName.
+};
+
+///
+/// Macro to grab the FFS_HANDLE instance holding a FILE_PRIVATE_DATA.
+///
+#define FFS_HANDLE_FROM_PRIVATE(a) BASE_CR (a, FFS_HANDLE, Private)
+
+///
+/// File handle slab datatype. Slabs are allocated as a volume's open handles
+/// outgrow its free list, and are only freed when the volume is torn down.
+///
+struct _FFS_HANDLE_SLAB {
+  FFS_HANDLE_SLAB *Next;                         ///< Next slab allocated for the volume.
+  FFS_HANDLE      Handles[FFS_HANDLES_PER_SLAB]; ///< The handles carved from this slab.
+};
+
+///
+/// Signature to identify FFS_CACHE_ENTRY instances.
+///
+#define FFS_CACHE_ENTRY_SIGNATURE (SIGNATURE_32 ('f', 'f', 's', 'c'))
+
+///
+/// Decoded content cache entry datatype. Decoded file contents are shared by
+/// every handle open on the same file of the same volume, and stay cached
+/// after the last handle closes until the cache's budget forces them out.
+///
+struct _FFS_CACHE_ENTRY {
+  UINT32                   Signature;    ///< Datatype signature.
+  LIST_ENTRY               Link;         ///< Link in the cache's LRU list.
+
+  FILE_SYSTEM_PRIVATE_DATA *FileSystem;  ///< The filesystem the file is a part of, or NULL once stale.
+  EFI_GUID                 NameGuid;     ///< The EFI_GUID that names the file in its FV2 instance.
+  EFI_SECTION_TYPE         SectionType;  ///< Type of the section held, or EFI_SECTION_ALL for the whole file.
+  UINTN                    Instance;     ///< Instance of the section held.
+  UINTN                    RefCount;     ///< Number of handles using the contents.
+  BOOLEAN                  Prefetched;   ///< Determines if the contents were decoded ahead of use and not yet used.
+
+  VOID                     *Contents;    ///< Decoded file contents.
+  UINTN                    ContentsSize; ///< Size of the buffer in Contents, in bytes.
+};
+
+///
+/// Macro to grab the FFS_CACHE_ENTRY instance associated with a link in the
+/// cache's LRU list.
+///
+#define FFS_CACHE_ENTRY_FROM_LINK(a) CR (a, FFS_CACHE_ENTRY, Link, FFS_CACHE_ENTRY_SIGNATURE)
+
+///
+/// Decoded content cache counters.
+///
+struct _FFS_CACHE_COUNTERS {
+  UINT64 Hits;            ///< Number of loads served from the cache.
+  UINT64 Misses;          ///< Number of loads that had to decode the file.
+  UINT64 Evictions;       ///< Number of entries freed to stay within the budget.
+  UINTN  NumEntries;      ///< Number of entries currently cached.
+  UINTN  BytesCached;     ///< Number of content bytes currently cached.
+
+  UINT64 Prefetches;      ///< Number of contents decoded ahead of use by the prefetcher.
+  UINT64 PrefetchHits;    ///< Number of prefetched contents that were later read.
+  UINT64 PrefetchWasted;  ///< Number of prefetched contents dropped without being read.
+  UINTN  BytesPrefetched; ///< Number of content bytes prefetched and not yet read.
+};
+
+///
+/// Signature to identify FFS_IO_REQUEST instances.
+///
+#define FFS_IO_REQUEST_SIGNATURE (SIGNATURE_32 ('f', 'f', 's', 'q'))
+
+///
+/// Queued asynchronous read datatype. A ReadEx() request that has to decode
+/// its file waits in the driver's queue as one of these until the background
+/// worker completes it.
+///
+struct _FFS_IO_REQUEST {
+  UINT32            Signature;    ///< Datatype signature.
+  LIST_ENTRY        Link;         ///< Link in the queue of pending requests.
+  FILE_PRIVATE_DATA *PrivateFile; ///< Handle the read was issued on.
+  EFI_FILE_IO_TOKEN *Token;       ///< Caller's token, completed and signalled when done.
+};
+
+///
+/// Macro to grab the FFS_IO_REQUEST instance associated with a link in the
+/// queue of pending requests.
+///
+#define FFS_IO_REQUEST_FROM_LINK(a) CR (a, FFS_IO_REQUEST, Link, FFS_IO_REQUEST_SIGNATURE)
+
+///
+/// Signature to identify FFS_PREFETCH_JOB instances.
+///
+#define FFS_PREFETCH_JOB_SIGNATURE (SIGNATURE_32 ('f', 'f', 's', 'p'))
+
+///
+/// Prefetch job datatype. Each one asks the background worker to decode the
+/// contents of a file, or of one of its sections, into the content cache
+/// before they are read. Jobs outlive neither their volume's generation nor,
+/// for read-ahead, the handle that asked for them.
+///
+struct _FFS_PREFETCH_JOB {
+  UINT32                   Signature;   ///< Datatype signature.
+  LIST_ENTRY               Link;        ///< Link in the queue of pending jobs.
+
+  FILE_SYSTEM_PRIVATE_DATA *FileSystem; ///< The filesystem the file is a part of.
+  UINTN                    Generation;  ///< Filesystem generation the job was queued in.
+  FV_FILE_ENTRY            *Entry;      ///< The file to prefetch.
+  FV_SECTION_ENTRY         *Section;    ///< The section to prefetch, or NULL for the whole file.
+  FILE_PRIVATE_DATA        *Owner;      ///< Handle reading ahead, or NULL for a directory walk.
+};
+
+///
+/// Macro to grab the FFS_PREFETCH_JOB instance associated with a link in the
+/// queue of pending jobs.
+///
+#define FFS_PREFETCH_JOB_FROM_LINK(a) CR (a, FFS_PREFETCH_JOB, Link, FFS_PREFETCH_JOB_SIGNATURE)
+
+///
+/// Signature and layout version of saved volume metadata.
+///
+#define FFS_METADATA_SIGNATURE (SIGNATURE_32 ('f', 'f', 's', 'm'))
+#define FFS_METADATA_VERSION   (4)
+
+///
+/// Length of the name of a variable holding saved volume metadata, including
+/// its terminator.
+///
+#define FFS_METADATA_NAME_LENGTH (25)
+
+///
+/// Flags kept for each file in saved volume metadata.
+///
+#define FFS_METADATA_EXECUTABLE BIT0
+#define FFS_METADATA_HAS_DATA   BIT1
+#define FFS_METADATA_HAS_DIRECT BIT2
+#define FFS_METADATA_SIZE_KNOWN BIT3
+#define FFS_METADATA_GUESSED    BIT4
+
+///
+/// Flags kept for the volume as a whole in saved volume metadata.
+///
+#define FFS_METADATA_HAS_NAMES  BIT0
+
+#pragma pack(1)
+
+///
+/// Key that saved volume metadata is checked against. Metadata is only reused
+/// for a volume with the same header and the same files in the same places.
+///
+struct _FFS_METADATA_KEY {
+  EFI_FIRMWARE_VOLUME_HEADER Header;      ///< The volume's header, up to its first block map entry.
+  UINT64                     ContentHash; ///< 64-bit FNV-1a hash of the offsets and FFS headers of the volume's files.
+};
+
+///
+/// Saved volume metadata header. It is followed by one FFS_METADATA_RECORD
+/// for every file, in GetNextFile order, and then by the files' UI names.
+///
+struct _FFS_METADATA_HEADER {
+  UINT32           Signature; ///< FFS_METADATA_SIGNATURE.
+  UINT32           Version;   ///< FFS_METADATA_VERSION.
+  FFS_METADATA_KEY Key;       ///< Key of the volume the metadata was saved for.
+  UINT32           NumFiles;  ///< Number of records that follow.
+  UINT32           NamesSize; ///< Number of bytes of UI names after the records.
+  UINT32           Flags;     ///< FFS_METADATA_HAS_NAMES if the UI names were saved.
+};
+
+///
+/// Saved metadata for a single file. Offsets and sizes are saved as 32-bit
+/// values; volumes that don't fit are never saved.
+///
+struct _FFS_METADATA_RECORD {
+  EFI_GUID NameGuid;     ///< The EFI_GUID that names the file in its FV2 instance.
+  UINT32   Size;         ///< The file size reported by GetNextFile.
+  UINT32   Attributes;   ///< The file attributes reported by GetNextFile.
+  UINT32   DataOffset;   ///< Offset of the file's FFS payload from the start of the FV.
+  UINT32   DirectOffset; ///< Offset of the file's contents from the start of the FV.
+  UINT32   DirectSize;   ///< Size of the file's contents in the FV.
+  UINT32   ContentSize;  ///< Size of the file as exposed by the filesystem.
+  UINT8    FileType;     ///< The file type reported by GetNextFile.
+  UINT8    Flags;        ///< FFS_METADATA_* flags.
+  UINT16   NameLength;   ///< Number of characters in the file's terminated UI name, or 0.
+};
+
+#pragma pack()
+
+//
+// Direct access to firmware volumes
+//
+
+/**
+  Locates direct access to a filesystem's firmware volume through the firmware
+  volume block protocol on the same handle. Memory-mapped volumes are read with
+  a plain copy out of the mapping; other volumes are read through FVB Read(),
+  provided their blocks are all the same size. Nested volumes are read out of
+  their in-memory image.
+
+  @param  Fs Private data for the filesystem to locate direct access for.
+
+  @retval EFI_SUCCESS     The volume can be read directly.
+  @retval EFI_UNSUPPORTED The volume has no usable FVB instance, or it does not
+                          hold a valid firmware volume header.
+
+**/
+EFI_STATUS
+FvLocateDirectAccess (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+;
+
+/**
+  Reads a range of bytes from a firmware volume, either by copying from its
+  memory mapping or through FVB Read(). Only the requested bytes are touched.
+
+  @param  Fs     Private data for a filesystem with direct access.
+  @param  Offset Offset of the first byte to read, from the start of the volume.
+  @param  Size   Number of bytes to read.
+  @param  Buffer The buffer to read into.
+
+  @retval EFI_SUCCESS           The bytes were read.
+  @retval EFI_INVALID_PARAMETER The range falls outside the volume.
+  @retval EFI_DEVICE_ERROR      The FVB instance failed to read the range.
+
+**/
+EFI_STATUS
+FvReadBytes (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  UINTN                    Offset,
+  IN  UINTN                    Size,
+  OUT VOID                     *Buffer
+  )
+;
+
+/**
+  Finds the next file in a firmware volume with direct access, the same way
+  GetNextFile does: pad files, and files whose data is not valid, are skipped.
+  Only file headers are read.
+
+  @param  Fs         Private data for a filesystem with direct access.
+  @param  Offset     On input, the offset to start looking at, or 0 to start
+                     at the first file. On output, the offset following the
+                     file that was found.
+  @param  FileHeader On output, the file's header.
+  @param  DataOffset On output, the offset of the file's FFS payload within
+                     the volume.
+  @param  DataSize   On output, the size of the file's FFS payload in bytes.
+
+  @retval EFI_SUCCESS          A file was found.
+  @retval EFI_NOT_FOUND        There are no more files in the volume.
+  @retval EFI_VOLUME_CORRUPTED A file does not fit in the volume.
+
+**/
+EFI_STATUS
+FvNextFile (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN OUT UINTN                    *Offset,
+  OUT    EFI_FFS_FILE_HEADER2     *FileHeader,
+  OUT    UINTN                    *DataOffset,
+  OUT    UINTN                    *DataSize
+  )
+;
+
+/**
+  Walks the FFS files of a firmware volume with direct access and records, in
+  each matching file index entry, where the file's FFS payload starts within
+  the volume. Only file headers are read.
+
+  @param  Fs Private data for a filesystem with direct access and an index.
+
+**/
+VOID
+FvIndexFileData (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+;
+
+/**
+  Finds the first section of a given type in a section stream, provided that
+  it is stored in the volume as-is. This is the same section that ReadSection
+  returns for instance 0 of the type. Only section headers are read:
+  compression sections of type EFI_NOT_COMPRESSED and GUID-defined sections
+  that do not require processing are searched in place, but any other
+  encapsulation ends the search, since the section could be hidden inside it.
+
+  @param  Fs          Private data for a filesystem with direct access.
+  @param  DataOffset  Offset of the section stream within the volume.
+  @param  DataSize    Size of the section stream in bytes.
+  @param  Depth       Number of encapsulation sections enclosing the stream.
+  @param  SectionType The type of section to find.
+  @param  Offset      On output, the offset of the section's contents within
+                      the volume.
+  @param  Size        On output, the size of the section's contents in bytes.
+
+  @retval EFI_SUCCESS     The section is stored directly in the volume.
+  @retval EFI_NOT_FOUND   The stream holds no section of the type.
+  @retval EFI_UNSUPPORTED The section may be inside an encoded encapsulation.
+
+**/
+EFI_STATUS
+FvFindDirectSection (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  UINTN                    DataOffset,
+  IN  UINTN                    DataSize,
+  IN  UINTN                    Depth,
+  IN  EFI_SECTION_TYPE         SectionType,
+  OUT UINTN                    *Offset,
+  OUT UINTN                    *Size
+  )
+;
+
+/**
+  Lists the leaf sections of a section stream that is stored in the volume
+  as-is, in the order that ReadSection numbers their instances. Encapsulation
+  sections are searched in place the same way FvFindDirectSection() does; any
+  other encapsulation ends the walk, since sections could be hidden inside it.
+  Only section headers are read.
+
+  @param  Fs          Private data for a filesystem with direct access.
+  @param  DataOffset  Offset of the section stream within the volume.
+  @param  DataSize    Size of the section stream in bytes.
+  @param  Depth       Number of encapsulation sections enclosing the stream.
+  @param  Sections    On input, the sections found so far. On output, the
+                      sections with those in the stream appended. The array is
+                      reallocated as it grows.
+  @param  NumSections On input and output, the number of entries in Sections.
+  @param  Capacity    On input and output, the capacity of Sections.
+
+  @retval EFI_SUCCESS          Every section of the stream was listed.
+  @retval EFI_UNSUPPORTED      Some sections may be inside an encoded encapsulation.
+  @retval EFI_OUT_OF_RESOURCES Sections could not be grown.
+
+**/
+EFI_STATUS
+FvFindDirectSections (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     UINTN                    DataOffset,
+  IN     UINTN                    DataSize,
+  IN     UINTN                    Depth,
+  IN OUT FV_SECTION_ENTRY         **Sections,
+  IN OUT UINTN                    *NumSections,
+  IN OUT UINTN                    *Capacity
+  )
+;
+
+/**
+  Gets the machine type of a PE32 or TE image stored in a firmware volume, the
+  same way PeCoffLoaderGetMachineType() does, but reading only the DOS header
+  and the first bytes of the PE or TE header rather than the whole image.
+
+  @param  Fs          Private data for a filesystem with direct access.
+  @param  ImageOffset Offset of the image within the volume.
+  @param  ImageSize   Size of the image in bytes.
+  @param  Machine     On output, the machine type of the image.
+
+  @retval EFI_SUCCESS     The machine type was returned.
+  @retval EFI_UNSUPPORTED The image has no recognizable PE or TE header.
+
+**/
+EFI_STATUS
+FvGetImageMachine (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  UINTN                    ImageOffset,
+  IN  UINTN                    ImageSize,
+  OUT UINT16                   *Machine
+  )
+;
+
+/**
+  Reads a range of a file's contents straight from its firmware volume. Only
+  the bytes in [Position, Position + *BufferSize) are read, so probing the
+  header of a large file does not pull in the rest of it.
+
+  @param  Fs         Private data for a filesystem with direct access.
+  @param  Offset     Offset of the file's contents within the volume.
+  @param  Size       Size of the file's contents in bytes.
+  @param  Position   Offset into the file's contents to start reading from.
+  @param  BufferSize On input, the size of Buffer. On output, the number of
+                     bytes read, which is capped at the end of the file.
+  @param  Buffer     The buffer to read into.
+
+  @retval EFI_SUCCESS      The range was read.
+  @retval EFI_DEVICE_ERROR Position is beyond the end of the file, or the
+                           volume could not be read.
+
+**/
+EFI_STATUS
+FileReadRange (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     UINTN                    Offset,
+  IN     UINTN                    Size,
+  IN     UINT64                   Position,
+  IN OUT UINTN                    *BufferSize,
+  OUT    VOID                     *Buffer
+  )
+;
+
+//
+// File index lookup
+//
+
+/**
+  Builds the file index for a filesystem instance. The index holds the GUID,
+  type, attributes, size and executable flag of every file in the volume, and
+  is built with a single pass over GetNextFile the first time it is needed.
+
+  @param  Fs Private data for the filesystem to index.
+
+  @retval EFI_SUCCESS          The index was built, or was already valid.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to build the index.
+
+**/
+EFI_STATUS
+FvBuildFileIndex (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+;
+
+/**
+  Releases a volume's file index and everything derived from it, so that it
+  is rebuilt from the FV2 instance the next time the volume is opened.
+
+  @param  Fs Private data for the filesystem whose index is to be released.
+
+**/
+VOID
+FvFreeFileIndex (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+;
+
+/**
+  Gets the file index entry for a file named by GUID, by probing the volume's
+  GUID hash table.
+
+  @param  Fs       Private data for the filesystem to search.
+  @param  NameGuid The GUID naming the file in its FV2 instance.
+
+  @retval an entry The file was found, and its index entry was returned.
+  @retval NULL     The file was not found.
+
+**/
+FV_FILE_ENTRY *
+FvGetFile (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN EFI_GUID                 *NameGuid
+  )
+;
+
+/**
+  Confirms or overturns the guess that a file is executable, once its PE32
+  section has been decoded for the first time. A file without a PE32 section,
+  or whose image is for another machine, is exposed as a .ffs file holding its
+  raw FFS payload from then on. Nothing is changed when the file's class was
+  not guessed, or when decoding failed for some other reason.
+
+  @param  Fs        Private data for the filesystem the file is a part of.
+  @param  Entry     Index entry for the file.
+  @param  Status    Status of decoding the file's first PE32 section.
+  @param  Image     The decoded PE32 section, if Status is EFI_SUCCESS.
+  @param  ImageSize Size of Image in bytes.
+
+  @retval TRUE  The file is executable.
+  @retval FALSE The file is not executable.
+
+**/
+BOOLEAN
+FvConfirmExecutable (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN OUT FV_FILE_ENTRY            *Entry,
+  IN     EFI_STATUS               Status,
+  IN     VOID                     *Image,
+  IN     UINTN                    ImageSize
+  )
+;
+
+/**
+  Gets the size of the file described by a file index entry, as it is exposed
+  through the filesystem. Sizes are taken from metadata: the size reported by
+  GetNextFile, or the PE32 section header found while indexing. The PE32
+  section is only extracted when it is hidden inside an encoded encapsulation,
+  and the result is remembered for the life of the mount.
+
+  @param  Fs    Private data for the filesystem the file is a part of.
+  @param  Entry Index entry for the file that the system is trying to access.
+
+  @retval The size of the file in bytes.
+
+**/
+UINTN
+FvFileGetSize (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN FV_FILE_ENTRY            *Entry
+  )
+;
+
+/**
+  Gets the EFI_FILE_INFO for a file in the index, rendering it into the
+  volume's info records the first time the file is described. Rendering may
+  have to decode the file if its size is not known yet.
+
+  @param  Fs    The filesystem the file is a part of.
+  @param  Entry Index entry for the file to describe.
+
+  @retval The file's EFI_FILE_INFO, SIZE_OF_FILE_INFO bytes long.
+
+**/
+EFI_FILE_INFO *
+FvEntryGetFileInfo (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN OUT FV_FILE_ENTRY            *Entry
+  )
+;
+
+//
+// UI name index
+//
+
+/**
+  Finds a file by the name in its UI section. The volume's name index is
+  built the first time a name is looked up, after which every lookup is a
+  single hash probe. Names are matched without regard to ASCII case.
+
+  @param  Fs         Private data for the filesystem to search.
+  @param  Name       The name to look up. It does not need to be terminated.
+  @param  NameLength Number of characters in Name.
+
+  @retval an entry A file has that UI name, and its index entry was returned.
+  @retval NULL     No file has that UI name, or the index could not be built.
+
+**/
+FV_FILE_ENTRY *
+FvFindFileByName (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN CHAR16                   *Name,
+  IN UINTN                    NameLength
+  )
+;
+
+/**
+  Releases a volume's UI name index, so that it is rebuilt the next time a
+  name is looked up.
+
+  @param  Fs Private data for the filesystem whose name index is released.
+
+**/
+VOID
+FvFreeNameIndex (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+;
+
+/**
+  Builds the UI name index for a filesystem instance. Every file's UI name is
+  harvested once, and the names are then interned and hashed by
+  FvInternNames().
+
+  @param  Fs Private data for a filesystem with a file index.
+
+  @retval EFI_SUCCESS          The index was built.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to build the index.
+
+**/
+EFI_STATUS
+FvBuildNameIndex (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+;
+
+/**
+  Builds the UI name index for a filesystem instance from names that have
+  already been harvested. The names are interned into a single arena and the
+  files are hashed by name so that later lookups are a probe. Files are
+  inserted in index order, so the first of any files sharing a name is the one
+  that is found. The harvested names, and the array holding them, are freed
+  whether or not the index could be built.
+
+  @param  Fs    Private data for a filesystem with a file index.
+  @param  Names Pool array holding a terminated pool copy of every file's UI
+                name, in index order, or NULL for files without one.
+
+  @retval EFI_SUCCESS          The index was built.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to build the index.
+
+**/
+EFI_STATUS
+FvInternNames (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     CHAR16                   **Names
+  )
+;
+
+/**
+  Frees an array of harvested UI names that won't be interned.
+
+  @param  Names    Pool array of terminated pool names, some of which may be NULL.
+  @param  NumNames Number of entries in Names.
+
+**/
+VOID
+FvFreeNames (
+  IN CHAR16 **Names,
+  IN UINTN  NumNames
+  )
+;
+
+//
+// Persistent metadata
+//
+
+/**
+  Works out the key a volume's saved metadata is stored and checked under:
+  the volume's header together with a hash of its entire contents. The name
+  of the variable holding the metadata is derived from the header alone, so
+  that reflashing a volume replaces its metadata rather than adding to it.
+  Only memory-mapped volumes have a key: hashing any other volume would read
+  all of it through FVB, which costs more than the GetNextFile walk that the
+  metadata saves.
+
+  @param  Fs           Private data for a top-level filesystem with direct access.
+  @param  Key          On output, the volume's key.
+  @param  VariableName On output, the name of the variable holding the metadata,
+                       FFS_METADATA_NAME_LENGTH characters long.
+
+  @retval EFI_SUCCESS      The key was worked out.
+  @retval EFI_UNSUPPORTED  The volume isn't memory-mapped.
+  @retval EFI_DEVICE_ERROR The volume could not be read.
+
+**/
+EFI_STATUS
+FvGetMetadataKey (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  OUT FFS_METADATA_KEY         *Key,
+  OUT CHAR16                   *VariableName
+  )
+;
+
+/**
+  Loads a volume's file index from the metadata saved on an earlier boot. The
+  metadata is only used if it was saved under the same key, and every record
+  in it is consistent with the volume.
+
+  @param  Fs           Private data for the filesystem to index.
+  @param  Key          The volume's key.
+  @param  VariableName The name of the variable holding the metadata.
+  @param  Files        On output, the file index, in GetNextFile order.
+  @param  NumFiles     On output, the number of entries in Files.
+  @param  Names        On output, the UI names of the files, for FvInternNames(),
+                       or NULL if they were not saved.
+
+  @retval EFI_SUCCESS          The index was loaded.
+  @retval EFI_NOT_FOUND        No metadata was saved for the volume.
+  @retval EFI_VOLUME_CORRUPTED The saved metadata is stale or malformed.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to load the index.
+
+**/
+EFI_STATUS
+FvLoadMetadata (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  FFS_METADATA_KEY         *Key,
+  IN  CHAR16                   *VariableName,
+  OUT FV_FILE_ENTRY            **Files,
+  OUT UINTN                    *NumFiles,
+  OUT CHAR16                   ***Names
+  )
+;
+
+/**
+  Saves the metadata of a freshly indexed volume, so that the next boot can
+  load it instead of walking the volume. Only what indexing has already
+  learnt is saved: executables that have yet to be sized stay unsized, and
+  UI names are only saved if the name index has already been built. Nothing
+  is saved if the metadata would not fit in a variable. Failing to save is
+  not an error.
+
+  @param  Fs           Private data for a filesystem with a file index.
+  @param  Key          The volume's key.
+  @param  VariableName The name of the variable to hold the metadata.
+
+**/
+VOID
+FvSaveMetadata (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN FFS_METADATA_KEY         *Key,
+  IN CHAR16                   *VariableName
+  )
+;
+
+/**
+  Saves a volume's metadata again now that its UI names are known, when it
+  was first saved without them. The names are never harvested just to be
+  saved: this is only done once something has built the name index anyway.
+
+  @param  Fs Private data for a filesystem with a UI name index.
+
+**/
+VOID
+FvSaveMetadataNames (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+;
+
+//
+// Section directories
+//
+
+/**
+  Gets the description of a section type that is exposed in section
+  directories.
+
+  @param  Type The section type.
+
+  @retval a kind The section type is exposed, and its description was returned.
+  @retval NULL   Sections of the type are not exposed.
+
+**/
+CONST FV_SECTION_KIND *
+FvGetSectionKind (
+  IN EFI_SECTION_TYPE Type
+  )
+;
+
+/**
+  Appends a zeroed entry to a growing list of sections.
+
+  @param  Sections    On input and output, the list. It is reallocated as it
+                      grows.
+  @param  NumSections On input and output, the number of entries in Sections.
+  @param  Capacity    On input and output, the capacity of Sections.
+
+  @retval The new entry, or NULL if the list could not be grown.
+
+**/
+FV_SECTION_ENTRY *
+FvAppendSection (
+  IN OUT FV_SECTION_ENTRY **Sections,
+  IN OUT UINTN            *NumSections,
+  IN OUT UINTN            *Capacity
+  )
+;
+
+//
+// Nested firmware volumes
+//
+
+///
+/// Template that every new FILE_SYSTEM_PRIVATE_DATA instance is copied from.
+///
+extern FILE_SYSTEM_PRIVATE_DATA mFileSystemPrivateDataTemplate;
+
+/**
+  Determines if a file holds a nested firmware volume, and so is also listed
+  as a directory holding the volume's files.
+
+  @param  Entry Index entry for the file to check.
+
+  @retval TRUE  The file has a nested volume directory.
+  @retval FALSE The file has no nested volume directory.
+
+**/
+BOOLEAN
+FvFileIsVolume (
+  IN FV_FILE_ENTRY *Entry
+  )
+;
+
+/**
+  Mounts the firmware volume nested in a file, the first time its directory
+  is opened. The volume image is extracted through the enclosing volume's FV2
+  instance once, decompressing it if need be, and kept in memory for as long
+  as the enclosing volume stays mounted. The nested volume is then indexed
+  and navigated like any other, through an FV2 interface over the image.
+
+  @param  Fs     Private data for the filesystem holding the file.
+  @param  Entry  Index entry for a file that holds a nested volume.
+  @param  Nested On output, private data for the nested volume.
+
+  @retval EFI_SUCCESS          The nested volume is mounted and indexed.
+  @retval EFI_VOLUME_CORRUPTED The file does not hold a valid firmware volume.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to mount the volume.
+  @retval other                The volume image could not be extracted.
+
+**/
+EFI_STATUS
+FvMountNestedVolume (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  FV_FILE_ENTRY            *Entry,
+  OUT FILE_SYSTEM_PRIVATE_DATA **Nested
+  )
+;
+
+/**
+  Invalidates a volume and every volume nested in it. Each volume's file
+  index and cached contents are dropped and its generation moves on, so that
+  handles opened before now return EFI_MEDIA_CHANGED. The images of nested
+  volumes are released, to be extracted again when they are next opened.
+
+  @param  Fs Private data for the filesystem to invalidate.
+
+**/
+VOID
+FvInvalidateVolume (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+;
+
+//
+// File handle slabs
+//
+
+///
+/// Template that every new FILE_PRIVATE_DATA instance is copied from.
+///
+extern FILE_PRIVATE_DATA mFilePrivateDataTemplate;
+
+/**
+  Takes a file handle from a filesystem's handle slabs and initializes it from
+  the EFI_FILE_PROTOCOL template. Directory handles get zeroed DIR_INFO
+  storage and file handles get zeroed FILE_INFO storage. FileName points to
+  inline storage for a GUID file name and starts out empty.
+
+  @param  Fs          Private data for the filesystem to open the handle on.
+  @param  IsDirectory TRUE for a directory handle, FALSE for a file handle.
+
+  @retval The new handle, or NULL if a new slab could not be allocated.
+
+**/
+FILE_PRIVATE_DATA *
+FfsAllocateHandle (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN BOOLEAN                  IsDirectory
+  )
+;
+
+/**
+  Returns a file handle to its filesystem's free list for reuse.
+
+  @param  PrivateFile The handle to free.
+
+**/
+VOID
+FfsFreeHandle (
+  IN FILE_PRIVATE_DATA *PrivateFile
+  )
+;
+
+/**
+  Frees all of a filesystem's handle slabs when the volume is invalidated, so
+  that it doesn't hold on to as many slabs as it needed at its busiest. The
+  slabs are kept while any handle is still open, since stale handles live in
+  them until they are closed.
+
+  @param  Fs Private data for the filesystem being invalidated.
+
+**/
+VOID
+FfsReclaimHandles (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+;
+
+//
+// Decoded content cache
+//
+
+/**
+  Looks up the decoded contents of a file or one of its sections in the cache.
+  On a hit, the entry is referenced on behalf of the caller and becomes the
+  most recently used one.
+
+  @param  Fs          Private data for the filesystem the file is a part of.
+  @param  NameGuid    Name of the file in its FV2 instance.
+  @param  SectionType Type of the section, or EFI_SECTION_ALL for the file.
+  @param  Instance    Instance of the section, or 0 for the file.
+
+  @retval The referenced cache entry, or NULL if the contents aren't cached.
+
+**/
+FFS_CACHE_ENTRY *
+FfsCacheLookup (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN EFI_GUID                 *NameGuid,
+  IN EFI_SECTION_TYPE         SectionType,
+  IN UINTN                    Instance
+  )
+;
+
+/**
+  Adds the freshly decoded contents of a file or one of its sections to the
+  cache, referenced on behalf of the caller. The cache takes ownership of the
+  contents buffer, and makes room for it by evicting contents that no handle
+  is using.
+
+  @param  Fs           Private data for the filesystem the file is a part of.
+  @param  NameGuid     Name of the file in its FV2 instance.
+  @param  SectionType  Type of the section, or EFI_SECTION_ALL for the file.
+  @param  Instance     Instance of the section, or 0 for the file.
+  @param  Contents     Pool buffer holding the decoded contents.
+  @param  ContentsSize Size of the decoded contents in bytes.
+  @param  CacheEntry   On output, the referenced cache entry.
+
+  @retval EFI_SUCCESS          The contents were added to the cache.
+  @retval EFI_OUT_OF_RESOURCES The cache entry could not be allocated. The
+                               contents buffer is still owned by the caller.
+
+**/
+EFI_STATUS
+FfsCacheInsert (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  EFI_GUID                 *NameGuid,
+  IN  EFI_SECTION_TYPE         SectionType,
+  IN  UINTN                    Instance,
+  IN  VOID                     *Contents,
+  IN  UINTN                    ContentsSize,
+  OUT FFS_CACHE_ENTRY          **CacheEntry
+  )
+;
+
+/**
+  Determines whether the decoded contents of a file or one of its sections
+  are cached, without referencing them or counting the lookup.
+
+  @param  Fs          Private data for the filesystem the file is a part of.
+  @param  NameGuid    Name of the file in its FV2 instance.
+  @param  SectionType Type of the section, or EFI_SECTION_ALL for the file.
+  @param  Instance    Instance of the section, or 0 for the file.
+
+  @retval TRUE  The contents are cached.
+  @retval FALSE The contents aren't cached.
+
+**/
+BOOLEAN
+FfsCacheContains (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN EFI_GUID                 *NameGuid,
+  IN EFI_SECTION_TYPE         SectionType,
+  IN UINTN                    Instance
+  )
+;
+
+/**
+  Determines whether contents of a given size can be prefetched without going
+  over the prefetch budget or pushing anything else out of the cache.
+
+  @param  ContentsSize Size of the contents in bytes, or 0 if not yet known.
+
+  @retval TRUE  The contents fit.
+  @retval FALSE The contents must not be prefetched.
+
+**/
+BOOLEAN
+FfsCacheHasPrefetchRoom (
+  IN UINTN ContentsSize
+  )
+;
+
+/**
+  Adds contents decoded ahead of use to the cache, unreferenced. Nothing is
+  evicted to make room for them: contents that don't fit in the prefetch
+  budget, or in the cache's own budget, are turned away.
+
+  @param  Fs           Private data for the filesystem the file is a part of.
+  @param  NameGuid     Name of the file in its FV2 instance.
+  @param  SectionType  Type of the section, or EFI_SECTION_ALL for the file.
+  @param  Instance     Instance of the section, or 0 for the file.
+  @param  Contents     Pool buffer holding the decoded contents.
+  @param  ContentsSize Size of the decoded contents in bytes.
+
+  @retval EFI_SUCCESS          The contents were added to the cache.
+  @retval EFI_OUT_OF_RESOURCES The contents don't fit, or the cache entry could
+                               not be allocated. The contents buffer is still
+                               owned by the caller.
+
+**/
+EFI_STATUS
+FfsCacheInsertPrefetched (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN EFI_GUID                 *NameGuid,
+  IN EFI_SECTION_TYPE         SectionType,
+  IN UINTN                    Instance,
+  IN VOID                     *Contents,
+  IN UINTN                    ContentsSize
+  )
+;
+
+/**
+  Drops a reference to a cache entry. Contents that are no longer used by any
+  handle stay cached until the budget forces them out.
+
+  @param  CacheEntry The cache entry to release.
+
+**/
+VOID
+FfsCacheRelease (
+  IN FFS_CACHE_ENTRY *CacheEntry
+  )
+;
+
+/**
+  Drops every cached file of a filesystem, after its FV2 interface has been
+  reinstalled. Contents still used by open handles are freed as soon as the
+  last of those handles is closed.
+
+  @param  Fs Private data for the filesystem whose contents are stale.
+
+**/
+VOID
+FfsCachePurge (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+;
+
+/**
+  Returns a snapshot of the cache's counters.
+
+  @param  Statistics On output, the cache's counters.
+
+**/
+VOID
+FfsCacheGetStatistics (
+  OUT FFS_CACHE_STATISTICS *Statistics
+  )
+;
+
+//
+// Asynchronous I/O
+//
+
+///
+/// Lock serializing the file protocol functions with the background worker
+/// that completes queued ReadEx() requests. It raises to TPL_CALLBACK.
+///
+extern EFI_LOCK mFfsLock;
+
+/**
+  Reads data from a file or directory handle on behalf of Read() and ReadEx().
+  The caller holds mFfsLock and has completed the handle's queued requests.
+
+  @param  PrivateFile The handle to read from.
+  @param  BufferSize  On input, the size of Buffer. On output, the amount of data
+                      returned in Buffer.
+  @param  Buffer      The buffer into which the data is read.
+
+  @retval EFI_SUCCESS          Data was read.
+  @retval EFI_MEDIA_CHANGED    The handle's volume was reinstalled since it was opened.
+  @retval EFI_DEVICE_ERROR     The file could not be decoded, or the position is past EOF.
+  @retval EFI_BUFFER_TOO_SMALL The buffer is too small for the next directory entry.
+
+**/
+EFI_STATUS
+FileRead (
+  IN OUT FILE_PRIVATE_DATA *PrivateFile,
+  IN OUT UINTN             *BufferSize,
+  OUT    VOID              *Buffer
+  )
+;
+
+/**
+  Determines whether reading from a handle has to decode its file first, in
+  which case a ReadEx() request is worth completing in the background.
+
+  @param  PrivateFile The handle to be read from.
+
+  @retval TRUE  The file's contents have yet to be decoded.
+  @retval FALSE The read can be served from the volume or from memory.
+
+**/
+BOOLEAN
+FileReadNeedsDecoding (
+  IN FILE_PRIVATE_DATA *PrivateFile
+  )
+;
+
+/**
+  Creates the timer event that drives the background worker.
+
+  @retval EFI_SUCCESS The worker is ready to accept requests.
+  @retval other       The timer event could not be created.
+
+**/
+EFI_STATUS
+FfsIoInitialize (
+  VOID
+  )
+;
+
+/**
+  Has the background worker run on the next timer tick. The timer is simply
+  rearmed if it is already pending.
+
+**/
+VOID
+FfsIoSchedule (
+  VOID
+  )
+;
+
+/**
+  Queues a ReadEx() request for the background worker, behind any requests
+  already queued. The caller holds mFfsLock.
+
+  @param  PrivateFile The handle to read from.
+  @param  Token       The caller's token, with Event set.
+
+  @retval EFI_SUCCESS          The request was queued.
+  @retval EFI_OUT_OF_RESOURCES The request could not be allocated.
+
+**/
+EFI_STATUS
+FfsIoQueueRead (
+  IN FILE_PRIVATE_DATA *PrivateFile,
+  IN EFI_FILE_IO_TOKEN *Token
+  )
+;
+
+/**
+  Completes every request still queued on a handle, in the order they were
+  issued, so that a synchronous call on the handle observes their effects.
+  The caller holds mFfsLock.
+
+  @param  PrivateFile The handle whose requests are completed.
+
+**/
+VOID
+FfsIoDrain (
+  IN FILE_PRIVATE_DATA *PrivateFile
+  )
+;
+
+//
+// Prefetching
+//
+
+/**
+  Works out which section holds the contents exposed for a file or one of its
+  sections, which is also what the contents are cached under. An executable's
+  contents are the same as its first PE32 section file, so the two share a
+  cache entry.
+
+  @param  Entry       Index entry for the file.
+  @param  Section     The section exposed, or NULL for the whole file.
+  @param  SectionType On output, the section's type, or EFI_SECTION_ALL for the
+                      file's raw FFS payload.
+  @param  Instance    On output, the section's instance.
+
+**/
+VOID
+FvGetContentsKey (
+  IN  FV_FILE_ENTRY    *Entry,
+  IN  FV_SECTION_ENTRY *Section,
+  OUT EFI_SECTION_TYPE *SectionType,
+  OUT UINTN            *Instance
+  )
+;
+
+/**
+  Decodes the contents of a file, or of one of its sections, through the
+  volume's FV2 instance.
+
+  @param  Fs           Private data for the filesystem the file is a part of.
+  @param  NameGuid     Name of the file in its FV2 instance.
+  @param  SectionType  Type of the section, or EFI_SECTION_ALL for the file.
+  @param  Instance     Instance of the section.
+  @param  Contents     On output, a pool buffer holding the decoded contents.
+  @param  ContentsSize On output, the size of the decoded contents in bytes.
+
+  @retval EFI_SUCCESS The contents were decoded.
+  @retval other       The contents could not be read from the FV2 instance.
+
+**/
+EFI_STATUS
+FvDecodeContents (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  EFI_GUID                 *NameGuid,
+  IN  EFI_SECTION_TYPE         SectionType,
+  IN  UINTN                    Instance,
+  OUT VOID                     **Contents,
+  OUT UINTN                    *ContentsSize
+  )
+;
+
+/**
+  Notes a completed read on a file handle. Once a handle has been read
+  FFS_READ_AHEAD_TRIGGER times in a row without seeking, the rest of its file
+  is read ahead into the content cache in the background. Only files read
+  through a volume that isn't memory-mapped are read ahead: encoded files
+  are decoded whole by their first read, and memory-mapped ones are a copy.
+
+  @param  PrivateFile The file handle that was read.
+
+**/
+VOID
+FfsReadAheadNoteRead (
+  IN FILE_PRIVATE_DATA *PrivateFile
+  )
+;
+
+/**
+  Notes that a directory listing has returned a file, and queues the next
+  PcdFfsPrefetchDepth files of the listing for prefetch, so that their
+  metadata and contents are ready by the time the walk opens them.
+
+  @param  PrivateFile The directory handle being listed.
+  @param  Index       Index of the returned file among the listed files.
+  @param  NumFiles    Number of files in the listing.
+
+**/
+VOID
+FfsPrefetchNextFiles (
+  IN OUT FILE_PRIVATE_DATA *PrivateFile,
+  IN     UINTN             Index,
+  IN     UINTN             NumFiles
+  )
+;
+
+/**
+  Runs the oldest queued prefetch job on behalf of the background worker.
+  Jobs queued before their volume was invalidated are dropped.
 
-  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL SimpleFileSystem; ///< Holds the SFS interface.
-  EFI_FIRMWARE_VOLUME2_PROTOCOL   *FirmwareVolume2; ///< Pointer to the filesystem's FV2 instance.
-};
+**/
+VOID
+FfsPrefetchRunOne (
+  VOID
+  )
+;
 
-///
-/// Macro to grab the FILE_SYSTEM_PRIVATE_DATA instance associated with a given
-/// pointer to an EFI_SIMPLE_FILE_SYSTEM_PROTOCOL.
-///
-#define FILE_SYSTEM_PRIVATE_DATA_FROM_THIS(a) CR (a, FILE_SYSTEM_PRIVATE_DATA, SimpleFileSystem, FILE_SYSTEM_PRIVATE_DATA_SIGNATURE)
+/**
+  Determines whether any prefetch jobs are waiting for the background worker.
 
-///
-/// Signature to identify FILE_PRIVATE_DATA instances.
-///
-#define FILE_PRIVATE_DATA_SIGNATURE (SIGNATURE_32 ('f', 'f', 's', 'f'))
+  @retval TRUE  Jobs are queued.
+  @retval FALSE The queue is empty.
 
-///
-/// Private data structure for file instances. For each EFI_FILE_PROTOCOL instance
-/// created in the filesystem, there will be one corresponding FILE_PRIVATE_DATA
-/// instance to hold associated data.
-///
-struct _FILE_PRIVATE_DATA {
-  UINT32                   Signature;   ///< Datatype signature.
+**/
+BOOLEAN
+FfsPrefetchPending (
+  VOID
+  )
+;
 
-  EFI_FILE_PROTOCOL        File;        ///< Holds the EFI_FILE_PROTOCOL interface.
-  FILE_SYSTEM_PRIVATE_DATA *FileSystem; ///< Pointer to the file's filesystem instance.
+/**
+  Drops the read-ahead jobs a handle has queued, before the handle is closed.
 
-  CHAR16                   *FileName;   ///< String name used to reference the file.
+  @param  PrivateFile The handle being closed.
 
-  BOOLEAN                  IsDirectory; ///< Determines if the file is a directory or not.
-  DIR_INFO                 *DirInfo;    ///< Associated information for directories.
-  FILE_INFO                *FileInfo;   ///< Associated information for files.
+**/
+VOID
+FfsPrefetchCancel (
+  IN FILE_PRIVATE_DATA *PrivateFile
+  )
+;
 
-  UINT64                   Position;    ///< Number of bytes to offset calls to Read() by.
-};
+//
+// Tracing
+//
 
-///
-/// Macro to grab the FILE_PRIVATE_DATA instance associated with a given
-/// pointer to an EFI_FILE_PROTOCOL.
-///
-#define FILE_PRIVATE_DATA_FROM_THIS(a) CR (a, FILE_PRIVATE_DATA, File, FILE_PRIVATE_DATA_SIGNATURE)
+/**
+  Sets up the trace when the driver is built with PcdFfsTrace: allocates the
+  ring buffer and publishes the trace protocol on the driver's image handle.
+  Nothing is allocated after this, however many calls are traced.
 
-///
-/// Directory information datatype. This data structure has members that give
-/// more specific information about FILE_PRIVATE_DATA instances that are
-/// directories rather than files.
-///
-struct _DIR_INFO {
-  VOID       *Key;     ///< Search key to keep track of directory index position.
-};
+  @param  ImageHandle The driver's image handle.
 
-///
-/// File information datatype. This data structure has members that give more
-/// specific information about FILE_PRIVATE_DATA instances that are files rather
-/// than directories.
-///
-struct _FILE_INFO {
-  BOOLEAN  IsExecutable; ///< Determines if the file has an executable section or not.
-  EFI_GUID NameGuid;     ///< The EFI_GUID that represents the file in it's FV2 instance.
-};
+  @retval EFI_SUCCESS          The trace was set up, or is not built in.
+  @retval EFI_OUT_OF_RESOURCES The ring buffer could not be allocated.
+  @retval other                The protocol could not be installed.
+
+**/
+EFI_STATUS
+FfsTraceInitialize (
+  IN EFI_HANDLE ImageHandle
+  )
+;
+
+/**
+  Reads the performance counter at the start of a traced call.
+
+  @retval The counter reading, or 0 when tracing is not built in.
+
+**/
+UINT64
+FfsTraceStart (
+  VOID
+  )
+;
+
+/**
+  Records a traced call in the ring buffer and in its operation's histogram,
+  overwriting the oldest record once the ring is full. Must be called with
+  the driver lock held.
+
+  @param  Operation   The operation that was called.
+  @param  PrivateFile The handle the call was made on or opened, or NULL.
+  @param  Position    Position in the file the call was made at, or set.
+  @param  Size        Number of bytes the caller asked for.
+  @param  Status      Status the call is returning.
+  @param  Start       Counter reading from FfsTraceStart().
+
+**/
+VOID
+FfsTraceRecord (
+  IN FFS_TRACE_OPERATION Operation,
+  IN FILE_PRIVATE_DATA   *PrivateFile,
+  IN UINT64              Position,
+  IN UINT64              Size,
+  IN EFI_STATUS          Status,
+  IN UINT64              Start
+  )
+;
+
+/**
+  Returns the traced calls still held in the ring buffer, oldest first.
+
+  @param  This       The trace instance.
+  @param  NumRecords On input, the number of records Records can hold. On
+                     output, the number of records returned, or needed.
+  @param  Records    The buffer to return the records in.
+
+  @retval EFI_SUCCESS           The records were returned.
+  @retval EFI_BUFFER_TOO_SMALL  Records is too small. NumRecords was updated.
+  @retval EFI_INVALID_PARAMETER NumRecords is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsTraceGetRecords (
+  IN     FFS_TRACE_PROTOCOL *This,
+  IN OUT UINTN              *NumRecords,
+  OUT    FFS_TRACE_RECORD   *Records
+  )
+;
+
+/**
+  Returns the latency histogram of an operation.
+
+  @param  This      The trace instance.
+  @param  Operation The operation whose histogram is returned.
+  @param  Histogram On output, the operation's histogram.
+
+  @retval EFI_SUCCESS           The histogram was returned.
+  @retval EFI_INVALID_PARAMETER Operation is not traced, or Histogram is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsTraceGetHistogram (
+  IN  FFS_TRACE_PROTOCOL  *This,
+  IN  FFS_TRACE_OPERATION Operation,
+  OUT FFS_TRACE_HISTOGRAM *Histogram
+  )
+;
+
+/**
+  Empties the ring buffer and clears every histogram.
+
+  @param  This The trace instance.
+
+  @retval EFI_SUCCESS The trace was reset.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsTraceReset (
+  IN FFS_TRACE_PROTOCOL *This
+  )
+;
+
+//
+// Statistics
+//
+
+/**
+  Gets the counters that work done for a volume is charged to. Nested volumes
+  are charged to the top-level volume they were mounted from, since only that
+  volume's handle publishes its counters.
+
+  @param  Fs Private data for the volume the work was done for.
+
+  @retval The counters to update.
+
+**/
+FFS_VOLUME_STATISTICS *
+FvCounters (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+;
+
+/**
+  Allocates a pool buffer while serving a file operation, counting it.
+
+  @param  Fs   Private data for the volume the buffer is allocated for.
+  @param  Size Number of bytes to allocate.
+
+  @retval a buffer The buffer was allocated.
+  @retval NULL     There was not enough memory.
+
+**/
+VOID *
+FvAllocateBuffer (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN UINTN                    Size
+  )
+;
+
+/**
+  Frees a pool buffer that was counted when it was allocated, counting the
+  free.
+
+  @param  Fs     Private data for the volume the buffer was allocated for, or
+                 NULL if the volume has since been unmounted.
+  @param  Buffer The buffer to free.
+
+**/
+VOID
+FvFreeBuffer (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN VOID                     *Buffer
+  )
+;
+
+/**
+  Calls a volume's GetNextFile(), counting the call.
+
+  @param  Fs         Private data for the volume to walk.
+  @param  Key        Search key, as for GetNextFile().
+  @param  FileType   File type filter on input, and the file's type on output.
+  @param  NameGuid   On output, the GUID naming the file.
+  @param  Attributes On output, the file's attributes.
+  @param  Size       On output, the file's size.
+
+  @retval The status returned by GetNextFile().
+
+**/
+EFI_STATUS
+FvGetNextFile (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN OUT VOID                     *Key,
+  IN OUT EFI_FV_FILETYPE          *FileType,
+  OUT    EFI_GUID                 *NameGuid,
+  OUT    EFI_FV_FILE_ATTRIBUTES   *Attributes,
+  OUT    UINTN                    *Size
+  )
+;
+
+/**
+  Calls a volume's ReadFile(), counting the call, the bytes it returns and
+  any buffer it allocates. Such a buffer is freed with FvFreeBuffer().
+
+  @param  Fs                   Private data for the volume to read from.
+  @param  NameGuid             The GUID naming the file to read.
+  @param  Buffer               Buffer to read into, as for ReadFile().
+  @param  BufferSize           Size of Buffer, as for ReadFile().
+  @param  FoundType            On output, the file's type.
+  @param  FileAttributes       On output, the file's attributes.
+  @param  AuthenticationStatus On output, the file's authentication status.
+
+  @retval The status returned by ReadFile().
+
+**/
+EFI_STATUS
+FvReadFile (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     CONST EFI_GUID           *NameGuid,
+  IN OUT VOID                     **Buffer,
+  IN OUT UINTN                    *BufferSize,
+  OUT    EFI_FV_FILETYPE          *FoundType,
+  OUT    EFI_FV_FILE_ATTRIBUTES   *FileAttributes,
+  OUT    UINT32                   *AuthenticationStatus
+  )
+;
+
+/**
+  Calls a volume's ReadSection(), counting the call, the bytes it returns and
+  any buffer it allocates. Such a buffer is freed with FvFreeBuffer().
+
+  @param  Fs                   Private data for the volume to read from.
+  @param  NameGuid             The GUID naming the file to read from.
+  @param  SectionType          Type of the section to read.
+  @param  SectionInstance      Instance of the section to read.
+  @param  Buffer               Buffer to read into, as for ReadSection().
+  @param  BufferSize           Size of Buffer, as for ReadSection().
+  @param  AuthenticationStatus On output, the section's authentication status.
+
+  @retval The status returned by ReadSection().
+
+**/
+EFI_STATUS
+FvReadSection (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     CONST EFI_GUID           *NameGuid,
+  IN     EFI_SECTION_TYPE         SectionType,
+  IN     UINTN                    SectionInstance,
+  IN OUT VOID                     **Buffer,
+  IN OUT UINTN                    *BufferSize,
+  OUT    UINT32                   *AuthenticationStatus
+  )
+;
+
+/**
+  Returns a snapshot of a volume's counters.
+
+  @param  This       The statistics instance of the volume.
+  @param  Statistics On output, the volume's counters.
+
+  @retval EFI_SUCCESS           The counters were returned.
+  @retval EFI_INVALID_PARAMETER Statistics is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsGetStatistics (
+  IN  FFS_STATISTICS_PROTOCOL *This,
+  OUT FFS_VOLUME_STATISTICS   *Statistics
+  )
+;
+
+/**
+  Returns a snapshot of the decoded-content cache's counters, which are the
+  same whichever volume they are asked through.
+
+  @param  This       A statistics instance.
+  @param  Statistics On output, the cache's counters.
+
+  @retval EFI_SUCCESS           The counters were returned.
+  @retval EFI_INVALID_PARAMETER Statistics is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsGetCacheStatistics (
+  IN  FFS_STATISTICS_PROTOCOL *This,
+  OUT FFS_CACHE_STATISTICS    *Statistics
+  )
+;
+
+/**
+  Resets a volume's counters to zero, leaving OpenHandles as it is.
+
+  @param  This The statistics instance of the volume.
+
+  @retval EFI_SUCCESS The counters were reset.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsResetStatistics (
+  IN FFS_STATISTICS_PROTOCOL *This
+  )
+;
+
+/**
+  Drops a volume's file index and cached contents, and those of the volumes
+  nested inside it, as if its FV2 interface had been reinstalled.
+
+  @param  This The statistics instance of the volume.
+
+  @retval EFI_SUCCESS       The volume's caches were dropped.
+  @retval EFI_ACCESS_DENIED Files are open on the volume.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsDropCaches (
+  IN FFS_STATISTICS_PROTOCOL *This
+  )
+;
 
 //
 // SimpleFileSystem and File protocol functions
@@ -438,4 +2264,95 @@ EFIAPI
 FfsFlush (IN EFI_FILE_PROTOCOL *This)
 ;
 
+/**
+  Opens a new file relative to the source file's location. Opening never
+  waits on the device, so a non-blocking request is completed, and its event
+  signalled, before returning.
+
+  @param  This       A pointer to the EFI_FILE_PROTOCOL instance that is the file
+                     handle to the source location.
+  @param  NewHandle  A pointer to the location to return the opened handle for the new
+                     file.
+  @param  FileName   The Null-terminated string of the name of the file to be opened.
+  @param  OpenMode   The mode to open the file.
+  @param  Attributes Only valid for EFI_FILE_MODE_CREATE.
+  @param  Token      A pointer to the token associated with the transaction.
+
+  @retval EFI_SUCCESS For a non-blocking request, the request was completed and
+                      Token->Status holds the result. Otherwise, the file was opened.
+  @retval other       See Open().
+
+**/
+EFI_STATUS
+EFIAPI
+FfsOpenEx (
+  IN EFI_FILE_PROTOCOL     *This,
+  OUT EFI_FILE_PROTOCOL    **NewHandle,
+  IN CHAR16                *FileName,
+  IN UINT64                OpenMode,
+  IN UINT64                Attributes,
+  IN OUT EFI_FILE_IO_TOKEN *Token
+  )
+;
+
+/**
+  Reads data from a file. A non-blocking read that has to decode the file is
+  queued and completed in the background at TPL_CALLBACK. Any other read is
+  completed before returning.
+
+  @param  This  A pointer to the EFI_FILE_PROTOCOL instance that is the file
+                handle to read data from.
+  @param  Token A pointer to the token associated with the transaction.
+
+  @retval EFI_SUCCESS          For a non-blocking request, the request was queued or
+                               completed and Token->Status will hold the result.
+                               Otherwise, data was read.
+  @retval EFI_OUT_OF_RESOURCES The request could not be queued.
+  @retval other                See Read().
+
+**/
+EFI_STATUS
+EFIAPI
+FfsReadEx (
+  IN EFI_FILE_PROTOCOL     *This,
+  IN OUT EFI_FILE_IO_TOKEN *Token
+  )
+;
+
+/**
+  Writes data to a file.
+
+  @param  This  A pointer to the EFI_FILE_PROTOCOL instance that is the file
+                handle to write data to.
+  @param  Token A pointer to the token associated with the transaction.
+
+  @retval EFI_ACCESS_DENIED The file was opened read-only.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsWriteEx (
+  IN EFI_FILE_PROTOCOL     *This,
+  IN OUT EFI_FILE_IO_TOKEN *Token
+  )
+;
+
+/**
+  Flushes all modified data associated with a file to a device.
+
+  @param  This  A pointer to the EFI_FILE_PROTOCOL instance that is the file
+                handle to flush.
+  @param  Token A pointer to the token associated with the transaction.
+
+  @retval EFI_ACCESS_DENIED The file was opened read-only.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsFlushEx (
+  IN EFI_FILE_PROTOCOL     *This,
+  IN OUT EFI_FILE_IO_TOKEN *Token
+  )
+;
+
 #endif  // _FFS_H_
@@ -0,0 +1,210 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include "Ffs.h"
+
+//
+// Module-scope variables
+//
+
+///
+/// Lock serializing the file protocol functions with the background worker.
+///
+EFI_LOCK   mFfsLock = EFI_INITIALIZE_LOCK_VARIABLE (TPL_CALLBACK);
+
+///
+/// ReadEx() requests waiting for the background worker, oldest first, and the
+/// timer event that runs the worker at TPL_CALLBACK.
+///
+LIST_ENTRY mFfsIoQueue = INITIALIZE_LIST_HEAD_VARIABLE (mFfsIoQueue);
+EFI_EVENT  mFfsIoTimer;
+
+//
+// Misc. helper methods
+//
+
+/**
+  Completes a queued request: performs the read, stores its status in the
+  token, frees the request and signals the token's event.
+
+  @param  Request The request to complete.
+
+**/
+VOID
+FfsIoComplete (
+  IN FFS_IO_REQUEST *Request
+  )
+{
+  EFI_FILE_IO_TOKEN *Token;
+
+  RemoveEntryList (&Request->Link);
+  Request->PrivateFile->PendingIo--;
+
+  Token         = Request->Token;
+  Token->Status = FileRead (Request->PrivateFile, &Token->BufferSize, Token->Buffer);
+
+  FvFreeBuffer (Request->PrivateFile->FileSystem, Request);
+  gBS->SignalEvent (Token->Event);
+}
+
+/**
+  Background worker. Completes the oldest queued request on each tick, or
+  runs the oldest prefetch job once no requests are waiting, and rearms the
+  timer for as long as work remains, so that a long queue doesn't hold off
+  the rest of the system.
+
+  @param  Event   The worker's timer event.
+  @param  Context Unused.
+
+**/
+VOID
+EFIAPI
+FfsIoWorker (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  )
+{
+  EfiAcquireLock (&mFfsLock);
+
+  if (!IsListEmpty (&mFfsIoQueue)) {
+    FfsIoComplete (FFS_IO_REQUEST_FROM_LINK (GetFirstNode (&mFfsIoQueue)));
+  } else {
+    FfsPrefetchRunOne ();
+  }
+
+  if (!IsListEmpty (&mFfsIoQueue) || FfsPrefetchPending ()) {
+    FfsIoSchedule ();
+  }
+
+  EfiReleaseLock (&mFfsLock);
+}
+
+//
+// Global functions
+//
+
+/**
+  Creates the timer event that drives the background worker.
+
+  @retval EFI_SUCCESS The worker is ready to accept requests.
+  @retval other       The timer event could not be created.
+
+**/
+EFI_STATUS
+FfsIoInitialize (
+  VOID
+  )
+{
+  return gBS->CreateEvent (
+                EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                TPL_CALLBACK,
+                FfsIoWorker,
+                NULL,
+                &mFfsIoTimer
+                );
+}
+
+/**
+  Has the background worker run on the next timer tick. The timer is simply
+  rearmed if it is already pending.
+
+**/
+VOID
+FfsIoSchedule (
+  VOID
+  )
+{
+  gBS->SetTimer (mFfsIoTimer, TimerRelative, 0);
+}
+
+/**
+  Queues a ReadEx() request for the background worker, behind any requests
+  already queued. The caller holds mFfsLock.
+
+  @param  PrivateFile The handle to read from.
+  @param  Token       The caller's token, with Event set.
+
+  @retval EFI_SUCCESS          The request was queued.
+  @retval EFI_OUT_OF_RESOURCES The request could not be allocated.
+
+**/
+EFI_STATUS
+FfsIoQueueRead (
+  IN FILE_PRIVATE_DATA *PrivateFile,
+  IN EFI_FILE_IO_TOKEN *Token
+  )
+{
+  FFS_IO_REQUEST *Request;
+
+  Request = FvAllocateBuffer (PrivateFile->FileSystem, sizeof (FFS_IO_REQUEST));
+
+  if (Request == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Request->Signature   = FFS_IO_REQUEST_SIGNATURE;
+  Request->PrivateFile = PrivateFile;
+  Request->Token       = Token;
+
+  InsertTailList (&mFfsIoQueue, &Request->Link);
+  PrivateFile->PendingIo++;
+
+  FfsIoSchedule ();
+  return EFI_SUCCESS;
+}
+
+/**
+  Completes every request still queued on a handle, in the order they were
+  issued, so that a synchronous call on the handle observes their effects.
+  The caller holds mFfsLock.
+
+  @param  PrivateFile The handle whose requests are completed.
+
+**/
+VOID
+FfsIoDrain (
+  IN FILE_PRIVATE_DATA *PrivateFile
+  )
+{
+  LIST_ENTRY     *Link;
+  FFS_IO_REQUEST *Request;
+
+  Link = GetFirstNode (&mFfsIoQueue);
+
+  while (PrivateFile->PendingIo > 0 && !IsNull (&mFfsIoQueue, Link)) {
+    Request = FFS_IO_REQUEST_FROM_LINK (Link);
+    Link    = GetNextNode (&mFfsIoQueue, Link);
+
+    if (Request->PrivateFile == PrivateFile) {
+      FfsIoComplete (Request);
+    }
+  }
+}
@@ -0,0 +1,432 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include "Ffs.h"
+
+//
+// Module-scope variables
+//
+
+///
+/// The decoded-content cache shared by every mounted volume. Entries are kept
+/// on an LRU list, most recently used first.
+///
+LIST_ENTRY           mFfsCacheList = INITIALIZE_LIST_HEAD_VARIABLE (mFfsCacheList);
+FFS_CACHE_COUNTERS   mFfsCacheCounters;
+
+//
+// Misc. helper methods
+//
+
+/**
+  Unlinks a cache entry that no handle is using and frees it.
+
+  @param  CacheEntry The cache entry to free.
+
+**/
+VOID
+FfsCacheRemove (
+  IN FFS_CACHE_ENTRY *CacheEntry
+  )
+{
+  RemoveEntryList (&CacheEntry->Link);
+
+  mFfsCacheCounters.BytesCached -= CacheEntry->ContentsSize;
+  mFfsCacheCounters.NumEntries--;
+
+  if (CacheEntry->Prefetched) {
+    mFfsCacheCounters.BytesPrefetched -= CacheEntry->ContentsSize;
+    mFfsCacheCounters.PrefetchWasted++;
+  }
+
+  FvFreeBuffer (CacheEntry->FileSystem, CacheEntry->Contents);
+  FreePool (CacheEntry);
+}
+
+/**
+  Frees cached contents that no handle is using, least recently used first,
+  until the cache fits in its budget.
+
+**/
+VOID
+FfsCacheTrim (
+  VOID
+  )
+{
+  LIST_ENTRY      *Link, *PrevLink;
+  FFS_CACHE_ENTRY *CacheEntry;
+  UINTN           Budget;
+
+  Budget = (UINTN) PcdGet32 (PcdFfsContentCacheSize);
+  Link   = mFfsCacheList.BackLink;
+
+  while (mFfsCacheCounters.BytesCached > Budget && Link != &mFfsCacheList) {
+    CacheEntry = FFS_CACHE_ENTRY_FROM_LINK (Link);
+    PrevLink   = Link->BackLink;
+
+    if (CacheEntry->RefCount == 0) {
+      FfsCacheRemove (CacheEntry);
+      mFfsCacheCounters.Evictions++;
+    }
+
+    Link = PrevLink;
+  }
+}
+
+/**
+  Finds the cache entry holding the decoded contents of a file or one of its
+  sections, without referencing it or counting the lookup.
+
+  @param  Fs          Private data for the filesystem the file is a part of.
+  @param  NameGuid    Name of the file in its FV2 instance.
+  @param  SectionType Type of the section, or EFI_SECTION_ALL for the file.
+  @param  Instance    Instance of the section, or 0 for the file.
+
+  @retval The cache entry, or NULL if the contents aren't cached.
+
+**/
+FFS_CACHE_ENTRY *
+FfsCacheFind (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN EFI_GUID                 *NameGuid,
+  IN EFI_SECTION_TYPE         SectionType,
+  IN UINTN                    Instance
+  )
+{
+  LIST_ENTRY      *Link;
+  FFS_CACHE_ENTRY *CacheEntry;
+
+  for (Link = GetFirstNode (&mFfsCacheList);
+       !IsNull (&mFfsCacheList, Link);
+       Link = GetNextNode (&mFfsCacheList, Link)) {
+    CacheEntry = FFS_CACHE_ENTRY_FROM_LINK (Link);
+
+    if (CacheEntry->FileSystem == Fs &&
+        CacheEntry->SectionType == SectionType &&
+        CacheEntry->Instance == Instance &&
+        CompareGuid (&CacheEntry->NameGuid, NameGuid)) {
+      return CacheEntry;
+    }
+  }
+
+  return NULL;
+}
+
+//
+// Decoded content cache
+//
+
+/**
+  Looks up the decoded contents of a file or one of its sections in the cache.
+  On a hit, the entry is referenced on behalf of the caller and becomes the
+  most recently used one.
+
+  @param  Fs          Private data for the filesystem the file is a part of.
+  @param  NameGuid    Name of the file in its FV2 instance.
+  @param  SectionType Type of the section, or EFI_SECTION_ALL for the file.
+  @param  Instance    Instance of the section, or 0 for the file.
+
+  @retval The referenced cache entry, or NULL if the contents aren't cached.
+
+**/
+FFS_CACHE_ENTRY *
+FfsCacheLookup (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN EFI_GUID                 *NameGuid,
+  IN EFI_SECTION_TYPE         SectionType,
+  IN UINTN                    Instance
+  )
+{
+  FFS_CACHE_ENTRY *CacheEntry;
+
+  CacheEntry = FfsCacheFind (Fs, NameGuid, SectionType, Instance);
+
+  if (CacheEntry == NULL) {
+    mFfsCacheCounters.Misses++;
+    return NULL;
+  }
+
+  RemoveEntryList (&CacheEntry->Link);
+  InsertHeadList (&mFfsCacheList, &CacheEntry->Link);
+
+  CacheEntry->RefCount++;
+  mFfsCacheCounters.Hits++;
+
+  //
+  // The first read of prefetched contents is what the prefetch was for.
+  //
+  if (CacheEntry->Prefetched) {
+    CacheEntry->Prefetched = FALSE;
+    mFfsCacheCounters.BytesPrefetched -= CacheEntry->ContentsSize;
+    mFfsCacheCounters.PrefetchHits++;
+  }
+
+  return CacheEntry;
+}
+
+/**
+  Determines whether the decoded contents of a file or one of its sections
+  are cached, without referencing them or counting the lookup.
+
+  @param  Fs          Private data for the filesystem the file is a part of.
+  @param  NameGuid    Name of the file in its FV2 instance.
+  @param  SectionType Type of the section, or EFI_SECTION_ALL for the file.
+  @param  Instance    Instance of the section, or 0 for the file.
+
+  @retval TRUE  The contents are cached.
+  @retval FALSE The contents aren't cached.
+
+**/
+BOOLEAN
+FfsCacheContains (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN EFI_GUID                 *NameGuid,
+  IN EFI_SECTION_TYPE         SectionType,
+  IN UINTN                    Instance
+  )
+{
+  return (BOOLEAN) (FfsCacheFind (Fs, NameGuid, SectionType, Instance) != NULL);
+}
+
+/**
+  Adds the freshly decoded contents of a file or one of its sections to the
+  cache, referenced on behalf of the caller. The cache takes ownership of the
+  contents buffer, and makes room for it by evicting contents that no handle
+  is using.
+
+  @param  Fs           Private data for the filesystem the file is a part of.
+  @param  NameGuid     Name of the file in its FV2 instance.
+  @param  SectionType  Type of the section, or EFI_SECTION_ALL for the file.
+  @param  Instance     Instance of the section, or 0 for the file.
+  @param  Contents     Pool buffer holding the decoded contents.
+  @param  ContentsSize Size of the decoded contents in bytes.
+  @param  CacheEntry   On output, the referenced cache entry.
+
+  @retval EFI_SUCCESS          The contents were added to the cache.
+  @retval EFI_OUT_OF_RESOURCES The cache entry could not be allocated. The
+                               contents buffer is still owned by the caller.
+
+**/
+EFI_STATUS
+FfsCacheInsert (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  EFI_GUID                 *NameGuid,
+  IN  EFI_SECTION_TYPE         SectionType,
+  IN  UINTN                    Instance,
+  IN  VOID                     *Contents,
+  IN  UINTN                    ContentsSize,
+  OUT FFS_CACHE_ENTRY          **CacheEntry
+  )
+{
+  FFS_CACHE_ENTRY *NewEntry;
+
+  NewEntry = AllocateZeroPool (sizeof (FFS_CACHE_ENTRY));
+
+  if (NewEntry == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  NewEntry->Signature    = FFS_CACHE_ENTRY_SIGNATURE;
+  NewEntry->FileSystem   = Fs;
+  NewEntry->SectionType  = SectionType;
+  NewEntry->Instance     = Instance;
+  NewEntry->Contents     = Contents;
+  NewEntry->ContentsSize = ContentsSize;
+  NewEntry->RefCount     = 1;
+  CopyGuid (&NewEntry->NameGuid, NameGuid);
+
+  InsertHeadList (&mFfsCacheList, &NewEntry->Link);
+  mFfsCacheCounters.BytesCached += ContentsSize;
+  mFfsCacheCounters.NumEntries++;
+
+  FfsCacheTrim ();
+
+  *CacheEntry = NewEntry;
+  return EFI_SUCCESS;
+}
+
+/**
+  Determines whether contents of a given size can be prefetched without going
+  over the prefetch budget or pushing anything else out of the cache.
+
+  @param  ContentsSize Size of the contents in bytes, or 0 if not yet known.
+
+  @retval TRUE  The contents fit.
+  @retval FALSE The contents must not be prefetched.
+
+**/
+BOOLEAN
+FfsCacheHasPrefetchRoom (
+  IN UINTN ContentsSize
+  )
+{
+  UINTN PrefetchBudget, CacheBudget;
+
+  PrefetchBudget = (UINTN) PcdGet32 (PcdFfsPrefetchBudget);
+  CacheBudget    = (UINTN) PcdGet32 (PcdFfsContentCacheSize);
+
+  return (BOOLEAN) (mFfsCacheCounters.BytesPrefetched < PrefetchBudget &&
+                    ContentsSize <= PrefetchBudget - mFfsCacheCounters.BytesPrefetched &&
+                    mFfsCacheCounters.BytesCached < CacheBudget &&
+                    ContentsSize <= CacheBudget - mFfsCacheCounters.BytesCached);
+}
+
+/**
+  Adds contents decoded ahead of use to the cache, unreferenced. Nothing is
+  evicted to make room for them: contents that don't fit in the prefetch
+  budget, or in the cache's own budget, are turned away.
+
+  @param  Fs           Private data for the filesystem the file is a part of.
+  @param  NameGuid     Name of the file in its FV2 instance.
+  @param  SectionType  Type of the section, or EFI_SECTION_ALL for the file.
+  @param  Instance     Instance of the section, or 0 for the file.
+  @param  Contents     Pool buffer holding the decoded contents.
+  @param  ContentsSize Size of the decoded contents in bytes.
+
+  @retval EFI_SUCCESS          The contents were added to the cache.
+  @retval EFI_OUT_OF_RESOURCES The contents don't fit, or the cache entry could
+                               not be allocated. The contents buffer is still
+                               owned by the caller.
+
+**/
+EFI_STATUS
+FfsCacheInsertPrefetched (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN EFI_GUID                 *NameGuid,
+  IN EFI_SECTION_TYPE         SectionType,
+  IN UINTN                    Instance,
+  IN VOID                     *Contents,
+  IN UINTN                    ContentsSize
+  )
+{
+  EFI_STATUS      Status;
+  FFS_CACHE_ENTRY *NewEntry;
+
+  if (!FfsCacheHasPrefetchRoom (ContentsSize)) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = FfsCacheInsert (Fs, NameGuid, SectionType, Instance, Contents, ContentsSize, &NewEntry);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  NewEntry->RefCount   = 0;
+  NewEntry->Prefetched = TRUE;
+
+  mFfsCacheCounters.BytesPrefetched += ContentsSize;
+  mFfsCacheCounters.Prefetches++;
+  return EFI_SUCCESS;
+}
+
+/**
+  Drops a reference to a cache entry. Contents that are no longer used by any
+  handle stay cached until the budget forces them out.
+
+  @param  CacheEntry The cache entry to release.
+
+**/
+VOID
+FfsCacheRelease (
+  IN FFS_CACHE_ENTRY *CacheEntry
+  )
+{
+  ASSERT (CacheEntry->Signature == FFS_CACHE_ENTRY_SIGNATURE);
+  ASSERT (CacheEntry->RefCount > 0);
+
+  CacheEntry->RefCount--;
+
+  //
+  // Stale contents can never be looked up again, so free them right away.
+  //
+  if (CacheEntry->RefCount == 0 && CacheEntry->FileSystem == NULL) {
+    FfsCacheRemove (CacheEntry);
+    return;
+  }
+
+  FfsCacheTrim ();
+}
+
+/**
+  Drops every cached file of a filesystem, after its FV2 interface has been
+  reinstalled. Contents still used by open handles are freed as soon as the
+  last of those handles is closed.
+
+  @param  Fs Private data for the filesystem whose contents are stale.
+
+**/
+VOID
+FfsCachePurge (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  LIST_ENTRY      *Link, *NextLink;
+  FFS_CACHE_ENTRY *CacheEntry;
+
+  for (Link = GetFirstNode (&mFfsCacheList);
+       !IsNull (&mFfsCacheList, Link);
+       Link = NextLink) {
+    CacheEntry = FFS_CACHE_ENTRY_FROM_LINK (Link);
+    NextLink   = GetNextNode (&mFfsCacheList, Link);
+
+    if (CacheEntry->FileSystem == Fs) {
+      if (CacheEntry->RefCount == 0) {
+        FfsCacheRemove (CacheEntry);
+      } else {
+        CacheEntry->FileSystem = NULL;
+      }
+    }
+  }
+}
+
+/**
+  Returns a snapshot of the cache's counters.
+
+  @param  Statistics On output, the cache's counters.
+
+**/
+VOID
+FfsCacheGetStatistics (
+  OUT FFS_CACHE_STATISTICS *Statistics
+  )
+{
+  Statistics->Hits        = mFfsCacheCounters.Hits;
+  Statistics->Misses      = mFfsCacheCounters.Misses;
+  Statistics->Evictions   = mFfsCacheCounters.Evictions;
+  Statistics->NumEntries  = mFfsCacheCounters.NumEntries;
+  Statistics->BytesCached = mFfsCacheCounters.BytesCached;
+
+  Statistics->Prefetches      = mFfsCacheCounters.Prefetches;
+  Statistics->PrefetchHits    = mFfsCacheCounters.PrefetchHits;
+  Statistics->PrefetchWasted  = mFfsCacheCounters.PrefetchWasted;
+  Statistics->BytesPrefetched = mFfsCacheCounters.BytesPrefetched;
+}
@@ -0,0 +1,947 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include "Ffs.h"
+
+//
+// Misc. helper methods
+//
+
+/**
+  Determines if a region of a firmware volume is still in its erased state,
+  which marks the start of the volume's free space.
+
+  @param  Buffer        A pointer to a copy of the region to test.
+  @param  Size          The size of the region in bytes.
+  @param  ErasePolarity TRUE if erased bytes read as 0xFF, FALSE for 0x00.
+
+  @retval TRUE  Every byte in the region is erased.
+  @retval FALSE The region holds data.
+
+**/
+BOOLEAN
+FvIsErased (
+  IN UINT8   *Buffer,
+  IN UINTN   Size,
+  IN BOOLEAN ErasePolarity
+  )
+{
+  UINT8 ErasedByte;
+  UINTN Index;
+
+  ErasedByte = (UINT8) (ErasePolarity ? 0xFF : 0x00);
+
+  for (Index = 0; Index < Size; Index++) {
+    if (Buffer[Index] != ErasedByte) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+  Determines if an FFS file header describes a file whose data is valid, in the
+  same way the FV2 producer decides which files GetNextFile returns.
+
+  @param  FileHeader    A pointer to the FFS file header to test.
+  @param  ErasePolarity TRUE if erased bits read as 1, FALSE for 0.
+
+  @retval TRUE  The file's highest state bit is EFI_FILE_DATA_VALID.
+  @retval FALSE The file is under construction, deleted or otherwise invalid.
+
+**/
+BOOLEAN
+FvFileIsValid (
+  IN EFI_FFS_FILE_HEADER *FileHeader,
+  IN BOOLEAN             ErasePolarity
+  )
+{
+  EFI_FFS_FILE_STATE State;
+  UINT8              HighestBit;
+
+  State = FileHeader->State;
+
+  if (ErasePolarity) {
+    State = (EFI_FFS_FILE_STATE) ~State;
+  }
+
+  for (HighestBit = 0x80; HighestBit != 0 && (State & HighestBit) == 0; HighestBit >>= 1);
+
+  return (BOOLEAN) (HighestBit == EFI_FILE_DATA_VALID);
+}
+
+/**
+  Finds the file index entry for a GUID. The FFS walk visits files in the same
+  order as GetNextFile, so the entry at *Cursor is tried before falling back to
+  a lookup in the index's hash table.
+
+  @param  Fs       Private data for the filesystem to search.
+  @param  NameGuid The GUID naming the file to find.
+  @param  Cursor   On input, the index of the expected entry. On output, the
+                   index following the entry that was found.
+
+  @retval an entry The file was found, and its index entry was returned.
+  @retval NULL     The file is not in the index.
+
+**/
+FV_FILE_ENTRY *
+FvFindIndexEntry (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     EFI_GUID                 *NameGuid,
+  IN OUT UINTN                    *Cursor
+  )
+{
+  FV_FILE_ENTRY *Entry;
+
+  if (*Cursor < Fs->NumFiles && CompareGuid (&Fs->Files[*Cursor].NameGuid, NameGuid)) {
+    return &Fs->Files[(*Cursor)++];
+  }
+
+  Entry = FvGetFile (Fs, NameGuid);
+
+  if (Entry != NULL) {
+    *Cursor = (UINTN) (Entry - Fs->Files) + 1;
+  }
+
+  return Entry;
+}
+
+/**
+  Reads the header of the section at a given offset of a firmware volume.
+
+  @param  Fs            Private data for a filesystem with direct access.
+  @param  SectionOffset Offset of the section within the volume.
+  @param  SectionEnd    Offset of the end of the enclosing section stream.
+  @param  Type          On output, the type of the section.
+  @param  HeaderSize    On output, the size of the section's common header.
+  @param  SectionSize   On output, the size of the whole section.
+
+  @retval EFI_SUCCESS          The header was read.
+  @retval EFI_VOLUME_CORRUPTED The section does not fit in its stream.
+  @retval other                The header could not be read.
+
+**/
+EFI_STATUS
+FvReadSectionHeader (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  UINTN                    SectionOffset,
+  IN  UINTN                    SectionEnd,
+  OUT EFI_SECTION_TYPE         *Type,
+  OUT UINTN                    *HeaderSize,
+  OUT UINTN                    *SectionSize
+  )
+{
+  EFI_STATUS                 Status;
+  EFI_COMMON_SECTION_HEADER2 Header;
+
+  if (SectionOffset + sizeof (EFI_COMMON_SECTION_HEADER) > SectionEnd) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  ZeroMem (&Header, sizeof (Header));
+  Status = FvReadBytes (
+             Fs,
+             SectionOffset,
+             MIN (sizeof (Header), SectionEnd - SectionOffset),
+             &Header);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (IS_SECTION2 (&Header)) {
+    *HeaderSize  = sizeof (EFI_COMMON_SECTION_HEADER2);
+    *SectionSize = SECTION2_SIZE (&Header);
+  } else {
+    *HeaderSize  = sizeof (EFI_COMMON_SECTION_HEADER);
+    *SectionSize = SECTION_SIZE (&Header);
+  }
+
+  //
+  // Reject malformed sections rather than reading outside the stream.
+  //
+  if (*SectionSize < *HeaderSize || *SectionSize > SectionEnd - SectionOffset) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  *Type = Header.Type;
+  return EFI_SUCCESS;
+}
+
+/**
+  Locates the section stream enclosed by an encapsulation section, provided
+  that it is stored in the volume as-is. Compression sections of type
+  EFI_NOT_COMPRESSED and GUID-defined sections that do not require processing
+  enclose their stream in place; any other encapsulation has to be decoded.
+
+  @param  Fs            Private data for a filesystem with direct access.
+  @param  SectionOffset Offset of the section within the volume.
+  @param  Type          The type of the section.
+  @param  HeaderSize    The size of the section's common header.
+  @param  SectionSize   The size of the whole section.
+  @param  InnerOffset   On output, the offset of the enclosed stream from the
+                        start of the section, or 0 if the section is a leaf.
+
+  @retval EFI_SUCCESS     InnerOffset was returned.
+  @retval EFI_UNSUPPORTED The section encloses a stream that must be decoded.
+
+**/
+EFI_STATUS
+FvGetEncapsulatedStream (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  UINTN                    SectionOffset,
+  IN  EFI_SECTION_TYPE         Type,
+  IN  UINTN                    HeaderSize,
+  IN  UINTN                    SectionSize,
+  OUT UINTN                    *InnerOffset
+  )
+{
+  EFI_STATUS                Status;
+  EFI_COMPRESSION_SECTION2  Compression;
+  EFI_GUID_DEFINED_SECTION2 Guided;
+  UINT8                     CompressionType;
+  UINT16                    GuidedDataOffset, GuidedAttributes;
+
+  *InnerOffset = 0;
+
+  if (Type == EFI_SECTION_COMPRESSION) {
+    //
+    // Only streams stored with EFI_NOT_COMPRESSED can be searched in place.
+    //
+    if (SectionSize < HeaderSize + sizeof (Compression.UncompressedLength) + sizeof (CompressionType)) {
+      return EFI_UNSUPPORTED;
+    }
+
+    Status = FvReadBytes (
+               Fs,
+               SectionOffset,
+               HeaderSize + sizeof (Compression.UncompressedLength) + sizeof (CompressionType),
+               &Compression);
+
+    if (EFI_ERROR (Status)) {
+      return EFI_UNSUPPORTED;
+    }
+
+    CompressionType = (HeaderSize == sizeof (EFI_COMMON_SECTION_HEADER2)) ?
+                        Compression.CompressionType :
+                        ((EFI_COMPRESSION_SECTION *) &Compression)->CompressionType;
+
+    if (CompressionType != EFI_NOT_COMPRESSED) {
+      return EFI_UNSUPPORTED;
+    }
+
+    *InnerOffset = HeaderSize + sizeof (Compression.UncompressedLength) + sizeof (CompressionType);
+  } else if (Type == EFI_SECTION_GUID_DEFINED) {
+    //
+    // Only GUID-defined sections that need no processing can be searched in
+    // place; their data starts at the offset named in the header.
+    //
+    if (SectionSize < HeaderSize + sizeof (EFI_GUID) + 2 * sizeof (UINT16)) {
+      return EFI_UNSUPPORTED;
+    }
+
+    Status = FvReadBytes (
+               Fs,
+               SectionOffset,
+               HeaderSize + sizeof (EFI_GUID) + 2 * sizeof (UINT16),
+               &Guided);
+
+    if (EFI_ERROR (Status)) {
+      return EFI_UNSUPPORTED;
+    }
+
+    if (HeaderSize == sizeof (EFI_COMMON_SECTION_HEADER2)) {
+      GuidedDataOffset = Guided.DataOffset;
+      GuidedAttributes = Guided.Attributes;
+    } else {
+      GuidedDataOffset = ((EFI_GUID_DEFINED_SECTION *) &Guided)->DataOffset;
+      GuidedAttributes = ((EFI_GUID_DEFINED_SECTION *) &Guided)->Attributes;
+    }
+
+    if ((GuidedAttributes & EFI_GUIDED_SECTION_PROCESSING_REQUIRED) != 0 ||
+        GuidedDataOffset < HeaderSize || GuidedDataOffset > SectionSize) {
+      return EFI_UNSUPPORTED;
+    }
+
+    *InnerOffset = GuidedDataOffset;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Finds the first section of a given type in a section stream, provided that
+  it is stored in the volume as-is. This is the same section that ReadSection
+  returns for instance 0 of the type. Only section headers are read:
+  compression sections of type EFI_NOT_COMPRESSED and GUID-defined sections
+  that do not require processing are searched in place, but any other
+  encapsulation ends the search, since the section could be hidden inside it.
+
+  @param  Fs          Private data for a filesystem with direct access.
+  @param  DataOffset  Offset of the section stream within the volume.
+  @param  DataSize    Size of the section stream in bytes.
+  @param  Depth       Number of encapsulation sections enclosing the stream.
+  @param  SectionType The type of section to find.
+  @param  Offset      On output, the offset of the section's contents within
+                      the volume.
+  @param  Size        On output, the size of the section's contents in bytes.
+
+  @retval EFI_SUCCESS     The section is stored directly in the volume.
+  @retval EFI_NOT_FOUND   The stream holds no section of the type.
+  @retval EFI_UNSUPPORTED The section may be inside an encoded encapsulation.
+
+**/
+EFI_STATUS
+FvFindDirectSection (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  UINTN                    DataOffset,
+  IN  UINTN                    DataSize,
+  IN  UINTN                    Depth,
+  IN  EFI_SECTION_TYPE         SectionType,
+  OUT UINTN                    *Offset,
+  OUT UINTN                    *Size
+  )
+{
+  EFI_STATUS       Status;
+  EFI_SECTION_TYPE Type;
+  UINTN            SectionOffset, SectionEnd, SectionSize, HeaderSize;
+  UINTN            InnerOffset;
+
+  if (Depth > FV_MAX_SECTION_DEPTH) {
+    return EFI_UNSUPPORTED;
+  }
+
+  SectionOffset = DataOffset;
+  SectionEnd    = DataOffset + DataSize;
+
+  while (SectionOffset < SectionEnd) {
+    Status = FvReadSectionHeader (
+               Fs,
+               SectionOffset,
+               SectionEnd,
+               &Type,
+               &HeaderSize,
+               &SectionSize);
+
+    if (EFI_ERROR (Status)) {
+      return EFI_UNSUPPORTED;
+    }
+
+    if (Type == SectionType) {
+      *Offset = SectionOffset + HeaderSize;
+      *Size   = SectionSize - HeaderSize;
+      return EFI_SUCCESS;
+    }
+
+    Status = FvGetEncapsulatedStream (
+               Fs,
+               SectionOffset,
+               Type,
+               HeaderSize,
+               SectionSize,
+               &InnerOffset);
+
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    if (InnerOffset != 0) {
+      Status = FvFindDirectSection (
+                 Fs,
+                 SectionOffset + InnerOffset,
+                 SectionSize - InnerOffset,
+                 Depth + 1,
+                 SectionType,
+                 Offset,
+                 Size);
+
+      if (Status != EFI_NOT_FOUND) {
+        return Status;
+      }
+    }
+
+    SectionOffset = ALIGN_VALUE (SectionOffset + SectionSize, 4);
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+/**
+  Lists the leaf sections of a section stream that is stored in the volume
+  as-is, in the order that ReadSection numbers their instances. Encapsulation
+  sections are searched in place the same way FvFindDirectSection() does; any
+  other encapsulation ends the walk, since sections could be hidden inside it.
+  Only section headers are read.
+
+  @param  Fs          Private data for a filesystem with direct access.
+  @param  DataOffset  Offset of the section stream within the volume.
+  @param  DataSize    Size of the section stream in bytes.
+  @param  Depth       Number of encapsulation sections enclosing the stream.
+  @param  Sections    On input, the sections found so far. On output, the
+                      sections with those in the stream appended. The array is
+                      reallocated as it grows.
+  @param  NumSections On input and output, the number of entries in Sections.
+  @param  Capacity    On input and output, the capacity of Sections.
+
+  @retval EFI_SUCCESS          Every section of the stream was listed.
+  @retval EFI_UNSUPPORTED      Some sections may be inside an encoded encapsulation.
+  @retval EFI_OUT_OF_RESOURCES Sections could not be grown.
+
+**/
+EFI_STATUS
+FvFindDirectSections (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     UINTN                    DataOffset,
+  IN     UINTN                    DataSize,
+  IN     UINTN                    Depth,
+  IN OUT FV_SECTION_ENTRY         **Sections,
+  IN OUT UINTN                    *NumSections,
+  IN OUT UINTN                    *Capacity
+  )
+{
+  EFI_STATUS       Status;
+  EFI_SECTION_TYPE Type;
+  UINTN            SectionOffset, SectionEnd, SectionSize, HeaderSize;
+  UINTN            InnerOffset;
+  FV_SECTION_ENTRY *Section;
+
+  if (Depth > FV_MAX_SECTION_DEPTH) {
+    return EFI_UNSUPPORTED;
+  }
+
+  SectionOffset = DataOffset;
+  SectionEnd    = DataOffset + DataSize;
+
+  while (SectionOffset < SectionEnd) {
+    Status = FvReadSectionHeader (
+               Fs,
+               SectionOffset,
+               SectionEnd,
+               &Type,
+               &HeaderSize,
+               &SectionSize);
+
+    if (EFI_ERROR (Status)) {
+      return EFI_UNSUPPORTED;
+    }
+
+    Status = FvGetEncapsulatedStream (
+               Fs,
+               SectionOffset,
+               Type,
+               HeaderSize,
+               SectionSize,
+               &InnerOffset);
+
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    if (InnerOffset != 0) {
+      Status = FvFindDirectSections (
+                 Fs,
+                 SectionOffset + InnerOffset,
+                 SectionSize - InnerOffset,
+                 Depth + 1,
+                 Sections,
+                 NumSections,
+                 Capacity);
+
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
+    } else if (FvGetSectionKind (Type) != NULL) {
+      Section = FvAppendSection (Sections, NumSections, Capacity);
+
+      if (Section == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+      }
+
+      Section->Type         = Type;
+      Section->Size         = SectionSize - HeaderSize;
+      Section->HasDirect    = TRUE;
+      Section->DirectOffset = SectionOffset + HeaderSize;
+    }
+
+    SectionOffset = ALIGN_VALUE (SectionOffset + SectionSize, 4);
+  }
+
+  return EFI_SUCCESS;
+}
+
+//
+// Direct access to firmware volumes
+//
+
+/**
+  Locates direct access to a filesystem's firmware volume through the firmware
+  volume block protocol on the same handle. Memory-mapped volumes are read with
+  a plain copy out of the mapping; other volumes are read through FVB Read(),
+  provided their blocks are all the same size. Nested volumes are read out of
+  their in-memory image.
+
+  @param  Fs Private data for the filesystem to locate direct access for.
+
+  @retval EFI_SUCCESS     The volume can be read directly.
+  @retval EFI_UNSUPPORTED The volume has no usable FVB instance, or it does not
+                          hold a valid firmware volume header.
+
+**/
+EFI_STATUS
+FvLocateDirectAccess (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  EFI_STATUS                         Status;
+  EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL *Fvb;
+  EFI_FVB_ATTRIBUTES_2               Attributes;
+  EFI_PHYSICAL_ADDRESS               Address;
+  EFI_FIRMWARE_VOLUME_HEADER         FvHeader;
+  UINTN                              BlockSize, NumberOfBlocks, Size;
+
+  Fs->Fvb        = NULL;
+  Fs->MappedBase = NULL;
+  Fs->FvLength   = 0;
+  Fs->BlockSize  = 0;
+
+  //
+  // Nested volumes are held in memory, and their headers were checked when
+  // they were mounted.
+  //
+  if (Fs->Parent != NULL) {
+    if (Fs->Image == NULL) {
+      return EFI_UNSUPPORTED;
+    }
+
+    CopyMem (&FvHeader, Fs->Image, sizeof (FvHeader));
+
+    Fs->MappedBase    = Fs->Image;
+    Fs->FvLength      = (UINTN) FvHeader.FvLength;
+    Fs->ErasePolarity = (BOOLEAN) ((FvHeader.Attributes & EFI_FVB2_ERASE_POLARITY) != 0);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Direct access is only reachable through the FVB instance on the same handle.
+  //
+  Status = gBS->HandleProtocol (
+                  Fs->Handle,
+                  &gEfiFirmwareVolumeBlockProtocolGuid,
+                  (VOID **) &Fvb
+                  );
+
+  if (EFI_ERROR (Status)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Status = Fvb->GetAttributes (Fvb, &Attributes);
+
+  if (EFI_ERROR (Status) || (Attributes & EFI_FVB2_READ_STATUS) == 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  if ((Attributes & EFI_FVB2_MEMORY_MAPPED) != 0) {
+    Status = Fvb->GetPhysicalAddress (Fvb, &Address);
+
+    if (!EFI_ERROR (Status) && Address != 0) {
+      CopyMem (&FvHeader, (VOID *) (UINTN) Address, sizeof (FvHeader));
+    } else {
+      Address = 0;
+    }
+  } else {
+    Address = 0;
+  }
+
+  if (Address == 0) {
+    //
+    // Unmapped volumes are addressed by (Lba, Offset), which is only a simple
+    // division when every block has the same size.
+    //
+    Status = Fvb->GetBlockSize (Fvb, 0, &BlockSize, &NumberOfBlocks);
+
+    if (EFI_ERROR (Status) || BlockSize == 0) {
+      return EFI_UNSUPPORTED;
+    }
+
+    Size   = sizeof (FvHeader);
+    Status = Fvb->Read (Fvb, 0, 0, &Size, (UINT8 *) &FvHeader);
+
+    if (EFI_ERROR (Status) || Size != sizeof (FvHeader) ||
+        MultU64x64 (BlockSize, NumberOfBlocks) != FvHeader.FvLength) {
+      return EFI_UNSUPPORTED;
+    }
+
+    Fs->BlockSize = BlockSize;
+  }
+
+  //
+  // Sanity check the firmware volume header before trusting its length.
+  //
+  if (FvHeader.Signature != EFI_FVH_SIGNATURE ||
+      FvHeader.HeaderLength < sizeof (EFI_FIRMWARE_VOLUME_HEADER) ||
+      FvHeader.FvLength < FvHeader.HeaderLength ||
+      FvHeader.FvLength > MAX_ADDRESS - Address) {
+    DEBUG ((EFI_D_INFO, "FvLocateDirectAccess: Invalid FV header\n"));
+    return EFI_UNSUPPORTED;
+  }
+
+  Fs->Fvb           = Fvb;
+  Fs->MappedBase    = (UINT8 *) (UINTN) Address;
+  Fs->FvLength      = (UINTN) FvHeader.FvLength;
+  Fs->ErasePolarity = (BOOLEAN) ((FvHeader.Attributes & EFI_FVB2_ERASE_POLARITY) != 0);
+
+  DEBUG ((EFI_D_INFO, "FvLocateDirectAccess: FV mapped at 0x%lx\n", Address));
+  return EFI_SUCCESS;
+}
+
+/**
+  Reads a range of bytes from a firmware volume, either by copying from its
+  memory mapping or through FVB Read(). Only the requested bytes are touched.
+
+  @param  Fs     Private data for a filesystem with direct access.
+  @param  Offset Offset of the first byte to read, from the start of the volume.
+  @param  Size   Number of bytes to read.
+  @param  Buffer The buffer to read into.
+
+  @retval EFI_SUCCESS           The bytes were read.
+  @retval EFI_INVALID_PARAMETER The range falls outside the volume.
+  @retval EFI_DEVICE_ERROR      The FVB instance failed to read the range.
+
+**/
+EFI_STATUS
+FvReadBytes (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  UINTN                    Offset,
+  IN  UINTN                    Size,
+  OUT VOID                     *Buffer
+  )
+{
+  EFI_STATUS            Status;
+  UINT8                 *Destination;
+  UINTN                 NumBytes;
+  FFS_VOLUME_STATISTICS *Counters;
+
+  if (Size > Fs->FvLength || Offset > Fs->FvLength - Size) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Counters = FvCounters (Fs);
+  Counters->DirectReads++;
+  Counters->BytesReadDirect += Size;
+
+  if (Fs->MappedBase != NULL) {
+    CopyMem (Buffer, Fs->MappedBase + Offset, Size);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Read block by block, as FVB Read() does not cross block boundaries.
+  //
+  Destination = Buffer;
+
+  while (Size > 0) {
+    Counters->FvbReadCalls++;
+
+    NumBytes = MIN (Size, Fs->BlockSize - Offset % Fs->BlockSize);
+    Status   = Fs->Fvb->Read (
+                          Fs->Fvb,
+                          Offset / Fs->BlockSize,
+                          Offset % Fs->BlockSize,
+                          &NumBytes,
+                          Destination);
+
+    if (EFI_ERROR (Status) || NumBytes == 0) {
+      return EFI_DEVICE_ERROR;
+    }
+
+    Offset      += NumBytes;
+    Destination += NumBytes;
+    Size        -= NumBytes;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Finds the next file in a firmware volume with direct access, the same way
+  GetNextFile does: pad files, and files whose data is not valid, are skipped.
+  Only file headers are read.
+
+  @param  Fs         Private data for a filesystem with direct access.
+  @param  Offset     On input, the offset to start looking at, or 0 to start
+                     at the first file. On output, the offset following the
+                     file that was found.
+  @param  FileHeader On output, the file's header.
+  @param  DataOffset On output, the offset of the file's FFS payload within
+                     the volume.
+  @param  DataSize   On output, the size of the file's FFS payload in bytes.
+
+  @retval EFI_SUCCESS          A file was found.
+  @retval EFI_NOT_FOUND        There are no more files in the volume.
+  @retval EFI_VOLUME_CORRUPTED A file does not fit in the volume.
+
+**/
+EFI_STATUS
+FvNextFile (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN OUT UINTN                    *Offset,
+  OUT    EFI_FFS_FILE_HEADER2     *FileHeader,
+  OUT    UINTN                    *DataOffset,
+  OUT    UINTN                    *DataSize
+  )
+{
+  EFI_STATUS                     Status;
+  EFI_FIRMWARE_VOLUME_HEADER     FvHeader;
+  EFI_FIRMWARE_VOLUME_EXT_HEADER ExtHeader;
+  UINTN                          FileOffset, FileSize, HeaderSize;
+
+  FileOffset = *Offset;
+
+  if (FileOffset == 0) {
+    //
+    // The first file follows the volume header, or the extended header if
+    // the volume has one.
+    //
+    Status = FvReadBytes (Fs, 0, sizeof (FvHeader), &FvHeader);
+
+    if (EFI_ERROR (Status)) {
+      return EFI_NOT_FOUND;
+    }
+
+    FileOffset = FvHeader.HeaderLength;
+
+    if (FvHeader.ExtHeaderOffset != 0 &&
+        !EFI_ERROR (FvReadBytes (Fs, FvHeader.ExtHeaderOffset, sizeof (ExtHeader), &ExtHeader))) {
+      FileOffset = FvHeader.ExtHeaderOffset + ExtHeader.ExtHeaderSize;
+    }
+  }
+
+  FileOffset = ALIGN_VALUE (FileOffset, 8);
+
+  while (FileOffset + sizeof (EFI_FFS_FILE_HEADER) <= Fs->FvLength) {
+    Status = FvReadBytes (Fs, FileOffset, sizeof (EFI_FFS_FILE_HEADER), FileHeader);
+
+    if (EFI_ERROR (Status)) {
+      return EFI_NOT_FOUND;
+    }
+
+    //
+    // An erased file header marks the start of the volume's free space.
+    //
+    if (FvIsErased ((UINT8 *) FileHeader, sizeof (EFI_FFS_FILE_HEADER), Fs->ErasePolarity)) {
+      return EFI_NOT_FOUND;
+    }
+
+    if (IS_FFS_FILE2 (FileHeader)) {
+      Status = FvReadBytes (Fs, FileOffset, sizeof (EFI_FFS_FILE_HEADER2), FileHeader);
+
+      if (EFI_ERROR (Status)) {
+        return EFI_NOT_FOUND;
+      }
+
+      HeaderSize = sizeof (EFI_FFS_FILE_HEADER2);
+      FileSize   = (UINTN) FFS_FILE2_SIZE (FileHeader);
+    } else {
+      HeaderSize = sizeof (EFI_FFS_FILE_HEADER);
+      FileSize   = FFS_FILE_SIZE (FileHeader);
+    }
+
+    if (FileSize < HeaderSize || FileSize > Fs->FvLength - FileOffset) {
+      DEBUG ((EFI_D_INFO, "FvNextFile: Malformed file at 0x%x\n", FileOffset));
+      return EFI_VOLUME_CORRUPTED;
+    }
+
+    if (FileHeader->Type != EFI_FV_FILETYPE_FFS_PAD &&
+        FvFileIsValid ((EFI_FFS_FILE_HEADER *) FileHeader, Fs->ErasePolarity)) {
+      *Offset     = FileOffset + FileSize;
+      *DataOffset = FileOffset + HeaderSize;
+      *DataSize   = FileSize - HeaderSize;
+      return EFI_SUCCESS;
+    }
+
+    FileOffset = ALIGN_VALUE (FileOffset + FileSize, 8);
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+/**
+  Walks the FFS files of a firmware volume with direct access and records, in
+  each matching file index entry, where the file's FFS payload starts within
+  the volume. Only file headers are read.
+
+  @param  Fs Private data for a filesystem with direct access and an index.
+
+**/
+VOID
+FvIndexFileData (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  EFI_FFS_FILE_HEADER2 FileHeader;
+  FV_FILE_ENTRY        *Entry;
+  UINTN                Offset, DataOffset, DataSize, Cursor;
+
+  Offset = 0;
+  Cursor = 0;
+
+  while (!EFI_ERROR (FvNextFile (Fs, &Offset, &FileHeader, &DataOffset, &DataSize))) {
+    Entry = FvFindIndexEntry (Fs, &FileHeader.Name, &Cursor);
+
+    //
+    // Only trust the volume when it agrees with what GetNextFile reported.
+    //
+    if (Entry != NULL && Entry->Size == DataSize) {
+      Entry->HasData    = TRUE;
+      Entry->DataOffset = DataOffset;
+    }
+  }
+}
+
+/**
+  Gets the machine type of a PE32 or TE image stored in a firmware volume, the
+  same way PeCoffLoaderGetMachineType() does, but reading only the DOS header
+  and the first bytes of the PE or TE header rather than the whole image.
+
+  @param  Fs          Private data for a filesystem with direct access.
+  @param  ImageOffset Offset of the image within the volume.
+  @param  ImageSize   Size of the image in bytes.
+  @param  Machine     On output, the machine type of the image.
+
+  @retval EFI_SUCCESS     The machine type was returned.
+  @retval EFI_UNSUPPORTED The image has no recognizable PE or TE header.
+
+**/
+EFI_STATUS
+FvGetImageMachine (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  UINTN                    ImageOffset,
+  IN  UINTN                    ImageSize,
+  OUT UINT16                   *Machine
+  )
+{
+  EFI_STATUS           Status;
+  EFI_IMAGE_DOS_HEADER DosHeader;
+  UINT8                Header[sizeof (UINT32) + sizeof (UINT16)];
+  UINTN                HeaderOffset;
+
+  //
+  // A DOS header, if there is one, points at the PE header.
+  //
+  HeaderOffset = 0;
+
+  if (ImageSize >= sizeof (DosHeader)) {
+    Status = FvReadBytes (Fs, ImageOffset, sizeof (DosHeader), &DosHeader);
+
+    if (EFI_ERROR (Status)) {
+      return EFI_UNSUPPORTED;
+    }
+
+    if (DosHeader.e_magic == EFI_IMAGE_DOS_SIGNATURE) {
+      HeaderOffset = DosHeader.e_lfanew;
+    }
+  }
+
+  if (ImageSize < sizeof (Header) || HeaderOffset > ImageSize - sizeof (Header)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Status = FvReadBytes (Fs, ImageOffset + HeaderOffset, sizeof (Header), Header);
+
+  if (EFI_ERROR (Status)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // TE headers keep the machine type right after their 16-bit signature, and
+  // PE headers keep it right after their 32-bit signature.
+  //
+  if (ReadUnaligned16 ((UINT16 *) Header) == EFI_TE_IMAGE_HEADER_SIGNATURE) {
+    *Machine = ReadUnaligned16 ((UINT16 *) (Header + sizeof (UINT16)));
+  } else if (ReadUnaligned32 ((UINT32 *) Header) == EFI_IMAGE_NT_SIGNATURE) {
+    *Machine = ReadUnaligned16 ((UINT16 *) (Header + sizeof (UINT32)));
+  } else {
+    return EFI_UNSUPPORTED;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Reads a range of a file's contents straight from its firmware volume. Only
+  the bytes in [Position, Position + *BufferSize) are read, so probing the
+  header of a large file does not pull in the rest of it.
+
+  @param  Fs         Private data for a filesystem with direct access.
+  @param  Offset     Offset of the file's contents within the volume.
+  @param  Size       Size of the file's contents in bytes.
+  @param  Position   Offset into the file's contents to start reading from.
+  @param  BufferSize On input, the size of Buffer. On output, the number of
+                     bytes read, which is capped at the end of the file.
+  @param  Buffer     The buffer to read into.
+
+  @retval EFI_SUCCESS      The range was read.
+  @retval EFI_DEVICE_ERROR Position is beyond the end of the file, or the
+                           volume could not be read.
+
+**/
+EFI_STATUS
+FileReadRange (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     UINTN                    Offset,
+  IN     UINTN                    Size,
+  IN     UINT64                   Position,
+  IN OUT UINTN                    *BufferSize,
+  OUT    VOID                     *Buffer
+  )
+{
+  EFI_STATUS Status;
+
+  if (Position > Size) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (*BufferSize > Size - (UINTN) Position) {
+    *BufferSize = Size - (UINTN) Position;
+  }
+
+  FFS_PERF_START (FFS_PERF_COPY);
+  Status = FvReadBytes (Fs, Offset + (UINTN) Position, *BufferSize, Buffer);
+  FFS_PERF_END (FFS_PERF_COPY);
+
+  if (EFI_ERROR (Status)) {
+    *BufferSize = 0;
+    return EFI_DEVICE_ERROR;
+  }
+
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,160 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include "Ffs.h"
+
+//
+// File handle slabs
+//
+
+/**
+  Takes a file handle from a filesystem's handle slabs and initializes it from
+  the EFI_FILE_PROTOCOL template. Directory handles get zeroed DIR_INFO
+  storage and file handles get zeroed FILE_INFO storage. FileName points to
+  inline storage for a GUID file name and starts out empty.
+
+  @param  Fs          Private data for the filesystem to open the handle on.
+  @param  IsDirectory TRUE for a directory handle, FALSE for a file handle.
+
+  @retval The new handle, or NULL if a new slab could not be allocated.
+
+**/
+FILE_PRIVATE_DATA *
+FfsAllocateHandle (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN BOOLEAN                  IsDirectory
+  )
+{
+  FFS_HANDLE_SLAB   *Slab;
+  FFS_HANDLE        *Handle;
+  FILE_PRIVATE_DATA *PrivateFile;
+  UINTN             Index;
+
+  //
+  // Carve a new slab into free handles once the free list runs dry.
+  //
+  if (Fs->FreeHandles == NULL) {
+    Slab = FvAllocateBuffer (Fs, sizeof (FFS_HANDLE_SLAB));
+
+    if (Slab == NULL) {
+      return NULL;
+    }
+
+    for (Index = 0; Index < FFS_HANDLES_PER_SLAB; Index++) {
+      Slab->Handles[Index].NextFree = Fs->FreeHandles;
+      Fs->FreeHandles               = &Slab->Handles[Index];
+    }
+
+    Slab->Next = Fs->Slabs;
+    Fs->Slabs  = Slab;
+  }
+
+  Handle          = Fs->FreeHandles;
+  Fs->FreeHandles = Handle->NextFree;
+  Fs->OpenHandles++;
+
+  ZeroMem (Handle, sizeof (FFS_HANDLE));
+  PrivateFile = &Handle->Private;
+  CopyMem (PrivateFile, &mFilePrivateDataTemplate, sizeof (FILE_PRIVATE_DATA));
+
+  PrivateFile->FileSystem  = Fs;
+  PrivateFile->Generation  = Fs->Generation;
+  PrivateFile->FileName    = Handle->FileName;
+  PrivateFile->IsDirectory = IsDirectory;
+
+  if (IsDirectory) {
+    PrivateFile->DirInfo  = &Handle->DirInfo;
+  } else {
+    PrivateFile->FileInfo = &Handle->FileInfo;
+  }
+
+  return PrivateFile;
+}
+
+/**
+  Returns a file handle to its filesystem's free list for reuse.
+
+  @param  PrivateFile The handle to free.
+
+**/
+VOID
+FfsFreeHandle (
+  IN FILE_PRIVATE_DATA *PrivateFile
+  )
+{
+  FILE_SYSTEM_PRIVATE_DATA *Fs;
+  FFS_HANDLE               *Handle;
+
+  Fs     = PrivateFile->FileSystem;
+  Handle = FFS_HANDLE_FROM_PRIVATE (PrivateFile);
+
+  ASSERT (Fs->OpenHandles > 0);
+
+  //
+  // Clear the signature so that a stale EFI_FILE_PROTOCOL pointer to the
+  // handle trips the CR() check instead of reusing it.
+  //
+  PrivateFile->Signature = 0;
+
+  Handle->NextFree = Fs->FreeHandles;
+  Fs->FreeHandles  = Handle;
+  Fs->OpenHandles--;
+}
+
+/**
+  Frees all of a filesystem's handle slabs when the volume is invalidated, so
+  that it doesn't hold on to as many slabs as it needed at its busiest. The
+  slabs are kept while any handle is still open, since stale handles live in
+  them until they are closed.
+
+  @param  Fs Private data for the filesystem being invalidated.
+
+**/
+VOID
+FfsReclaimHandles (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  FFS_HANDLE_SLAB *Slab;
+
+  if (Fs->OpenHandles != 0) {
+    DEBUG ((EFI_D_INFO, "FfsReclaimHandles: %d stale handles still open\n", Fs->OpenHandles));
+    return;
+  }
+
+  while (Fs->Slabs != NULL) {
+    Slab      = Fs->Slabs;
+    Fs->Slabs = Slab->Next;
+    FvFreeBuffer (Fs, Slab);
+  }
+
+  Fs->FreeHandles = NULL;
+}
@@ -0,0 +1,501 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include "Ffs.h"
+
+//
+// Misc. helper methods
+//
+
+/**
+  Folds bytes into a running 64-bit FNV-1a hash.
+
+  @param  Hash   The hash so far.
+  @param  Buffer The bytes to fold in.
+  @param  Size   Number of bytes in Buffer.
+
+  @retval The updated hash.
+
+**/
+UINT64
+FvHashBytes (
+  IN UINT64 Hash,
+  IN UINT8  *Buffer,
+  IN UINTN  Size
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < Size; Index++) {
+    Hash = MultU64x64 (Hash ^ Buffer[Index], 0x00000100000001B3ULL);
+  }
+
+  return Hash;
+}
+
+//
+// Persistent metadata
+//
+
+/**
+  Works out the key a volume's saved metadata is stored and checked under:
+  the volume's header together with a hash of where each of its files lies
+  and of their FFS headers, which hold each file's name, size, state and
+  IntegrityCheck. Only file headers are read, the same as the walk that the
+  metadata saves. The name of the variable holding the metadata is derived
+  from the volume header alone, so that reflashing a volume replaces its
+  metadata rather than adding to it. Only memory-mapped volumes have a key:
+  on any other volume, reading every file header through FVB costs as much
+  as the GetNextFile walk that the metadata saves.
+
+  @param  Fs           Private data for a top-level filesystem with direct access.
+  @param  Key          On output, the volume's key.
+  @param  VariableName On output, the name of the variable holding the metadata,
+                       FFS_METADATA_NAME_LENGTH characters long.
+
+  @retval EFI_SUCCESS          The key was worked out.
+  @retval EFI_UNSUPPORTED      The volume isn't memory-mapped.
+  @retval EFI_DEVICE_ERROR     The volume could not be read.
+  @retval EFI_VOLUME_CORRUPTED A file does not fit in the volume.
+
+**/
+EFI_STATUS
+FvGetMetadataKey (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  OUT FFS_METADATA_KEY         *Key,
+  OUT CHAR16                   *VariableName
+  )
+{
+  EFI_STATUS           Status;
+  EFI_FFS_FILE_HEADER2 FileHeader;
+  UINTN                Offset, DataOffset, DataSize;
+
+  if (Fs->MappedBase == NULL) {
+    return EFI_UNSUPPORTED;
+  }
+
+  ZeroMem (Key, sizeof (FFS_METADATA_KEY));
+
+  Status = FvReadBytes (Fs, 0, sizeof (Key->Header), &Key->Header);
+
+  if (EFI_ERROR (Status)) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  //
+  // Hash the offset and header of every file GetNextFile would return. Pad
+  // files and invalid files are left out, as they never reach the index.
+  //
+  Key->ContentHash = 0xCBF29CE484222325ULL;
+  Offset           = 0;
+
+  while (!EFI_ERROR (Status = FvNextFile (Fs, &Offset, &FileHeader, &DataOffset, &DataSize))) {
+    Key->ContentHash = FvHashBytes (Key->ContentHash, (UINT8 *) &DataOffset, sizeof (DataOffset));
+    Key->ContentHash = FvHashBytes (
+                         Key->ContentHash,
+                         (UINT8 *) &FileHeader,
+                         IS_FFS_FILE2 (&FileHeader) ? sizeof (EFI_FFS_FILE_HEADER2) : sizeof (EFI_FFS_FILE_HEADER)
+                         );
+  }
+
+  if (Status != EFI_NOT_FOUND) {
+    return Status;
+  }
+
+  //
+  // Name the variable after the header, so that each volume has one.
+  //
+  UnicodeSPrint (
+    VariableName,
+    FFS_METADATA_NAME_LENGTH * sizeof (CHAR16),
+    L"FfsIndex%016lx",
+    FvHashBytes (0xCBF29CE484222325ULL, (UINT8 *) &Key->Header, sizeof (Key->Header)));
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Loads a volume's file index from the metadata saved on an earlier boot. The
+  metadata is only used if it was saved under the same key, and every record
+  in it is consistent with the volume.
+
+  @param  Fs           Private data for the filesystem to index.
+  @param  Key          The volume's key.
+  @param  VariableName The name of the variable holding the metadata.
+  @param  Files        On output, the file index, in GetNextFile order.
+  @param  NumFiles     On output, the number of entries in Files.
+  @param  Names        On output, the UI names of the files, for FvInternNames(),
+                       or NULL if they were not saved.
+
+  @retval EFI_SUCCESS          The index was loaded.
+  @retval EFI_NOT_FOUND        No metadata was saved for the volume.
+  @retval EFI_VOLUME_CORRUPTED The saved metadata is stale or malformed.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to load the index.
+
+**/
+EFI_STATUS
+FvLoadMetadata (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  FFS_METADATA_KEY         *Key,
+  IN  CHAR16                   *VariableName,
+  OUT FV_FILE_ENTRY            **Files,
+  OUT UINTN                    *NumFiles,
+  OUT CHAR16                   ***Names
+  )
+{
+  EFI_STATUS          Status;
+  UINT8               *Blob;
+  UINTN               BlobSize, Index, NameOffset, NamesEnd;
+  FFS_METADATA_HEADER *Header;
+  FFS_METADATA_RECORD *Record;
+  FV_FILE_ENTRY       *Entries, *Entry;
+  CHAR16              **EntryNames;
+  CHAR16              *Name;
+
+  Blob       = NULL;
+  Header     = NULL;
+  Entries    = NULL;
+  EntryNames = NULL;
+  BlobSize   = 0;
+
+  //
+  // Read the saved metadata, if there is any.
+  //
+  Status = gRT->GetVariable (VariableName, &gFfsMetadataCacheGuid, NULL, &BlobSize, NULL);
+
+  if (Status != EFI_BUFFER_TOO_SMALL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Blob = AllocatePool (BlobSize);
+
+  if (Blob == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = gRT->GetVariable (VariableName, &gFfsMetadataCacheGuid, NULL, &BlobSize, Blob);
+
+  if (EFI_ERROR (Status)) {
+    Status = EFI_NOT_FOUND;
+    goto Done;
+  }
+
+  //
+  // Check that the metadata was saved for this volume as it is now.
+  //
+  Status = EFI_VOLUME_CORRUPTED;
+  Header = (FFS_METADATA_HEADER *) Blob;
+
+  if (BlobSize < sizeof (FFS_METADATA_HEADER) ||
+      Header->Signature != FFS_METADATA_SIGNATURE ||
+      Header->Version != FFS_METADATA_VERSION ||
+      CompareMem (&Header->Key, Key, sizeof (FFS_METADATA_KEY)) != 0) {
+    goto Done;
+  }
+
+  NameOffset = sizeof (FFS_METADATA_HEADER) + (UINTN) Header->NumFiles * sizeof (FFS_METADATA_RECORD);
+  NamesEnd   = NameOffset + Header->NamesSize;
+
+  if (NamesEnd != BlobSize) {
+    goto Done;
+  }
+
+  Entries    = AllocateZeroPool (MAX (Header->NumFiles, 1) * sizeof (FV_FILE_ENTRY));
+  EntryNames = AllocateZeroPool (MAX (Header->NumFiles, 1) * sizeof (CHAR16 *));
+
+  if (Entries == NULL || EntryNames == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  //
+  // Rebuild the index entry of every file, checking that whatever it points
+  // at still lies inside the volume.
+  //
+  Record = (FFS_METADATA_RECORD *) (Blob + sizeof (FFS_METADATA_HEADER));
+
+  for (Index = 0; Index < Header->NumFiles; Index++, Record++) {
+    if (((Record->Flags & FFS_METADATA_HAS_DATA) != 0 &&
+         Record->DataOffset > Fs->FvLength) ||
+        ((Record->Flags & FFS_METADATA_HAS_DIRECT) != 0 &&
+         ((UINTN) Record->DirectOffset > Fs->FvLength ||
+          (UINTN) Record->DirectSize > Fs->FvLength - Record->DirectOffset)) ||
+        Record->NameLength * sizeof (CHAR16) > NamesEnd - NameOffset) {
+      goto Done;
+    }
+
+    Entry = &Entries[Index];
+    CopyGuid (&Entry->NameGuid, &Record->NameGuid);
+
+    Entry->FileType     = Record->FileType;
+    Entry->IsExecutable = (BOOLEAN) ((Record->Flags & FFS_METADATA_EXECUTABLE) != 0);
+    Entry->Guessed      = (BOOLEAN) ((Record->Flags & FFS_METADATA_GUESSED) != 0);
+    Entry->Attributes   = Record->Attributes;
+    Entry->Size         = Record->Size;
+    Entry->SizeKnown    = (BOOLEAN) ((Record->Flags & FFS_METADATA_SIZE_KNOWN) != 0);
+    Entry->ContentSize  = Record->ContentSize;
+    Entry->HasData      = (BOOLEAN) ((Record->Flags & FFS_METADATA_HAS_DATA) != 0);
+    Entry->DataOffset   = Record->DataOffset;
+    Entry->HasDirect    = (BOOLEAN) ((Record->Flags & FFS_METADATA_HAS_DIRECT) != 0);
+    Entry->DirectOffset = Record->DirectOffset;
+    Entry->DirectSize   = Record->DirectSize;
+
+    //
+    // Copy out the file's UI name, which has to be terminated where the
+    // record says it ends.
+    //
+    if (Record->NameLength != 0) {
+      Name = (CHAR16 *) (Blob + NameOffset);
+
+      if (Name[Record->NameLength - 1] != CHAR_NULL) {
+        goto Done;
+      }
+
+      EntryNames[Index] = AllocateCopyPool (Record->NameLength * sizeof (CHAR16), Name);
+
+      if (EntryNames[Index] == NULL) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Done;
+      }
+
+      NameOffset += Record->NameLength * sizeof (CHAR16);
+    }
+  }
+
+  if (NameOffset != NamesEnd) {
+    goto Done;
+  }
+
+  //
+  // Without saved names the name index is built on demand, as usual.
+  //
+  if ((Header->Flags & FFS_METADATA_HAS_NAMES) == 0) {
+    FreePool (EntryNames);
+    EntryNames = NULL;
+  }
+
+  *Files    = Entries;
+  *NumFiles = Header->NumFiles;
+  *Names    = EntryNames;
+  Entries    = NULL;
+  EntryNames = NULL;
+  Status     = EFI_SUCCESS;
+
+Done:
+  if (EntryNames != NULL) {
+    FvFreeNames (EntryNames, Header->NumFiles);
+  }
+
+  if (Entries != NULL) {
+    FreePool (Entries);
+  }
+
+  FreePool (Blob);
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_INFO, "FvLoadMetadata: Not using %s: %r\n", VariableName, Status));
+  }
+
+  return Status;
+}
+
+/**
+  Saves the metadata of a freshly indexed volume, so that the next boot can
+  load it instead of walking the volume. Only what indexing has already
+  learnt is saved: executables that have yet to be sized stay unsized, and
+  UI names are only saved if the name index has already been built. Nothing
+  is saved if the metadata would not fit in a variable. Failing to save is
+  not an error.
+
+  @param  Fs           Private data for a filesystem with a file index.
+  @param  Key          The volume's key.
+  @param  VariableName The name of the variable to hold the metadata.
+
+**/
+VOID
+FvSaveMetadata (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN FFS_METADATA_KEY         *Key,
+  IN CHAR16                   *VariableName
+  )
+{
+  EFI_STATUS          Status;
+  UINT8               *Blob;
+  UINTN               BlobSize, NamesSize, Index, Length;
+  UINT64              MaximumStorage, RemainingStorage, MaximumVariableSize;
+  FFS_METADATA_HEADER *Header;
+  FFS_METADATA_RECORD *Record;
+  FV_FILE_ENTRY       *Entry;
+  CHAR16              *Name;
+
+  //
+  // Size the metadata and check that everything fits before building it.
+  //
+  NamesSize = 0;
+
+  for (Index = 0; Index < Fs->NumFiles; Index++) {
+    Entry = &Fs->Files[Index];
+
+    if (Entry->Size > MAX_UINT32 || Entry->ContentSize > MAX_UINT32 ||
+        Entry->DataOffset > MAX_UINT32 || Entry->DirectOffset > MAX_UINT32 ||
+        Entry->DirectSize > MAX_UINT32) {
+      return;
+    }
+
+    if (Fs->NameIndexValid && Entry->UiName != NULL) {
+      NamesSize += StrSize (Entry->UiName);
+    }
+  }
+
+  BlobSize = sizeof (FFS_METADATA_HEADER) +
+             Fs->NumFiles * sizeof (FFS_METADATA_RECORD) +
+             NamesSize;
+
+  if (BlobSize > MAX_UINT32) {
+    return;
+  }
+
+  if (gRT->Hdr.Revision >= EFI_2_00_SYSTEM_TABLE_REVISION) {
+    Status = gRT->QueryVariableInfo (
+                    EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+                    &MaximumStorage,
+                    &RemainingStorage,
+                    &MaximumVariableSize);
+
+    if (!EFI_ERROR (Status) && BlobSize + StrSize (VariableName) > MaximumVariableSize) {
+      DEBUG ((EFI_D_INFO, "FvSaveMetadata: %d bytes don't fit in %s\n", BlobSize, VariableName));
+      return;
+    }
+  }
+
+  Blob = AllocateZeroPool (BlobSize);
+
+  if (Blob == NULL) {
+    return;
+  }
+
+  Header = (FFS_METADATA_HEADER *) Blob;
+  Header->Signature = FFS_METADATA_SIGNATURE;
+  Header->Version   = FFS_METADATA_VERSION;
+  Header->NumFiles  = (UINT32) Fs->NumFiles;
+  Header->NamesSize = (UINT32) NamesSize;
+  Header->Flags     = Fs->NameIndexValid ? FFS_METADATA_HAS_NAMES : 0;
+  CopyMem (&Header->Key, Key, sizeof (FFS_METADATA_KEY));
+
+  //
+  // Lay out one record per file, followed by the names they refer to.
+  //
+  Record = (FFS_METADATA_RECORD *) (Blob + sizeof (FFS_METADATA_HEADER));
+  Name   = (CHAR16 *) (Record + Fs->NumFiles);
+
+  for (Index = 0; Index < Fs->NumFiles; Index++, Record++) {
+    Entry = &Fs->Files[Index];
+    CopyGuid (&Record->NameGuid, &Entry->NameGuid);
+
+    Record->Size         = (UINT32) Entry->Size;
+    Record->Attributes   = (UINT32) Entry->Attributes;
+    Record->DataOffset   = (UINT32) Entry->DataOffset;
+    Record->DirectOffset = (UINT32) Entry->DirectOffset;
+    Record->DirectSize   = (UINT32) Entry->DirectSize;
+    Record->ContentSize  = (UINT32) Entry->ContentSize;
+    Record->FileType     = Entry->FileType;
+    Record->Flags        = 0;
+
+    if (Entry->IsExecutable) {
+      Record->Flags |= FFS_METADATA_EXECUTABLE;
+    }
+
+    if (Entry->Guessed) {
+      Record->Flags |= FFS_METADATA_GUESSED;
+    }
+
+    if (Entry->HasData) {
+      Record->Flags |= FFS_METADATA_HAS_DATA;
+    }
+
+    if (Entry->HasDirect) {
+      Record->Flags |= FFS_METADATA_HAS_DIRECT;
+    }
+
+    if (Entry->SizeKnown) {
+      Record->Flags |= FFS_METADATA_SIZE_KNOWN;
+    }
+
+    if (Fs->NameIndexValid && Entry->UiName != NULL) {
+      Length             = StrLen (Entry->UiName) + 1;
+      Record->NameLength = (UINT16) Length;
+      CopyMem (Name, Entry->UiName, Length * sizeof (CHAR16));
+      Name += Length;
+    }
+  }
+
+  Status = gRT->SetVariable (
+                  VariableName,
+                  &gFfsMetadataCacheGuid,
+                  EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+                  BlobSize,
+                  Blob);
+
+  DEBUG ((EFI_D_INFO, "FvSaveMetadata: Saved %d bytes to %s: %r\n", BlobSize, VariableName, Status));
+  FreePool (Blob);
+
+  //
+  // Save the metadata again once the UI names have been harvested anyway.
+  //
+  Fs->NamesPending = (BOOLEAN) (!EFI_ERROR (Status) && !Fs->NameIndexValid);
+}
+
+/**
+  Saves a volume's metadata again now that its UI names are known, when it
+  was first saved without them. The names are never harvested just to be
+  saved: this is only done once something has built the name index anyway.
+
+  @param  Fs Private data for a filesystem with a UI name index.
+
+**/
+VOID
+FvSaveMetadataNames (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  FFS_METADATA_KEY Key;
+  CHAR16           VariableName[FFS_METADATA_NAME_LENGTH];
+
+  if (!Fs->NamesPending) {
+    return;
+  }
+
+  Fs->NamesPending = FALSE;
+
+  if (!EFI_ERROR (FvGetMetadataKey (Fs, &Key, VariableName))) {
+    FvSaveMetadata (Fs, &Key, VariableName);
+  }
+}
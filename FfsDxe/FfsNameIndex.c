@@ -0,0 +1,481 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include "Ffs.h"
+
+//
+// Misc. helper methods
+//
+
+/**
+  Folds an ASCII letter to lower case, so that names can be matched and
+  hashed without regard to case. Other characters are returned unchanged.
+
+  @param  Char The character to fold.
+
+  @retval The folded character.
+
+**/
+CHAR16
+FvFoldChar (
+  IN CHAR16 Char
+  )
+{
+  if (Char >= L'A' && Char <= L'Z') {
+    return (CHAR16) (Char - L'A' + L'a');
+  }
+
+  return Char;
+}
+
+/**
+  Hashes a name for the name index's hash table, using 32-bit FNV-1a over the
+  case-folded characters.
+
+  @param  Name       The name to hash.
+  @param  NameLength Number of characters in Name.
+
+  @retval The hash of the name.
+
+**/
+UINT32
+FvHashName (
+  IN CHAR16 *Name,
+  IN UINTN  NameLength
+  )
+{
+  UINT32 Hash;
+  UINTN  Index;
+
+  Hash = 0x811C9DC5;
+
+  for (Index = 0; Index < NameLength; Index++) {
+    Hash = (Hash ^ FvFoldChar (Name[Index])) * 0x01000193;
+  }
+
+  return Hash;
+}
+
+/**
+  Determines if an interned name matches a name being looked up.
+
+  @param  Interned   The terminated name held in the name index.
+  @param  Name       The name being looked up.
+  @param  NameLength Number of characters in Name.
+
+  @retval TRUE  The names match without regard to case.
+  @retval FALSE The names differ.
+
+**/
+BOOLEAN
+FvNamesMatch (
+  IN CHAR16 *Interned,
+  IN CHAR16 *Name,
+  IN UINTN  NameLength
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < NameLength; Index++) {
+    if (Interned[Index] == CHAR_NULL ||
+        FvFoldChar (Interned[Index]) != FvFoldChar (Name[Index])) {
+      return FALSE;
+    }
+  }
+
+  return (BOOLEAN) (Interned[NameLength] == CHAR_NULL);
+}
+
+/**
+  Reads the name in a file's UI section. When the section is stored in the
+  volume as-is, only section headers and the name itself are read; otherwise
+  the section is extracted through FV2.
+
+  @param  Fs     Private data for the filesystem the file is a part of.
+  @param  Entry  Index entry for the file whose name is read.
+  @param  UiName On output, a terminated pool copy of the name.
+
+  @retval EFI_SUCCESS          The name was read.
+  @retval EFI_NOT_FOUND        The file has no UI section.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to copy the name.
+  @retval other                The UI section could not be read.
+
+**/
+EFI_STATUS
+FvReadUiName (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  FV_FILE_ENTRY            *Entry,
+  OUT CHAR16                   **UiName
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Offset, Size;
+  VOID       *Buffer;
+  UINT32     AuthenticationStatus;
+  CHAR16     *Name;
+
+  if (Entry->FileType == EFI_FV_FILETYPE_RAW) {
+    return EFI_NOT_FOUND;
+  }
+
+  Buffer = NULL;
+  Size   = 0;
+  Status = EFI_UNSUPPORTED;
+
+  if (Entry->HasData) {
+    Status = FvFindDirectSection (
+               Fs,
+               Entry->DataOffset,
+               Entry->Size,
+               0,
+               EFI_SECTION_USER_INTERFACE,
+               &Offset,
+               &Size);
+
+    if (Status == EFI_NOT_FOUND) {
+      return Status;
+    }
+  }
+
+  //
+  // Names are copied with room for a terminator, since nothing guarantees
+  // that the section holds one.
+  //
+  if (!EFI_ERROR (Status)) {
+    Name = AllocateZeroPool (Size + sizeof (CHAR16));
+
+    if (Name == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = FvReadBytes (Fs, Offset, Size, Name);
+  } else {
+    Status = FvReadSection (
+               Fs,
+               &Entry->NameGuid,
+               EFI_SECTION_USER_INTERFACE,
+               0,
+               &Buffer,
+               &Size,
+               &AuthenticationStatus);
+
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    Name = AllocateZeroPool (Size + sizeof (CHAR16));
+
+    if (Name == NULL) {
+      FvFreeBuffer (Fs, Buffer);
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    CopyMem (Name, Buffer, Size);
+    FvFreeBuffer (Fs, Buffer);
+  }
+
+  if (EFI_ERROR (Status)) {
+    FreePool (Name);
+    return Status;
+  }
+
+  *UiName = Name;
+  return EFI_SUCCESS;
+}
+
+/**
+  Frees an array of harvested UI names that won't be interned.
+
+  @param  Names    Pool array of terminated pool names, some of which may be NULL.
+  @param  NumNames Number of entries in Names.
+
+**/
+VOID
+FvFreeNames (
+  IN CHAR16 **Names,
+  IN UINTN  NumNames
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < NumNames; Index++) {
+    if (Names[Index] != NULL) {
+      FreePool (Names[Index]);
+    }
+  }
+
+  FreePool (Names);
+}
+
+/**
+  Builds the UI name index for a filesystem instance from names that have
+  already been harvested. The names are interned into a single arena and the
+  files are hashed by name so that later lookups are a probe. Files are
+  inserted in index order, so the first of any files sharing a name is the one
+  that is found. The harvested names, and the array holding them, are freed
+  whether or not the index could be built.
+
+  @param  Fs    Private data for a filesystem with a file index.
+  @param  Names Pool array holding a terminated pool copy of every file's UI
+                name, in index order, or NULL for files without one.
+
+  @retval EFI_SUCCESS          The index was built.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to build the index.
+
+**/
+EFI_STATUS
+FvInternNames (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     CHAR16                   **Names
+  )
+{
+  EFI_STATUS    Status;
+  CHAR16        *Arena, *Interned;
+  FV_FILE_ENTRY **NameTable, *Entry;
+  UINTN         Index, NumNames, ArenaSize, Slots, Slot, Length;
+
+  //
+  // Size the arena, dropping empty names along the way.
+  //
+  NumNames  = 0;
+  ArenaSize = 0;
+
+  for (Index = 0; Index < Fs->NumFiles; Index++) {
+    if (Names[Index] != NULL && Names[Index][0] == CHAR_NULL) {
+      FreePool (Names[Index]);
+      Names[Index] = NULL;
+    }
+
+    if (Names[Index] != NULL) {
+      ArenaSize += StrSize (Names[Index]);
+      NumNames++;
+    }
+  }
+
+  Status = EFI_SUCCESS;
+  Slots  = FV_HASH_MIN_SLOTS;
+
+  while (Slots < NumNames * 2) {
+    Slots *= 2;
+  }
+
+  Arena     = AllocatePool (MAX (ArenaSize, sizeof (CHAR16)));
+  NameTable = AllocateZeroPool (Slots * sizeof (FV_FILE_ENTRY *));
+
+  if (Arena == NULL || NameTable == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Intern the names and hash them, dropping the harvested copies.
+  //
+  Interned = Arena;
+
+  for (Index = 0; Index < Fs->NumFiles; Index++) {
+    if (Names[Index] == NULL) {
+      continue;
+    }
+
+    if (!EFI_ERROR (Status)) {
+      Length = StrLen (Names[Index]);
+      StrCpy (Interned, Names[Index]);
+
+      Entry         = &Fs->Files[Index];
+      Entry->UiName = Interned;
+      Interned     += Length + 1;
+
+      Slot = FvHashName (Entry->UiName, Length) & (Slots - 1);
+
+      while (NameTable[Slot] != NULL &&
+             !FvNamesMatch (NameTable[Slot]->UiName, Entry->UiName, Length)) {
+        Slot = (Slot + 1) & (Slots - 1);
+      }
+
+      if (NameTable[Slot] == NULL) {
+        NameTable[Slot] = Entry;
+      }
+    }
+
+    FreePool (Names[Index]);
+  }
+
+  FreePool (Names);
+
+  if (EFI_ERROR (Status)) {
+    for (Index = 0; Index < Fs->NumFiles; Index++) {
+      Fs->Files[Index].UiName = NULL;
+    }
+
+    if (Arena != NULL) {
+      FreePool (Arena);
+    }
+
+    if (NameTable != NULL) {
+      FreePool (NameTable);
+    }
+
+    return Status;
+  }
+
+  Fs->NameArena      = Arena;
+  Fs->NameTable      = NameTable;
+  Fs->NameMask       = Slots - 1;
+  Fs->NameIndexValid = TRUE;
+
+  DEBUG ((EFI_D_INFO, "FvInternNames: Indexed %d names\n", NumNames));
+  return EFI_SUCCESS;
+}
+
+/**
+  Builds the UI name index for a filesystem instance. Every file's UI name is
+  harvested once, and the names are then interned and hashed by
+  FvInternNames().
+
+  @param  Fs Private data for a filesystem with a file index.
+
+  @retval EFI_SUCCESS          The index was built.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to build the index.
+
+**/
+EFI_STATUS
+FvBuildNameIndex (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  EFI_STATUS Status;
+  CHAR16     **Names;
+  UINTN      Index;
+
+  Names = AllocateZeroPool (MAX (Fs->NumFiles, 1) * sizeof (CHAR16 *));
+
+  if (Names == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Harvest every file's name. Files without a usable UI section simply have
+  // no name.
+  //
+  for (Index = 0; Index < Fs->NumFiles; Index++) {
+    Status = FvReadUiName (Fs, &Fs->Files[Index], &Names[Index]);
+
+    if (Status == EFI_OUT_OF_RESOURCES) {
+      FvFreeNames (Names, Index);
+      return Status;
+    }
+  }
+
+  Status = FvInternNames (Fs, Names);
+
+  if (!EFI_ERROR (Status)) {
+    FvSaveMetadataNames (Fs);
+  }
+
+  return Status;
+}
+
+//
+// UI name index
+//
+
+/**
+  Finds a file by the name in its UI section. The volume's name index is
+  built the first time a name is looked up, after which every lookup is a
+  single hash probe. Names are matched without regard to ASCII case.
+
+  @param  Fs         Private data for the filesystem to search.
+  @param  Name       The name to look up. It does not need to be terminated.
+  @param  NameLength Number of characters in Name.
+
+  @retval an entry A file has that UI name, and its index entry was returned.
+  @retval NULL     No file has that UI name, or the index could not be built.
+
+**/
+FV_FILE_ENTRY *
+FvFindFileByName (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN CHAR16                   *Name,
+  IN UINTN                    NameLength
+  )
+{
+  FV_FILE_ENTRY *Entry;
+  UINTN         Slot;
+
+  if (!Fs->NameIndexValid && EFI_ERROR (FvBuildNameIndex (Fs))) {
+    return NULL;
+  }
+
+  Slot = FvHashName (Name, NameLength) & Fs->NameMask;
+
+  //
+  // The table is never full, so an empty slot always ends the probe.
+  //
+  while ((Entry = Fs->NameTable[Slot]) != NULL) {
+    if (FvNamesMatch (Entry->UiName, Name, NameLength)) {
+      return Entry;
+    }
+
+    Slot = (Slot + 1) & Fs->NameMask;
+  }
+
+  return NULL;
+}
+
+/**
+  Releases a volume's UI name index, so that it is rebuilt the next time a
+  name is looked up.
+
+  @param  Fs Private data for the filesystem whose name index is released.
+
+**/
+VOID
+FvFreeNameIndex (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  UINTN Index;
+
+  if (!Fs->NameIndexValid) {
+    return;
+  }
+
+  for (Index = 0; Index < Fs->NumFiles; Index++) {
+    Fs->Files[Index].UiName = NULL;
+  }
+
+  FreePool (Fs->NameArena);
+  FreePool (Fs->NameTable);
+
+  Fs->NameIndexValid = FALSE;
+  Fs->NameArena      = NULL;
+  Fs->NameTable      = NULL;
+  Fs->NameMask       = 0;
+}
@@ -0,0 +1,659 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include "Ffs.h"
+
+//
+// Module-scope variables
+//
+
+///
+/// EFI_FV_FILE_ATTRIB_ALIGNMENT values for each FFS_ATTRIB_DATA_ALIGNMENT
+/// value, as the FV2 producer reports them.
+///
+CONST UINT8 mFvNestedAlignments[] = { 0, 4, 7, 9, 10, 12, 15, 16 };
+
+//
+// Misc. helper methods
+//
+
+/**
+  Finds a file in a nested volume by walking its file headers.
+
+  @param  Fs         Private data for a mounted nested volume.
+  @param  NameGuid   The GUID naming the file to find.
+  @param  FileHeader On output, the file's header.
+  @param  DataOffset On output, the offset of the file's FFS payload within
+                     the volume.
+  @param  DataSize   On output, the size of the file's FFS payload in bytes.
+
+  @retval EFI_SUCCESS   The file was found.
+  @retval EFI_NOT_FOUND The volume holds no such file.
+
+**/
+EFI_STATUS
+FvNestedFindFile (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  CONST EFI_GUID           *NameGuid,
+  OUT EFI_FFS_FILE_HEADER2     *FileHeader,
+  OUT UINTN                    *DataOffset,
+  OUT UINTN                    *DataSize
+  )
+{
+  UINTN Offset;
+
+  Offset = 0;
+
+  while (!EFI_ERROR (FvNextFile (Fs, &Offset, FileHeader, DataOffset, DataSize))) {
+    if (CompareGuid (&FileHeader->Name, NameGuid)) {
+      return EFI_SUCCESS;
+    }
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+/**
+  Converts the attributes in an FFS file header to the file attributes that
+  FV2 reports for it. Nested volumes are always held in memory.
+
+  @param  FfsAttributes The attributes from the FFS file header.
+
+  @retval The file's FV2 attributes.
+
+**/
+EFI_FV_FILE_ATTRIBUTES
+FvNestedFileAttributes (
+  IN UINT8 FfsAttributes
+  )
+{
+  EFI_FV_FILE_ATTRIBUTES Attributes;
+
+  Attributes  = mFvNestedAlignments[(FfsAttributes & FFS_ATTRIB_DATA_ALIGNMENT) >> 3];
+  Attributes |= EFI_FV_FILE_ATTRIB_MEMORY_MAPPED;
+
+  if ((FfsAttributes & FFS_ATTRIB_FIXED) != 0) {
+    Attributes |= EFI_FV_FILE_ATTRIB_FIXED;
+  }
+
+  return Attributes;
+}
+
+/**
+  Copies a range of a nested volume out to an FV2 caller. If *Buffer is NULL,
+  a buffer is allocated for the caller; otherwise as much of the range as
+  fits in the caller's buffer is copied.
+
+  @param  Fs         Private data for a mounted nested volume.
+  @param  Offset     Offset of the range within the volume.
+  @param  Size       Size of the range in bytes.
+  @param  Buffer     On input, the caller's buffer, or NULL. On output, the
+                     buffer holding the range.
+  @param  BufferSize On input, the size of the caller's buffer. On output,
+                     the number of bytes copied.
+
+  @retval EFI_SUCCESS               The range was copied.
+  @retval EFI_WARN_BUFFER_TOO_SMALL The range was truncated to fit the buffer.
+  @retval EFI_OUT_OF_RESOURCES      A buffer could not be allocated.
+  @retval other                     The range could not be read.
+
+**/
+EFI_STATUS
+FvNestedCopyOut (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     UINTN                    Offset,
+  IN     UINTN                    Size,
+  IN OUT VOID                     **Buffer,
+  IN OUT UINTN                    *BufferSize
+  )
+{
+  EFI_STATUS Status;
+  EFI_STATUS CopyStatus;
+
+  CopyStatus = EFI_SUCCESS;
+
+  if (*Buffer == NULL) {
+    *Buffer = AllocatePool (Size);
+
+    if (*Buffer == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+  } else if (*BufferSize < Size) {
+    Size       = *BufferSize;
+    CopyStatus = EFI_WARN_BUFFER_TOO_SMALL;
+  }
+
+  Status = FvReadBytes (Fs, Offset, Size, *Buffer);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  *BufferSize = Size;
+  return CopyStatus;
+}
+
+//
+// Nested FV2 protocol functions
+//
+
+/**
+  Returns the attributes of a nested volume, which is always readable.
+
+  @param  This         The nested volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  FvAttributes On output, the volume's attributes.
+
+  @retval EFI_SUCCESS The attributes were returned.
+
+**/
+EFI_STATUS
+EFIAPI
+FvNestedGetVolumeAttributes (
+  IN  CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  OUT EFI_FV_ATTRIBUTES                   *FvAttributes
+  )
+{
+  *FvAttributes = EFI_FV2_READ_STATUS | EFI_FV2_MEMORY_MAPPED;
+  return EFI_SUCCESS;
+}
+
+/**
+  Sets the attributes of a nested volume, which cannot be changed.
+
+  @param  This         The nested volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  FvAttributes The requested attributes.
+
+  @retval EFI_ACCESS_DENIED The attributes cannot be changed.
+
+**/
+EFI_STATUS
+EFIAPI
+FvNestedSetVolumeAttributes (
+  IN     CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN OUT EFI_FV_ATTRIBUTES                   *FvAttributes
+  )
+{
+  return EFI_ACCESS_DENIED;
+}
+
+/**
+  Reads a whole file from a nested volume.
+
+  @param  This                 The nested volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  NameGuid             The GUID naming the file to read.
+  @param  Buffer               On input, the caller's buffer, NULL to have one
+                               allocated, or a NULL pointer to only return
+                               the file's size, type and attributes. On
+                               output, the buffer holding the file's payload.
+  @param  BufferSize           On input, the size of the caller's buffer. On
+                               output, the number of bytes returned.
+  @param  FoundType            On output, the file's type.
+  @param  FileAttributes       On output, the file's attributes.
+  @param  AuthenticationStatus On output, 0, since nothing is authenticated.
+
+  @retval EFI_SUCCESS               The file was read.
+  @retval EFI_WARN_BUFFER_TOO_SMALL The file was truncated to fit the buffer.
+  @retval EFI_NOT_FOUND             The volume holds no such file.
+  @retval EFI_OUT_OF_RESOURCES      A buffer could not be allocated.
+
+**/
+EFI_STATUS
+EFIAPI
+FvNestedReadFile (
+  IN     CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN     CONST EFI_GUID                      *NameGuid,
+  IN OUT VOID                                **Buffer,
+  IN OUT UINTN                               *BufferSize,
+  OUT    EFI_FV_FILETYPE                     *FoundType,
+  OUT    EFI_FV_FILE_ATTRIBUTES              *FileAttributes,
+  OUT    UINT32                              *AuthenticationStatus
+  )
+{
+  EFI_STATUS               Status;
+  FILE_SYSTEM_PRIVATE_DATA *Fs;
+  EFI_FFS_FILE_HEADER2     FileHeader;
+  UINTN                    DataOffset, DataSize;
+
+  Fs     = FILE_SYSTEM_PRIVATE_DATA_FROM_FV2 (This);
+  Status = FvNestedFindFile (Fs, NameGuid, &FileHeader, &DataOffset, &DataSize);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  *FoundType            = FileHeader.Type;
+  *FileAttributes       = FvNestedFileAttributes (FileHeader.Attributes);
+  *AuthenticationStatus = 0;
+
+  if (Buffer == NULL) {
+    *BufferSize = DataSize;
+    return EFI_SUCCESS;
+  }
+
+  return FvNestedCopyOut (Fs, DataOffset, DataSize, Buffer, BufferSize);
+}
+
+/**
+  Reads a section of a file in a nested volume. Sections are found by
+  walking the file's section headers in place, the same way section
+  directories list them, so only sections that are not inside an encoded
+  encapsulation can be read. Instances are numbered in stream order, the
+  same way the FV2 producer numbers them.
+
+  @param  This                 The nested volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  NameGuid             The GUID naming the file to read.
+  @param  SectionType          The type of section to read, or EFI_SECTION_ALL
+                               for a section of any type.
+  @param  SectionInstance      The instance of the type to read.
+  @param  Buffer               On input, the caller's buffer, or NULL to have
+                               one allocated. On output, the buffer holding
+                               the section's contents.
+  @param  BufferSize           On input, the size of the caller's buffer. On
+                               output, the number of bytes returned.
+  @param  AuthenticationStatus On output, 0, since nothing is authenticated.
+
+  @retval EFI_SUCCESS               The section was read.
+  @retval EFI_WARN_BUFFER_TOO_SMALL The section was truncated to fit the buffer.
+  @retval EFI_NOT_FOUND             The file or the section does not exist.
+  @retval EFI_UNSUPPORTED           The section may be inside an encoded
+                                    encapsulation.
+  @retval EFI_OUT_OF_RESOURCES      A buffer could not be allocated.
+
+**/
+EFI_STATUS
+EFIAPI
+FvNestedReadSection (
+  IN     CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN     CONST EFI_GUID                      *NameGuid,
+  IN     EFI_SECTION_TYPE                    SectionType,
+  IN     UINTN                               SectionInstance,
+  IN OUT VOID                                **Buffer,
+  IN OUT UINTN                               *BufferSize,
+  OUT    UINT32                              *AuthenticationStatus
+  )
+{
+  EFI_STATUS               Status;
+  FILE_SYSTEM_PRIVATE_DATA *Fs;
+  EFI_FFS_FILE_HEADER2     FileHeader;
+  FV_SECTION_ENTRY         *Sections;
+  UINTN                    DataOffset, DataSize, NumSections, Capacity, Index;
+
+  Fs     = FILE_SYSTEM_PRIVATE_DATA_FROM_FV2 (This);
+  Status = FvNestedFindFile (Fs, NameGuid, &FileHeader, &DataOffset, &DataSize);
+
+  if (EFI_ERROR (Status) || FileHeader.Type == EFI_FV_FILETYPE_RAW) {
+    return EFI_NOT_FOUND;
+  }
+
+  Sections    = NULL;
+  NumSections = 0;
+  Capacity    = 0;
+  Status      = FvFindDirectSections (
+                  Fs,
+                  DataOffset,
+                  DataSize,
+                  0,
+                  &Sections,
+                  &NumSections,
+                  &Capacity);
+
+  //
+  // Sections listed ahead of an encoded encapsulation still have the right
+  // instance numbers, so they can be read even if the walk stopped early.
+  //
+  if (!EFI_ERROR (Status)) {
+    Status = EFI_NOT_FOUND;
+  }
+
+  for (Index = 0; Index < NumSections; Index++) {
+    if (SectionType != EFI_SECTION_ALL && Sections[Index].Type != SectionType) {
+      continue;
+    }
+
+    if (SectionInstance-- == 0) {
+      *AuthenticationStatus = 0;
+      Status = FvNestedCopyOut (
+                 Fs,
+                 Sections[Index].DirectOffset,
+                 Sections[Index].Size,
+                 Buffer,
+                 BufferSize);
+      break;
+    }
+  }
+
+  if (Sections != NULL) {
+    FreePool (Sections);
+  }
+
+  return Status;
+}
+
+/**
+  Writes files to a nested volume, which is read-only.
+
+  @param  This          The nested volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  NumberOfFiles Number of files to write.
+  @param  WritePolicy   The write policy.
+  @param  FileData      The files to write.
+
+  @retval EFI_WRITE_PROTECTED The volume is read-only.
+
+**/
+EFI_STATUS
+EFIAPI
+FvNestedWriteFile (
+  IN CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN UINT32                              NumberOfFiles,
+  IN EFI_FV_WRITE_POLICY                 WritePolicy,
+  IN EFI_FV_WRITE_FILE_DATA              *FileData
+  )
+{
+  return EFI_WRITE_PROTECTED;
+}
+
+/**
+  Gets the next file in a nested volume. The key holds the offset following
+  the file last returned, or 0 to start at the first file.
+
+  @param  This       The nested volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  Key        On input, where to continue the search from. On output,
+                     where to continue the next search from.
+  @param  FileType   On input, the type of file to find, or
+                     EFI_FV_FILETYPE_ALL. On output, the file's type.
+  @param  NameGuid   On output, the GUID naming the file.
+  @param  Attributes On output, the file's attributes.
+  @param  Size       On output, the size of the file's FFS payload in bytes.
+
+  @retval EFI_SUCCESS   A file was found.
+  @retval EFI_NOT_FOUND There are no more files of the type in the volume.
+
+**/
+EFI_STATUS
+EFIAPI
+FvNestedGetNextFile (
+  IN     CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN OUT VOID                                *Key,
+  IN OUT EFI_FV_FILETYPE                     *FileType,
+  OUT    EFI_GUID                            *NameGuid,
+  OUT    EFI_FV_FILE_ATTRIBUTES              *Attributes,
+  OUT    UINTN                               *Size
+  )
+{
+  EFI_STATUS               Status;
+  FILE_SYSTEM_PRIVATE_DATA *Fs;
+  EFI_FFS_FILE_HEADER2     FileHeader;
+  UINTN                    Offset, DataOffset, DataSize;
+
+  Fs     = FILE_SYSTEM_PRIVATE_DATA_FROM_FV2 (This);
+  Offset = *(UINTN *) Key;
+
+  do {
+    Status = FvNextFile (Fs, &Offset, &FileHeader, &DataOffset, &DataSize);
+
+    if (EFI_ERROR (Status)) {
+      return EFI_NOT_FOUND;
+    }
+  } while (*FileType != EFI_FV_FILETYPE_ALL && FileHeader.Type != *FileType);
+
+  *(UINTN *) Key = Offset;
+
+  *FileType   = FileHeader.Type;
+  *Attributes = FvNestedFileAttributes (FileHeader.Attributes);
+  *Size       = DataSize;
+  CopyGuid (NameGuid, &FileHeader.Name);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Gets information about a nested volume. No information types are known.
+
+  @param  This            The nested volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  InformationType The type of information to return.
+  @param  BufferSize      On input, the size of Buffer.
+  @param  Buffer          The buffer to return the information in.
+
+  @retval EFI_UNSUPPORTED The information type is not known.
+
+**/
+EFI_STATUS
+EFIAPI
+FvNestedGetInfo (
+  IN     CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN     CONST EFI_GUID                      *InformationType,
+  IN OUT UINTN                               *BufferSize,
+  OUT    VOID                                *Buffer
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+/**
+  Sets information about a nested volume. No information types are known.
+
+  @param  This            The nested volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  InformationType The type of information to set.
+  @param  BufferSize      The size of Buffer.
+  @param  Buffer          The information to set.
+
+  @retval EFI_UNSUPPORTED The information type is not known.
+
+**/
+EFI_STATUS
+EFIAPI
+FvNestedSetInfo (
+  IN CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN CONST EFI_GUID                      *InformationType,
+  IN UINTN                               BufferSize,
+  IN CONST VOID                          *Buffer
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+//
+// Protocol templates
+//
+
+///
+/// Template that the FV2 interface of every nested volume is copied from.
+///
+EFI_FIRMWARE_VOLUME2_PROTOCOL mFvNestedFv2Template = {
+  FvNestedGetVolumeAttributes,
+  FvNestedSetVolumeAttributes,
+  FvNestedReadFile,
+  FvNestedReadSection,
+  FvNestedWriteFile,
+  FvNestedGetNextFile,
+  sizeof (UINTN),
+  NULL,
+  FvNestedGetInfo,
+  FvNestedSetInfo
+};
+
+//
+// Nested firmware volumes
+//
+
+/**
+  Mounts the firmware volume nested in a file, the first time its directory
+  is opened. The volume image is extracted through the enclosing volume's FV2
+  instance once, decompressing it if need be, and kept in memory for as long
+  as the enclosing volume stays mounted. The nested volume is then indexed
+  and navigated like any other, through an FV2 interface over the image.
+
+  A nested volume's private data outlives remounts of the enclosing volume,
+  so that handles opened before a remount can still be closed; only its image
+  and index are released, and the same private data is used again when the
+  file is next opened.
+
+  @param  Fs     Private data for the filesystem holding the file.
+  @param  Entry  Index entry for a file that holds a nested volume.
+  @param  Nested On output, private data for the nested volume.
+
+  @retval EFI_SUCCESS          The nested volume is mounted and indexed.
+  @retval EFI_VOLUME_CORRUPTED The file does not hold a valid firmware volume.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory to mount the volume.
+  @retval other                The volume image could not be extracted.
+
+**/
+EFI_STATUS
+FvMountNestedVolume (
+  IN  FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN  FV_FILE_ENTRY            *Entry,
+  OUT FILE_SYSTEM_PRIVATE_DATA **Nested
+  )
+{
+  EFI_STATUS                 Status;
+  EFI_FIRMWARE_VOLUME_HEADER *FvHeader;
+  FILE_SYSTEM_PRIVATE_DATA   *Volume;
+  VOID                       *Image;
+  UINTN                      ImageSize;
+  UINT32                     AuthenticationStatus;
+
+  for (Volume = Fs->NestedVolumes; Volume != NULL; Volume = Volume->NextNested) {
+    if (CompareGuid (&Volume->ParentFile, &Entry->NameGuid)) {
+      break;
+    }
+  }
+
+  //
+  // Extract the volume image the first time the volume is entered. Repeat
+  // visits find it already in memory.
+  //
+  if (Volume == NULL || Volume->Image == NULL) {
+    Image     = NULL;
+    ImageSize = 0;
+
+    Status = FvReadSection (
+               Fs,
+               &Entry->NameGuid,
+               EFI_SECTION_FIRMWARE_VOLUME_IMAGE,
+               0,
+               &Image,
+               &ImageSize,
+               &AuthenticationStatus);
+
+    if (EFI_ERROR (Status)) {
+      DEBUG ((EFI_D_INFO, "FvMountNestedVolume: Extracting %g failed with %r\n", &Entry->NameGuid, Status));
+      return Status;
+    }
+
+    //
+    // Sanity check the firmware volume header before trusting its length.
+    //
+    FvHeader = Image;
+
+    if (ImageSize < sizeof (EFI_FIRMWARE_VOLUME_HEADER) ||
+        FvHeader->Signature != EFI_FVH_SIGNATURE ||
+        FvHeader->HeaderLength < sizeof (EFI_FIRMWARE_VOLUME_HEADER) ||
+        FvHeader->FvLength < FvHeader->HeaderLength ||
+        FvHeader->FvLength > ImageSize) {
+      DEBUG ((EFI_D_INFO, "FvMountNestedVolume: Invalid FV header in %g\n", &Entry->NameGuid));
+      FvFreeBuffer (Fs, Image);
+      return EFI_VOLUME_CORRUPTED;
+    }
+
+    if (Volume == NULL) {
+      Volume = AllocateCopyPool (
+                 sizeof (FILE_SYSTEM_PRIVATE_DATA),
+                 &mFileSystemPrivateDataTemplate
+                 );
+
+      if (Volume == NULL) {
+        FvFreeBuffer (Fs, Image);
+        return EFI_OUT_OF_RESOURCES;
+      }
+
+      CopyGuid (&Volume->ParentFile, &Entry->NameGuid);
+      CopyMem (&Volume->NestedFv2, &mFvNestedFv2Template, sizeof (EFI_FIRMWARE_VOLUME2_PROTOCOL));
+
+      Volume->Parent          = Fs;
+      Volume->FirmwareVolume2 = &Volume->NestedFv2;
+      Volume->NextNested      = Fs->NestedVolumes;
+      Fs->NestedVolumes       = Volume;
+    }
+
+    Volume->Image = Image;
+  }
+
+  FFS_PERF_START (FFS_PERF_INDEX);
+  Status = FvBuildFileIndex (Volume);
+  FFS_PERF_END (FFS_PERF_INDEX);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // The nested volume's root is known by the name of its directory.
+  //
+  UnicodeSPrint (Volume->RootInfo->FileName, SIZE_OF_FILENAME, L"%g.fv", &Volume->ParentFile);
+
+  *Nested = Volume;
+  return EFI_SUCCESS;
+}
+
+/**
+  Invalidates a volume and every volume nested in it. Each volume's file
+  index and cached contents are dropped and its generation moves on, so that
+  handles opened before now return EFI_MEDIA_CHANGED. Handle slabs are freed
+  if no handle is open, and the images of nested volumes are released, to be
+  extracted again when they are next opened.
+
+  @param  Fs Private data for the filesystem to invalidate.
+
+**/
+VOID
+FvInvalidateVolume (
+  IN OUT FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  FILE_SYSTEM_PRIVATE_DATA *Nested;
+
+  Fs->Generation++;
+  FvFreeFileIndex (Fs);
+  FfsCachePurge (Fs);
+  FfsReclaimHandles (Fs);
+
+  for (Nested = Fs->NestedVolumes; Nested != NULL; Nested = Nested->NextNested) {
+    FvInvalidateVolume (Nested);
+  }
+
+  if (Fs->Image != NULL) {
+    FvFreeBuffer (Fs, Fs->Image);
+
+    Fs->Image      = NULL;
+    Fs->MappedBase = NULL;
+    Fs->FvLength   = 0;
+  }
+}
@@ -0,0 +1,357 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include "Ffs.h"
+
+//
+// Module-scope variables
+//
+
+///
+/// Prefetch jobs waiting for the background worker, oldest first. The worker
+/// only gets to them once every queued ReadEx() request has completed.
+///
+LIST_ENTRY mFfsPrefetchQueue = INITIALIZE_LIST_HEAD_VARIABLE (mFfsPrefetchQueue);
+
+//
+// Misc. helper methods
+//
+
+/**
+  Queues a prefetch job for the background worker.
+
+  @param  Fs      Private data for the filesystem the file is a part of.
+  @param  Entry   Index entry for the file to prefetch.
+  @param  Section The section to prefetch, or NULL for the whole file.
+  @param  Owner   Handle reading ahead, or NULL for a directory walk.
+
+  @retval EFI_SUCCESS          The job was queued.
+  @retval EFI_OUT_OF_RESOURCES The job could not be allocated.
+
+**/
+EFI_STATUS
+FfsPrefetchQueue (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN FV_FILE_ENTRY            *Entry,
+  IN FV_SECTION_ENTRY         *Section,
+  IN FILE_PRIVATE_DATA        *Owner
+  )
+{
+  FFS_PREFETCH_JOB *Job;
+
+  Job = FvAllocateBuffer (Fs, sizeof (FFS_PREFETCH_JOB));
+
+  if (Job == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Job->Signature  = FFS_PREFETCH_JOB_SIGNATURE;
+  Job->FileSystem = Fs;
+  Job->Generation = Fs->Generation;
+  Job->Entry      = Entry;
+  Job->Section    = Section;
+  Job->Owner      = Owner;
+
+  InsertTailList (&mFfsPrefetchQueue, &Job->Link);
+  FfsIoSchedule ();
+  return EFI_SUCCESS;
+}
+
+/**
+  Decodes the contents of a file, or of one of its sections, into the content
+  cache ahead of use. Contents that are already cached, that a read would
+  only copy out of a memory-mapped volume, or that don't fit in the prefetch
+  budget are left alone. Contents stored uncompressed are read straight from
+  the volume in one go.
+
+  @param  Fs      Private data for the filesystem the file is a part of.
+  @param  Entry   Index entry for the file to prefetch.
+  @param  Section The section to prefetch, or NULL for the whole file.
+
+**/
+VOID
+FfsPrefetchContents (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN FV_FILE_ENTRY            *Entry,
+  IN FV_SECTION_ENTRY         *Section
+  )
+{
+  EFI_STATUS       Status;
+  EFI_SECTION_TYPE SectionType;
+  UINTN            Instance;
+  BOOLEAN          HasDirect;
+  UINTN            DirectOffset, Size;
+  VOID             *Contents;
+
+  FvGetContentsKey (Entry, Section, &SectionType, &Instance);
+
+  if (FfsCacheContains (Fs, &Entry->NameGuid, SectionType, Instance)) {
+    return;
+  }
+
+  //
+  // Work out how large the contents are, when that is known without decoding
+  // them, so that the budget can be checked up front.
+  //
+  if (Section != NULL) {
+    HasDirect    = Section->HasDirect;
+    DirectOffset = Section->DirectOffset;
+    Size         = Section->Size;
+  } else {
+    HasDirect    = Entry->HasDirect;
+    DirectOffset = Entry->DirectOffset;
+    Size         = HasDirect ? Entry->DirectSize : (Entry->SizeKnown ? Entry->ContentSize : 0);
+  }
+
+  if ((HasDirect && Fs->MappedBase != NULL) || !FfsCacheHasPrefetchRoom (Size)) {
+    return;
+  }
+
+  if (HasDirect) {
+    Contents = FvAllocateBuffer (Fs, Size);
+
+    if (Contents == NULL) {
+      return;
+    }
+
+    Status = FvReadBytes (Fs, DirectOffset, Size, Contents);
+  } else {
+    Status = FvDecodeContents (Fs, &Entry->NameGuid, SectionType, Instance, &Contents, &Size);
+
+    //
+    // Contents decoded for a file guessed to be executable are only kept if
+    // the file turns out to be one.
+    //
+    if (Section == NULL && SectionType == EFI_SECTION_PE32 &&
+        !FvConfirmExecutable (Fs, Entry, Status, Contents, Size)) {
+      Status = EFI_NOT_FOUND;
+    }
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = FfsCacheInsertPrefetched (Fs, &Entry->NameGuid, SectionType, Instance, Contents, Size);
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_INFO, "FfsPrefetchContents: Skipped %g with %r\n", &Entry->NameGuid, Status));
+
+    if (Contents != NULL) {
+      FvFreeBuffer (Fs, Contents);
+    }
+
+    return;
+  }
+
+  //
+  // Remember the decoded size so that sizing the file never decodes it again.
+  //
+  if (Section == NULL) {
+    Entry->SizeKnown   = TRUE;
+    Entry->ContentSize = Size;
+  }
+}
+
+//
+// Global functions
+//
+
+/**
+  Notes a completed read on a file handle. Once a handle has been read
+  FFS_READ_AHEAD_TRIGGER times in a row without seeking, the rest of its file
+  is read ahead into the content cache in the background. Only files read
+  through a volume that isn't memory-mapped are read ahead: encoded files
+  are decoded whole by their first read, and memory-mapped ones are a copy.
+
+  @param  PrivateFile The file handle that was read.
+
+**/
+VOID
+FfsReadAheadNoteRead (
+  IN FILE_PRIVATE_DATA *PrivateFile
+  )
+{
+  FILE_INFO *FileInfo;
+  BOOLEAN   HasDirect;
+  UINTN     DirectSize;
+
+  if (!FeaturePcdGet (PcdFfsPrefetch)) {
+    return;
+  }
+
+  FileInfo = PrivateFile->FileInfo;
+  FileInfo->SequentialReads++;
+
+  if (FileInfo->SequentialReads != FFS_READ_AHEAD_TRIGGER || FileInfo->Cached != NULL) {
+    return;
+  }
+
+  if (FileInfo->Section != NULL) {
+    HasDirect  = FileInfo->Section->HasDirect;
+    DirectSize = FileInfo->Section->Size;
+  } else {
+    HasDirect  = FileInfo->Entry->HasDirect;
+    DirectSize = FileInfo->Entry->DirectSize;
+  }
+
+  if (!HasDirect ||
+      PrivateFile->FileSystem->MappedBase != NULL ||
+      PrivateFile->Position >= DirectSize) {
+    return;
+  }
+
+  FfsPrefetchQueue (PrivateFile->FileSystem, FileInfo->Entry, FileInfo->Section, PrivateFile);
+}
+
+/**
+  Notes that a directory listing has returned a file, and queues the next
+  PcdFfsPrefetchDepth files of the listing for prefetch, so that their
+  metadata and contents are ready by the time the walk opens them.
+
+  @param  PrivateFile The directory handle being listed.
+  @param  Index       Index of the returned file among the listed files.
+  @param  NumFiles    Number of files in the listing.
+
+**/
+VOID
+FfsPrefetchNextFiles (
+  IN OUT FILE_PRIVATE_DATA *PrivateFile,
+  IN     UINTN             Index,
+  IN     UINTN             NumFiles
+  )
+{
+  FILE_SYSTEM_PRIVATE_DATA *Fs;
+  DIR_INFO                 *DirInfo;
+  FV_FILE_ENTRY            *Entry;
+  UINTN                    Next, Last;
+
+  if (!FeaturePcdGet (PcdFfsPrefetch)) {
+    return;
+  }
+
+  Fs      = PrivateFile->FileSystem;
+  DirInfo = PrivateFile->DirInfo;
+  Next    = MAX (DirInfo->Prefetched, Index + 1);
+  Last    = MIN (Index + 1 + (UINTN) PcdGet32 (PcdFfsPrefetchDepth), NumFiles);
+
+  for (; Next < Last; Next++) {
+    if (DirInfo->Directory == NULL) {
+      Entry = &Fs->Files[Next];
+    } else {
+      Entry = DirInfo->Directory->Members[Next];
+    }
+
+    if (EFI_ERROR (FfsPrefetchQueue (Fs, Entry, NULL, NULL))) {
+      break;
+    }
+  }
+
+  DirInfo->Prefetched = Next;
+}
+
+/**
+  Runs the oldest queued prefetch job on behalf of the background worker.
+  Jobs queued before their volume was invalidated are dropped.
+
+**/
+VOID
+FfsPrefetchRunOne (
+  VOID
+  )
+{
+  FFS_PREFETCH_JOB *Job;
+
+  if (IsListEmpty (&mFfsPrefetchQueue)) {
+    return;
+  }
+
+  Job = FFS_PREFETCH_JOB_FROM_LINK (GetFirstNode (&mFfsPrefetchQueue));
+  RemoveEntryList (&Job->Link);
+
+  if (Job->Generation == Job->FileSystem->Generation) {
+    FfsPrefetchContents (Job->FileSystem, Job->Entry, Job->Section);
+
+    //
+    // Warm the metadata of files a directory walk is heading for. Their
+    // sizes are known by now if the contents were decoded.
+    //
+    if (Job->Owner == NULL) {
+      FvEntryGetFileInfo (Job->FileSystem, Job->Entry);
+    }
+  }
+
+  if (Job->Owner != NULL) {
+    Job->Owner->FileInfo->ReadAheadReady = TRUE;
+  }
+
+  FvFreeBuffer (Job->FileSystem, Job);
+}
+
+/**
+  Determines whether any prefetch jobs are waiting for the background worker.
+
+  @retval TRUE  Jobs are queued.
+  @retval FALSE The queue is empty.
+
+**/
+BOOLEAN
+FfsPrefetchPending (
+  VOID
+  )
+{
+  return (BOOLEAN) !IsListEmpty (&mFfsPrefetchQueue);
+}
+
+/**
+  Drops the read-ahead jobs a handle has queued, before the handle is closed.
+
+  @param  PrivateFile The handle being closed.
+
+**/
+VOID
+FfsPrefetchCancel (
+  IN FILE_PRIVATE_DATA *PrivateFile
+  )
+{
+  LIST_ENTRY       *Link, *NextLink;
+  FFS_PREFETCH_JOB *Job;
+
+  for (Link = GetFirstNode (&mFfsPrefetchQueue);
+       !IsNull (&mFfsPrefetchQueue, Link);
+       Link = NextLink) {
+    Job      = FFS_PREFETCH_JOB_FROM_LINK (Link);
+    NextLink = GetNextNode (&mFfsPrefetchQueue, Link);
+
+    if (Job->Owner == PrivateFile) {
+      RemoveEntryList (&Job->Link);
+      FvFreeBuffer (Job->FileSystem, Job);
+    }
+  }
+}
@@ -0,0 +1,412 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include "Ffs.h"
+
+//
+// Misc. helper methods
+//
+
+/**
+  Counts the handles open on a volume and on every volume nested inside it.
+
+  @param  Fs Private data for the volume.
+
+  @retval The number of open handles.
+
+**/
+UINTN
+FvCountOpenHandles (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  FILE_SYSTEM_PRIVATE_DATA *Nested;
+  UINTN                    OpenHandles;
+
+  OpenHandles = Fs->OpenHandles;
+
+  for (Nested = Fs->NestedVolumes; Nested != NULL; Nested = Nested->NextNested) {
+    OpenHandles += FvCountOpenHandles (Nested);
+  }
+
+  return OpenHandles;
+}
+
+//
+// Counted allocations and FV2 calls
+//
+
+/**
+  Gets the counters that work done for a volume is charged to. Nested volumes
+  are charged to the top-level volume they were mounted from, since only that
+  volume's handle publishes its counters.
+
+  @param  Fs Private data for the volume the work was done for.
+
+  @retval The counters to update.
+
+**/
+FFS_VOLUME_STATISTICS *
+FvCounters (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs
+  )
+{
+  while (Fs->Parent != NULL) {
+    Fs = Fs->Parent;
+  }
+
+  return &Fs->Counters;
+}
+
+/**
+  Allocates a pool buffer while serving a file operation, counting it.
+
+  @param  Fs   Private data for the volume the buffer is allocated for.
+  @param  Size Number of bytes to allocate.
+
+  @retval a buffer The buffer was allocated.
+  @retval NULL     There was not enough memory.
+
+**/
+VOID *
+FvAllocateBuffer (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN UINTN                    Size
+  )
+{
+  VOID *Buffer;
+
+  Buffer = AllocatePool (Size);
+
+  if (Buffer != NULL) {
+    FvCounters (Fs)->Allocations++;
+  }
+
+  return Buffer;
+}
+
+/**
+  Frees a pool buffer that was counted when it was allocated, counting the
+  free.
+
+  @param  Fs     Private data for the volume the buffer was allocated for, or
+                 NULL if the volume has since been unmounted.
+  @param  Buffer The buffer to free.
+
+**/
+VOID
+FvFreeBuffer (
+  IN FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN VOID                     *Buffer
+  )
+{
+  if (Fs != NULL) {
+    FvCounters (Fs)->Frees++;
+  }
+
+  FreePool (Buffer);
+}
+
+/**
+  Calls a volume's GetNextFile(), counting the call.
+
+  @param  Fs         Private data for the volume to walk.
+  @param  Key        Search key, as for GetNextFile().
+  @param  FileType   File type filter on input, and the file's type on output.
+  @param  NameGuid   On output, the GUID naming the file.
+  @param  Attributes On output, the file's attributes.
+  @param  Size       On output, the file's size.
+
+  @retval The status returned by GetNextFile().
+
+**/
+EFI_STATUS
+FvGetNextFile (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN OUT VOID                     *Key,
+  IN OUT EFI_FV_FILETYPE          *FileType,
+  OUT    EFI_GUID                 *NameGuid,
+  OUT    EFI_FV_FILE_ATTRIBUTES   *Attributes,
+  OUT    UINTN                    *Size
+  )
+{
+  EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2;
+
+  Fv2 = Fs->FirmwareVolume2;
+  FvCounters (Fs)->GetNextFileCalls++;
+
+  return Fv2->GetNextFile (Fv2, Key, FileType, NameGuid, Attributes, Size);
+}
+
+/**
+  Calls a volume's ReadFile(), counting the call, the bytes it returns and
+  any buffer it allocates. Such a buffer is freed with FvFreeBuffer().
+
+  @param  Fs                   Private data for the volume to read from.
+  @param  NameGuid             The GUID naming the file to read.
+  @param  Buffer               Buffer to read into, as for ReadFile().
+  @param  BufferSize           Size of Buffer, as for ReadFile().
+  @param  FoundType            On output, the file's type.
+  @param  FileAttributes       On output, the file's attributes.
+  @param  AuthenticationStatus On output, the file's authentication status.
+
+  @retval The status returned by ReadFile().
+
+**/
+EFI_STATUS
+FvReadFile (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     CONST EFI_GUID           *NameGuid,
+  IN OUT VOID                     **Buffer,
+  IN OUT UINTN                    *BufferSize,
+  OUT    EFI_FV_FILETYPE          *FoundType,
+  OUT    EFI_FV_FILE_ATTRIBUTES   *FileAttributes,
+  OUT    UINT32                   *AuthenticationStatus
+  )
+{
+  EFI_STATUS                    Status;
+  EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2;
+  FFS_VOLUME_STATISTICS         *Counters;
+  BOOLEAN                       Allocates;
+
+  Fv2       = Fs->FirmwareVolume2;
+  Counters  = FvCounters (Fs);
+  Allocates = (BOOLEAN) (*Buffer == NULL);
+
+  Counters->ReadFileCalls++;
+
+  Status = Fv2->ReadFile (
+                  Fv2,
+                  NameGuid,
+                  Buffer,
+                  BufferSize,
+                  FoundType,
+                  FileAttributes,
+                  AuthenticationStatus);
+
+  if (!EFI_ERROR (Status)) {
+    Counters->BytesDecoded += *BufferSize;
+
+    if (Allocates && *Buffer != NULL) {
+      Counters->Allocations++;
+    }
+  }
+
+  return Status;
+}
+
+/**
+  Calls a volume's ReadSection(), counting the call, the bytes it returns and
+  any buffer it allocates. Such a buffer is freed with FvFreeBuffer().
+
+  @param  Fs                   Private data for the volume to read from.
+  @param  NameGuid             The GUID naming the file to read from.
+  @param  SectionType          Type of the section to read.
+  @param  SectionInstance      Instance of the section to read.
+  @param  Buffer               Buffer to read into, as for ReadSection().
+  @param  BufferSize           Size of Buffer, as for ReadSection().
+  @param  AuthenticationStatus On output, the section's authentication status.
+
+  @retval The status returned by ReadSection().
+
+**/
+EFI_STATUS
+FvReadSection (
+  IN     FILE_SYSTEM_PRIVATE_DATA *Fs,
+  IN     CONST EFI_GUID           *NameGuid,
+  IN     EFI_SECTION_TYPE         SectionType,
+  IN     UINTN                    SectionInstance,
+  IN OUT VOID                     **Buffer,
+  IN OUT UINTN                    *BufferSize,
+  OUT    UINT32                   *AuthenticationStatus
+  )
+{
+  EFI_STATUS                    Status;
+  EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2;
+  FFS_VOLUME_STATISTICS         *Counters;
+  BOOLEAN                       Allocates;
+
+  Fv2       = Fs->FirmwareVolume2;
+  Counters  = FvCounters (Fs);
+  Allocates = (BOOLEAN) (*Buffer == NULL);
+
+  Counters->ReadSectionCalls++;
+
+  Status = Fv2->ReadSection (
+                  Fv2,
+                  NameGuid,
+                  SectionType,
+                  SectionInstance,
+                  Buffer,
+                  BufferSize,
+                  AuthenticationStatus);
+
+  if (!EFI_ERROR (Status)) {
+    Counters->BytesDecoded += *BufferSize;
+
+    if (Allocates && *Buffer != NULL) {
+      Counters->Allocations++;
+    }
+  }
+
+  return Status;
+}
+
+//
+// Statistics protocol functions
+//
+
+/**
+  Returns a snapshot of a volume's counters.
+
+  @param  This       The statistics instance of the volume.
+  @param  Statistics On output, the volume's counters.
+
+  @retval EFI_SUCCESS           The counters were returned.
+  @retval EFI_INVALID_PARAMETER Statistics is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsGetStatistics (
+  IN  FFS_STATISTICS_PROTOCOL *This,
+  OUT FFS_VOLUME_STATISTICS   *Statistics
+  )
+{
+  FILE_SYSTEM_PRIVATE_DATA *Fs;
+
+  if (Statistics == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Fs = FILE_SYSTEM_PRIVATE_DATA_FROM_STATISTICS (This);
+
+  //
+  // Hold the driver lock so that the background worker can't update the
+  // counters halfway through the snapshot.
+  //
+  EfiAcquireLock (&mFfsLock);
+  CopyMem (Statistics, &Fs->Counters, sizeof (FFS_VOLUME_STATISTICS));
+  Statistics->OpenHandles = FvCountOpenHandles (Fs);
+  EfiReleaseLock (&mFfsLock);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Returns a snapshot of the decoded-content cache's counters, which are the
+  same whichever volume they are asked through.
+
+  @param  This       A statistics instance.
+  @param  Statistics On output, the cache's counters.
+
+  @retval EFI_SUCCESS           The counters were returned.
+  @retval EFI_INVALID_PARAMETER Statistics is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsGetCacheStatistics (
+  IN  FFS_STATISTICS_PROTOCOL *This,
+  OUT FFS_CACHE_STATISTICS    *Statistics
+  )
+{
+  if (Statistics == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  EfiAcquireLock (&mFfsLock);
+  FfsCacheGetStatistics (Statistics);
+  EfiReleaseLock (&mFfsLock);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Resets a volume's counters to zero, leaving OpenHandles as it is.
+
+  @param  This The statistics instance of the volume.
+
+  @retval EFI_SUCCESS The counters were reset.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsResetStatistics (
+  IN FFS_STATISTICS_PROTOCOL *This
+  )
+{
+  FILE_SYSTEM_PRIVATE_DATA *Fs;
+
+  Fs = FILE_SYSTEM_PRIVATE_DATA_FROM_STATISTICS (This);
+
+  EfiAcquireLock (&mFfsLock);
+  ZeroMem (&Fs->Counters, sizeof (FFS_VOLUME_STATISTICS));
+  EfiReleaseLock (&mFfsLock);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Drops a volume's file index and cached contents, and those of the volumes
+  nested inside it, as if its FV2 interface had been reinstalled. Open
+  handles would be left stale by this, so it is refused while there are any.
+
+  @param  This The statistics instance of the volume.
+
+  @retval EFI_SUCCESS       The volume's caches were dropped.
+  @retval EFI_ACCESS_DENIED Files are open on the volume.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsDropCaches (
+  IN FFS_STATISTICS_PROTOCOL *This
+  )
+{
+  EFI_STATUS               Status;
+  FILE_SYSTEM_PRIVATE_DATA *Fs;
+
+  Fs = FILE_SYSTEM_PRIVATE_DATA_FROM_STATISTICS (This);
+
+  EfiAcquireLock (&mFfsLock);
+
+  if (FvCountOpenHandles (Fs) != 0) {
+    Status = EFI_ACCESS_DENIED;
+  } else {
+    FvInvalidateVolume (Fs);
+    Status = EFI_SUCCESS;
+  }
+
+  EfiReleaseLock (&mFfsLock);
+
+  return Status;
+}
@@ -0,0 +1,336 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include "Ffs.h"
+
+//
+// Global data
+//
+
+///
+/// Ring buffer of traced calls, allocated once when the driver loads. The
+/// record for call N lives in slot N modulo the capacity.
+///
+FFS_TRACE_RECORD    *mFfsTraceRing;
+UINTN               mFfsTraceCapacity;
+UINT64              mFfsTraceCount;
+
+///
+/// Latency histogram of each traced operation.
+///
+FFS_TRACE_HISTOGRAM mFfsTraceHistograms[FfsTraceOperationMax];
+
+///
+/// Performance counter bounds, which tell whether it counts up or down.
+///
+UINT64              mFfsTraceCounterStart;
+UINT64              mFfsTraceCounterEnd;
+
+FFS_TRACE_PROTOCOL  mFfsTraceProtocol = {
+  FFS_TRACE_PROTOCOL_REVISION,
+  0,
+  FfsTraceGetRecords,
+  FfsTraceGetHistogram,
+  FfsTraceReset
+};
+
+//
+// Misc. helper methods
+//
+
+/**
+  Works out how many ticks have passed since a performance counter reading,
+  allowing for counters that count down and for a single wrap.
+
+  @param  Start The earlier counter reading.
+
+  @retval The number of ticks since Start.
+
+**/
+UINT64
+FfsTraceElapsed (
+  IN UINT64 Start
+  )
+{
+  UINT64 Now;
+
+  Now = GetPerformanceCounter ();
+
+  if (mFfsTraceCounterEnd >= mFfsTraceCounterStart) {
+    if (Now >= Start) {
+      return Now - Start;
+    }
+
+    return (mFfsTraceCounterEnd - Start) + (Now - mFfsTraceCounterStart);
+  }
+
+  if (Start >= Now) {
+    return Start - Now;
+  }
+
+  return (Start - mFfsTraceCounterEnd) + (mFfsTraceCounterStart - Now);
+}
+
+//
+// Tracing
+//
+
+/**
+  Sets up the trace when the driver is built with PcdFfsTrace: allocates the
+  ring buffer and publishes the trace protocol on the driver's image handle.
+  Nothing is allocated after this, however many calls are traced. A TimerLib
+  whose counter doesn't run would make every latency 0, so the trace is left
+  off with one, and the driver runs without it.
+
+  @param  ImageHandle The driver's image handle.
+
+  @retval EFI_SUCCESS          The trace was set up, is not built in, or was
+                               left off for want of a performance counter.
+  @retval EFI_OUT_OF_RESOURCES The ring buffer could not be allocated.
+  @retval other                The protocol could not be installed.
+
+**/
+EFI_STATUS
+FfsTraceInitialize (
+  IN EFI_HANDLE ImageHandle
+  )
+{
+  if (!FeaturePcdGet (PcdFfsTrace)) {
+    return EFI_SUCCESS;
+  }
+
+  mFfsTraceProtocol.TicksPerSecond = GetPerformanceCounterProperties (
+                                       &mFfsTraceCounterStart,
+                                       &mFfsTraceCounterEnd);
+
+  if (mFfsTraceProtocol.TicksPerSecond == 0) {
+    DEBUG ((EFI_D_ERROR, "FfsTraceInitialize: the performance counter doesn't run, map a real TimerLib\n"));
+    return EFI_SUCCESS;
+  }
+
+  mFfsTraceCapacity = MAX (PcdGet32 (PcdFfsTraceEntries), 1);
+  mFfsTraceRing     = AllocateZeroPool (mFfsTraceCapacity * sizeof (FFS_TRACE_RECORD));
+
+  if (mFfsTraceRing == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  return gBS->InstallMultipleProtocolInterfaces (
+                &ImageHandle,
+                &gFfsTraceProtocolGuid,
+                &mFfsTraceProtocol,
+                NULL
+                );
+}
+
+/**
+  Reads the performance counter at the start of a traced call.
+
+  @retval The counter reading, or 0 when tracing is not built in or is off.
+
+**/
+UINT64
+FfsTraceStart (
+  VOID
+  )
+{
+  if (!FeaturePcdGet (PcdFfsTrace) || mFfsTraceRing == NULL) {
+    return 0;
+  }
+
+  return GetPerformanceCounter ();
+}
+
+/**
+  Records a traced call in the ring buffer and in its operation's histogram,
+  overwriting the oldest record once the ring is full. Must be called with
+  the driver lock held.
+
+  @param  Operation   The operation that was called.
+  @param  PrivateFile The handle the call was made on or opened, or NULL.
+  @param  Position    Position in the file the call was made at, or set.
+  @param  Size        Number of bytes the caller asked for.
+  @param  Status      Status the call is returning.
+  @param  Start       Counter reading from FfsTraceStart().
+
+**/
+VOID
+FfsTraceRecord (
+  IN FFS_TRACE_OPERATION Operation,
+  IN FILE_PRIVATE_DATA   *PrivateFile,
+  IN UINT64              Position,
+  IN UINT64              Size,
+  IN EFI_STATUS          Status,
+  IN UINT64              Start
+  )
+{
+  FFS_TRACE_RECORD    *Record;
+  FFS_TRACE_HISTOGRAM *Histogram;
+  UINT64              Ticks;
+  UINTN               Bucket;
+
+  if (!FeaturePcdGet (PcdFfsTrace) || mFfsTraceRing == NULL) {
+    return;
+  }
+
+  Ticks  = FfsTraceElapsed (Start);
+  Record = &mFfsTraceRing[(UINTN) ModU64x32 (mFfsTraceCount, (UINT32) mFfsTraceCapacity)];
+
+  Record->Sequence  = mFfsTraceCount++;
+  Record->Operation = (UINT32) Operation;
+  Record->Status    = Status;
+  Record->Position  = Position;
+  Record->Size      = Size;
+  Record->Ticks     = Ticks;
+
+  if (PrivateFile != NULL && !PrivateFile->IsDirectory) {
+    CopyGuid (&Record->FileGuid, &PrivateFile->FileInfo->NameGuid);
+  } else {
+    ZeroMem (&Record->FileGuid, sizeof (EFI_GUID));
+  }
+
+  Bucket    = (Ticks == 0) ? 0 : (UINTN) HighBitSet64 (Ticks) + 1;
+  Histogram = &mFfsTraceHistograms[Operation];
+
+  Histogram->Count++;
+  Histogram->TotalTicks += Ticks;
+  Histogram->MaxTicks    = MAX (Histogram->MaxTicks, Ticks);
+  Histogram->Buckets[MIN (Bucket, FFS_TRACE_HISTOGRAM_BUCKETS - 1)]++;
+}
+
+//
+// Trace protocol functions
+//
+
+/**
+  Returns the traced calls still held in the ring buffer, oldest first.
+
+  @param  This       The trace instance.
+  @param  NumRecords On input, the number of records Records can hold. On
+                     output, the number of records returned, or needed.
+  @param  Records    The buffer to return the records in.
+
+  @retval EFI_SUCCESS           The records were returned.
+  @retval EFI_BUFFER_TOO_SMALL  Records is too small. NumRecords was updated.
+  @retval EFI_INVALID_PARAMETER NumRecords is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsTraceGetRecords (
+  IN     FFS_TRACE_PROTOCOL *This,
+  IN OUT UINTN              *NumRecords,
+  OUT    FFS_TRACE_RECORD   *Records
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Held, Index;
+  UINT64     First;
+
+  if (NumRecords == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  EfiAcquireLock (&mFfsLock);
+
+  Held  = (mFfsTraceCount < mFfsTraceCapacity) ? (UINTN) mFfsTraceCount : mFfsTraceCapacity;
+  First = mFfsTraceCount - Held;
+
+  if (*NumRecords < Held || (Held > 0 && Records == NULL)) {
+    Status = EFI_BUFFER_TOO_SMALL;
+  } else {
+    for (Index = 0; Index < Held; Index++) {
+      CopyMem (
+        &Records[Index],
+        &mFfsTraceRing[(UINTN) ModU64x32 (First + Index, (UINT32) mFfsTraceCapacity)],
+        sizeof (FFS_TRACE_RECORD));
+    }
+
+    Status = EFI_SUCCESS;
+  }
+
+  *NumRecords = Held;
+  EfiReleaseLock (&mFfsLock);
+
+  return Status;
+}
+
+/**
+  Returns the latency histogram of an operation.
+
+  @param  This      The trace instance.
+  @param  Operation The operation whose histogram is returned.
+  @param  Histogram On output, the operation's histogram.
+
+  @retval EFI_SUCCESS           The histogram was returned.
+  @retval EFI_INVALID_PARAMETER Operation is not traced, or Histogram is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsTraceGetHistogram (
+  IN  FFS_TRACE_PROTOCOL  *This,
+  IN  FFS_TRACE_OPERATION Operation,
+  OUT FFS_TRACE_HISTOGRAM *Histogram
+  )
+{
+  if ((UINTN) Operation >= FfsTraceOperationMax || Histogram == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  EfiAcquireLock (&mFfsLock);
+  CopyMem (Histogram, &mFfsTraceHistograms[Operation], sizeof (FFS_TRACE_HISTOGRAM));
+  EfiReleaseLock (&mFfsLock);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Empties the ring buffer and clears every histogram.
+
+  @param  This The trace instance.
+
+  @retval EFI_SUCCESS The trace was reset.
+
+**/
+EFI_STATUS
+EFIAPI
+FfsTraceReset (
+  IN FFS_TRACE_PROTOCOL *This
+  )
+{
+  EfiAcquireLock (&mFfsLock);
+  mFfsTraceCount = 0;
+  ZeroMem (mFfsTraceHistograms, sizeof (mFfsTraceHistograms));
+  EfiReleaseLock (&mFfsLock);
+
+  return EFI_SUCCESS;
+}
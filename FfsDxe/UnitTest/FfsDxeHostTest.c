@@ -0,0 +1,1225 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include <Uefi.h>
+#include <Guid/FileInfo.h>
+#include <Protocol/SimpleFileSystem.h>
+#include <Protocol/FfsStatistics.h>
+#include <IndustryStandard/PeImage.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PrintLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UnitTestLib.h>
+#include <Library/CountingMemoryAllocationLib.h>
+#include <Library/MockFirmwareVolume2Lib.h>
+
+//
+// Constants
+//
+
+#define UNIT_TEST_APP_NAME     "FfsDxe Host Tests"
+#define UNIT_TEST_APP_VERSION  "0.1"
+
+#define FFS_TEST_SEED          0x46667344
+#define FFS_TEST_CHUNK_SIZE    512
+#define FFS_TEST_INFO_SIZE     (SIZE_OF_EFI_FILE_INFO + 256)
+#define FFS_TEST_NAME_LENGTH   64
+#define FFS_TEST_MAX_DEPTH     4
+#define FFS_TEST_RANGES        4
+#define FFS_TEST_COMPARE_FILES 256
+#define FFS_TEST_DROP_FILES    64
+
+///
+/// How much the cost per file may grow from one volume size to the next, ten
+/// times larger, before the growth is taken to be worse than linear. Lookups
+/// that are logarithmic stay well under it, and quadratic ones go ten times
+/// over it.
+///
+#define FFS_TEST_MAX_GROWTH    2
+
+//
+// Types
+//
+
+///
+/// What a sweep measures on each volume.
+///
+typedef enum {
+  FfsTestListing,        ///< Reads every entry of the root directory.
+  FfsTestOpen,           ///< Opens every file, by GUID or by UI name.
+  FfsTestSequentialRead, ///< Reads every file from start to end, in volume order.
+  FfsTestRandomRead,     ///< Reads a chunk at a random place of random files.
+  FfsTestAsyncRead,      ///< Queues a ReadEx() of every file before any of them completes.
+  FfsTestWalk            ///< Reads every file of every directory, type and section directories included.
+} FFS_TEST_OPERATION;
+
+///
+/// Context of a sweep test.
+///
+typedef struct {
+  MOCK_FV_ACCESS     Access;    ///< How the volumes can be reached besides FV2.
+  FFS_TEST_OPERATION Operation; ///< What is measured.
+} FFS_TEST_CONTEXT;
+
+///
+/// What an operation cost on a volume.
+///
+typedef struct {
+  UINT64 Calls;       ///< Calls made to the volume's FV2 and FVB instances.
+  UINT64 Allocations; ///< Pool and page allocations.
+  UINT64 Nanoseconds; ///< Time taken.
+} FFS_TEST_SAMPLE;
+
+//
+// Module-scope variables
+//
+
+///
+/// The numbers of files of the volumes a sweep measures.
+///
+CONST UINTN mFfsTestFileCounts[] = { 10, 100, 1000, 10000 };
+
+CHAR8 *mFfsTestOperationNames[] = {
+  "Listing", "Open", "SequentialRead", "RandomRead", "AsyncRead", "Walk"
+};
+
+FFS_TEST_CONTEXT mFfsTestContexts[] = {
+  { MockFvAccessFv2Only, FfsTestListing        },
+  { MockFvAccessFv2Only, FfsTestOpen           },
+  { MockFvAccessFv2Only, FfsTestSequentialRead },
+  { MockFvAccessFv2Only, FfsTestRandomRead     },
+  { MockFvAccessFv2Only, FfsTestAsyncRead      },
+  { MockFvAccessFv2Only, FfsTestWalk           },
+  { MockFvAccessFvb,     FfsTestListing        },
+  { MockFvAccessFvb,     FfsTestOpen           },
+  { MockFvAccessFvb,     FfsTestSequentialRead },
+  { MockFvAccessFvb,     FfsTestRandomRead     },
+  { MockFvAccessFvb,     FfsTestAsyncRead      },
+  { MockFvAccessFvb,     FfsTestWalk           },
+  { MockFvAccessMapped,  FfsTestListing        },
+  { MockFvAccessMapped,  FfsTestOpen           },
+  { MockFvAccessMapped,  FfsTestSequentialRead },
+  { MockFvAccessMapped,  FfsTestRandomRead     },
+  { MockFvAccessMapped,  FfsTestAsyncRead      },
+  { MockFvAccessMapped,  FfsTestWalk           }
+};
+
+///
+/// The ways of reaching a volume that the contents tests read through, each
+/// checked against a volume reached through FV2 alone.
+///
+MOCK_FV_ACCESS mFfsTestAccesses[] = { MockFvAccessFv2Only, MockFvAccessFvb, MockFvAccessMapped };
+
+//
+// Function prototypes
+//
+
+/**
+  The entry point of FfsDxe, which the tests call the way the DXE core would.
+
+  @param  ImageHandle The image handle of the driver.
+  @param  SystemTable The system table.
+
+  @retval EFI_SUCCESS The driver was initialized.
+  @retval other       The driver could not be initialized.
+
+**/
+EFI_STATUS
+EFIAPI
+InitializeFfsFileSystem (
+  IN EFI_HANDLE       ImageHandle,
+  IN EFI_SYSTEM_TABLE *SystemTable
+  );
+
+//
+// Misc. helper methods
+//
+
+/**
+  Describes the files of a generated volume: a mix of freeform files, raw
+  files, drivers and applications, of sizes from 16 bytes to 1KB. Freeform
+  files hold a RAW or a TE section, and drivers and applications a PE32
+  image for the machine the tests run on. Leaf sections are stored as is, in
+  an uncompressed compression section, or in a GUID-defined section that only
+  FV2 can decode. Some files are named. The files are small so that the
+  largest volumes stay small too, as volumes cannot be unmounted and every
+  one measured stays in memory.
+
+  @param  Files     The descriptions to fill out.
+  @param  FileCount Number of descriptions.
+  @param  Guesses   TRUE to make some images for another machine. The driver
+                    takes those for executables until it has read their
+                    image header, so their names change when it does.
+
+**/
+VOID
+FfsTestDescribeFiles (
+  OUT MOCK_FV_FILE_SPEC *Files,
+  IN  UINTN             FileCount,
+  IN  BOOLEAN           Guesses
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < FileCount; Index++) {
+    Files[Index].SectionType = EFI_SECTION_RAW;
+    Files[Index].Machine     = EFI_IMAGE_MACHINE_TYPE;
+    Files[Index].DataSize    = 16 << (Index % 7);
+    Files[Index].Encoding    = (MOCK_FV_ENCODING) (Index % 3);
+    Files[Index].Named       = (BOOLEAN) ((Index / 8) % 2 == 0);
+
+    switch (Index % 8) {
+    case 3:
+    case 5:
+      Files[Index].Type        = (Index % 8 == 3) ? EFI_FV_FILETYPE_DRIVER : EFI_FV_FILETYPE_APPLICATION;
+      Files[Index].SectionType = EFI_SECTION_PE32;
+      Files[Index].DataSize    = MAX (Files[Index].DataSize, 128);
+
+      if (Guesses && (Index / 8) % 4 == 3) {
+        Files[Index].Machine = EFI_IMAGE_MACHINE_ARMTHUMB_MIXED;
+      }
+
+      break;
+
+    case 6:
+      Files[Index].Type        = EFI_FV_FILETYPE_FREEFORM;
+      Files[Index].SectionType = EFI_SECTION_TE;
+      break;
+
+    case 7:
+      Files[Index].Type = EFI_FV_FILETYPE_RAW;
+      break;
+
+    default:
+      Files[Index].Type = EFI_FV_FILETYPE_FREEFORM;
+      break;
+    }
+  }
+}
+
+/**
+  Determines if the driver exposes a file of a generated volume as an
+  executable, once it has decoded the file if it had to.
+
+  @param  File The description of the file.
+
+  @retval TRUE  The file is exposed as a .efi file.
+  @retval FALSE The file is exposed as a .ffs file.
+
+**/
+BOOLEAN
+FfsTestIsExecutable (
+  IN CONST MOCK_FV_FILE_SPEC *File
+  )
+{
+  return (BOOLEAN) ((File->Type == EFI_FV_FILETYPE_DRIVER || File->Type == EFI_FV_FILETYPE_APPLICATION) &&
+                    File->SectionType == EFI_SECTION_PE32 &&
+                    EFI_IMAGE_MACHINE_TYPE_SUPPORTED (File->Machine));
+}
+
+/**
+  Makes the name a file of a generated volume is opened by: its UI name if
+  it has one, and its GUID otherwise, with the extension for its contents.
+
+  @param  Files The descriptions of the volume's files.
+  @param  Index The index of the file.
+  @param  Name  On output, the name, FFS_TEST_NAME_LENGTH characters at most.
+
+**/
+VOID
+FfsTestFileName (
+  IN  CONST MOCK_FV_FILE_SPEC *Files,
+  IN  UINTN                   Index,
+  OUT CHAR16                  *Name
+  )
+{
+  EFI_GUID NameGuid;
+  CHAR16   *Extension;
+
+  Extension = FfsTestIsExecutable (&Files[Index]) ? L"efi" : L"ffs";
+
+  if (Files[Index].Type != EFI_FV_FILETYPE_RAW && Files[Index].Named) {
+    UnicodeSPrint (Name, FFS_TEST_NAME_LENGTH * sizeof (CHAR16), L"File%d.%s", Index, Extension);
+  } else {
+    MockFvFileGuid (FFS_TEST_SEED, Index, &NameGuid);
+    UnicodeSPrint (Name, FFS_TEST_NAME_LENGTH * sizeof (CHAR16), L"%g.%s", &NameGuid, Extension);
+  }
+}
+
+/**
+  Installs a volume and opens its root directory through the driver, which
+  mounts the volume on its handle as soon as FV2 is installed.
+
+  @param  Image     The volume's image.
+  @param  ImageSize The size of the image.
+  @param  Access    How the volume can be reached besides FV2.
+  @param  Handle    On output, the volume's handle.
+  @param  Root      On output, the volume's root directory.
+
+  @retval EFI_SUCCESS The root directory was opened.
+  @retval other       The volume could not be installed, mounted or opened.
+
+**/
+EFI_STATUS
+FfsTestOpenVolume (
+  IN  VOID              *Image,
+  IN  UINTN             ImageSize,
+  IN  MOCK_FV_ACCESS    Access,
+  OUT EFI_HANDLE        *Handle,
+  OUT EFI_FILE_PROTOCOL **Root
+  )
+{
+  EFI_STATUS                      Status;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *SimpleFileSystem;
+
+  Status = MockFv2Install (Image, ImageSize, Access, Handle);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = gBS->HandleProtocol (
+                  *Handle,
+                  &gEfiSimpleFileSystemProtocolGuid,
+                  (VOID **) &SimpleFileSystem
+                  );
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // The volume is only scanned once it is opened, so that is where the
+  // counting starts.
+  //
+  MockFv2ResetCounters (*Handle);
+  ResetMemoryAllocationCounters ();
+
+  return SimpleFileSystem->OpenVolume (SimpleFileSystem, Root);
+}
+
+/**
+  Reads a file from its current position to its end.
+
+  @param  File  The file.
+  @param  Total On output, the number of bytes read.
+
+  @retval EFI_SUCCESS The file was read.
+  @retval other       The file could not be read.
+
+**/
+EFI_STATUS
+FfsTestReadToEnd (
+  IN  EFI_FILE_PROTOCOL *File,
+  OUT UINT64            *Total
+  )
+{
+  EFI_STATUS Status;
+  UINT8      Chunk[FFS_TEST_CHUNK_SIZE];
+  UINTN      Size;
+
+  *Total = 0;
+
+  do {
+    Size   = sizeof (Chunk);
+    Status = File->Read (File, &Size, Chunk);
+
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    *Total += Size;
+  } while (Size > 0);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Reads a whole file into a buffer, in a single read from its start.
+
+  @param  File         The file.
+  @param  Contents     On output, a pool buffer holding the file's contents.
+  @param  ContentsSize On output, the size of the file's contents.
+
+  @retval UNIT_TEST_PASSED            The file was read.
+  @retval UNIT_TEST_ERROR_TEST_FAILED The file could not be read, or read
+                                      short or long.
+
+**/
+UNIT_TEST_STATUS
+FfsTestReadAll (
+  IN  EFI_FILE_PROTOCOL *File,
+  OUT UINT8             **Contents,
+  OUT UINTN             *ContentsSize
+  )
+{
+  EFI_STATUS    Status;
+  EFI_FILE_INFO *Info;
+  UINT64        Buffer[FFS_TEST_INFO_SIZE / sizeof (UINT64)];
+  UINTN         Size;
+
+  Info   = (EFI_FILE_INFO *) Buffer;
+  Size   = sizeof (Buffer);
+  Status = File->GetInfo (File, &gEfiFileInfoGuid, &Size, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  *ContentsSize = (UINTN) Info->FileSize;
+  *Contents     = AllocatePool (MAX (*ContentsSize, 1));
+  UT_ASSERT_NOT_NULL (*Contents);
+
+  Status = File->SetPosition (File, 0);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Size   = *ContentsSize;
+  Status = File->Read (File, &Size, *Contents);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (Size, *ContentsSize);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Checks that a file reads as the bytes expected of it, both whole and in
+  random ranges.
+
+  @param  File         The file.
+  @param  Expected     The bytes expected.
+  @param  ExpectedSize Number of bytes expected.
+  @param  Random       State of the generator picking the ranges.
+
+  @retval UNIT_TEST_PASSED            The file read as expected.
+  @retval UNIT_TEST_ERROR_TEST_FAILED The file could not be read, or read
+                                      other bytes.
+
+**/
+UNIT_TEST_STATUS
+FfsTestCheckFile (
+  IN     EFI_FILE_PROTOCOL *File,
+  IN     UINT8             *Expected,
+  IN     UINTN             ExpectedSize,
+  IN OUT UINT32            *Random
+  )
+{
+  EFI_STATUS       Status;
+  UNIT_TEST_STATUS TestStatus;
+  UINT8            *Contents;
+  UINT8            Chunk[2 * FFS_TEST_CHUNK_SIZE];
+  UINTN            ContentsSize, Count, Position, Length, Size;
+
+  TestStatus = FfsTestReadAll (File, &Contents, &ContentsSize);
+
+  if (TestStatus != UNIT_TEST_PASSED) {
+    return TestStatus;
+  }
+
+  UT_ASSERT_EQUAL (ContentsSize, ExpectedSize);
+  UT_ASSERT_MEM_EQUAL (Contents, Expected, ExpectedSize);
+  FreePool (Contents);
+
+  for (Count = 0; Count < FFS_TEST_RANGES; Count++) {
+    *Random  = *Random * 1103515245 + 12345;
+    Position = (*Random >> 8) % (ExpectedSize + 1);
+    *Random  = *Random * 1103515245 + 12345;
+    Length   = (*Random >> 8) % sizeof (Chunk) + 1;
+
+    Status = File->SetPosition (File, Position);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    Size   = Length;
+    Status = File->Read (File, &Size, Chunk);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+    UT_ASSERT_EQUAL (Size, MIN (Length, ExpectedSize - Position));
+    UT_ASSERT_MEM_EQUAL (Chunk, Expected + Position, Size);
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Reads every entry of a directory, and of every directory in it, and reads
+  every file in full. When a reference directory is given, each entry is
+  also opened in it, and has to be described the same way there and read as
+  the same bytes, whole and in random ranges.
+
+  @param  Directory    The directory.
+  @param  RefDirectory The same directory of the same image reached through
+                       FV2 alone, or NULL.
+  @param  Depth        Number of directories above the directory.
+  @param  Random       State of the generator picking the ranges compared.
+
+  @retval UNIT_TEST_PASSED            Every file was read, and read the same
+                                      as in the reference directory.
+  @retval UNIT_TEST_ERROR_TEST_FAILED An entry could not be opened or read,
+                                      or differs from the reference.
+
+**/
+UNIT_TEST_STATUS
+FfsTestWalkDirectory (
+  IN     EFI_FILE_PROTOCOL *Directory,
+  IN     EFI_FILE_PROTOCOL *RefDirectory OPTIONAL,
+  IN     UINTN             Depth,
+  IN OUT UINT32            *Random
+  )
+{
+  EFI_STATUS        Status;
+  UNIT_TEST_STATUS  TestStatus;
+  EFI_FILE_PROTOCOL *File;
+  EFI_FILE_PROTOCOL *RefFile;
+  EFI_FILE_INFO     *Info, *RefInfo;
+  UINT64            Buffer[FFS_TEST_INFO_SIZE / sizeof (UINT64)];
+  UINT64            RefBuffer[FFS_TEST_INFO_SIZE / sizeof (UINT64)];
+  UINT8             *Contents;
+  UINTN             Size, ContentsSize;
+  UINT64            Total;
+
+  UT_ASSERT_TRUE (Depth < FFS_TEST_MAX_DEPTH);
+
+  Info    = (EFI_FILE_INFO *) Buffer;
+  RefInfo = (EFI_FILE_INFO *) RefBuffer;
+
+  while (TRUE) {
+    Size   = sizeof (Buffer);
+    Status = Directory->Read (Directory, &Size, Buffer);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    if (Size == 0) {
+      break;
+    }
+
+    Status = Directory->Open (Directory, &File, Info->FileName, EFI_FILE_MODE_READ, 0);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    RefFile = NULL;
+
+    if (RefDirectory != NULL) {
+      Status = RefDirectory->Open (RefDirectory, &RefFile, Info->FileName, EFI_FILE_MODE_READ, 0);
+      UT_ASSERT_NOT_EFI_ERROR (Status);
+
+      Size   = sizeof (RefBuffer);
+      Status = RefFile->GetInfo (RefFile, &gEfiFileInfoGuid, &Size, RefBuffer);
+      UT_ASSERT_NOT_EFI_ERROR (Status);
+      UT_ASSERT_EQUAL (Info->FileSize, RefInfo->FileSize);
+      UT_ASSERT_EQUAL (Info->Attribute, RefInfo->Attribute);
+    }
+
+    if ((Info->Attribute & EFI_FILE_DIRECTORY) != 0) {
+      TestStatus = FfsTestWalkDirectory (File, RefFile, Depth + 1, Random);
+    } else if (RefFile == NULL) {
+      Status = FfsTestReadToEnd (File, &Total);
+      UT_ASSERT_NOT_EFI_ERROR (Status);
+      UT_ASSERT_EQUAL (Total, Info->FileSize);
+      TestStatus = UNIT_TEST_PASSED;
+    } else {
+      TestStatus = FfsTestReadAll (RefFile, &Contents, &ContentsSize);
+
+      if (TestStatus == UNIT_TEST_PASSED) {
+        TestStatus = FfsTestCheckFile (File, Contents, ContentsSize, Random);
+        FreePool (Contents);
+      }
+    }
+
+    File->Close (File);
+
+    if (RefFile != NULL) {
+      RefFile->Close (RefFile);
+    }
+
+    if (TestStatus != UNIT_TEST_PASSED) {
+      return TestStatus;
+    }
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Counts a completed ReadEx() request.
+
+  @param  Event   The event of the request's token.
+  @param  Context The count of completed requests.
+
+**/
+VOID
+EFIAPI
+FfsTestReadDone (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  )
+{
+  (*(UINTN *) Context)++;
+}
+
+/**
+  Performs an operation on a mounted volume of generated files.
+
+  @param  Root      The volume's root directory.
+  @param  Operation The operation.
+  @param  Files     The descriptions of the volume's files.
+  @param  FileCount Number of files.
+
+  @retval UNIT_TEST_PASSED The operation succeeded.
+  @retval other            The operation failed.
+
+**/
+UNIT_TEST_STATUS
+FfsTestPerform (
+  IN EFI_FILE_PROTOCOL       *Root,
+  IN FFS_TEST_OPERATION      Operation,
+  IN CONST MOCK_FV_FILE_SPEC *Files,
+  IN UINTN                   FileCount
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *File;
+  EFI_FILE_PROTOCOL **Handles;
+  EFI_FILE_IO_TOKEN *Tokens;
+  EFI_EVENT         Event;
+  UINT64            Buffer[MAX (FFS_TEST_INFO_SIZE, FFS_TEST_CHUNK_SIZE) / sizeof (UINT64)];
+  CHAR16            Name[FFS_TEST_NAME_LENGTH];
+  UINT8             *Chunks;
+  UINT64            Total;
+  UINTN             Index, Count, Size, Entries, Completed;
+  UINT32            Random;
+
+  switch (Operation) {
+  case FfsTestListing:
+    Entries = 0;
+
+    do {
+      Size   = sizeof (Buffer);
+      Status = Root->Read (Root, &Size, Buffer);
+      UT_ASSERT_NOT_EFI_ERROR (Status);
+
+      Entries += (Size > 0) ? 1 : 0;
+    } while (Size > 0);
+
+    UT_ASSERT_TRUE (Entries >= FileCount);
+    break;
+
+  case FfsTestOpen:
+  case FfsTestSequentialRead:
+    for (Index = 0; Index < FileCount; Index++) {
+      FfsTestFileName (Files, Index, Name);
+
+      Status = Root->Open (Root, &File, Name, EFI_FILE_MODE_READ, 0);
+      UT_ASSERT_NOT_EFI_ERROR (Status);
+
+      if (Operation == FfsTestSequentialRead) {
+        Status = FfsTestReadToEnd (File, &Total);
+        File->Close (File);
+
+        UT_ASSERT_NOT_EFI_ERROR (Status);
+        UT_ASSERT_TRUE (Total >= Files[Index].DataSize);
+      } else {
+        File->Close (File);
+      }
+    }
+
+    break;
+
+  case FfsTestRandomRead:
+    Random = FFS_TEST_SEED;
+
+    for (Count = 0; Count < FileCount; Count++) {
+      Random = Random * 1103515245 + 12345;
+      Index  = (Random >> 8) % FileCount;
+
+      FfsTestFileName (Files, Index, Name);
+
+      Status = Root->Open (Root, &File, Name, EFI_FILE_MODE_READ, 0);
+      UT_ASSERT_NOT_EFI_ERROR (Status);
+
+      Random = Random * 1103515245 + 12345;
+      Status = File->SetPosition (File, (Random >> 8) % Files[Index].DataSize);
+
+      if (!EFI_ERROR (Status)) {
+        Size   = FFS_TEST_CHUNK_SIZE;
+        Status = File->Read (File, &Size, Buffer);
+      }
+
+      File->Close (File);
+      UT_ASSERT_NOT_EFI_ERROR (Status);
+    }
+
+    break;
+
+  case FfsTestAsyncRead:
+    Handles = AllocateZeroPool (FileCount * sizeof (EFI_FILE_PROTOCOL *));
+    Tokens  = AllocateZeroPool (FileCount * sizeof (EFI_FILE_IO_TOKEN));
+    Chunks  = AllocatePool (FileCount * FFS_TEST_CHUNK_SIZE);
+    UT_ASSERT_TRUE (Handles != NULL && Tokens != NULL && Chunks != NULL);
+
+    Completed = 0;
+    Status    = gBS->CreateEvent (EVT_NOTIFY_SIGNAL, TPL_CALLBACK, FfsTestReadDone, &Completed, &Event);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    for (Index = 0; Index < FileCount; Index++) {
+      FfsTestFileName (Files, Index, Name);
+
+      Status = Root->Open (Root, &Handles[Index], Name, EFI_FILE_MODE_READ, 0);
+      UT_ASSERT_NOT_EFI_ERROR (Status);
+
+      Tokens[Index].Event      = Event;
+      Tokens[Index].BufferSize = FFS_TEST_CHUNK_SIZE;
+      Tokens[Index].Buffer     = Chunks + Index * FFS_TEST_CHUNK_SIZE;
+
+      Status = Handles[Index]->ReadEx (Handles[Index], &Tokens[Index]);
+      UT_ASSERT_NOT_EFI_ERROR (Status);
+    }
+
+    //
+    // Host tests have no timer ticks to run the driver's worker, so the
+    // reads it queued only complete as their handles are closed.
+    //
+    for (Index = 0; Index < FileCount; Index++) {
+      Handles[Index]->Close (Handles[Index]);
+
+      UT_ASSERT_NOT_EFI_ERROR (Tokens[Index].Status);
+      UT_ASSERT_TRUE (Tokens[Index].BufferSize >= MIN (FFS_TEST_CHUNK_SIZE, Files[Index].DataSize));
+    }
+
+    UT_ASSERT_EQUAL (Completed, FileCount);
+
+    gBS->CloseEvent (Event);
+    FreePool (Handles);
+    FreePool (Tokens);
+    FreePool (Chunks);
+    break;
+
+  case FfsTestWalk:
+    Random = FFS_TEST_SEED;
+    return FfsTestWalkDirectory (Root, NULL, 0, &Random);
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+//
+// Test cases
+//
+
+/**
+  Measures an operation on volumes of 10 to 10,000 generated files, and fails
+  if the calls the driver makes to FV2 and FVB, or the allocations it makes,
+  grow faster than the number of files does.
+
+  @param  Context The FFS_TEST_CONTEXT of the test.
+
+  @retval UNIT_TEST_PASSED            The costs grow linearly.
+  @retval UNIT_TEST_ERROR_TEST_FAILED The costs grow faster, or the operation
+                                      failed.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+FfsTestSweep (
+  IN UNIT_TEST_CONTEXT Context
+  )
+{
+  EFI_STATUS                 Status;
+  UNIT_TEST_STATUS           TestStatus;
+  FFS_TEST_CONTEXT           *TestContext;
+  FFS_TEST_SAMPLE            Samples[ARRAY_SIZE (mFfsTestFileCounts)];
+  MOCK_FV_FILE_SPEC          *Files;
+  MOCK_FV_COUNTERS           Counters;
+  MEMORY_ALLOCATION_COUNTERS Allocations;
+  EFI_FILE_PROTOCOL          *Root;
+  EFI_HANDLE                 Handle;
+  VOID                       *Image;
+  UINTN                      ImageSize, Index, FileCount;
+  UINT64                     Start;
+
+  TestContext = (FFS_TEST_CONTEXT *) Context;
+
+  for (Index = 0; Index < ARRAY_SIZE (mFfsTestFileCounts); Index++) {
+    FileCount = mFfsTestFileCounts[Index];
+    Files     = AllocatePool (FileCount * sizeof (MOCK_FV_FILE_SPEC));
+    UT_ASSERT_NOT_NULL (Files);
+
+    FfsTestDescribeFiles (Files, FileCount, FALSE);
+
+    Status = MockFvGenerate (Files, FileCount, FFS_TEST_SEED, &Image, &ImageSize);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    //
+    // Every volume is a fresh mount, so that no operation finds the
+    // driver's caches warmed up by another. Volumes cannot be unmounted, so
+    // their images stay allocated.
+    //
+    Start  = GetPerformanceCounter ();
+    Status = FfsTestOpenVolume (Image, ImageSize, TestContext->Access, &Handle, &Root);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    TestStatus = FfsTestPerform (Root, TestContext->Operation, Files, FileCount);
+    Root->Close (Root);
+    FreePool (Files);
+
+    if (TestStatus != UNIT_TEST_PASSED) {
+      return TestStatus;
+    }
+
+    Samples[Index].Nanoseconds = GetTimeInNanoSecond (GetPerformanceCounter () - Start);
+
+    MockFv2GetCounters (Handle, &Counters);
+    GetMemoryAllocationCounters (&Allocations);
+
+    Samples[Index].Calls       = Counters.GetNextFileCalls + Counters.ReadFileCalls +
+                                 Counters.ReadSectionCalls + Counters.FvbReadCalls;
+    Samples[Index].Allocations = Allocations.Allocations;
+
+    UT_LOG_INFO (
+      "%a, %d files: %ld calls (GetNextFile %ld, ReadFile %ld, ReadSection %ld, FVB Read %ld), %ld allocations, %ld us\n",
+      mFfsTestOperationNames[TestContext->Operation],
+      FileCount,
+      Samples[Index].Calls,
+      Counters.GetNextFileCalls,
+      Counters.ReadFileCalls,
+      Counters.ReadSectionCalls,
+      Counters.FvbReadCalls,
+      Samples[Index].Allocations,
+      DivU64x32 (Samples[Index].Nanoseconds, 1000)
+      );
+
+    if (Index == 0) {
+      continue;
+    }
+
+    //
+    // Compare the cost per file with the one on the last volume. One is
+    // added per file so that volumes on which the operation costs next to
+    // nothing do not make any growth look like a large one. Time is only
+    // logged, as it is too noisy to fail on.
+    //
+    UT_ASSERT_TRUE (
+      MultU64x64 (Samples[Index].Calls + FileCount, mFfsTestFileCounts[Index - 1]) <=
+      MultU64x64 (FFS_TEST_MAX_GROWTH * (Samples[Index - 1].Calls + mFfsTestFileCounts[Index - 1]), FileCount)
+      );
+    UT_ASSERT_TRUE (
+      MultU64x64 (Samples[Index].Allocations + FileCount, mFfsTestFileCounts[Index - 1]) <=
+      MultU64x64 (FFS_TEST_MAX_GROWTH * (Samples[Index - 1].Allocations + mFfsTestFileCounts[Index - 1]), FileCount)
+      );
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Checks that dropping a volume's caches is refused while a file is open on
+  it, and that once they are dropped the volume is scanned and read again
+  exactly as the first time it was opened.
+
+  @param  Context The MOCK_FV_ACCESS of the volume checked.
+
+  @retval UNIT_TEST_PASSED            The caches were dropped.
+  @retval UNIT_TEST_ERROR_TEST_FAILED The caches could be dropped under an
+                                      open file, or the volume was not read
+                                      again from scratch.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+FfsTestDropCaches (
+  IN UNIT_TEST_CONTEXT Context
+  )
+{
+  EFI_STATUS                      Status;
+  UNIT_TEST_STATUS                TestStatus;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *SimpleFileSystem;
+  FFS_STATISTICS_PROTOCOL         *Statistics;
+  EFI_FILE_PROTOCOL               *Root;
+  EFI_HANDLE                      Handle;
+  MOCK_FV_FILE_SPEC               Files[FFS_TEST_DROP_FILES];
+  MOCK_FV_COUNTERS                First, Second;
+  VOID                            *Image;
+  UINTN                           ImageSize;
+  UINT32                          Random;
+
+  FfsTestDescribeFiles (Files, FFS_TEST_DROP_FILES, FALSE);
+
+  Status = MockFvGenerate (Files, FFS_TEST_DROP_FILES, FFS_TEST_SEED, &Image, &ImageSize);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = FfsTestOpenVolume (Image, ImageSize, *(MOCK_FV_ACCESS *) Context, &Handle, &Root);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = gBS->HandleProtocol (Handle, &gEfiSimpleFileSystemProtocolGuid, (VOID **) &SimpleFileSystem);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = gBS->HandleProtocol (Handle, &gFfsStatisticsProtocolGuid, (VOID **) &Statistics);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_TRUE (Statistics->Revision >= FFS_STATISTICS_PROTOCOL_REVISION);
+
+  Random     = FFS_TEST_SEED;
+  TestStatus = FfsTestWalkDirectory (Root, NULL, 0, &Random);
+
+  if (TestStatus != UNIT_TEST_PASSED) {
+    return TestStatus;
+  }
+
+  MockFv2GetCounters (Handle, &First);
+
+  Status = Statistics->DropCaches (Statistics);
+  UT_ASSERT_STATUS_EQUAL (Status, EFI_ACCESS_DENIED);
+
+  Root->Close (Root);
+
+  Status = Statistics->DropCaches (Statistics);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  MockFv2ResetCounters (Handle);
+
+  Status = SimpleFileSystem->OpenVolume (SimpleFileSystem, &Root);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Random     = FFS_TEST_SEED;
+  TestStatus = FfsTestWalkDirectory (Root, NULL, 0, &Random);
+  Root->Close (Root);
+
+  if (TestStatus != UNIT_TEST_PASSED) {
+    return TestStatus;
+  }
+
+  MockFv2GetCounters (Handle, &Second);
+
+  UT_ASSERT_EQUAL (Second.GetNextFileCalls, First.GetNextFileCalls);
+  UT_ASSERT_EQUAL (Second.ReadFileCalls, First.ReadFileCalls);
+  UT_ASSERT_EQUAL (Second.ReadSectionCalls, First.ReadSectionCalls);
+  UT_ASSERT_EQUAL (Second.FvbReadCalls, First.FvbReadCalls);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Mounts a volume of generated files through FV2 alone and again through the
+  way the test reaches volumes, and checks that the driver reads every file
+  and every section the same way through both. Each file is also checked
+  against the bytes FV2 returns for it: its PE32 section if it is exposed as
+  an executable, and its FFS payload otherwise.
+
+  @param  Context The MOCK_FV_ACCESS of the volume checked.
+
+  @retval UNIT_TEST_PASSED            Every file reads the same through both.
+  @retval UNIT_TEST_ERROR_TEST_FAILED A file reads differently, or could not
+                                      be read.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+FfsTestContents (
+  IN UNIT_TEST_CONTEXT Context
+  )
+{
+  EFI_STATUS                    Status;
+  UNIT_TEST_STATUS              TestStatus;
+  EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2;
+  EFI_FILE_PROTOCOL             *Roots[2];
+  EFI_FILE_PROTOCOL             *File;
+  EFI_HANDLE                    Handle, RefHandle;
+  EFI_GUID                      NameGuid;
+  EFI_FV_FILETYPE               FoundType;
+  EFI_FV_FILE_ATTRIBUTES        Attributes;
+  MOCK_FV_FILE_SPEC             *Files;
+  CHAR16                        Name[FFS_TEST_NAME_LENGTH];
+  VOID                          *Image;
+  UINT8                         *Expected;
+  UINTN                         ImageSize, ExpectedSize, Index, RootIndex;
+  UINT32                        AuthenticationStatus, Random;
+  BOOLEAN                       Executable;
+
+  Files = AllocatePool (FFS_TEST_COMPARE_FILES * sizeof (MOCK_FV_FILE_SPEC));
+  UT_ASSERT_NOT_NULL (Files);
+
+  FfsTestDescribeFiles (Files, FFS_TEST_COMPARE_FILES, TRUE);
+
+  Status = MockFvGenerate (Files, FFS_TEST_COMPARE_FILES, FFS_TEST_SEED, &Image, &ImageSize);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = FfsTestOpenVolume (Image, ImageSize, MockFvAccessFv2Only, &RefHandle, &Roots[1]);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = FfsTestOpenVolume (Image, ImageSize, *(MOCK_FV_ACCESS *) Context, &Handle, &Roots[0]);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = gBS->HandleProtocol (RefHandle, &gEfiFirmwareVolume2ProtocolGuid, (VOID **) &Fv2);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  //
+  // Walking the reference volume first has the driver settle which of its
+  // guesses are executable, so that both volumes name their files the same.
+  //
+  Random     = FFS_TEST_SEED;
+  TestStatus = FfsTestWalkDirectory (Roots[1], NULL, 0, &Random);
+
+  if (TestStatus == UNIT_TEST_PASSED) {
+    TestStatus = FfsTestWalkDirectory (Roots[0], Roots[1], 0, &Random);
+  }
+
+  if (TestStatus != UNIT_TEST_PASSED) {
+    return TestStatus;
+  }
+
+  for (Index = 0; Index < FFS_TEST_COMPARE_FILES; Index++) {
+    MockFvFileGuid (FFS_TEST_SEED, Index, &NameGuid);
+    Executable = FfsTestIsExecutable (&Files[Index]);
+
+    Expected     = NULL;
+    ExpectedSize = 0;
+
+    if (Executable) {
+      Status = Fv2->ReadSection (
+                      Fv2,
+                      &NameGuid,
+                      EFI_SECTION_PE32,
+                      0,
+                      (VOID **) &Expected,
+                      &ExpectedSize,
+                      &AuthenticationStatus
+                      );
+    } else {
+      Status = Fv2->ReadFile (
+                      Fv2,
+                      &NameGuid,
+                      (VOID **) &Expected,
+                      &ExpectedSize,
+                      &FoundType,
+                      &Attributes,
+                      &AuthenticationStatus
+                      );
+    }
+
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+
+    UnicodeSPrint (Name, sizeof (Name), L"%g.%s", &NameGuid, Executable ? L"efi" : L"ffs");
+
+    for (RootIndex = 0; RootIndex < ARRAY_SIZE (Roots); RootIndex++) {
+      Status = Roots[RootIndex]->Open (Roots[RootIndex], &File, Name, EFI_FILE_MODE_READ, 0);
+      UT_ASSERT_NOT_EFI_ERROR (Status);
+
+      TestStatus = FfsTestCheckFile (File, Expected, ExpectedSize, &Random);
+      File->Close (File);
+
+      if (TestStatus != UNIT_TEST_PASSED) {
+        return TestStatus;
+      }
+    }
+
+    FreePool (Expected);
+  }
+
+  Roots[0]->Close (Roots[0]);
+  Roots[1]->Close (Roots[1]);
+  FreePool (Files);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Mounts a volume loaded from a file of the host through FV2 alone and again
+  memory-mapped, and checks that the driver reads every file and section the
+  same way through both.
+
+  @param  Context The path of the file of the host.
+
+  @retval UNIT_TEST_PASSED            Every file reads the same through both.
+  @retval UNIT_TEST_ERROR_TEST_FAILED A file reads differently, or could not
+                                      be read.
+
+**/
+UNIT_TEST_STATUS
+EFIAPI
+FfsTestImage (
+  IN UNIT_TEST_CONTEXT Context
+  )
+{
+  EFI_STATUS        Status;
+  UNIT_TEST_STATUS  TestStatus;
+  EFI_FILE_PROTOCOL *Root;
+  EFI_FILE_PROTOCOL *RefRoot;
+  EFI_HANDLE        Handle, RefHandle;
+  MOCK_FV_COUNTERS  Counters;
+  VOID              *Image;
+  UINTN             ImageSize;
+  UINT32            Random;
+
+  Status = MockFvLoad ((CHAR8 *) Context, &Image, &ImageSize);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = FfsTestOpenVolume (Image, ImageSize, MockFvAccessFv2Only, &RefHandle, &RefRoot);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Status = FfsTestOpenVolume (Image, ImageSize, MockFvAccessMapped, &Handle, &Root);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  Random     = FFS_TEST_SEED;
+  TestStatus = FfsTestWalkDirectory (RefRoot, NULL, 0, &Random);
+
+  if (TestStatus == UNIT_TEST_PASSED) {
+    TestStatus = FfsTestWalkDirectory (Root, RefRoot, 0, &Random);
+  }
+
+  Root->Close (Root);
+  RefRoot->Close (RefRoot);
+
+  if (TestStatus != UNIT_TEST_PASSED) {
+    return TestStatus;
+  }
+
+  MockFv2GetCounters (Handle, &Counters);
+
+  UT_LOG_INFO (
+    "%a: GetNextFile %ld, ReadFile %ld, ReadSection %ld, FVB Read %ld\n",
+    (CHAR8 *) Context,
+    Counters.GetNextFileCalls,
+    Counters.ReadFileCalls,
+    Counters.ReadSectionCalls,
+    Counters.FvbReadCalls
+    );
+
+  return UNIT_TEST_PASSED;
+}
+
+//
+// Entry point
+//
+
+/**
+  Runs the tests: a sweep of each operation and a check of the contents read
+  for each way a volume can be reached, then a check of every image named on
+  the command line.
+
+  @param  argc Number of arguments.
+  @param  argv The arguments: paths of firmware volume images to read.
+
+  @retval 0 The tests ran.
+  @retval 1 The tests could not be run.
+
+**/
+int
+main (
+  int  argc,
+  char *argv[]
+  )
+{
+  EFI_STATUS                 Status;
+  UNIT_TEST_FRAMEWORK_HANDLE Framework;
+  UNIT_TEST_SUITE_HANDLE     Suites[MockFvAccessMapped + 1];
+  UNIT_TEST_SUITE_HANDLE     ImageSuite;
+  CHAR8                      *SuiteNames[] = { "Fv2Only", "Fvb", "Mapped" };
+  UINTN                      Index;
+
+  Framework = NULL;
+
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_APP_NAME, gEfiCallerBaseName, UNIT_TEST_APP_VERSION);
+
+  if (EFI_ERROR (Status)) {
+    goto Done;
+  }
+
+  Status = InitializeFfsFileSystem (gImageHandle, gST);
+
+  if (EFI_ERROR (Status)) {
+    goto Done;
+  }
+
+  for (Index = 0; Index <= MockFvAccessMapped; Index++) {
+    Status = CreateUnitTestSuite (
+               &Suites[Index],
+               Framework,
+               SuiteNames[Index],
+               SuiteNames[Index],
+               NULL,
+               NULL
+               );
+
+    if (EFI_ERROR (Status)) {
+      goto Done;
+    }
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mFfsTestContexts); Index++) {
+    AddTestCase (
+      Suites[mFfsTestContexts[Index].Access],
+      mFfsTestOperationNames[mFfsTestContexts[Index].Operation],
+      mFfsTestOperationNames[mFfsTestContexts[Index].Operation],
+      FfsTestSweep,
+      NULL,
+      NULL,
+      &mFfsTestContexts[Index]
+      );
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mFfsTestAccesses); Index++) {
+    AddTestCase (
+      Suites[mFfsTestAccesses[Index]],
+      "Contents",
+      "Contents",
+      FfsTestContents,
+      NULL,
+      NULL,
+      &mFfsTestAccesses[Index]
+      );
+
+    AddTestCase (
+      Suites[mFfsTestAccesses[Index]],
+      "DropCaches",
+      "DropCaches",
+      FfsTestDropCaches,
+      NULL,
+      NULL,
+      &mFfsTestAccesses[Index]
+      );
+  }
+
+  if (argc > 1) {
+    Status = CreateUnitTestSuite (&ImageSuite, Framework, "Images", "Images", NULL, NULL);
+
+    if (EFI_ERROR (Status)) {
+      goto Done;
+    }
+
+    for (Index = 1; Index < (UINTN) argc; Index++) {
+      AddTestCase (ImageSuite, argv[Index], "Image", FfsTestImage, NULL, NULL, argv[Index]);
+    }
+  }
+
+  Status = RunAllTestSuites (Framework);
+
+Done:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return EFI_ERROR (Status) ? 1 : 0;
+}
@@ -0,0 +1,165 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#ifndef _FFS_STATISTICS_H_
+#define _FFS_STATISTICS_H_
+
+///
+/// GUID of the statistics protocol FfsDxe installs next to the SFS instance
+/// on every FV2 handle it mounts.
+///
+#define FFS_STATISTICS_PROTOCOL_GUID \
+  { 0x3a8e6d51, 0xc2f4, 0x4b1e, { 0x8d, 0x07, 0x95, 0x6b, 0xe1, 0x3c, 0x42, 0xa8 } }
+
+#define FFS_STATISTICS_PROTOCOL_REVISION 0x00030000
+
+typedef struct _FFS_STATISTICS_PROTOCOL FFS_STATISTICS_PROTOCOL;
+
+///
+/// Counters of the work FfsDxe has done for a volume, and for every volume
+/// nested inside it, since it was mounted or its counters were last reset.
+///
+typedef struct {
+  UINT64 GetNextFileCalls; ///< Number of FV2 GetNextFile() calls.
+  UINT64 ReadFileCalls;    ///< Number of FV2 ReadFile() calls.
+  UINT64 ReadSectionCalls; ///< Number of FV2 ReadSection() calls.
+  UINT64 BytesDecoded;     ///< Number of bytes returned by successful ReadFile() and ReadSection() calls.
+  UINT64 DirectReads;      ///< Number of reads made straight from the volume, bypassing FV2.
+  UINT64 FvbReadCalls;     ///< Number of FVB Read() calls made by direct reads.
+  UINT64 BytesReadDirect;  ///< Number of bytes read straight from the volume.
+  UINT64 BytesCopied;      ///< Number of bytes returned to callers by Read(), ReadEx() and GetInfo().
+  UINT64 Allocations;      ///< Number of pool buffers allocated while serving file operations.
+  UINT64 Frees;            ///< Number of those pool buffers freed again.
+  UINT64 OpenHandles;      ///< Number of file handles currently open.
+} FFS_VOLUME_STATISTICS;
+
+///
+/// Counters of the decoded-content cache, which is shared by every volume
+/// FfsDxe mounts. They are kept since the driver was loaded.
+///
+typedef struct {
+  UINT64 Hits;            ///< Number of loads served from the cache.
+  UINT64 Misses;          ///< Number of loads that had to decode the file.
+  UINT64 Evictions;       ///< Number of entries freed to stay within the budget.
+  UINT64 NumEntries;      ///< Number of entries currently cached.
+  UINT64 BytesCached;     ///< Number of content bytes currently cached.
+  UINT64 Prefetches;      ///< Number of contents decoded or read ahead of use by the prefetcher.
+  UINT64 PrefetchHits;    ///< Number of prefetched contents that were later read.
+  UINT64 PrefetchWasted;  ///< Number of prefetched contents dropped without being read.
+  UINT64 BytesPrefetched; ///< Number of content bytes prefetched and not yet read.
+} FFS_CACHE_STATISTICS;
+
+/**
+  Returns a snapshot of a volume's counters.
+
+  @param  This       The statistics instance of the volume.
+  @param  Statistics On output, the volume's counters.
+
+  @retval EFI_SUCCESS           The counters were returned.
+  @retval EFI_INVALID_PARAMETER Statistics is NULL.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *FFS_STATISTICS_GET)(
+  IN  FFS_STATISTICS_PROTOCOL *This,
+  OUT FFS_VOLUME_STATISTICS   *Statistics
+  );
+
+/**
+  Returns a snapshot of the decoded-content cache's counters. The cache is
+  shared by every volume, so every instance returns the same counters, and
+  they are not affected by Reset().
+
+  @param  This       A statistics instance.
+  @param  Statistics On output, the cache's counters.
+
+  @retval EFI_SUCCESS           The counters were returned.
+  @retval EFI_INVALID_PARAMETER Statistics is NULL.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *FFS_STATISTICS_GET_CACHE)(
+  IN  FFS_STATISTICS_PROTOCOL *This,
+  OUT FFS_CACHE_STATISTICS    *Statistics
+  );
+
+/**
+  Resets a volume's counters to zero. OpenHandles is not a counter, and is
+  left as it is.
+
+  @param  This The statistics instance of the volume.
+
+  @retval EFI_SUCCESS The counters were reset.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *FFS_STATISTICS_RESET)(
+  IN FFS_STATISTICS_PROTOCOL *This
+  );
+
+/**
+  Drops everything FfsDxe holds for a volume and for every volume nested
+  inside it: the file index, the decoded contents in the cache and the images
+  of nested volumes. The next OpenVolume() finds the volume as it was at
+  boot, and has to scan it again. Metadata saved to a variable is kept, as it
+  is across a reboot. The counters are left as they are.
+
+  @param  This The statistics instance of the volume.
+
+  @retval EFI_SUCCESS       The volume's caches were dropped.
+  @retval EFI_ACCESS_DENIED Files are open on the volume, so nothing was
+                            dropped.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *FFS_STATISTICS_DROP_CACHES)(
+  IN FFS_STATISTICS_PROTOCOL *This
+  );
+
+///
+/// Per-volume counters published by FfsDxe, so that the cost of a file
+/// operation can be told apart from the cost of the FV2 producer below it.
+///
+struct _FFS_STATISTICS_PROTOCOL {
+  UINT64                     Revision;           ///< FFS_STATISTICS_PROTOCOL_REVISION.
+  FFS_STATISTICS_GET         GetStatistics;      ///< Returns a snapshot of the counters.
+  FFS_STATISTICS_RESET       Reset;              ///< Resets the counters.
+  FFS_STATISTICS_GET_CACHE   GetCacheStatistics; ///< Returns a snapshot of the cache's counters. Revision 2 and later.
+  FFS_STATISTICS_DROP_CACHES DropCaches;         ///< Drops the volume's caches. Revision 3 and later.
+};
+
+extern EFI_GUID gFfsStatisticsProtocolGuid;
+
+#endif
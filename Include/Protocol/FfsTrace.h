@@ -0,0 +1,160 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#ifndef _FFS_TRACE_H_
+#define _FFS_TRACE_H_
+
+///
+/// GUID of the trace protocol FfsDxe installs on its image handle when it is
+/// built with PcdFfsTrace.
+///
+#define FFS_TRACE_PROTOCOL_GUID \
+  { 0x9f2b47c3, 0x6e1a, 0x4d58, { 0xb3, 0x9c, 0x20, 0x8e, 0x75, 0xd4, 0x1b, 0x6f } }
+
+#define FFS_TRACE_PROTOCOL_REVISION 0x00010000
+
+///
+/// Number of buckets in each latency histogram. Bucket 0 counts calls that
+/// took no ticks at all, and bucket N counts calls that took at least 2^(N-1)
+/// and less than 2^N ticks.
+///
+#define FFS_TRACE_HISTOGRAM_BUCKETS 64
+
+typedef struct _FFS_TRACE_PROTOCOL FFS_TRACE_PROTOCOL;
+
+///
+/// SFS and File protocol calls that are traced. Calls that are refused
+/// outright, such as writes, are not traced.
+///
+typedef enum {
+  FfsTraceOpenVolume,
+  FfsTraceOpen,
+  FfsTraceClose,
+  FfsTraceRead,
+  FfsTraceReadEx,
+  FfsTraceGetPosition,
+  FfsTraceSetPosition,
+  FfsTraceGetInfo,
+  FfsTraceOperationMax
+} FFS_TRACE_OPERATION;
+
+///
+/// A single traced call.
+///
+typedef struct {
+  UINT64     Sequence;  ///< Number of calls traced before this one since the trace was last reset.
+  UINT32     Operation; ///< The FFS_TRACE_OPERATION that was called.
+  EFI_STATUS Status;    ///< Status the call returned.
+  EFI_GUID   FileGuid;  ///< GUID of the file the call was made on, or zero for directories and volumes.
+  UINT64     Position;  ///< Position in the file when the call was made, or the position it set.
+  UINT64     Size;      ///< Number of bytes the caller asked for.
+  UINT64     Ticks;     ///< Performance counter ticks the call took.
+} FFS_TRACE_RECORD;
+
+///
+/// Latency histogram of one operation.
+///
+typedef struct {
+  UINT64 Count;                                ///< Number of calls traced.
+  UINT64 TotalTicks;                           ///< Sum of the ticks those calls took.
+  UINT64 MaxTicks;                             ///< Most ticks any one call took.
+  UINT64 Buckets[FFS_TRACE_HISTOGRAM_BUCKETS]; ///< Number of calls in each log2 bucket of ticks.
+} FFS_TRACE_HISTOGRAM;
+
+/**
+  Returns the traced calls still held in the ring buffer, oldest first.
+
+  @param  This       The trace instance.
+  @param  NumRecords On input, the number of records Records can hold. On
+                     output, the number of records returned, or needed.
+  @param  Records    The buffer to return the records in.
+
+  @retval EFI_SUCCESS           The records were returned.
+  @retval EFI_BUFFER_TOO_SMALL  Records is too small. NumRecords was updated.
+  @retval EFI_INVALID_PARAMETER NumRecords is NULL.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *FFS_TRACE_GET_RECORDS)(
+  IN     FFS_TRACE_PROTOCOL *This,
+  IN OUT UINTN              *NumRecords,
+  OUT    FFS_TRACE_RECORD   *Records
+  );
+
+/**
+  Returns the latency histogram of an operation.
+
+  @param  This      The trace instance.
+  @param  Operation The operation whose histogram is returned.
+  @param  Histogram On output, the operation's histogram.
+
+  @retval EFI_SUCCESS           The histogram was returned.
+  @retval EFI_INVALID_PARAMETER Operation is not traced, or Histogram is NULL.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *FFS_TRACE_GET_HISTOGRAM)(
+  IN  FFS_TRACE_PROTOCOL  *This,
+  IN  FFS_TRACE_OPERATION Operation,
+  OUT FFS_TRACE_HISTOGRAM *Histogram
+  );
+
+/**
+  Empties the ring buffer and clears every histogram.
+
+  @param  This The trace instance.
+
+  @retval EFI_SUCCESS The trace was reset.
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *FFS_TRACE_RESET)(
+  IN FFS_TRACE_PROTOCOL *This
+  );
+
+///
+/// Trace of the SFS and File protocol calls made on every volume FfsDxe has
+/// mounted, with per-operation latency histograms.
+///
+struct _FFS_TRACE_PROTOCOL {
+  UINT64                  Revision;       ///< FFS_TRACE_PROTOCOL_REVISION.
+  UINT64                  TicksPerSecond; ///< Frequency of the performance counter the ticks are measured with.
+  FFS_TRACE_GET_RECORDS   GetRecords;     ///< Returns the traced calls.
+  FFS_TRACE_GET_HISTOGRAM GetHistogram;   ///< Returns an operation's latency histogram.
+  FFS_TRACE_RESET         Reset;          ///< Resets the trace.
+};
+
+extern EFI_GUID gFfsTraceProtocolGuid;
+
+#endif
@@ -0,0 +1,71 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#ifndef _COUNTING_MEMORY_ALLOCATION_LIB_H_
+#define _COUNTING_MEMORY_ALLOCATION_LIB_H_
+
+///
+/// Counters of the allocations made through MemoryAllocationLib by a host
+/// test, since it started or the counters were last reset.
+///
+typedef struct {
+  UINT64 Allocations;    ///< Number of pool and page buffers allocated.
+  UINT64 Frees;          ///< Number of pool and page buffers freed.
+  UINT64 BytesAllocated; ///< Number of bytes asked for by those allocations.
+  UINT64 BytesInUse;     ///< Number of bytes in buffers that are not freed yet.
+  UINT64 PeakBytesInUse; ///< Largest BytesInUse has been.
+} MEMORY_ALLOCATION_COUNTERS;
+
+/**
+  Returns a snapshot of the allocation counters.
+
+  @param  Counters On output, the counters.
+
+**/
+VOID
+EFIAPI
+GetMemoryAllocationCounters (
+  OUT MEMORY_ALLOCATION_COUNTERS *Counters
+  );
+
+/**
+  Resets the allocation counters to zero. BytesInUse is left as it is, since
+  the buffers it counts are still allocated, and PeakBytesInUse restarts from
+  it.
+
+**/
+VOID
+EFIAPI
+ResetMemoryAllocationCounters (
+  VOID
+  );
+
+#endif
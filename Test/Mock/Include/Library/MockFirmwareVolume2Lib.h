@@ -0,0 +1,219 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#ifndef _MOCK_FIRMWARE_VOLUME2_LIB_H_
+#define _MOCK_FIRMWARE_VOLUME2_LIB_H_
+
+#include <Protocol/FirmwareVolume2.h>
+
+///
+/// How a mock volume can be reached besides FV2.
+///
+typedef enum {
+  MockFvAccessFv2Only, ///< Only FV2 is installed.
+  MockFvAccessFvb,     ///< An FVB instance that can only be read block by block is installed too.
+  MockFvAccessMapped   ///< A memory-mapped FVB instance is installed too.
+} MOCK_FV_ACCESS;
+
+///
+/// How the leaf section of a generated file is encapsulated.
+///
+typedef enum {
+  MockFvEncodingNone,         ///< The leaf section is stored as is.
+  MockFvEncodingUncompressed, ///< The leaf section is inside an EFI_NOT_COMPRESSED compression section.
+  MockFvEncodingGuided        ///< The leaf section is inside a GUID-defined section that requires processing.
+} MOCK_FV_ENCODING;
+
+///
+/// Describes a file of a generated volume.
+///
+typedef struct {
+  EFI_FV_FILETYPE  Type;        ///< The file's type. RAW files hold their data as is, others a leaf section.
+  EFI_SECTION_TYPE SectionType; ///< Type of the leaf section. PE32 and TE sections start with an image header.
+  UINT16           Machine;     ///< Machine type in the image header of a PE32 or TE section.
+  UINT32           DataSize;    ///< Number of bytes of data in the leaf section, or in the file if it is RAW.
+  MOCK_FV_ENCODING Encoding;    ///< How the leaf section is encapsulated.
+  BOOLEAN          Named;       ///< Adds a UI section naming the file "File<index>".
+} MOCK_FV_FILE_SPEC;
+
+///
+/// Counters of the calls made to a mock volume since it was installed or its
+/// counters were last reset.
+///
+typedef struct {
+  UINT64 GetNextFileCalls; ///< Number of FV2 GetNextFile() calls.
+  UINT64 ReadFileCalls;    ///< Number of FV2 ReadFile() calls.
+  UINT64 ReadSectionCalls; ///< Number of FV2 ReadSection() calls.
+  UINT64 FvbReadCalls;     ///< Number of FVB Read() calls.
+  UINT64 BytesReturned;    ///< Number of bytes returned by all of them.
+} MOCK_FV_COUNTERS;
+
+/**
+  Returns the GUID naming a file of a volume made by MockFvGenerate().
+
+  @param  Seed     The seed the volume was generated with.
+  @param  Index    The index of the file's description.
+  @param  NameGuid On output, the GUID naming the file.
+
+**/
+VOID
+EFIAPI
+MockFvFileGuid (
+  IN  UINT32   Seed,
+  IN  UINTN    Index,
+  OUT EFI_GUID *NameGuid
+  );
+
+/**
+  Generates a firmware volume image holding one file per description. The
+  files are named by GUIDs made of Seed and their index, and filled with data
+  that only depends on the same, so that the same arguments always make the
+  same image. Compression sections are stored uncompressed: they are still
+  encapsulation, but can be read in place and need no compressor to make.
+  Sections that have to be decoded are GUID-defined sections of the mock's
+  own, which only its FV2 instances can decode.
+
+  @param  Files     The descriptions of the files.
+  @param  FileCount Number of descriptions.
+  @param  Seed      Seed of the names and data of the files.
+  @param  Image     On output, the image. Free it with MockFvFree().
+  @param  ImageSize On output, the size of the image.
+
+  @retval EFI_SUCCESS           The image was generated.
+  @retval EFI_INVALID_PARAMETER A file is too large for a plain FFS file, or
+                                too small for the image it holds.
+  @retval EFI_OUT_OF_RESOURCES  There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFvGenerate (
+  IN  CONST MOCK_FV_FILE_SPEC *Files,
+  IN  UINTN                   FileCount,
+  IN  UINT32                  Seed,
+  OUT VOID                    **Image,
+  OUT UINTN                   *ImageSize
+  );
+
+/**
+  Loads a firmware volume image from a file of the host, such as an FV built
+  for a platform.
+
+  @param  FileName  Path of the file on the host.
+  @param  Image     On output, the image. Free it with MockFvFree().
+  @param  ImageSize On output, the size of the image.
+
+  @retval EFI_SUCCESS          The image was loaded.
+  @retval EFI_NOT_FOUND        The file could not be opened.
+  @retval EFI_DEVICE_ERROR     The file could not be read.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFvLoad (
+  IN  CONST CHAR8 *FileName,
+  OUT VOID        **Image,
+  OUT UINTN       *ImageSize
+  );
+
+/**
+  Frees an image made by MockFvGenerate() or MockFvLoad(). Volumes installed
+  on it must not be used any more.
+
+  @param  Image     The image.
+  @param  ImageSize The size of the image.
+
+**/
+VOID
+EFIAPI
+MockFvFree (
+  IN VOID  *Image,
+  IN UINTN ImageSize
+  );
+
+/**
+  Installs a mock FV2 instance serving an image on a new handle, along with
+  an FVB instance if Access asks for one. The files of the image are indexed
+  first, so that the mock's own lookups take no part in what is measured.
+
+  @param  Image     The image, which has to stay allocated while it is used.
+  @param  ImageSize The size of the image.
+  @param  Access    How the volume can be reached besides FV2.
+  @param  Handle    On output, the handle the instances are installed on.
+
+  @retval EFI_SUCCESS          The instances were installed.
+  @retval EFI_VOLUME_CORRUPTED The image is not a valid firmware volume.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2Install (
+  IN  VOID           *Image,
+  IN  UINTN          ImageSize,
+  IN  MOCK_FV_ACCESS Access,
+  OUT EFI_HANDLE     *Handle
+  );
+
+/**
+  Returns a snapshot of the counters of the mock volume installed on a handle.
+
+  @param  Handle   The handle returned by MockFv2Install().
+  @param  Counters On output, the counters.
+
+  @retval EFI_SUCCESS   The counters were returned.
+  @retval EFI_NOT_FOUND The handle carries no mock volume.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2GetCounters (
+  IN  EFI_HANDLE       Handle,
+  OUT MOCK_FV_COUNTERS *Counters
+  );
+
+/**
+  Resets the counters of the mock volume installed on a handle.
+
+  @param  Handle The handle returned by MockFv2Install().
+
+  @retval EFI_SUCCESS   The counters were reset.
+  @retval EFI_NOT_FOUND The handle carries no mock volume.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2ResetCounters (
+  IN EFI_HANDLE Handle
+  );
+
+#endif
@@ -0,0 +1,586 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include <stdlib.h>
+#include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/CountingMemoryAllocationLib.h>
+
+//
+// Miscellaneous helpful macros.
+//
+#define COUNTED_BUFFER_SIGNATURE SIGNATURE_32 ('C', 'N', 'T', 'B')
+#define COUNTED_POOL_ALIGNMENT   (16)
+
+///
+/// Bookkeeping kept right in front of every buffer handed out.
+///
+typedef struct {
+  UINT32 Signature; ///< COUNTED_BUFFER_SIGNATURE while the buffer is allocated.
+  VOID   *Block;    ///< What malloc() returned, which the buffer is carved from.
+  UINTN  Size;      ///< Number of bytes asked for.
+} COUNTED_BUFFER_HEAD;
+
+//
+// Module-scope variables
+//
+
+MEMORY_ALLOCATION_COUNTERS mCountedAllocations;
+
+//
+// Misc. helper methods
+//
+
+/**
+  Allocates a counted buffer from the host's heap.
+
+  @param  Size      Number of bytes to allocate.
+  @param  Alignment Alignment of the buffer, a power of two.
+
+  @retval a buffer The buffer was allocated.
+  @retval NULL     There was not enough memory.
+
+**/
+VOID *
+CountedAllocate (
+  IN UINTN Size,
+  IN UINTN Alignment
+  )
+{
+  UINT8               *Block;
+  UINTN               Buffer;
+  COUNTED_BUFFER_HEAD *Head;
+
+  Block = malloc (sizeof (COUNTED_BUFFER_HEAD) + Alignment + Size);
+
+  if (Block == NULL) {
+    return NULL;
+  }
+
+  Buffer = ALIGN_VALUE ((UINTN) Block + sizeof (COUNTED_BUFFER_HEAD), Alignment);
+  Head   = (COUNTED_BUFFER_HEAD *) Buffer - 1;
+
+  Head->Signature = COUNTED_BUFFER_SIGNATURE;
+  Head->Block     = Block;
+  Head->Size      = Size;
+
+  mCountedAllocations.Allocations++;
+  mCountedAllocations.BytesAllocated += Size;
+  mCountedAllocations.BytesInUse     += Size;
+  mCountedAllocations.PeakBytesInUse  = MAX (mCountedAllocations.PeakBytesInUse, mCountedAllocations.BytesInUse);
+
+  return (VOID *) Buffer;
+}
+
+/**
+  Frees a buffer allocated by CountedAllocate().
+
+  @param  Buffer The buffer to free.
+
+**/
+VOID
+CountedFree (
+  IN VOID *Buffer
+  )
+{
+  COUNTED_BUFFER_HEAD *Head;
+
+  Head = (COUNTED_BUFFER_HEAD *) Buffer - 1;
+
+  ASSERT (Head->Signature == COUNTED_BUFFER_SIGNATURE);
+
+  mCountedAllocations.Frees++;
+  mCountedAllocations.BytesInUse -= Head->Size;
+
+  Head->Signature = 0;
+  free (Head->Block);
+}
+
+//
+// Counters
+//
+
+/**
+  Returns a snapshot of the allocation counters.
+
+  @param  Counters On output, the counters.
+
+**/
+VOID
+EFIAPI
+GetMemoryAllocationCounters (
+  OUT MEMORY_ALLOCATION_COUNTERS *Counters
+  )
+{
+  CopyMem (Counters, &mCountedAllocations, sizeof (MEMORY_ALLOCATION_COUNTERS));
+}
+
+/**
+  Resets the allocation counters to zero. BytesInUse is left as it is, since
+  the buffers it counts are still allocated, and PeakBytesInUse restarts from
+  it.
+
+**/
+VOID
+EFIAPI
+ResetMemoryAllocationCounters (
+  VOID
+  )
+{
+  mCountedAllocations.Allocations    = 0;
+  mCountedAllocations.Frees          = 0;
+  mCountedAllocations.BytesAllocated = 0;
+  mCountedAllocations.PeakBytesInUse = mCountedAllocations.BytesInUse;
+}
+
+//
+// MemoryAllocationLib functions. Pages and pools of every memory type all
+// come from the host's heap, and are counted alike.
+//
+
+/**
+  Allocates a number of 4KB pages.
+
+  @param  Pages The number of pages to allocate.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocatePages (
+  IN UINTN Pages
+  )
+{
+  return AllocateAlignedPages (Pages, EFI_PAGE_SIZE);
+}
+
+/**
+  Allocates a number of 4KB pages of type EfiRuntimeServicesData.
+
+  @param  Pages The number of pages to allocate.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateRuntimePages (
+  IN UINTN Pages
+  )
+{
+  return AllocatePages (Pages);
+}
+
+/**
+  Allocates a number of 4KB pages of type EfiReservedMemoryType.
+
+  @param  Pages The number of pages to allocate.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateReservedPages (
+  IN UINTN Pages
+  )
+{
+  return AllocatePages (Pages);
+}
+
+/**
+  Frees pages allocated by one of the page allocation functions.
+
+  @param  Buffer The buffer to free.
+  @param  Pages  The number of pages to free.
+
+**/
+VOID
+EFIAPI
+FreePages (
+  IN VOID  *Buffer,
+  IN UINTN Pages
+  )
+{
+  ASSERT (Pages != 0);
+  CountedFree (Buffer);
+}
+
+/**
+  Allocates a number of 4KB pages, aligned on a boundary.
+
+  @param  Pages     The number of pages to allocate.
+  @param  Alignment The alignment of the buffer, a power of two, or 0.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateAlignedPages (
+  IN UINTN Pages,
+  IN UINTN Alignment
+  )
+{
+  ASSERT ((Alignment & (Alignment - 1)) == 0);
+
+  if (Pages == 0) {
+    return NULL;
+  }
+
+  return CountedAllocate (EFI_PAGES_TO_SIZE (Pages), MAX (Alignment, EFI_PAGE_SIZE));
+}
+
+/**
+  Allocates a number of 4KB pages of type EfiRuntimeServicesData, aligned on a
+  boundary.
+
+  @param  Pages     The number of pages to allocate.
+  @param  Alignment The alignment of the buffer, a power of two, or 0.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateAlignedRuntimePages (
+  IN UINTN Pages,
+  IN UINTN Alignment
+  )
+{
+  return AllocateAlignedPages (Pages, Alignment);
+}
+
+/**
+  Allocates a number of 4KB pages of type EfiReservedMemoryType, aligned on a
+  boundary.
+
+  @param  Pages     The number of pages to allocate.
+  @param  Alignment The alignment of the buffer, a power of two, or 0.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateAlignedReservedPages (
+  IN UINTN Pages,
+  IN UINTN Alignment
+  )
+{
+  return AllocateAlignedPages (Pages, Alignment);
+}
+
+/**
+  Frees pages allocated by one of the aligned page allocation functions.
+
+  @param  Buffer The buffer to free.
+  @param  Pages  The number of pages to free.
+
+**/
+VOID
+EFIAPI
+FreeAlignedPages (
+  IN VOID  *Buffer,
+  IN UINTN Pages
+  )
+{
+  FreePages (Buffer, Pages);
+}
+
+/**
+  Allocates a buffer of type EfiBootServicesData.
+
+  @param  AllocationSize The number of bytes to allocate.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocatePool (
+  IN UINTN AllocationSize
+  )
+{
+  return CountedAllocate (AllocationSize, COUNTED_POOL_ALIGNMENT);
+}
+
+/**
+  Allocates a buffer of type EfiRuntimeServicesData.
+
+  @param  AllocationSize The number of bytes to allocate.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateRuntimePool (
+  IN UINTN AllocationSize
+  )
+{
+  return AllocatePool (AllocationSize);
+}
+
+/**
+  Allocates a buffer of type EfiReservedMemoryType.
+
+  @param  AllocationSize The number of bytes to allocate.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateReservedPool (
+  IN UINTN AllocationSize
+  )
+{
+  return AllocatePool (AllocationSize);
+}
+
+/**
+  Allocates and zeros a buffer of type EfiBootServicesData.
+
+  @param  AllocationSize The number of bytes to allocate and zero.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateZeroPool (
+  IN UINTN AllocationSize
+  )
+{
+  VOID *Buffer;
+
+  Buffer = AllocatePool (AllocationSize);
+
+  if (Buffer != NULL) {
+    ZeroMem (Buffer, AllocationSize);
+  }
+
+  return Buffer;
+}
+
+/**
+  Allocates and zeros a buffer of type EfiRuntimeServicesData.
+
+  @param  AllocationSize The number of bytes to allocate and zero.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateRuntimeZeroPool (
+  IN UINTN AllocationSize
+  )
+{
+  return AllocateZeroPool (AllocationSize);
+}
+
+/**
+  Allocates and zeros a buffer of type EfiReservedMemoryType.
+
+  @param  AllocationSize The number of bytes to allocate and zero.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateReservedZeroPool (
+  IN UINTN AllocationSize
+  )
+{
+  return AllocateZeroPool (AllocationSize);
+}
+
+/**
+  Copies a buffer to an allocated buffer of type EfiBootServicesData.
+
+  @param  AllocationSize The number of bytes to allocate and copy.
+  @param  Buffer         The buffer to copy.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateCopyPool (
+  IN UINTN      AllocationSize,
+  IN CONST VOID *Buffer
+  )
+{
+  VOID *Memory;
+
+  ASSERT (Buffer != NULL);
+
+  Memory = AllocatePool (AllocationSize);
+
+  if (Memory != NULL) {
+    CopyMem (Memory, Buffer, AllocationSize);
+  }
+
+  return Memory;
+}
+
+/**
+  Copies a buffer to an allocated buffer of type EfiRuntimeServicesData.
+
+  @param  AllocationSize The number of bytes to allocate and copy.
+  @param  Buffer         The buffer to copy.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateRuntimeCopyPool (
+  IN UINTN      AllocationSize,
+  IN CONST VOID *Buffer
+  )
+{
+  return AllocateCopyPool (AllocationSize, Buffer);
+}
+
+/**
+  Copies a buffer to an allocated buffer of type EfiReservedMemoryType.
+
+  @param  AllocationSize The number of bytes to allocate and copy.
+  @param  Buffer         The buffer to copy.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+AllocateReservedCopyPool (
+  IN UINTN      AllocationSize,
+  IN CONST VOID *Buffer
+  )
+{
+  return AllocateCopyPool (AllocationSize, Buffer);
+}
+
+/**
+  Reallocates a buffer of type EfiBootServicesData. The contents are copied to
+  the new buffer, which counts as an allocation, and the old one is freed,
+  which counts as a free.
+
+  @param  OldSize   The size of the old buffer.
+  @param  NewSize   The size of the new buffer.
+  @param  OldBuffer The buffer to reallocate, or NULL.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+ReallocatePool (
+  IN UINTN OldSize,
+  IN UINTN NewSize,
+  IN VOID  *OldBuffer OPTIONAL
+  )
+{
+  VOID *NewBuffer;
+
+  NewBuffer = AllocateZeroPool (NewSize);
+
+  if (NewBuffer != NULL && OldBuffer != NULL) {
+    CopyMem (NewBuffer, OldBuffer, MIN (OldSize, NewSize));
+    FreePool (OldBuffer);
+  }
+
+  return NewBuffer;
+}
+
+/**
+  Reallocates a buffer of type EfiRuntimeServicesData.
+
+  @param  OldSize   The size of the old buffer.
+  @param  NewSize   The size of the new buffer.
+  @param  OldBuffer The buffer to reallocate, or NULL.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+ReallocateRuntimePool (
+  IN UINTN OldSize,
+  IN UINTN NewSize,
+  IN VOID  *OldBuffer OPTIONAL
+  )
+{
+  return ReallocatePool (OldSize, NewSize, OldBuffer);
+}
+
+/**
+  Reallocates a buffer of type EfiReservedMemoryType.
+
+  @param  OldSize   The size of the old buffer.
+  @param  NewSize   The size of the new buffer.
+  @param  OldBuffer The buffer to reallocate, or NULL.
+
+  @return A pointer to the allocated buffer, or NULL if it could not be allocated.
+
+**/
+VOID *
+EFIAPI
+ReallocateReservedPool (
+  IN UINTN OldSize,
+  IN UINTN NewSize,
+  IN VOID  *OldBuffer OPTIONAL
+  )
+{
+  return ReallocatePool (OldSize, NewSize, OldBuffer);
+}
+
+/**
+  Frees a buffer allocated by one of the pool allocation functions.
+
+  @param  Buffer The buffer to free.
+
+**/
+VOID
+EFIAPI
+FreePool (
+  IN VOID *Buffer
+  )
+{
+  CountedFree (Buffer);
+}
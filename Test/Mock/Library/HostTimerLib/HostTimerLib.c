@@ -0,0 +1,161 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include <time.h>
+#include <Base.h>
+#include <Library/TimerLib.h>
+
+//
+// The performance counter is the host's clock in nanoseconds, read with
+// timespec_get(), which every host C library of note has.
+//
+#define HOST_COUNTER_FREQUENCY (1000000000ULL)
+
+/**
+  Reads the host's clock.
+
+  @retval The host's time, in nanoseconds.
+
+**/
+UINT64
+HostReadClock (
+  VOID
+  )
+{
+  struct timespec Now;
+
+  timespec_get (&Now, TIME_UTC);
+
+  return (UINT64) Now.tv_sec * HOST_COUNTER_FREQUENCY + (UINT64) Now.tv_nsec;
+}
+
+/**
+  Waits for a number of microseconds.
+
+  @param  MicroSeconds The number of microseconds to wait.
+
+  @return MicroSeconds.
+
+**/
+UINTN
+EFIAPI
+MicroSecondDelay (
+  IN UINTN MicroSeconds
+  )
+{
+  NanoSecondDelay (MicroSeconds * 1000);
+
+  return MicroSeconds;
+}
+
+/**
+  Waits for a number of nanoseconds, by spinning on the host's clock.
+
+  @param  NanoSeconds The number of nanoseconds to wait.
+
+  @return NanoSeconds.
+
+**/
+UINTN
+EFIAPI
+NanoSecondDelay (
+  IN UINTN NanoSeconds
+  )
+{
+  UINT64 End;
+
+  End = HostReadClock () + NanoSeconds;
+
+  while (HostReadClock () < End) {
+  }
+
+  return NanoSeconds;
+}
+
+/**
+  Reads the performance counter.
+
+  @return The host's time, in nanoseconds.
+
+**/
+UINT64
+EFIAPI
+GetPerformanceCounter (
+  VOID
+  )
+{
+  return HostReadClock ();
+}
+
+/**
+  Returns the performance counter's range and frequency. It counts up, one
+  tick per nanosecond.
+
+  @param  StartValue On output, the first value of the counter, if not NULL.
+  @param  EndValue   On output, the last value of the counter, if not NULL.
+
+  @return The counter's frequency, in Hz.
+
+**/
+UINT64
+EFIAPI
+GetPerformanceCounterProperties (
+  OUT UINT64 *StartValue OPTIONAL,
+  OUT UINT64 *EndValue OPTIONAL
+  )
+{
+  if (StartValue != NULL) {
+    *StartValue = 0;
+  }
+
+  if (EndValue != NULL) {
+    *EndValue = MAX_UINT64;
+  }
+
+  return HOST_COUNTER_FREQUENCY;
+}
+
+/**
+  Converts performance counter ticks to nanoseconds, which they already are.
+
+  @param  Ticks The number of ticks.
+
+  @return The number of nanoseconds.
+
+**/
+UINT64
+EFIAPI
+GetTimeInNanoSecond (
+  IN UINT64 Ticks
+  )
+{
+  return Ticks;
+}
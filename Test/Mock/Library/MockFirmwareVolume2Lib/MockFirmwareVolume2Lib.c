@@ -0,0 +1,1651 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <PiDxe.h>
+#include <Guid/FirmwareFileSystem2.h>
+#include <Guid/FirmwareFileSystem3.h>
+#include <Protocol/FirmwareVolume2.h>
+#include <Protocol/FirmwareVolumeBlock.h>
+#include <IndustryStandard/PeImage.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PrintLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiDecompressLib.h>
+#include <Library/MockFirmwareVolume2Lib.h>
+
+//
+// Constants
+//
+
+#define MOCK_FV_SIGNATURE         SIGNATURE_32 ('m', 'f', 'v', '2')
+#define MOCK_FV_BLOCK_SIZE        0x1000
+#define MOCK_FV_MAX_SECTION_DEPTH 8
+#define MOCK_FV_PE_HEADER_OFFSET  sizeof (EFI_IMAGE_DOS_HEADER)
+#define MOCK_FV_ENCODING_KEY      0xA5
+
+//
+// Types
+//
+
+///
+/// A file of a mock volume, found when it was installed.
+///
+typedef struct {
+  EFI_GUID        Name;       ///< The GUID naming the file.
+  EFI_FV_FILETYPE Type;       ///< The file's type.
+  UINT8           Attributes; ///< The attributes from the file's header.
+  UINTN           DataOffset; ///< Offset of the file's payload within the image.
+  UINTN           DataSize;   ///< Size of the file's payload in bytes.
+} MOCK_FV_FILE;
+
+///
+/// A mock volume, serving an image through FV2 and optionally FVB.
+///
+typedef struct {
+  UINT32                             Signature;     ///< MOCK_FV_SIGNATURE.
+  EFI_HANDLE                         Handle;        ///< The handle the instances are installed on.
+  EFI_FIRMWARE_VOLUME2_PROTOCOL      Fv2;           ///< The FV2 instance.
+  EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL Fvb;           ///< The FVB instance, if Access asks for one.
+  MOCK_FV_ACCESS                     Access;        ///< How the volume can be reached besides FV2.
+  UINT8                              *Image;        ///< The image.
+  UINTN                              FvLength;      ///< The length of the volume, from its header.
+  EFI_FVB_ATTRIBUTES_2               FvbAttributes; ///< The attributes from the volume's header.
+  UINTN                              BlockSize;     ///< Size of the volume's blocks, from its block map.
+  UINTN                              NumBlocks;     ///< Number of blocks of that size.
+  MOCK_FV_FILE                       *Files;        ///< The files, in volume order.
+  MOCK_FV_FILE                       **ByName;      ///< The files, sorted by GUID.
+  UINTN                              NumFiles;      ///< Number of files.
+  MOCK_FV_COUNTERS                   Counters;      ///< The volume's counters.
+} MOCK_FV;
+
+#define MOCK_FV_FROM_FV2(a) CR (a, MOCK_FV, Fv2, MOCK_FV_SIGNATURE)
+#define MOCK_FV_FROM_FVB(a) CR (a, MOCK_FV, Fvb, MOCK_FV_SIGNATURE)
+
+//
+// Module-scope variables
+//
+
+///
+/// EFI_FV_FILE_ATTRIB_ALIGNMENT values for each FFS_ATTRIB_DATA_ALIGNMENT
+/// value, as the DXE core reports them.
+///
+CONST UINT8 mMockFvAlignments[] = { 0, 4, 7, 9, 10, 12, 15, 16 };
+
+///
+/// GUID of the GUID-defined sections that MockFvGenerate() encodes and only
+/// the mock's own section extraction can decode, the way a core decodes LZMA
+/// sections with an extraction library that the driver knows nothing about.
+///
+EFI_GUID mMockFvEncodedSectionGuid = {
+  0x6d2e1c8a, 0x3f47, 0x4b9e, { 0x8a, 0x51, 0x2c, 0x7d, 0x90, 0x4e, 0xb3, 0x16 }
+};
+
+//
+// Misc. helper methods
+//
+
+/**
+  Compares the GUIDs naming two files, for qsort().
+
+  @param  Left  A pointer to the first file's MOCK_FV_FILE pointer.
+  @param  Right A pointer to the second file's MOCK_FV_FILE pointer.
+
+  @retval The order of the two GUIDs, compared as bytes.
+
+**/
+int
+MockFvCompareFiles (
+  IN CONST VOID *Left,
+  IN CONST VOID *Right
+  )
+{
+  return (int) CompareMem (
+                 &(*(MOCK_FV_FILE * CONST *) Left)->Name,
+                 &(*(MOCK_FV_FILE * CONST *) Right)->Name,
+                 sizeof (EFI_GUID));
+}
+
+/**
+  Finds a file of a mock volume by binary search, so that looking files up
+  costs the same whatever the number of files, and only the driver's own
+  behavior shows in the counters as the volume grows.
+
+  @param  MockFv   The mock volume.
+  @param  NameGuid The GUID naming the file.
+
+  @retval a file The file was found.
+  @retval NULL   The volume holds no such file.
+
+**/
+MOCK_FV_FILE *
+MockFvFindFile (
+  IN MOCK_FV        *MockFv,
+  IN CONST EFI_GUID *NameGuid
+  )
+{
+  UINTN Low, High, Middle;
+  INTN  Order;
+
+  Low  = 0;
+  High = MockFv->NumFiles;
+
+  while (Low < High) {
+    Middle = Low + (High - Low) / 2;
+    Order  = CompareMem (NameGuid, &MockFv->ByName[Middle]->Name, sizeof (EFI_GUID));
+
+    if (Order == 0) {
+      return MockFv->ByName[Middle];
+    } else if (Order < 0) {
+      High = Middle;
+    } else {
+      Low = Middle + 1;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Converts the attributes in an FFS file header to the file attributes that
+  FV2 reports for it.
+
+  @param  MockFv        The mock volume.
+  @param  FfsAttributes The attributes from the FFS file header.
+
+  @retval The file's FV2 attributes.
+
+**/
+EFI_FV_FILE_ATTRIBUTES
+MockFvFileAttributes (
+  IN MOCK_FV *MockFv,
+  IN UINT8   FfsAttributes
+  )
+{
+  EFI_FV_FILE_ATTRIBUTES Attributes;
+
+  Attributes = mMockFvAlignments[(FfsAttributes & FFS_ATTRIB_DATA_ALIGNMENT) >> 3];
+
+  if (MockFv->Access == MockFvAccessMapped) {
+    Attributes |= EFI_FV_FILE_ATTRIB_MEMORY_MAPPED;
+  }
+
+  if ((FfsAttributes & FFS_ATTRIB_FIXED) != 0) {
+    Attributes |= EFI_FV_FILE_ATTRIB_FIXED;
+  }
+
+  return Attributes;
+}
+
+/**
+  Determines if an FFS file header describes a file whose data is valid, the
+  same way the DXE core decides which files GetNextFile returns.
+
+  @param  FileHeader    The FFS file header.
+  @param  ErasePolarity TRUE if erased bits read as 1, FALSE for 0.
+
+  @retval TRUE  The file's highest state bit is EFI_FILE_DATA_VALID.
+  @retval FALSE The file is under construction, deleted or otherwise invalid.
+
+**/
+BOOLEAN
+MockFvFileIsValid (
+  IN EFI_FFS_FILE_HEADER *FileHeader,
+  IN BOOLEAN             ErasePolarity
+  )
+{
+  EFI_FFS_FILE_STATE State;
+  UINT8              HighestBit;
+
+  State = FileHeader->State;
+
+  if (ErasePolarity) {
+    State = (EFI_FFS_FILE_STATE) ~State;
+  }
+
+  for (HighestBit = 0x80; HighestBit != 0 && (State & HighestBit) == 0; HighestBit >>= 1);
+
+  return (BOOLEAN) (HighestBit == EFI_FILE_DATA_VALID);
+}
+
+/**
+  Copies bytes out to an FV2 caller. If *Buffer is NULL, a buffer is
+  allocated for the caller; otherwise as much as fits in the caller's buffer
+  is copied.
+
+  @param  MockFv     The mock volume.
+  @param  Source     The bytes to copy.
+  @param  Size       Number of bytes to copy.
+  @param  Buffer     On input, the caller's buffer, or NULL. On output, the
+                     buffer holding the bytes.
+  @param  BufferSize On input, the size of the caller's buffer. On output,
+                     the number of bytes copied.
+
+  @retval EFI_SUCCESS               The bytes were copied.
+  @retval EFI_WARN_BUFFER_TOO_SMALL The bytes were truncated to fit the buffer.
+  @retval EFI_OUT_OF_RESOURCES      A buffer could not be allocated.
+
+**/
+EFI_STATUS
+MockFvCopyOut (
+  IN     MOCK_FV    *MockFv,
+  IN     CONST VOID *Source,
+  IN     UINTN      Size,
+  IN OUT VOID       **Buffer,
+  IN OUT UINTN      *BufferSize
+  )
+{
+  EFI_STATUS Status;
+
+  Status = EFI_SUCCESS;
+
+  if (*Buffer == NULL) {
+    *Buffer = AllocatePool (Size);
+
+    if (*Buffer == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+  } else if (*BufferSize < Size) {
+    Size   = *BufferSize;
+    Status = EFI_WARN_BUFFER_TOO_SMALL;
+  }
+
+  CopyMem (*Buffer, Source, Size);
+
+  *BufferSize                     = Size;
+  MockFv->Counters.BytesReturned += Size;
+  return Status;
+}
+
+/**
+  Finds an instance of a section type in a section stream and copies it out,
+  the way the DXE core's section extraction does: compression sections are
+  decoded, GUID-defined sections that need no processing are searched in
+  place, and instances are numbered depth-first in stream order.
+
+  @param  MockFv          The mock volume.
+  @param  Stream          The section stream.
+  @param  StreamSize      Size of the stream in bytes.
+  @param  SectionType     The type of section to find, or EFI_SECTION_ALL for
+                          a section of any type.
+  @param  SectionInstance On input, the instance of the type to find. On
+                          output, the number of instances left to skip.
+  @param  Depth           Number of encapsulations the stream is inside.
+  @param  Buffer          The caller's buffer, as for MockFvCopyOut().
+  @param  BufferSize      The caller's buffer size, as for MockFvCopyOut().
+
+  @retval EFI_SUCCESS               The section was copied out.
+  @retval EFI_WARN_BUFFER_TOO_SMALL The section was truncated to fit the buffer.
+  @retval EFI_NOT_FOUND             The stream holds no such instance.
+  @retval EFI_OUT_OF_RESOURCES      There was not enough memory.
+
+**/
+EFI_STATUS
+MockFvFindSection (
+  IN     MOCK_FV          *MockFv,
+  IN     UINT8            *Stream,
+  IN     UINTN            StreamSize,
+  IN     EFI_SECTION_TYPE SectionType,
+  IN OUT UINTN            *SectionInstance,
+  IN     UINTN            Depth,
+  IN OUT VOID             **Buffer,
+  IN OUT UINTN            *BufferSize
+  )
+{
+  EFI_STATUS                Status;
+  EFI_COMMON_SECTION_HEADER *Section;
+  UINT8                     *Data, *Decoded, *Scratch;
+  UINTN                     Offset, Size, HeaderSize, DataSize, Index;
+  UINT32                    DecodedSize, ScratchSize;
+  UINT16                    GuidedOffset, GuidedAttributes;
+
+  Offset = 0;
+
+  while (Offset + sizeof (EFI_COMMON_SECTION_HEADER) <= StreamSize) {
+    Section = (EFI_COMMON_SECTION_HEADER *) (Stream + Offset);
+
+    if (IS_SECTION2 (Section)) {
+      if (Offset + sizeof (EFI_COMMON_SECTION_HEADER2) > StreamSize) {
+        break;
+      }
+
+      HeaderSize = sizeof (EFI_COMMON_SECTION_HEADER2);
+      Size       = SECTION2_SIZE (Section);
+    } else {
+      HeaderSize = sizeof (EFI_COMMON_SECTION_HEADER);
+      Size       = SECTION_SIZE (Section);
+    }
+
+    if (Size < HeaderSize || Size > StreamSize - Offset) {
+      break;
+    }
+
+    Data     = Stream + Offset + HeaderSize;
+    DataSize = Size - HeaderSize;
+
+    if (SectionType == EFI_SECTION_ALL || Section->Type == SectionType) {
+      if ((*SectionInstance)-- == 0) {
+        return MockFvCopyOut (MockFv, Data, DataSize, Buffer, BufferSize);
+      }
+    }
+
+    Status = EFI_NOT_FOUND;
+
+    if (Depth < MOCK_FV_MAX_SECTION_DEPTH &&
+        Section->Type == EFI_SECTION_COMPRESSION &&
+        DataSize >= sizeof (UINT32) + sizeof (UINT8)) {
+      //
+      // UncompressedLength and CompressionType follow the common header.
+      //
+      switch (Data[sizeof (UINT32)]) {
+      case EFI_NOT_COMPRESSED:
+        Status = MockFvFindSection (
+                   MockFv,
+                   Data + sizeof (UINT32) + sizeof (UINT8),
+                   DataSize - sizeof (UINT32) - sizeof (UINT8),
+                   SectionType,
+                   SectionInstance,
+                   Depth + 1,
+                   Buffer,
+                   BufferSize);
+        break;
+
+      case EFI_STANDARD_COMPRESSION:
+        Data     += sizeof (UINT32) + sizeof (UINT8);
+        DataSize -= sizeof (UINT32) + sizeof (UINT8);
+
+        if (RETURN_ERROR (UefiDecompressGetInfo (Data, (UINT32) DataSize, &DecodedSize, &ScratchSize))) {
+          break;
+        }
+
+        Decoded = AllocatePool (DecodedSize);
+        Scratch = AllocatePool (ScratchSize);
+
+        if (Decoded == NULL || Scratch == NULL) {
+          Status = EFI_OUT_OF_RESOURCES;
+        } else if (!RETURN_ERROR (UefiDecompress (Data, Decoded, Scratch))) {
+          Status = MockFvFindSection (
+                     MockFv,
+                     Decoded,
+                     DecodedSize,
+                     SectionType,
+                     SectionInstance,
+                     Depth + 1,
+                     Buffer,
+                     BufferSize);
+        }
+
+        if (Decoded != NULL) {
+          FreePool (Decoded);
+        }
+
+        if (Scratch != NULL) {
+          FreePool (Scratch);
+        }
+
+        break;
+      }
+    } else if (Depth < MOCK_FV_MAX_SECTION_DEPTH &&
+               Section->Type == EFI_SECTION_GUID_DEFINED &&
+               DataSize >= sizeof (EFI_GUID) + 2 * sizeof (UINT16)) {
+      //
+      // Sections whose GUID calls for processing are decoded if they are the
+      // mock's own encoding. Any other, such as LZMA compression, is opaque
+      // here, as it is to a core without the extraction library for it.
+      //
+      GuidedOffset     = ReadUnaligned16 ((UINT16 *) (Data + sizeof (EFI_GUID)));
+      GuidedAttributes = ReadUnaligned16 ((UINT16 *) (Data + sizeof (EFI_GUID) + sizeof (UINT16)));
+
+      if (GuidedOffset < HeaderSize || GuidedOffset > Size) {
+        Status = EFI_NOT_FOUND;
+      } else if ((GuidedAttributes & EFI_GUIDED_SECTION_PROCESSING_REQUIRED) == 0) {
+        Status = MockFvFindSection (
+                   MockFv,
+                   Stream + Offset + GuidedOffset,
+                   Size - GuidedOffset,
+                   SectionType,
+                   SectionInstance,
+                   Depth + 1,
+                   Buffer,
+                   BufferSize);
+      } else if (CompareGuid ((EFI_GUID *) Data, &mMockFvEncodedSectionGuid)) {
+        DecodedSize = (UINT32) (Size - GuidedOffset);
+        Decoded     = AllocatePool (MAX (DecodedSize, 1));
+
+        if (Decoded == NULL) {
+          Status = EFI_OUT_OF_RESOURCES;
+        } else {
+          for (Index = 0; Index < DecodedSize; Index++) {
+            Decoded[Index] = (UINT8) (Stream[Offset + GuidedOffset + Index] ^ MOCK_FV_ENCODING_KEY);
+          }
+
+          Status = MockFvFindSection (
+                     MockFv,
+                     Decoded,
+                     DecodedSize,
+                     SectionType,
+                     SectionInstance,
+                     Depth + 1,
+                     Buffer,
+                     BufferSize);
+          FreePool (Decoded);
+        }
+      }
+    }
+
+    if (Status != EFI_NOT_FOUND) {
+      return Status;
+    }
+
+    Offset = ALIGN_VALUE (Offset + Size, 4);
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+/**
+  Indexes the files of an image, walking their headers the way the DXE core
+  does: pad files, and files whose data is not valid, are skipped.
+
+  @param  MockFv The mock volume, whose Image and FvLength are set.
+
+  @retval EFI_SUCCESS          The files were indexed.
+  @retval EFI_VOLUME_CORRUPTED A file does not fit in the volume.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory.
+
+**/
+EFI_STATUS
+MockFvIndexFiles (
+  IN OUT MOCK_FV *MockFv
+  )
+{
+  EFI_FIRMWARE_VOLUME_HEADER     *FvHeader;
+  EFI_FIRMWARE_VOLUME_EXT_HEADER *ExtHeader;
+  EFI_FFS_FILE_HEADER            *FileHeader;
+  MOCK_FV_FILE                   *File;
+  BOOLEAN                        ErasePolarity;
+  UINTN                          FirstOffset, Offset, FileSize, HeaderSize, Index;
+  UINT8                          ErasedHeader[sizeof (EFI_FFS_FILE_HEADER)];
+
+  FvHeader      = (EFI_FIRMWARE_VOLUME_HEADER *) MockFv->Image;
+  ErasePolarity = (BOOLEAN) ((FvHeader->Attributes & EFI_FVB2_ERASE_POLARITY) != 0);
+  FirstOffset   = FvHeader->HeaderLength;
+
+  if (FvHeader->ExtHeaderOffset != 0 &&
+      FvHeader->ExtHeaderOffset + sizeof (EFI_FIRMWARE_VOLUME_EXT_HEADER) <= MockFv->FvLength) {
+    ExtHeader   = (EFI_FIRMWARE_VOLUME_EXT_HEADER *) (MockFv->Image + FvHeader->ExtHeaderOffset);
+    FirstOffset = FvHeader->ExtHeaderOffset + ExtHeader->ExtHeaderSize;
+  }
+
+  SetMem (ErasedHeader, sizeof (ErasedHeader), (UINT8) (ErasePolarity ? 0xFF : 0x00));
+
+  //
+  // Count the files on the first pass, and record them on the second.
+  //
+  for (Index = 0; Index < 2; Index++) {
+    MockFv->NumFiles = 0;
+    Offset           = ALIGN_VALUE (FirstOffset, 8);
+
+    while (Offset + sizeof (EFI_FFS_FILE_HEADER) <= MockFv->FvLength) {
+      FileHeader = (EFI_FFS_FILE_HEADER *) (MockFv->Image + Offset);
+
+      if (CompareMem (FileHeader, ErasedHeader, sizeof (ErasedHeader)) == 0) {
+        break;
+      }
+
+      if (IS_FFS_FILE2 (FileHeader)) {
+        if (Offset + sizeof (EFI_FFS_FILE_HEADER2) > MockFv->FvLength) {
+          return EFI_VOLUME_CORRUPTED;
+        }
+
+        HeaderSize = sizeof (EFI_FFS_FILE_HEADER2);
+        FileSize   = (UINTN) FFS_FILE2_SIZE (FileHeader);
+      } else {
+        HeaderSize = sizeof (EFI_FFS_FILE_HEADER);
+        FileSize   = FFS_FILE_SIZE (FileHeader);
+      }
+
+      if (FileSize < HeaderSize || FileSize > MockFv->FvLength - Offset) {
+        return EFI_VOLUME_CORRUPTED;
+      }
+
+      if (FileHeader->Type != EFI_FV_FILETYPE_FFS_PAD &&
+          MockFvFileIsValid (FileHeader, ErasePolarity)) {
+        if (MockFv->Files != NULL) {
+          File             = &MockFv->Files[MockFv->NumFiles];
+          File->Type       = FileHeader->Type;
+          File->Attributes = FileHeader->Attributes;
+          File->DataOffset = Offset + HeaderSize;
+          File->DataSize   = FileSize - HeaderSize;
+          CopyGuid (&File->Name, &FileHeader->Name);
+
+          MockFv->ByName[MockFv->NumFiles] = File;
+        }
+
+        MockFv->NumFiles++;
+      }
+
+      Offset = ALIGN_VALUE (Offset + FileSize, 8);
+    }
+
+    if (MockFv->Files == NULL) {
+      MockFv->Files  = AllocateZeroPool (MAX (MockFv->NumFiles, 1) * sizeof (MOCK_FV_FILE));
+      MockFv->ByName = AllocateZeroPool (MAX (MockFv->NumFiles, 1) * sizeof (MOCK_FV_FILE *));
+
+      if (MockFv->Files == NULL || MockFv->ByName == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+      }
+    }
+  }
+
+  qsort (MockFv->ByName, MockFv->NumFiles, sizeof (MOCK_FV_FILE *), MockFvCompareFiles);
+  return EFI_SUCCESS;
+}
+
+/**
+  Fills in the common header of a section.
+
+  @param  Section The section.
+  @param  Size    Size of the whole section in bytes, below 16 MB.
+  @param  Type    Type of the section.
+
+**/
+VOID
+MockFvSetSectionHeader (
+  OUT EFI_COMMON_SECTION_HEADER *Section,
+  IN  UINTN                     Size,
+  IN  EFI_SECTION_TYPE          Type
+  )
+{
+  Section->Size[0] = (UINT8) Size;
+  Section->Size[1] = (UINT8) (Size >> 8);
+  Section->Size[2] = (UINT8) (Size >> 16);
+  Section->Type    = Type;
+}
+
+/**
+  Lays out the FFS payload of a generated file, or only works out its size.
+
+  The payload of a RAW file is its data. Any other file holds a leaf section
+  of the type the description asks for, inside the encapsulation it asks
+  for, followed by a UI section if it is named. The data comes from a linear
+  congruential generator seeded by the volume's seed and the file's index;
+  images have a DOS header pointing at a PE header, or a TE header, written
+  over the start of it.
+
+  @param  File    The description of the file.
+  @param  Index   The index of the description.
+  @param  Seed    The volume's seed.
+  @param  Payload The buffer to lay the payload out in, or NULL to only work
+                  out its size.
+
+  @retval The size of the payload in bytes.
+
+**/
+UINTN
+MockFvWritePayload (
+  IN  CONST MOCK_FV_FILE_SPEC *File,
+  IN  UINTN                   Index,
+  IN  UINT32                  Seed,
+  OUT UINT8                   *Payload OPTIONAL
+  )
+{
+  EFI_COMPRESSION_SECTION  *Compression;
+  EFI_GUID_DEFINED_SECTION *Guided;
+  EFI_IMAGE_DOS_HEADER     *DosHeader;
+  UINT8                    *Data, *Leaf;
+  UINTN                    Offset, LeafSize, Byte, NameSize;
+  UINT32                   Random;
+  CHAR16                   Name[16];
+
+  //
+  // Place the leaf data, behind its headers unless the file is RAW.
+  //
+  Offset = 0;
+
+  if (File->Type != EFI_FV_FILETYPE_RAW) {
+    if (File->Encoding == MockFvEncodingUncompressed) {
+      Offset += sizeof (EFI_COMPRESSION_SECTION);
+    } else if (File->Encoding == MockFvEncodingGuided) {
+      Offset += sizeof (EFI_GUID_DEFINED_SECTION);
+    }
+
+    Offset += sizeof (EFI_COMMON_SECTION_HEADER);
+  }
+
+  if (Payload != NULL) {
+    Data   = Payload + Offset;
+    Random = Seed ^ (UINT32) (Index * 0x9E3779B9);
+
+    for (Byte = 0; Byte < File->DataSize; Byte++) {
+      Random     = Random * 1103515245 + 12345;
+      Data[Byte] = (UINT8) (Random >> 16);
+    }
+
+    if (File->SectionType == EFI_SECTION_PE32) {
+      DosHeader           = (EFI_IMAGE_DOS_HEADER *) Data;
+      DosHeader->e_magic  = EFI_IMAGE_DOS_SIGNATURE;
+      DosHeader->e_lfanew = MOCK_FV_PE_HEADER_OFFSET;
+      WriteUnaligned32 ((UINT32 *) (Data + MOCK_FV_PE_HEADER_OFFSET), EFI_IMAGE_NT_SIGNATURE);
+      WriteUnaligned16 ((UINT16 *) (Data + MOCK_FV_PE_HEADER_OFFSET + sizeof (UINT32)), File->Machine);
+    } else if (File->SectionType == EFI_SECTION_TE) {
+      WriteUnaligned16 ((UINT16 *) Data, EFI_TE_IMAGE_HEADER_SIGNATURE);
+      WriteUnaligned16 ((UINT16 *) (Data + sizeof (UINT16)), File->Machine);
+    }
+  }
+
+  Offset += File->DataSize;
+
+  if (File->Type == EFI_FV_FILETYPE_RAW) {
+    return Offset;
+  }
+
+  //
+  // Fill in the leaf section's header, then its encapsulation's, encoding
+  // the leaf section if the encapsulation calls for it.
+  //
+  LeafSize = sizeof (EFI_COMMON_SECTION_HEADER) + File->DataSize;
+
+  if (Payload != NULL) {
+    Leaf = Payload + Offset - LeafSize;
+    MockFvSetSectionHeader ((EFI_COMMON_SECTION_HEADER *) Leaf, LeafSize, File->SectionType);
+
+    if (File->Encoding == MockFvEncodingUncompressed) {
+      Compression = (EFI_COMPRESSION_SECTION *) Payload;
+      MockFvSetSectionHeader (&Compression->CommonHeader, Offset, EFI_SECTION_COMPRESSION);
+      Compression->UncompressedLength = (UINT32) LeafSize;
+      Compression->CompressionType    = EFI_NOT_COMPRESSED;
+    } else if (File->Encoding == MockFvEncodingGuided) {
+      Guided = (EFI_GUID_DEFINED_SECTION *) Payload;
+      MockFvSetSectionHeader (&Guided->CommonHeader, Offset, EFI_SECTION_GUID_DEFINED);
+      CopyGuid (&Guided->SectionDefinitionGuid, &mMockFvEncodedSectionGuid);
+      Guided->DataOffset = sizeof (EFI_GUID_DEFINED_SECTION);
+      Guided->Attributes = EFI_GUIDED_SECTION_PROCESSING_REQUIRED;
+
+      for (Byte = 0; Byte < LeafSize; Byte++) {
+        Leaf[Byte] ^= MOCK_FV_ENCODING_KEY;
+      }
+    }
+  }
+
+  if (File->Named) {
+    Offset   = ALIGN_VALUE (Offset, 4);
+    NameSize = (UnicodeSPrint (Name, sizeof (Name), L"File%d", Index) + 1) * sizeof (CHAR16);
+
+    if (Payload != NULL) {
+      MockFvSetSectionHeader (
+        (EFI_COMMON_SECTION_HEADER *) (Payload + Offset),
+        sizeof (EFI_COMMON_SECTION_HEADER) + NameSize,
+        EFI_SECTION_USER_INTERFACE);
+      CopyMem (Payload + Offset + sizeof (EFI_COMMON_SECTION_HEADER), Name, NameSize);
+    }
+
+    Offset += sizeof (EFI_COMMON_SECTION_HEADER) + NameSize;
+  }
+
+  return Offset;
+}
+
+//
+// Mock FV2 protocol functions
+//
+
+/**
+  Returns the attributes of a mock volume, which is always readable.
+
+  @param  This         The mock volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  FvAttributes On output, the volume's attributes.
+
+  @retval EFI_SUCCESS The attributes were returned.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2GetVolumeAttributes (
+  IN  CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  OUT EFI_FV_ATTRIBUTES                   *FvAttributes
+  )
+{
+  MOCK_FV *MockFv;
+
+  MockFv        = MOCK_FV_FROM_FV2 (This);
+  *FvAttributes = EFI_FV2_READ_STATUS;
+
+  if (MockFv->Access == MockFvAccessMapped) {
+    *FvAttributes |= EFI_FV2_MEMORY_MAPPED;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Sets the attributes of a mock volume, which cannot be changed.
+
+  @param  This         The mock volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  FvAttributes The requested attributes.
+
+  @retval EFI_ACCESS_DENIED The attributes cannot be changed.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2SetVolumeAttributes (
+  IN     CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN OUT EFI_FV_ATTRIBUTES                   *FvAttributes
+  )
+{
+  return EFI_ACCESS_DENIED;
+}
+
+/**
+  Reads a whole file from a mock volume.
+
+  @param  This                 The mock volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  NameGuid             The GUID naming the file to read.
+  @param  Buffer               On input, the caller's buffer, NULL to have one
+                               allocated, or a NULL pointer to only return
+                               the file's size, type and attributes. On
+                               output, the buffer holding the file's payload.
+  @param  BufferSize           On input, the size of the caller's buffer. On
+                               output, the number of bytes returned.
+  @param  FoundType            On output, the file's type.
+  @param  FileAttributes       On output, the file's attributes.
+  @param  AuthenticationStatus On output, 0, since nothing is authenticated.
+
+  @retval EFI_SUCCESS               The file was read.
+  @retval EFI_WARN_BUFFER_TOO_SMALL The file was truncated to fit the buffer.
+  @retval EFI_NOT_FOUND             The volume holds no such file.
+  @retval EFI_OUT_OF_RESOURCES      A buffer could not be allocated.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2ReadFile (
+  IN     CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN     CONST EFI_GUID                      *NameGuid,
+  IN OUT VOID                                **Buffer,
+  IN OUT UINTN                               *BufferSize,
+  OUT    EFI_FV_FILETYPE                     *FoundType,
+  OUT    EFI_FV_FILE_ATTRIBUTES              *FileAttributes,
+  OUT    UINT32                              *AuthenticationStatus
+  )
+{
+  MOCK_FV      *MockFv;
+  MOCK_FV_FILE *File;
+
+  MockFv = MOCK_FV_FROM_FV2 (This);
+  MockFv->Counters.ReadFileCalls++;
+
+  File = MockFvFindFile (MockFv, NameGuid);
+
+  if (File == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  *FoundType            = File->Type;
+  *FileAttributes       = MockFvFileAttributes (MockFv, File->Attributes);
+  *AuthenticationStatus = 0;
+
+  if (Buffer == NULL) {
+    *BufferSize = File->DataSize;
+    return EFI_SUCCESS;
+  }
+
+  return MockFvCopyOut (MockFv, MockFv->Image + File->DataOffset, File->DataSize, Buffer, BufferSize);
+}
+
+/**
+  Reads a section of a file in a mock volume.
+
+  @param  This                 The mock volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  NameGuid             The GUID naming the file to read.
+  @param  SectionType          The type of section to read, or EFI_SECTION_ALL
+                               for a section of any type.
+  @param  SectionInstance      The instance of the type to read.
+  @param  Buffer               On input, the caller's buffer, or NULL to have
+                               one allocated. On output, the buffer holding
+                               the section's contents.
+  @param  BufferSize           On input, the size of the caller's buffer. On
+                               output, the number of bytes returned.
+  @param  AuthenticationStatus On output, 0, since nothing is authenticated.
+
+  @retval EFI_SUCCESS               The section was read.
+  @retval EFI_WARN_BUFFER_TOO_SMALL The section was truncated to fit the buffer.
+  @retval EFI_NOT_FOUND             The file or the section does not exist.
+  @retval EFI_OUT_OF_RESOURCES      There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2ReadSection (
+  IN     CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN     CONST EFI_GUID                      *NameGuid,
+  IN     EFI_SECTION_TYPE                    SectionType,
+  IN     UINTN                               SectionInstance,
+  IN OUT VOID                                **Buffer,
+  IN OUT UINTN                               *BufferSize,
+  OUT    UINT32                              *AuthenticationStatus
+  )
+{
+  MOCK_FV      *MockFv;
+  MOCK_FV_FILE *File;
+
+  MockFv = MOCK_FV_FROM_FV2 (This);
+  MockFv->Counters.ReadSectionCalls++;
+
+  File = MockFvFindFile (MockFv, NameGuid);
+
+  //
+  // RAW files hold no sections.
+  //
+  if (File == NULL || File->Type == EFI_FV_FILETYPE_RAW) {
+    return EFI_NOT_FOUND;
+  }
+
+  *AuthenticationStatus = 0;
+
+  return MockFvFindSection (
+           MockFv,
+           MockFv->Image + File->DataOffset,
+           File->DataSize,
+           SectionType,
+           &SectionInstance,
+           0,
+           Buffer,
+           BufferSize);
+}
+
+/**
+  Writes files to a mock volume, which is read-only.
+
+  @param  This          The mock volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  NumberOfFiles Number of files to write.
+  @param  WritePolicy   The write policy.
+  @param  FileData      The files to write.
+
+  @retval EFI_WRITE_PROTECTED The volume is read-only.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2WriteFile (
+  IN CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN UINT32                              NumberOfFiles,
+  IN EFI_FV_WRITE_POLICY                 WritePolicy,
+  IN EFI_FV_WRITE_FILE_DATA              *FileData
+  )
+{
+  return EFI_WRITE_PROTECTED;
+}
+
+/**
+  Gets the next file in a mock volume. The key holds the index of the file
+  following the one last returned, so that each call costs the same however
+  far into the volume it is.
+
+  @param  This       The mock volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  Key        On input, where to continue the search from. On output,
+                     where to continue the next search from.
+  @param  FileType   On input, the type of file to find, or
+                     EFI_FV_FILETYPE_ALL. On output, the file's type.
+  @param  NameGuid   On output, the GUID naming the file.
+  @param  Attributes On output, the file's attributes.
+  @param  Size       On output, the size of the file's FFS payload in bytes.
+
+  @retval EFI_SUCCESS   A file was found.
+  @retval EFI_NOT_FOUND There are no more files of the type in the volume.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2GetNextFile (
+  IN     CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN OUT VOID                                *Key,
+  IN OUT EFI_FV_FILETYPE                     *FileType,
+  OUT    EFI_GUID                            *NameGuid,
+  OUT    EFI_FV_FILE_ATTRIBUTES              *Attributes,
+  OUT    UINTN                               *Size
+  )
+{
+  MOCK_FV      *MockFv;
+  MOCK_FV_FILE *File;
+  UINTN        Index;
+
+  MockFv = MOCK_FV_FROM_FV2 (This);
+  MockFv->Counters.GetNextFileCalls++;
+
+  for (Index = *(UINTN *) Key; Index < MockFv->NumFiles; Index++) {
+    File = &MockFv->Files[Index];
+
+    if (*FileType == EFI_FV_FILETYPE_ALL || File->Type == *FileType) {
+      *(UINTN *) Key = Index + 1;
+      *FileType      = File->Type;
+      *Attributes    = MockFvFileAttributes (MockFv, File->Attributes);
+      *Size          = File->DataSize;
+      CopyGuid (NameGuid, &File->Name);
+      return EFI_SUCCESS;
+    }
+  }
+
+  *(UINTN *) Key = MockFv->NumFiles;
+  return EFI_NOT_FOUND;
+}
+
+/**
+  Gets information about a mock volume, which has none to give.
+
+  @param  This             The mock volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  InformationType  The type of information.
+  @param  BufferSize       The size of Buffer.
+  @param  Buffer           The buffer to return the information in.
+
+  @retval EFI_UNSUPPORTED The information type is not supported.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2GetInfo (
+  IN     CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN     CONST EFI_GUID                      *InformationType,
+  IN OUT UINTN                               *BufferSize,
+  OUT    VOID                                *Buffer
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+/**
+  Sets information about a mock volume, which cannot be changed.
+
+  @param  This             The mock volume's EFI_FIRMWARE_VOLUME2_PROTOCOL.
+  @param  InformationType  The type of information.
+  @param  BufferSize       The size of Buffer.
+  @param  Buffer           The information.
+
+  @retval EFI_UNSUPPORTED The information type is not supported.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2SetInfo (
+  IN CONST EFI_FIRMWARE_VOLUME2_PROTOCOL *This,
+  IN CONST EFI_GUID                      *InformationType,
+  IN UINTN                               BufferSize,
+  IN CONST VOID                          *Buffer
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+//
+// Mock FVB protocol functions
+//
+
+/**
+  Returns the attributes of a mock volume's blocks.
+
+  @param  This       The mock volume's EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL.
+  @param  Attributes On output, the volume's attributes.
+
+  @retval EFI_SUCCESS The attributes were returned.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFvbGetAttributes (
+  IN  CONST EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL *This,
+  OUT EFI_FVB_ATTRIBUTES_2                     *Attributes
+  )
+{
+  MOCK_FV *MockFv;
+
+  MockFv      = MOCK_FV_FROM_FVB (This);
+  *Attributes = (MockFv->FvbAttributes & ~EFI_FVB2_MEMORY_MAPPED) | EFI_FVB2_READ_STATUS;
+
+  if (MockFv->Access == MockFvAccessMapped) {
+    *Attributes |= EFI_FVB2_MEMORY_MAPPED;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Sets the attributes of a mock volume's blocks, which cannot be changed.
+
+  @param  This       The mock volume's EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL.
+  @param  Attributes The requested attributes.
+
+  @retval EFI_ACCESS_DENIED The attributes cannot be changed.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFvbSetAttributes (
+  IN     CONST EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL *This,
+  IN OUT EFI_FVB_ATTRIBUTES_2                     *Attributes
+  )
+{
+  return EFI_ACCESS_DENIED;
+}
+
+/**
+  Returns the address a mock volume is mapped at.
+
+  @param  This    The mock volume's EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL.
+  @param  Address On output, the address of the volume.
+
+  @retval EFI_SUCCESS     The address was returned.
+  @retval EFI_UNSUPPORTED The volume is not memory-mapped.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFvbGetPhysicalAddress (
+  IN  CONST EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL *This,
+  OUT EFI_PHYSICAL_ADDRESS                     *Address
+  )
+{
+  MOCK_FV *MockFv;
+
+  MockFv = MOCK_FV_FROM_FVB (This);
+
+  if (MockFv->Access != MockFvAccessMapped) {
+    return EFI_UNSUPPORTED;
+  }
+
+  *Address = (EFI_PHYSICAL_ADDRESS) (UINTN) MockFv->Image;
+  return EFI_SUCCESS;
+}
+
+/**
+  Returns the size of a block of a mock volume, and the number of blocks of
+  that size from it on, from the first entry of the volume's block map.
+
+  @param  This           The mock volume's EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL.
+  @param  Lba            The block.
+  @param  BlockSize      On output, the size of the block.
+  @param  NumberOfBlocks On output, the number of blocks of that size from
+                         Lba on.
+
+  @retval EFI_SUCCESS           The size was returned.
+  @retval EFI_INVALID_PARAMETER The block is outside the first entry of the
+                                volume's block map.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFvbGetBlockSize (
+  IN  CONST EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL *This,
+  IN  EFI_LBA                                  Lba,
+  OUT UINTN                                    *BlockSize,
+  OUT UINTN                                    *NumberOfBlocks
+  )
+{
+  MOCK_FV *MockFv;
+
+  MockFv = MOCK_FV_FROM_FVB (This);
+
+  if (Lba >= MockFv->NumBlocks) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  *BlockSize      = MockFv->BlockSize;
+  *NumberOfBlocks = MockFv->NumBlocks - (UINTN) Lba;
+  return EFI_SUCCESS;
+}
+
+/**
+  Reads bytes from a block of a mock volume. Reads do not cross block
+  boundaries, as with real flash.
+
+  @param  This     The mock volume's EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL.
+  @param  Lba      The block to read from.
+  @param  Offset   Offset within the block to read from.
+  @param  NumBytes On input, the number of bytes to read. On output, the
+                   number of bytes read.
+  @param  Buffer   The buffer to read into.
+
+  @retval EFI_SUCCESS         The bytes were read.
+  @retval EFI_BAD_BUFFER_SIZE The read was truncated at the end of the block.
+  @retval EFI_DEVICE_ERROR    The range starts outside the volume.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFvbRead (
+  IN     CONST EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL *This,
+  IN     EFI_LBA                                  Lba,
+  IN     UINTN                                    Offset,
+  IN OUT UINTN                                    *NumBytes,
+  IN     UINT8                                    *Buffer
+  )
+{
+  EFI_STATUS Status;
+  MOCK_FV    *MockFv;
+
+  MockFv = MOCK_FV_FROM_FVB (This);
+  MockFv->Counters.FvbReadCalls++;
+
+  if (Lba >= MockFv->NumBlocks || Offset >= MockFv->BlockSize) {
+    *NumBytes = 0;
+    return EFI_DEVICE_ERROR;
+  }
+
+  Status = EFI_SUCCESS;
+
+  if (*NumBytes > MockFv->BlockSize - Offset) {
+    *NumBytes = MockFv->BlockSize - Offset;
+    Status    = EFI_BAD_BUFFER_SIZE;
+  }
+
+  CopyMem (Buffer, MockFv->Image + (UINTN) Lba * MockFv->BlockSize + Offset, *NumBytes);
+
+  MockFv->Counters.BytesReturned += *NumBytes;
+  return Status;
+}
+
+/**
+  Writes bytes to a block of a mock volume, which is read-only.
+
+  @param  This     The mock volume's EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL.
+  @param  Lba      The block to write to.
+  @param  Offset   Offset within the block to write to.
+  @param  NumBytes The number of bytes to write.
+  @param  Buffer   The bytes to write.
+
+  @retval EFI_ACCESS_DENIED The volume is read-only.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFvbWrite (
+  IN     CONST EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL *This,
+  IN     EFI_LBA                                  Lba,
+  IN     UINTN                                    Offset,
+  IN OUT UINTN                                    *NumBytes,
+  IN     UINT8                                    *Buffer
+  )
+{
+  return EFI_ACCESS_DENIED;
+}
+
+/**
+  Erases blocks of a mock volume, which is read-only.
+
+  @param  This The mock volume's EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL.
+  @param  ...  The ranges of blocks to erase.
+
+  @retval EFI_ACCESS_DENIED The volume is read-only.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFvbEraseBlocks (
+  IN CONST EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL *This,
+  ...
+  )
+{
+  return EFI_ACCESS_DENIED;
+}
+
+//
+// Library functions
+//
+
+/**
+  Finds the mock volume installed on a handle.
+
+  @param  Handle The handle.
+
+  @retval a volume The handle carries a mock volume.
+  @retval NULL     It does not.
+
+**/
+MOCK_FV *
+MockFvFromHandle (
+  IN EFI_HANDLE Handle
+  )
+{
+  EFI_STATUS                    Status;
+  EFI_FIRMWARE_VOLUME2_PROTOCOL *Fv2;
+
+  Status = gBS->HandleProtocol (Handle, &gEfiFirmwareVolume2ProtocolGuid, (VOID **) &Fv2);
+
+  if (EFI_ERROR (Status) || Fv2->GetNextFile != MockFv2GetNextFile) {
+    return NULL;
+  }
+
+  return MOCK_FV_FROM_FV2 (Fv2);
+}
+
+/**
+  Returns the GUID naming a file of a volume made by MockFvGenerate().
+
+  @param  Seed     The seed the volume was generated with.
+  @param  Index    The index of the file's description.
+  @param  NameGuid On output, the GUID naming the file.
+
+**/
+VOID
+EFIAPI
+MockFvFileGuid (
+  IN  UINT32   Seed,
+  IN  UINTN    Index,
+  OUT EFI_GUID *NameGuid
+  )
+{
+  NameGuid->Data1 = (UINT32) Index;
+  NameGuid->Data2 = (UINT16) Seed;
+  NameGuid->Data3 = (UINT16) (Seed >> 16);
+  CopyMem (NameGuid->Data4, "MockFile", sizeof (NameGuid->Data4));
+}
+
+/**
+  Generates a firmware volume image holding one file per description. The
+  files are named by GUIDs made of Seed and their index, and filled with data
+  that only depends on the same, so that the same arguments always make the
+  same image. Compression sections are stored uncompressed: they are still
+  encapsulation, but can be read in place and need no compressor to make.
+  Sections that have to be decoded are GUID-defined sections of the mock's
+  own, which only its FV2 instances can decode.
+
+  @param  Files     The descriptions of the files.
+  @param  FileCount Number of descriptions.
+  @param  Seed      Seed of the names and data of the files.
+  @param  Image     On output, the image. Free it with MockFvFree().
+  @param  ImageSize On output, the size of the image.
+
+  @retval EFI_SUCCESS           The image was generated.
+  @retval EFI_INVALID_PARAMETER A file is too large for a plain FFS file, or
+                                too small for the image it holds.
+  @retval EFI_OUT_OF_RESOURCES  There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFvGenerate (
+  IN  CONST MOCK_FV_FILE_SPEC *Files,
+  IN  UINTN                   FileCount,
+  IN  UINT32                  Seed,
+  OUT VOID                    **Image,
+  OUT UINTN                   *ImageSize
+  )
+{
+  EFI_FIRMWARE_VOLUME_HEADER *FvHeader;
+  EFI_FFS_FILE_HEADER        *FileHeader;
+  UINT8                      *Buffer;
+  UINTN                      HeaderLength, Offset, Index, FileSize, MinimumSize, Length;
+
+  ASSERT (Image != NULL && ImageSize != NULL);
+  ASSERT (Files != NULL || FileCount == 0);
+
+  //
+  // Size the image first: the volume header and a terminating block map
+  // entry, then each file, 8-byte aligned.
+  //
+  HeaderLength = sizeof (EFI_FIRMWARE_VOLUME_HEADER) + sizeof (EFI_FV_BLOCK_MAP_ENTRY);
+  Length       = HeaderLength;
+
+  for (Index = 0; Index < FileCount; Index++) {
+    switch (Files[Index].SectionType) {
+    case EFI_SECTION_PE32:
+      MinimumSize = MOCK_FV_PE_HEADER_OFFSET + sizeof (UINT32) + sizeof (UINT16);
+      break;
+
+    case EFI_SECTION_TE:
+      MinimumSize = 2 * sizeof (UINT16);
+      break;
+
+    default:
+      MinimumSize = 0;
+      break;
+    }
+
+    FileSize = sizeof (EFI_FFS_FILE_HEADER) + MockFvWritePayload (&Files[Index], Index, Seed, NULL);
+
+    if (Files[Index].DataSize < MinimumSize || FileSize > 0xFFFFFF) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    Length = ALIGN_VALUE (Length, 8) + FileSize;
+  }
+
+  Length = ALIGN_VALUE (Length, MOCK_FV_BLOCK_SIZE);
+  Buffer = AllocatePages (EFI_SIZE_TO_PAGES (Length));
+
+  if (Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // The volume is erased to 1s, like flash.
+  //
+  SetMem (Buffer, Length, 0xFF);
+
+  FvHeader = (EFI_FIRMWARE_VOLUME_HEADER *) Buffer;
+  ZeroMem (FvHeader, HeaderLength);
+  CopyGuid (&FvHeader->FileSystemGuid, &gEfiFirmwareFileSystem2Guid);
+  FvHeader->FvLength              = Length;
+  FvHeader->Signature             = EFI_FVH_SIGNATURE;
+  FvHeader->Attributes            = EFI_FVB2_READ_ENABLED_CAP | EFI_FVB2_READ_STATUS |
+                                    EFI_FVB2_ERASE_POLARITY | EFI_FVB2_ALIGNMENT_8;
+  FvHeader->HeaderLength          = (UINT16) HeaderLength;
+  FvHeader->Revision              = EFI_FVH_REVISION;
+  FvHeader->BlockMap[0].NumBlocks = (UINT32) (Length / MOCK_FV_BLOCK_SIZE);
+  FvHeader->BlockMap[0].Length    = MOCK_FV_BLOCK_SIZE;
+  FvHeader->Checksum              = CalculateCheckSum16 ((UINT16 *) FvHeader, HeaderLength);
+
+  Offset = HeaderLength;
+
+  for (Index = 0; Index < FileCount; Index++) {
+    Offset     = ALIGN_VALUE (Offset, 8);
+    FileHeader = (EFI_FFS_FILE_HEADER *) (Buffer + Offset);
+    FileSize   = sizeof (EFI_FFS_FILE_HEADER) + MockFvWritePayload (&Files[Index], Index, Seed, (UINT8 *) (FileHeader + 1));
+
+    //
+    // Fill in the header last. Its checksum is computed with State and the
+    // file checksum cleared.
+    //
+    ZeroMem (FileHeader, sizeof (EFI_FFS_FILE_HEADER));
+    MockFvFileGuid (Seed, Index, &FileHeader->Name);
+
+    FileHeader->Type    = Files[Index].Type;
+    FileHeader->Size[0] = (UINT8) FileSize;
+    FileHeader->Size[1] = (UINT8) (FileSize >> 8);
+    FileHeader->Size[2] = (UINT8) (FileSize >> 16);
+
+    FileHeader->IntegrityCheck.Checksum.Header = CalculateCheckSum8 ((UINT8 *) FileHeader, sizeof (EFI_FFS_FILE_HEADER));
+    FileHeader->IntegrityCheck.Checksum.File   = FFS_FIXED_CHECKSUM;
+    FileHeader->State                          = (EFI_FFS_FILE_STATE) ~(EFI_FILE_HEADER_CONSTRUCTION |
+                                                                        EFI_FILE_HEADER_VALID |
+                                                                        EFI_FILE_DATA_VALID);
+
+    Offset += FileSize;
+  }
+
+  *Image     = Buffer;
+  *ImageSize = Length;
+  return EFI_SUCCESS;
+}
+
+/**
+  Loads a firmware volume image from a file of the host, such as an FV built
+  for a platform.
+
+  @param  FileName  Path of the file on the host.
+  @param  Image     On output, the image. Free it with MockFvFree().
+  @param  ImageSize On output, the size of the image.
+
+  @retval EFI_SUCCESS          The image was loaded.
+  @retval EFI_NOT_FOUND        The file could not be opened.
+  @retval EFI_DEVICE_ERROR     The file could not be read.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFvLoad (
+  IN  CONST CHAR8 *FileName,
+  OUT VOID        **Image,
+  OUT UINTN       *ImageSize
+  )
+{
+  EFI_STATUS Status;
+  FILE       *File;
+  long       Length;
+  VOID       *Buffer;
+
+  File = fopen (FileName, "rb");
+
+  if (File == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Buffer = NULL;
+  Status = EFI_DEVICE_ERROR;
+
+  if (fseek (File, 0, SEEK_END) != 0 || (Length = ftell (File)) <= 0 || fseek (File, 0, SEEK_SET) != 0) {
+    goto Done;
+  }
+
+  Buffer = AllocatePages (EFI_SIZE_TO_PAGES ((UINTN) Length));
+
+  if (Buffer == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  if (fread (Buffer, 1, (size_t) Length, File) != (size_t) Length) {
+    FreePages (Buffer, EFI_SIZE_TO_PAGES ((UINTN) Length));
+    goto Done;
+  }
+
+  *Image     = Buffer;
+  *ImageSize = (UINTN) Length;
+  Status     = EFI_SUCCESS;
+
+Done:
+  fclose (File);
+  return Status;
+}
+
+/**
+  Frees an image made by MockFvGenerate() or MockFvLoad(). Volumes installed
+  on it must not be used any more.
+
+  @param  Image     The image.
+  @param  ImageSize The size of the image.
+
+**/
+VOID
+EFIAPI
+MockFvFree (
+  IN VOID  *Image,
+  IN UINTN ImageSize
+  )
+{
+  FreePages (Image, EFI_SIZE_TO_PAGES (ImageSize));
+}
+
+/**
+  Installs a mock FV2 instance serving an image on a new handle, along with
+  an FVB instance if Access asks for one. The files of the image are indexed
+  first, so that the mock's own lookups take no part in what is measured.
+
+  @param  Image     The image, which has to stay allocated while it is used.
+  @param  ImageSize The size of the image.
+  @param  Access    How the volume can be reached besides FV2.
+  @param  Handle    On output, the handle the instances are installed on.
+
+  @retval EFI_SUCCESS          The instances were installed.
+  @retval EFI_VOLUME_CORRUPTED The image is not a valid firmware volume.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2Install (
+  IN  VOID           *Image,
+  IN  UINTN          ImageSize,
+  IN  MOCK_FV_ACCESS Access,
+  OUT EFI_HANDLE     *Handle
+  )
+{
+  EFI_STATUS                 Status;
+  EFI_FIRMWARE_VOLUME_HEADER *FvHeader;
+  MOCK_FV                    *MockFv;
+
+  FvHeader = Image;
+
+  if (ImageSize < sizeof (EFI_FIRMWARE_VOLUME_HEADER) ||
+      FvHeader->Signature != EFI_FVH_SIGNATURE ||
+      (!CompareGuid (&FvHeader->FileSystemGuid, &gEfiFirmwareFileSystem2Guid) &&
+       !CompareGuid (&FvHeader->FileSystemGuid, &gEfiFirmwareFileSystem3Guid)) ||
+      FvHeader->HeaderLength < sizeof (EFI_FIRMWARE_VOLUME_HEADER) ||
+      FvHeader->FvLength < FvHeader->HeaderLength ||
+      FvHeader->FvLength > ImageSize ||
+      FvHeader->BlockMap[0].Length == 0) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  MockFv = AllocateZeroPool (sizeof (MOCK_FV));
+
+  if (MockFv == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  MockFv->Signature     = MOCK_FV_SIGNATURE;
+  MockFv->Access        = Access;
+  MockFv->Image         = Image;
+  MockFv->FvLength      = (UINTN) FvHeader->FvLength;
+  MockFv->FvbAttributes = FvHeader->Attributes;
+  MockFv->BlockSize     = FvHeader->BlockMap[0].Length;
+  MockFv->NumBlocks     = FvHeader->BlockMap[0].NumBlocks;
+
+  Status = MockFvIndexFiles (MockFv);
+
+  if (EFI_ERROR (Status)) {
+    goto Done;
+  }
+
+  MockFv->Fv2.GetVolumeAttributes = MockFv2GetVolumeAttributes;
+  MockFv->Fv2.SetVolumeAttributes = MockFv2SetVolumeAttributes;
+  MockFv->Fv2.ReadFile            = MockFv2ReadFile;
+  MockFv->Fv2.ReadSection         = MockFv2ReadSection;
+  MockFv->Fv2.WriteFile           = MockFv2WriteFile;
+  MockFv->Fv2.GetNextFile         = MockFv2GetNextFile;
+  MockFv->Fv2.KeySize             = sizeof (UINTN);
+  MockFv->Fv2.GetInfo             = MockFv2GetInfo;
+  MockFv->Fv2.SetInfo             = MockFv2SetInfo;
+
+  MockFv->Fvb.GetAttributes       = MockFvbGetAttributes;
+  MockFv->Fvb.SetAttributes       = MockFvbSetAttributes;
+  MockFv->Fvb.GetPhysicalAddress  = MockFvbGetPhysicalAddress;
+  MockFv->Fvb.GetBlockSize        = MockFvbGetBlockSize;
+  MockFv->Fvb.Read                = MockFvbRead;
+  MockFv->Fvb.Write               = MockFvbWrite;
+  MockFv->Fvb.EraseBlocks         = MockFvbEraseBlocks;
+
+  if (Access == MockFvAccessFv2Only) {
+    Status = gBS->InstallMultipleProtocolInterfaces (
+                    &MockFv->Handle,
+                    &gEfiFirmwareVolume2ProtocolGuid,
+                    &MockFv->Fv2,
+                    NULL
+                    );
+  } else {
+    Status = gBS->InstallMultipleProtocolInterfaces (
+                    &MockFv->Handle,
+                    &gEfiFirmwareVolumeBlockProtocolGuid,
+                    &MockFv->Fvb,
+                    &gEfiFirmwareVolume2ProtocolGuid,
+                    &MockFv->Fv2,
+                    NULL
+                    );
+  }
+
+Done:
+  if (EFI_ERROR (Status)) {
+    if (MockFv->Files != NULL) {
+      FreePool (MockFv->Files);
+    }
+
+    if (MockFv->ByName != NULL) {
+      FreePool (MockFv->ByName);
+    }
+
+    FreePool (MockFv);
+    return Status;
+  }
+
+  *Handle = MockFv->Handle;
+  return EFI_SUCCESS;
+}
+
+/**
+  Returns a snapshot of the counters of the mock volume installed on a handle.
+
+  @param  Handle   The handle returned by MockFv2Install().
+  @param  Counters On output, the counters.
+
+  @retval EFI_SUCCESS   The counters were returned.
+  @retval EFI_NOT_FOUND The handle carries no mock volume.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2GetCounters (
+  IN  EFI_HANDLE       Handle,
+  OUT MOCK_FV_COUNTERS *Counters
+  )
+{
+  MOCK_FV *MockFv;
+
+  MockFv = MockFvFromHandle (Handle);
+
+  if (MockFv == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  CopyMem (Counters, &MockFv->Counters, sizeof (MOCK_FV_COUNTERS));
+  return EFI_SUCCESS;
+}
+
+/**
+  Resets the counters of the mock volume installed on a handle.
+
+  @param  Handle The handle returned by MockFv2Install().
+
+  @retval EFI_SUCCESS   The counters were reset.
+  @retval EFI_NOT_FOUND The handle carries no mock volume.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFv2ResetCounters (
+  IN EFI_HANDLE Handle
+  )
+{
+  MOCK_FV *MockFv;
+
+  MockFv = MockFvFromHandle (Handle);
+
+  if (MockFv == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  ZeroMem (&MockFv->Counters, sizeof (MOCK_FV_COUNTERS));
+  return EFI_SUCCESS;
+}
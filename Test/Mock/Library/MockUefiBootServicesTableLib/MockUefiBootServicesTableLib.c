@@ -0,0 +1,1207 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+//
+// Miscellaneous helpful macros.
+//
+#define MOCK_HANDLE_SIGNATURE    SIGNATURE_32 ('m', 'h', 'n', 'd')
+#define MOCK_INTERFACE_SIGNATURE SIGNATURE_32 ('m', 'i', 'f', 'c')
+#define MOCK_EVENT_SIGNATURE     SIGNATURE_32 ('m', 'e', 'v', 't')
+#define MOCK_NOTIFY_SIGNATURE    SIGNATURE_32 ('m', 'n', 't', 'f')
+
+///
+/// Most protocol interfaces one InstallMultipleProtocolInterfaces() call takes.
+///
+#define MOCK_MAX_INTERFACES (16)
+
+///
+/// A handle of the mock handle database. EFI_HANDLEs point to these.
+///
+typedef struct {
+  UINT32     Signature;  ///< MOCK_HANDLE_SIGNATURE.
+  LIST_ENTRY Link;       ///< Link in mMockHandles.
+  LIST_ENTRY Interfaces; ///< The MOCK_INTERFACEs installed on the handle.
+} MOCK_HANDLE;
+
+///
+/// A protocol interface installed on a handle.
+///
+typedef struct {
+  UINT32     Signature;  ///< MOCK_INTERFACE_SIGNATURE.
+  LIST_ENTRY Link;       ///< Link in the handle's Interfaces.
+  EFI_GUID   Protocol;   ///< The protocol's GUID.
+  VOID       *Interface; ///< The interface.
+} MOCK_INTERFACE;
+
+///
+/// An event. EFI_EVENTs point to these.
+///
+typedef struct {
+  UINT32           Signature;      ///< MOCK_EVENT_SIGNATURE.
+  LIST_ENTRY       Link;           ///< Link in mMockEvents.
+  UINT32           Type;           ///< Type the event was created with.
+  EFI_TPL          NotifyTpl;      ///< TPL its notification function runs at.
+  EFI_EVENT_NOTIFY NotifyFunction; ///< Notification function, or NULL.
+  VOID             *NotifyContext; ///< Context of the notification function.
+  BOOLEAN          Pending;        ///< Signaled, with its notification not run yet.
+} MOCK_EVENT;
+
+///
+/// A RegisterProtocolNotify() registration. The handles the protocol has been
+/// installed on since are queued for LocateHandle (ByRegisterNotify).
+///
+typedef struct {
+  UINT32     Signature; ///< MOCK_NOTIFY_SIGNATURE.
+  LIST_ENTRY Link;      ///< Link in mMockNotifies.
+  EFI_GUID   Protocol;  ///< The protocol watched.
+  EFI_EVENT  Event;     ///< Event signaled when it is installed.
+  EFI_HANDLE *Queue;    ///< Handles not handed out yet.
+  UINTN      Queued;    ///< Number of handles in Queue.
+  UINTN      Capacity;  ///< Number of handles Queue has room for.
+} MOCK_NOTIFY;
+
+#define MOCK_HANDLE_FROM_LINK(a)    CR (a, MOCK_HANDLE, Link, MOCK_HANDLE_SIGNATURE)
+#define MOCK_INTERFACE_FROM_LINK(a) CR (a, MOCK_INTERFACE, Link, MOCK_INTERFACE_SIGNATURE)
+#define MOCK_EVENT_FROM_LINK(a)     CR (a, MOCK_EVENT, Link, MOCK_EVENT_SIGNATURE)
+#define MOCK_NOTIFY_FROM_LINK(a)    CR (a, MOCK_NOTIFY, Link, MOCK_NOTIFY_SIGNATURE)
+
+//
+// Module-scope variables
+//
+
+LIST_ENTRY mMockHandles  = INITIALIZE_LIST_HEAD_VARIABLE (mMockHandles);
+LIST_ENTRY mMockEvents   = INITIALIZE_LIST_HEAD_VARIABLE (mMockEvents);
+LIST_ENTRY mMockNotifies = INITIALIZE_LIST_HEAD_VARIABLE (mMockNotifies);
+EFI_TPL    mMockTpl      = TPL_APPLICATION;
+
+//
+// Misc. helper methods
+//
+
+/**
+  Checks that a handle is one of the mock handle database's.
+
+  @param  Handle The handle to check.
+
+  @retval The handle's MOCK_HANDLE, or NULL if it is not a handle.
+
+**/
+MOCK_HANDLE *
+MockGetHandle (
+  IN EFI_HANDLE Handle
+  )
+{
+  LIST_ENTRY *Link;
+
+  for (Link = GetFirstNode (&mMockHandles); !IsNull (&mMockHandles, Link); Link = GetNextNode (&mMockHandles, Link)) {
+    if (MOCK_HANDLE_FROM_LINK (Link) == (MOCK_HANDLE *) Handle) {
+      return (MOCK_HANDLE *) Handle;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Finds a protocol interface on a handle.
+
+  @param  Handle   The handle to search.
+  @param  Protocol The protocol to search for.
+
+  @retval The interface's MOCK_INTERFACE, or NULL if it is not installed.
+
+**/
+MOCK_INTERFACE *
+MockFindInterface (
+  IN MOCK_HANDLE    *Handle,
+  IN CONST EFI_GUID *Protocol
+  )
+{
+  LIST_ENTRY     *Link;
+  MOCK_INTERFACE *Interface;
+
+  for (Link = GetFirstNode (&Handle->Interfaces); !IsNull (&Handle->Interfaces, Link); Link = GetNextNode (&Handle->Interfaces, Link)) {
+    Interface = MOCK_INTERFACE_FROM_LINK (Link);
+
+    if (CompareGuid (&Interface->Protocol, Protocol)) {
+      return Interface;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Runs the notification functions of the pending events whose TPL is above a
+  TPL, highest TPL first, the way the TPL being lowered to it would.
+
+  @param  Tpl The TPL being run at.
+
+**/
+VOID
+MockDispatchEvents (
+  IN EFI_TPL Tpl
+  )
+{
+  LIST_ENTRY *Link;
+  MOCK_EVENT *Event;
+  MOCK_EVENT *Next;
+
+  for (;;) {
+    Next = NULL;
+
+    for (Link = GetFirstNode (&mMockEvents); !IsNull (&mMockEvents, Link); Link = GetNextNode (&mMockEvents, Link)) {
+      Event = MOCK_EVENT_FROM_LINK (Link);
+
+      if (Event->Pending && Event->NotifyTpl > Tpl && (Next == NULL || Event->NotifyTpl > Next->NotifyTpl)) {
+        Next = Event;
+      }
+    }
+
+    if (Next == NULL) {
+      return;
+    }
+
+    Next->Pending = FALSE;
+    mMockTpl      = Next->NotifyTpl;
+
+    Next->NotifyFunction ((EFI_EVENT) Next, Next->NotifyContext);
+
+    mMockTpl = Tpl;
+  }
+}
+
+/**
+  Queues a handle a protocol has just been installed on for every
+  registration watching the protocol, and signals their events.
+
+  @param  Handle   The handle.
+  @param  Protocol The protocol installed on it.
+
+**/
+VOID
+MockNotifyInstall (
+  IN EFI_HANDLE     Handle,
+  IN CONST EFI_GUID *Protocol
+  )
+{
+  LIST_ENTRY  *Link;
+  MOCK_NOTIFY *Notify;
+  EFI_HANDLE  *Queue;
+
+  for (Link = GetFirstNode (&mMockNotifies); !IsNull (&mMockNotifies, Link); Link = GetNextNode (&mMockNotifies, Link)) {
+    Notify = MOCK_NOTIFY_FROM_LINK (Link);
+
+    if (!CompareGuid (&Notify->Protocol, Protocol)) {
+      continue;
+    }
+
+    if (Notify->Queued == Notify->Capacity) {
+      Queue = ReallocatePool (
+                Notify->Capacity * sizeof (EFI_HANDLE),
+                (Notify->Capacity + 16) * sizeof (EFI_HANDLE),
+                Notify->Queue
+                );
+      ASSERT (Queue != NULL);
+
+      Notify->Queue     = Queue;
+      Notify->Capacity += 16;
+    }
+
+    Notify->Queue[Notify->Queued++] = Handle;
+    gBS->SignalEvent (Notify->Event);
+  }
+}
+
+//
+// Task priority services
+//
+
+/**
+  Raises the TPL.
+
+  @param  NewTpl The new TPL, which is at least the current one.
+
+  @return The previous TPL.
+
+**/
+EFI_TPL
+EFIAPI
+MockRaiseTpl (
+  IN EFI_TPL NewTpl
+  )
+{
+  EFI_TPL OldTpl;
+
+  OldTpl = mMockTpl;
+
+  ASSERT (NewTpl >= OldTpl);
+  mMockTpl = NewTpl;
+
+  return OldTpl;
+}
+
+/**
+  Restores the TPL, running the notification functions of the events that
+  were signaled meanwhile and can run now.
+
+  @param  OldTpl The TPL to restore, as returned by RaiseTPL().
+
+**/
+VOID
+EFIAPI
+MockRestoreTpl (
+  IN EFI_TPL OldTpl
+  )
+{
+  ASSERT (OldTpl <= mMockTpl);
+
+  mMockTpl = OldTpl;
+  MockDispatchEvents (OldTpl);
+}
+
+//
+// Memory services
+//
+
+/**
+  Allocates pool memory through MemoryAllocationLib.
+
+  @param  PoolType Type of pool to allocate.
+  @param  Size     Number of bytes to allocate.
+  @param  Buffer   On output, the allocated buffer.
+
+  @retval EFI_SUCCESS          The buffer was allocated.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockAllocatePool (
+  IN  EFI_MEMORY_TYPE PoolType,
+  IN  UINTN           Size,
+  OUT VOID            **Buffer
+  )
+{
+  *Buffer = AllocatePool (Size);
+
+  return (*Buffer == NULL) ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
+}
+
+/**
+  Frees pool memory allocated by MockAllocatePool().
+
+  @param  Buffer The buffer to free.
+
+  @retval EFI_SUCCESS The buffer was freed.
+
+**/
+EFI_STATUS
+EFIAPI
+MockFreePool (
+  IN VOID *Buffer
+  )
+{
+  FreePool (Buffer);
+
+  return EFI_SUCCESS;
+}
+
+//
+// Event and timer services
+//
+
+/**
+  Creates an event.
+
+  @param  Type           Type of the event.
+  @param  NotifyTpl      TPL its notification function runs at.
+  @param  NotifyFunction Its notification function, or NULL.
+  @param  NotifyContext  Context of the notification function.
+  @param  Event          On output, the event.
+
+  @retval EFI_SUCCESS           The event was created.
+  @retval EFI_INVALID_PARAMETER Event is NULL.
+  @retval EFI_OUT_OF_RESOURCES  There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockCreateEvent (
+  IN  UINT32           Type,
+  IN  EFI_TPL          NotifyTpl,
+  IN  EFI_EVENT_NOTIFY NotifyFunction OPTIONAL,
+  IN  VOID             *NotifyContext OPTIONAL,
+  OUT EFI_EVENT        *Event
+  )
+{
+  MOCK_EVENT *MockEvent;
+
+  if (Event == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  MockEvent = AllocateZeroPool (sizeof (MOCK_EVENT));
+
+  if (MockEvent == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  MockEvent->Signature      = MOCK_EVENT_SIGNATURE;
+  MockEvent->Type           = Type;
+  MockEvent->NotifyTpl      = NotifyTpl;
+  MockEvent->NotifyFunction = NotifyFunction;
+  MockEvent->NotifyContext  = NotifyContext;
+
+  InsertTailList (&mMockEvents, &MockEvent->Link);
+
+  *Event = (EFI_EVENT) MockEvent;
+  return EFI_SUCCESS;
+}
+
+/**
+  Sets a timer. Host tests have no timer interrupt, so timers never expire:
+  the setting is accepted and nothing else is done.
+
+  @param  Event       The timer event.
+  @param  Type        Type of the timer.
+  @param  TriggerTime Its period, in 100ns units.
+
+  @retval EFI_SUCCESS The setting was accepted.
+
+**/
+EFI_STATUS
+EFIAPI
+MockSetTimer (
+  IN EFI_EVENT       Event,
+  IN EFI_TIMER_DELAY Type,
+  IN UINT64          TriggerTime
+  )
+{
+  return EFI_SUCCESS;
+}
+
+/**
+  Signals an event. Its notification function runs right away if the current
+  TPL is below the event's, and when the TPL drops below it otherwise.
+
+  @param  Event The event to signal.
+
+  @retval EFI_SUCCESS The event was signaled.
+
+**/
+EFI_STATUS
+EFIAPI
+MockSignalEvent (
+  IN EFI_EVENT Event
+  )
+{
+  MOCK_EVENT *MockEvent;
+
+  MockEvent = (MOCK_EVENT *) Event;
+  ASSERT (MockEvent->Signature == MOCK_EVENT_SIGNATURE);
+
+  if ((MockEvent->Type & EVT_NOTIFY_SIGNAL) != 0 && MockEvent->NotifyFunction != NULL) {
+    MockEvent->Pending = TRUE;
+    MockDispatchEvents (mMockTpl);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Closes an event.
+
+  @param  Event The event to close.
+
+  @retval EFI_SUCCESS The event was closed.
+
+**/
+EFI_STATUS
+EFIAPI
+MockCloseEvent (
+  IN EFI_EVENT Event
+  )
+{
+  MOCK_EVENT *MockEvent;
+
+  MockEvent = (MOCK_EVENT *) Event;
+  ASSERT (MockEvent->Signature == MOCK_EVENT_SIGNATURE);
+
+  RemoveEntryList (&MockEvent->Link);
+  MockEvent->Signature = 0;
+  FreePool (MockEvent);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Checks whether an event is signaled. Only timers and wait events are
+  checked this way, and timers never expire here.
+
+  @param  Event The event to check.
+
+  @retval EFI_NOT_READY The event is not signaled.
+
+**/
+EFI_STATUS
+EFIAPI
+MockCheckEvent (
+  IN EFI_EVENT Event
+  )
+{
+  return EFI_NOT_READY;
+}
+
+//
+// Protocol handler services
+//
+
+/**
+  Installs a protocol interface on a handle, creating the handle if need be.
+
+  @param  Handle        The handle, or a pointer to NULL to create one.
+  @param  Protocol      The protocol to install.
+  @param  InterfaceType Must be EFI_NATIVE_INTERFACE.
+  @param  Interface     The interface.
+
+  @retval EFI_SUCCESS           The interface was installed.
+  @retval EFI_INVALID_PARAMETER The protocol is already on the handle, or a
+                                parameter is not valid.
+  @retval EFI_OUT_OF_RESOURCES  There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockInstallProtocolInterface (
+  IN OUT EFI_HANDLE         *Handle,
+  IN     EFI_GUID           *Protocol,
+  IN     EFI_INTERFACE_TYPE InterfaceType,
+  IN     VOID               *Interface
+  )
+{
+  MOCK_HANDLE    *MockHandle;
+  MOCK_INTERFACE *MockInterface;
+
+  if (Handle == NULL || Protocol == NULL || InterfaceType != EFI_NATIVE_INTERFACE) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (*Handle == NULL) {
+    MockHandle = AllocateZeroPool (sizeof (MOCK_HANDLE));
+
+    if (MockHandle == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    MockHandle->Signature = MOCK_HANDLE_SIGNATURE;
+    InitializeListHead (&MockHandle->Interfaces);
+    InsertTailList (&mMockHandles, &MockHandle->Link);
+  } else {
+    MockHandle = MockGetHandle (*Handle);
+
+    if (MockHandle == NULL || MockFindInterface (MockHandle, Protocol) != NULL) {
+      return EFI_INVALID_PARAMETER;
+    }
+  }
+
+  MockInterface = AllocateZeroPool (sizeof (MOCK_INTERFACE));
+
+  if (MockInterface == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  MockInterface->Signature = MOCK_INTERFACE_SIGNATURE;
+  MockInterface->Interface = Interface;
+  CopyGuid (&MockInterface->Protocol, Protocol);
+  InsertTailList (&MockHandle->Interfaces, &MockInterface->Link);
+
+  *Handle = (EFI_HANDLE) MockHandle;
+
+  MockNotifyInstall (*Handle, Protocol);
+  return EFI_SUCCESS;
+}
+
+/**
+  Removes a protocol interface from a handle. The handle is removed too once
+  no interface is left on it.
+
+  @param  Handle    The handle.
+  @param  Protocol  The protocol to remove.
+  @param  Interface The interface installed for it.
+
+  @retval EFI_SUCCESS   The interface was removed.
+  @retval EFI_NOT_FOUND The interface is not on the handle.
+
+**/
+EFI_STATUS
+EFIAPI
+MockUninstallProtocolInterface (
+  IN EFI_HANDLE Handle,
+  IN EFI_GUID   *Protocol,
+  IN VOID       *Interface
+  )
+{
+  MOCK_HANDLE    *MockHandle;
+  MOCK_INTERFACE *MockInterface;
+
+  MockHandle = MockGetHandle (Handle);
+
+  if (MockHandle == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  MockInterface = MockFindInterface (MockHandle, Protocol);
+
+  if (MockInterface == NULL || MockInterface->Interface != Interface) {
+    return EFI_NOT_FOUND;
+  }
+
+  RemoveEntryList (&MockInterface->Link);
+  FreePool (MockInterface);
+
+  if (IsListEmpty (&MockHandle->Interfaces)) {
+    RemoveEntryList (&MockHandle->Link);
+    MockHandle->Signature = 0;
+    FreePool (MockHandle);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Replaces a protocol interface on a handle, notifying the registrations
+  watching the protocol as if it had just been installed.
+
+  @param  Handle       The handle.
+  @param  Protocol     The protocol to replace.
+  @param  OldInterface The interface installed for it.
+  @param  NewInterface The interface to install instead.
+
+  @retval EFI_SUCCESS   The interface was replaced.
+  @retval EFI_NOT_FOUND The old interface is not on the handle.
+
+**/
+EFI_STATUS
+EFIAPI
+MockReinstallProtocolInterface (
+  IN EFI_HANDLE Handle,
+  IN EFI_GUID   *Protocol,
+  IN VOID       *OldInterface,
+  IN VOID       *NewInterface
+  )
+{
+  MOCK_HANDLE    *MockHandle;
+  MOCK_INTERFACE *MockInterface;
+
+  MockHandle = MockGetHandle (Handle);
+
+  if (MockHandle == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  MockInterface = MockFindInterface (MockHandle, Protocol);
+
+  if (MockInterface == NULL || MockInterface->Interface != OldInterface) {
+    return EFI_NOT_FOUND;
+  }
+
+  MockInterface->Interface = NewInterface;
+
+  MockNotifyInstall (Handle, Protocol);
+  return EFI_SUCCESS;
+}
+
+/**
+  Returns a protocol interface of a handle.
+
+  @param  Handle    The handle.
+  @param  Protocol  The protocol to look for.
+  @param  Interface On output, the interface.
+
+  @retval EFI_SUCCESS           The interface was returned.
+  @retval EFI_UNSUPPORTED       The handle does not support the protocol.
+  @retval EFI_INVALID_PARAMETER Handle is not a handle.
+
+**/
+EFI_STATUS
+EFIAPI
+MockHandleProtocol (
+  IN  EFI_HANDLE Handle,
+  IN  EFI_GUID   *Protocol,
+  OUT VOID       **Interface
+  )
+{
+  MOCK_HANDLE    *MockHandle;
+  MOCK_INTERFACE *MockInterface;
+
+  MockHandle = MockGetHandle (Handle);
+
+  if (MockHandle == NULL || Protocol == NULL || Interface == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  MockInterface = MockFindInterface (MockHandle, Protocol);
+
+  if (MockInterface == NULL) {
+    *Interface = NULL;
+    return EFI_UNSUPPORTED;
+  }
+
+  *Interface = MockInterface->Interface;
+  return EFI_SUCCESS;
+}
+
+/**
+  Registers an event to be signaled whenever a protocol is installed.
+
+  @param  Protocol     The protocol to watch.
+  @param  Event        The event to signal.
+  @param  Registration On output, the registration, for LocateHandle().
+
+  @retval EFI_SUCCESS          The registration was made.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockRegisterProtocolNotify (
+  IN  EFI_GUID  *Protocol,
+  IN  EFI_EVENT Event,
+  OUT VOID      **Registration
+  )
+{
+  MOCK_NOTIFY *Notify;
+
+  Notify = AllocateZeroPool (sizeof (MOCK_NOTIFY));
+
+  if (Notify == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Notify->Signature = MOCK_NOTIFY_SIGNATURE;
+  Notify->Event     = Event;
+  CopyGuid (&Notify->Protocol, Protocol);
+  InsertTailList (&mMockNotifies, &Notify->Link);
+
+  *Registration = Notify;
+  return EFI_SUCCESS;
+}
+
+/**
+  Returns handles: all of them, those supporting a protocol, or, for a
+  registration, the next handle the protocol was installed on since.
+
+  @param  SearchType Which handles to return.
+  @param  Protocol   The protocol, for ByProtocol.
+  @param  SearchKey  The registration, for ByRegisterNotify.
+  @param  BufferSize Size of Buffer on input, and of the handles on output.
+  @param  Buffer     On output, the handles.
+
+  @retval EFI_SUCCESS          The handles were returned.
+  @retval EFI_NOT_FOUND        No handle matched.
+  @retval EFI_BUFFER_TOO_SMALL Buffer is too small for the handles.
+
+**/
+EFI_STATUS
+EFIAPI
+MockLocateHandle (
+  IN     EFI_LOCATE_SEARCH_TYPE SearchType,
+  IN     EFI_GUID               *Protocol OPTIONAL,
+  IN     VOID                   *SearchKey OPTIONAL,
+  IN OUT UINTN                  *BufferSize,
+  OUT    EFI_HANDLE             *Buffer
+  )
+{
+  MOCK_NOTIFY *Notify;
+  LIST_ENTRY  *Link;
+  MOCK_HANDLE *MockHandle;
+  UINTN       Count;
+
+  if (SearchType == ByRegisterNotify) {
+    Notify = (MOCK_NOTIFY *) SearchKey;
+    ASSERT (Notify->Signature == MOCK_NOTIFY_SIGNATURE);
+
+    if (Notify->Queued == 0) {
+      return EFI_NOT_FOUND;
+    }
+
+    if (*BufferSize < sizeof (EFI_HANDLE)) {
+      *BufferSize = sizeof (EFI_HANDLE);
+      return EFI_BUFFER_TOO_SMALL;
+    }
+
+    *Buffer = Notify->Queue[0];
+    *BufferSize = sizeof (EFI_HANDLE);
+
+    Notify->Queued--;
+    CopyMem (Notify->Queue, Notify->Queue + 1, Notify->Queued * sizeof (EFI_HANDLE));
+    return EFI_SUCCESS;
+  }
+
+  Count = 0;
+
+  for (Link = GetFirstNode (&mMockHandles); !IsNull (&mMockHandles, Link); Link = GetNextNode (&mMockHandles, Link)) {
+    MockHandle = MOCK_HANDLE_FROM_LINK (Link);
+
+    if (SearchType == ByProtocol && MockFindInterface (MockHandle, Protocol) == NULL) {
+      continue;
+    }
+
+    if ((Count + 1) * sizeof (EFI_HANDLE) <= *BufferSize) {
+      Buffer[Count] = (EFI_HANDLE) MockHandle;
+    }
+
+    Count++;
+  }
+
+  if (Count == 0) {
+    return EFI_NOT_FOUND;
+  }
+
+  if (Count * sizeof (EFI_HANDLE) > *BufferSize) {
+    *BufferSize = Count * sizeof (EFI_HANDLE);
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  *BufferSize = Count * sizeof (EFI_HANDLE);
+  return EFI_SUCCESS;
+}
+
+/**
+  Stalls. Host tests do not wait, so this returns right away.
+
+  @param  Microseconds Number of microseconds to stall for.
+
+  @retval EFI_SUCCESS The stall is over.
+
+**/
+EFI_STATUS
+EFIAPI
+MockStall (
+  IN UINTN Microseconds
+  )
+{
+  return EFI_SUCCESS;
+}
+
+/**
+  Opens a protocol interface of a handle. Nothing is recorded about the agent
+  opening it, so this is HandleProtocol().
+
+  @param  Handle           The handle.
+  @param  Protocol         The protocol to look for.
+  @param  Interface        On output, the interface.
+  @param  AgentHandle      The agent opening it.
+  @param  ControllerHandle The controller it is opened for.
+  @param  Attributes       How it is opened.
+
+  @retval EFI_SUCCESS     The interface was returned.
+  @retval EFI_UNSUPPORTED The handle does not support the protocol.
+
+**/
+EFI_STATUS
+EFIAPI
+MockOpenProtocol (
+  IN  EFI_HANDLE Handle,
+  IN  EFI_GUID   *Protocol,
+  OUT VOID       **Interface OPTIONAL,
+  IN  EFI_HANDLE AgentHandle,
+  IN  EFI_HANDLE ControllerHandle,
+  IN  UINT32     Attributes
+  )
+{
+  VOID *Found;
+
+  return MockHandleProtocol (Handle, Protocol, (Interface != NULL) ? Interface : &Found);
+}
+
+/**
+  Closes a protocol interface opened with MockOpenProtocol().
+
+  @param  Handle           The handle.
+  @param  Protocol         The protocol.
+  @param  AgentHandle      The agent that opened it.
+  @param  ControllerHandle The controller it was opened for.
+
+  @retval EFI_SUCCESS The interface was closed.
+
+**/
+EFI_STATUS
+EFIAPI
+MockCloseProtocol (
+  IN EFI_HANDLE Handle,
+  IN EFI_GUID   *Protocol,
+  IN EFI_HANDLE AgentHandle,
+  IN EFI_HANDLE ControllerHandle
+  )
+{
+  return EFI_SUCCESS;
+}
+
+/**
+  Returns handles in an allocated buffer, as MockLocateHandle() does.
+
+  @param  SearchType Which handles to return.
+  @param  Protocol   The protocol, for ByProtocol.
+  @param  SearchKey  The registration, for ByRegisterNotify.
+  @param  NoHandles  On output, the number of handles.
+  @param  Buffer     On output, the handles, which the caller frees.
+
+  @retval EFI_SUCCESS          The handles were returned.
+  @retval EFI_NOT_FOUND        No handle matched.
+  @retval EFI_OUT_OF_RESOURCES There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockLocateHandleBuffer (
+  IN  EFI_LOCATE_SEARCH_TYPE SearchType,
+  IN  EFI_GUID               *Protocol OPTIONAL,
+  IN  VOID                   *SearchKey OPTIONAL,
+  OUT UINTN                  *NoHandles,
+  OUT EFI_HANDLE             **Buffer
+  )
+{
+  EFI_STATUS Status;
+  UINTN      BufferSize;
+
+  BufferSize = 0;
+  Status     = MockLocateHandle (SearchType, Protocol, SearchKey, &BufferSize, NULL);
+
+  if (Status != EFI_BUFFER_TOO_SMALL) {
+    return Status;
+  }
+
+  *Buffer = AllocatePool (BufferSize);
+
+  if (*Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status     = MockLocateHandle (SearchType, Protocol, SearchKey, &BufferSize, *Buffer);
+  *NoHandles = BufferSize / sizeof (EFI_HANDLE);
+
+  return Status;
+}
+
+/**
+  Returns the first interface installed for a protocol.
+
+  @param  Protocol     The protocol to look for.
+  @param  Registration Must be NULL.
+  @param  Interface    On output, the interface.
+
+  @retval EFI_SUCCESS   The interface was returned.
+  @retval EFI_NOT_FOUND No handle supports the protocol.
+
+**/
+EFI_STATUS
+EFIAPI
+MockLocateProtocol (
+  IN  EFI_GUID *Protocol,
+  IN  VOID     *Registration OPTIONAL,
+  OUT VOID     **Interface
+  )
+{
+  LIST_ENTRY     *Link;
+  MOCK_INTERFACE *MockInterface;
+
+  for (Link = GetFirstNode (&mMockHandles); !IsNull (&mMockHandles, Link); Link = GetNextNode (&mMockHandles, Link)) {
+    MockInterface = MockFindInterface (MOCK_HANDLE_FROM_LINK (Link), Protocol);
+
+    if (MockInterface != NULL) {
+      *Interface = MockInterface->Interface;
+      return EFI_SUCCESS;
+    }
+  }
+
+  *Interface = NULL;
+  return EFI_NOT_FOUND;
+}
+
+/**
+  Installs protocol interfaces on a handle, creating the handle if need be.
+  The notifications of the protocols only run once all are installed. If one
+  cannot be installed, none is.
+
+  @param  Handle The handle, or a pointer to NULL to create one.
+  @param  ...    Pairs of protocol GUID and interface, ending with NULL.
+
+  @retval EFI_SUCCESS           The interfaces were installed.
+  @retval EFI_INVALID_PARAMETER A protocol is already on the handle.
+  @retval EFI_OUT_OF_RESOURCES  There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockInstallMultipleProtocolInterfaces (
+  IN OUT EFI_HANDLE *Handle,
+  ...
+  )
+{
+  EFI_STATUS Status;
+  VA_LIST    Args;
+  EFI_GUID   *Protocols[MOCK_MAX_INTERFACES];
+  VOID       *Interfaces[MOCK_MAX_INTERFACES];
+  UINTN      Count;
+  UINTN      Index;
+  EFI_HANDLE NewHandle;
+  EFI_TPL    OldTpl;
+
+  Count = 0;
+
+  VA_START (Args, Handle);
+
+  for (;;) {
+    Protocols[Count] = VA_ARG (Args, EFI_GUID *);
+
+    if (Protocols[Count] == NULL) {
+      break;
+    }
+
+    Interfaces[Count] = VA_ARG (Args, VOID *);
+    Count++;
+    ASSERT (Count < MOCK_MAX_INTERFACES);
+  }
+
+  VA_END (Args);
+
+  OldTpl    = gBS->RaiseTPL (TPL_NOTIFY);
+  NewHandle = *Handle;
+  Status    = EFI_SUCCESS;
+
+  for (Index = 0; Index < Count && !EFI_ERROR (Status); Index++) {
+    Status = MockInstallProtocolInterface (&NewHandle, Protocols[Index], EFI_NATIVE_INTERFACE, Interfaces[Index]);
+  }
+
+  if (EFI_ERROR (Status)) {
+    //
+    // Back out what was installed. Index is one past the failed interface.
+    //
+    for (Index = Index - 1; Index > 0; Index--) {
+      MockUninstallProtocolInterface (NewHandle, Protocols[Index - 1], Interfaces[Index - 1]);
+    }
+  } else {
+    *Handle = NewHandle;
+  }
+
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  Removes protocol interfaces from a handle.
+
+  @param  Handle The handle.
+  @param  ...    Pairs of protocol GUID and interface, ending with NULL.
+
+  @retval EFI_SUCCESS           The interfaces were removed.
+  @retval EFI_INVALID_PARAMETER An interface is not on the handle.
+
+**/
+EFI_STATUS
+EFIAPI
+MockUninstallMultipleProtocolInterfaces (
+  IN EFI_HANDLE Handle,
+  ...
+  )
+{
+  EFI_STATUS Status;
+  VA_LIST    Args;
+  EFI_GUID   *Protocol;
+  VOID       *Interface;
+
+  Status = EFI_SUCCESS;
+
+  VA_START (Args, Handle);
+
+  for (;;) {
+    Protocol = VA_ARG (Args, EFI_GUID *);
+
+    if (Protocol == NULL) {
+      break;
+    }
+
+    Interface = VA_ARG (Args, VOID *);
+
+    if (EFI_ERROR (MockUninstallProtocolInterface (Handle, Protocol, Interface))) {
+      Status = EFI_INVALID_PARAMETER;
+    }
+  }
+
+  VA_END (Args);
+
+  return Status;
+}
+
+//
+// Miscellaneous services
+//
+
+/**
+  Copies memory.
+
+  @param  Destination Where to copy to.
+  @param  Source      What to copy.
+  @param  Length      Number of bytes to copy.
+
+**/
+VOID
+EFIAPI
+MockCopyMem (
+  IN VOID  *Destination,
+  IN VOID  *Source,
+  IN UINTN Length
+  )
+{
+  CopyMem (Destination, Source, Length);
+}
+
+/**
+  Fills memory with a value.
+
+  @param  Buffer The memory to fill.
+  @param  Size   Number of bytes to fill.
+  @param  Value  The value to fill it with.
+
+**/
+VOID
+EFIAPI
+MockSetMem (
+  IN VOID  *Buffer,
+  IN UINTN Size,
+  IN UINT8 Value
+  )
+{
+  SetMem (Buffer, Size, Value);
+}
+
+//
+// Global data
+//
+
+///
+/// The mock boot services. Those a host test has no use for are NULL.
+///
+EFI_BOOT_SERVICES mMockBootServices = {
+  {
+    EFI_BOOT_SERVICES_SIGNATURE,
+    EFI_BOOT_SERVICES_REVISION,
+    sizeof (EFI_BOOT_SERVICES),
+    0,
+    0
+  },
+  MockRaiseTpl,                            // RaiseTPL
+  MockRestoreTpl,                          // RestoreTPL
+  NULL,                                    // AllocatePages
+  NULL,                                    // FreePages
+  NULL,                                    // GetMemoryMap
+  MockAllocatePool,                        // AllocatePool
+  MockFreePool,                            // FreePool
+  MockCreateEvent,                         // CreateEvent
+  MockSetTimer,                            // SetTimer
+  NULL,                                    // WaitForEvent
+  MockSignalEvent,                         // SignalEvent
+  MockCloseEvent,                          // CloseEvent
+  MockCheckEvent,                          // CheckEvent
+  MockInstallProtocolInterface,            // InstallProtocolInterface
+  MockReinstallProtocolInterface,          // ReinstallProtocolInterface
+  MockUninstallProtocolInterface,          // UninstallProtocolInterface
+  MockHandleProtocol,                      // HandleProtocol
+  NULL,                                    // Reserved
+  MockRegisterProtocolNotify,              // RegisterProtocolNotify
+  MockLocateHandle,                        // LocateHandle
+  NULL,                                    // LocateDevicePath
+  NULL,                                    // InstallConfigurationTable
+  NULL,                                    // LoadImage
+  NULL,                                    // StartImage
+  NULL,                                    // Exit
+  NULL,                                    // UnloadImage
+  NULL,                                    // ExitBootServices
+  NULL,                                    // GetNextMonotonicCount
+  MockStall,                               // Stall
+  NULL,                                    // SetWatchdogTimer
+  NULL,                                    // ConnectController
+  NULL,                                    // DisconnectController
+  MockOpenProtocol,                        // OpenProtocol
+  MockCloseProtocol,                       // CloseProtocol
+  NULL,                                    // OpenProtocolInformation
+  NULL,                                    // ProtocolsPerHandle
+  MockLocateHandleBuffer,                  // LocateHandleBuffer
+  MockLocateProtocol,                      // LocateProtocol
+  MockInstallMultipleProtocolInterfaces,   // InstallMultipleProtocolInterfaces
+  MockUninstallMultipleProtocolInterfaces, // UninstallMultipleProtocolInterfaces
+  NULL,                                    // CalculateCrc32
+  MockCopyMem,                             // CopyMem
+  MockSetMem,                              // SetMem
+  NULL                                     // CreateEventEx
+};
+
+///
+/// The system table, which only carries the mock boot services.
+///
+EFI_SYSTEM_TABLE mMockSystemTable = {
+  {
+    EFI_SYSTEM_TABLE_SIGNATURE,
+    EFI_SYSTEM_TABLE_REVISION,
+    sizeof (EFI_SYSTEM_TABLE),
+    0,
+    0
+  },
+  NULL,                                    // FirmwareVendor
+  0,                                       // FirmwareRevision
+  NULL,                                    // ConsoleInHandle
+  NULL,                                    // ConIn
+  NULL,                                    // ConsoleOutHandle
+  NULL,                                    // ConOut
+  NULL,                                    // StandardErrorHandle
+  NULL,                                    // StdErr
+  NULL,                                    // RuntimeServices
+  &mMockBootServices,                      // BootServices
+  0,                                       // NumberOfTableEntries
+  NULL                                     // ConfigurationTable
+};
+
+///
+/// The globals UefiBootServicesTableLib provides. The image handle is created
+/// by the first protocol a test installs on it.
+///
+EFI_HANDLE        gImageHandle = NULL;
+EFI_SYSTEM_TABLE  *gST         = &mMockSystemTable;
+EFI_BOOT_SERVICES *gBS         = &mMockBootServices;
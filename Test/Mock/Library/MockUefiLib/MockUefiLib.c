@@ -0,0 +1,182 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include <Uefi.h>
+#include <Library/DebugLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+//
+// The part of UefiLib the drivers of this package use, built on whatever
+// boot services the host test provides. MdePkg's UefiLib cannot be linked
+// into host applications.
+//
+
+/**
+  Creates an event signaled whenever a protocol is installed, and signals it
+  once right away, for the interfaces installed before it.
+
+  @param  ProtocolGuid   The protocol to watch.
+  @param  NotifyTpl      TPL the notification function runs at.
+  @param  NotifyFunction The notification function.
+  @param  NotifyContext  Context of the notification function.
+  @param  Registration   On output, the registration, for LocateHandle().
+
+  @return The event.
+
+**/
+EFI_EVENT
+EFIAPI
+EfiCreateProtocolNotifyEvent (
+  IN  EFI_GUID         *ProtocolGuid,
+  IN  EFI_TPL          NotifyTpl,
+  IN  EFI_EVENT_NOTIFY NotifyFunction,
+  IN  VOID             *NotifyContext OPTIONAL,
+  OUT VOID             **Registration
+  )
+{
+  EFI_STATUS Status;
+  EFI_EVENT  Event;
+
+  ASSERT (ProtocolGuid != NULL);
+  ASSERT (NotifyFunction != NULL);
+  ASSERT (Registration != NULL);
+
+  Status = gBS->CreateEvent (
+                  EVT_NOTIFY_SIGNAL,
+                  NotifyTpl,
+                  NotifyFunction,
+                  NotifyContext,
+                  &Event
+                  );
+  ASSERT_EFI_ERROR (Status);
+
+  Status = gBS->RegisterProtocolNotify (ProtocolGuid, Event, Registration);
+  ASSERT_EFI_ERROR (Status);
+
+  gBS->SignalEvent (Event);
+
+  return Event;
+}
+
+/**
+  Initializes a lock.
+
+  @param  Lock     The lock to initialize.
+  @param  Priority TPL the lock is held at.
+
+  @return The lock.
+
+**/
+EFI_LOCK *
+EFIAPI
+EfiInitializeLock (
+  IN OUT EFI_LOCK *Lock,
+  IN     EFI_TPL  Priority
+  )
+{
+  ASSERT (Lock != NULL);
+  ASSERT (Priority <= TPL_HIGH_LEVEL);
+
+  Lock->Tpl      = Priority;
+  Lock->OwnerTpl = TPL_APPLICATION;
+  Lock->Lock     = EfiLockReleased;
+
+  return Lock;
+}
+
+/**
+  Acquires a lock, raising the TPL to the lock's.
+
+  @param  Lock The lock to acquire.
+
+**/
+VOID
+EFIAPI
+EfiAcquireLock (
+  IN EFI_LOCK *Lock
+  )
+{
+  ASSERT (Lock != NULL);
+  ASSERT (Lock->Lock == EfiLockReleased);
+
+  Lock->OwnerTpl = gBS->RaiseTPL (Lock->Tpl);
+  Lock->Lock     = EfiLockAcquired;
+}
+
+/**
+  Acquires a lock unless it is held already.
+
+  @param  Lock The lock to acquire.
+
+  @retval EFI_SUCCESS       The lock was acquired.
+  @retval EFI_ACCESS_DENIED The lock is held already.
+
+**/
+EFI_STATUS
+EFIAPI
+EfiAcquireLockOrFail (
+  IN EFI_LOCK *Lock
+  )
+{
+  ASSERT (Lock != NULL);
+  ASSERT (Lock->Lock != EfiLockUninitialized);
+
+  if (Lock->Lock == EfiLockAcquired) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  EfiAcquireLock (Lock);
+  return EFI_SUCCESS;
+}
+
+/**
+  Releases a lock, restoring the TPL it was acquired at.
+
+  @param  Lock The lock to release.
+
+**/
+VOID
+EFIAPI
+EfiReleaseLock (
+  IN EFI_LOCK *Lock
+  )
+{
+  EFI_TPL Tpl;
+
+  ASSERT (Lock != NULL);
+  ASSERT (Lock->Lock == EfiLockAcquired);
+
+  Tpl        = Lock->OwnerTpl;
+  Lock->Lock = EfiLockReleased;
+
+  gBS->RestoreTPL (Tpl);
+}
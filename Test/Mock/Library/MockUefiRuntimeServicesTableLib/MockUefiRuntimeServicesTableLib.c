@@ -0,0 +1,348 @@
+/** @file
+
+Copyright 2011 Colin Drake. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies,
+either expressed or implied, of Colin Drake.
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+
+//
+// Miscellaneous helpful macros.
+//
+#define MOCK_VARIABLE_SIGNATURE SIGNATURE_32 ('m', 'v', 'a', 'r')
+
+///
+/// Bytes of variable storage the mock reports, none of which runs out.
+///
+#define MOCK_VARIABLE_STORAGE_SIZE (SIZE_1MB)
+
+///
+/// Largest variable the mock reports it can store.
+///
+#define MOCK_MAX_VARIABLE_SIZE (SIZE_64KB)
+
+///
+/// A variable of the in-memory variable store.
+///
+typedef struct {
+  UINT32     Signature;  ///< MOCK_VARIABLE_SIGNATURE.
+  LIST_ENTRY Link;       ///< Link in mMockVariables.
+  CHAR16     *Name;      ///< The variable's name.
+  EFI_GUID   VendorGuid; ///< The variable's vendor GUID.
+  UINT32     Attributes; ///< The variable's attributes.
+  UINTN      DataSize;   ///< Number of bytes in Data.
+  VOID       *Data;      ///< The variable's contents.
+} MOCK_VARIABLE;
+
+#define MOCK_VARIABLE_FROM_LINK(a) CR (a, MOCK_VARIABLE, Link, MOCK_VARIABLE_SIGNATURE)
+
+//
+// Module-scope variables
+//
+
+LIST_ENTRY mMockVariables = INITIALIZE_LIST_HEAD_VARIABLE (mMockVariables);
+
+//
+// Misc. helper methods
+//
+
+/**
+  Finds a variable of the in-memory store.
+
+  @param  VariableName The variable's name.
+  @param  VendorGuid   The variable's vendor GUID.
+
+  @retval The variable, or NULL if there is none.
+
+**/
+MOCK_VARIABLE *
+MockFindVariable (
+  IN CONST CHAR16   *VariableName,
+  IN CONST EFI_GUID *VendorGuid
+  )
+{
+  LIST_ENTRY    *Link;
+  MOCK_VARIABLE *Variable;
+
+  for (Link = GetFirstNode (&mMockVariables); !IsNull (&mMockVariables, Link); Link = GetNextNode (&mMockVariables, Link)) {
+    Variable = MOCK_VARIABLE_FROM_LINK (Link);
+
+    if (StrCmp (Variable->Name, VariableName) == 0 && CompareGuid (&Variable->VendorGuid, VendorGuid)) {
+      return Variable;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Removes a variable from the in-memory store.
+
+  @param  Variable The variable to remove.
+
+**/
+VOID
+MockFreeVariable (
+  IN MOCK_VARIABLE *Variable
+  )
+{
+  RemoveEntryList (&Variable->Link);
+  FreePool (Variable->Name);
+  FreePool (Variable->Data);
+  FreePool (Variable);
+}
+
+//
+// Runtime services
+//
+
+/**
+  Returns the time. Host tests get a fixed time, so that runs compare.
+
+  @param  Time         On output, the time.
+  @param  Capabilities Ignored.
+
+  @retval EFI_SUCCESS           The time was returned.
+  @retval EFI_INVALID_PARAMETER Time is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+MockGetTime (
+  OUT EFI_TIME              *Time,
+  OUT EFI_TIME_CAPABILITIES *Capabilities OPTIONAL
+  )
+{
+  if (Time == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  ZeroMem (Time, sizeof (EFI_TIME));
+
+  Time->Year     = 2011;
+  Time->Month    = 1;
+  Time->Day      = 1;
+  Time->TimeZone = EFI_UNSPECIFIED_TIMEZONE;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Reads a variable of the in-memory store.
+
+  @param  VariableName The variable's name.
+  @param  VendorGuid   The variable's vendor GUID.
+  @param  Attributes   On output, the variable's attributes, if not NULL.
+  @param  DataSize     Size of Data on input, and of the variable on output.
+  @param  Data         On output, the variable's contents.
+
+  @retval EFI_SUCCESS          The variable was read.
+  @retval EFI_NOT_FOUND        There is no such variable.
+  @retval EFI_BUFFER_TOO_SMALL Data is too small for the variable.
+
+**/
+EFI_STATUS
+EFIAPI
+MockGetVariable (
+  IN     CHAR16   *VariableName,
+  IN     EFI_GUID *VendorGuid,
+  OUT    UINT32   *Attributes OPTIONAL,
+  IN OUT UINTN    *DataSize,
+  OUT    VOID     *Data OPTIONAL
+  )
+{
+  MOCK_VARIABLE *Variable;
+
+  if (VariableName == NULL || VendorGuid == NULL || DataSize == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Variable = MockFindVariable (VariableName, VendorGuid);
+
+  if (Variable == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  if (*DataSize < Variable->DataSize || Data == NULL) {
+    *DataSize = Variable->DataSize;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  if (Attributes != NULL) {
+    *Attributes = Variable->Attributes;
+  }
+
+  *DataSize = Variable->DataSize;
+  CopyMem (Data, Variable->Data, Variable->DataSize);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Writes or, with no data, deletes a variable of the in-memory store.
+
+  @param  VariableName The variable's name.
+  @param  VendorGuid   The variable's vendor GUID.
+  @param  Attributes   The variable's attributes.
+  @param  DataSize     Number of bytes in Data, or 0 to delete it.
+  @param  Data         The variable's contents.
+
+  @retval EFI_SUCCESS           The variable was written or deleted.
+  @retval EFI_NOT_FOUND         The variable to delete does not exist.
+  @retval EFI_INVALID_PARAMETER The variable is larger than the mock takes.
+  @retval EFI_OUT_OF_RESOURCES  There was not enough memory.
+
+**/
+EFI_STATUS
+EFIAPI
+MockSetVariable (
+  IN CHAR16   *VariableName,
+  IN EFI_GUID *VendorGuid,
+  IN UINT32   Attributes,
+  IN UINTN    DataSize,
+  IN VOID     *Data
+  )
+{
+  MOCK_VARIABLE *Variable;
+
+  if (VariableName == NULL || VendorGuid == NULL ||
+      DataSize + StrSize (VariableName) > MOCK_MAX_VARIABLE_SIZE) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Variable = MockFindVariable (VariableName, VendorGuid);
+
+  if (DataSize == 0 || Attributes == 0) {
+    if (Variable == NULL) {
+      return EFI_NOT_FOUND;
+    }
+
+    MockFreeVariable (Variable);
+    return EFI_SUCCESS;
+  }
+
+  if (Variable != NULL) {
+    MockFreeVariable (Variable);
+  }
+
+  Variable = AllocateZeroPool (sizeof (MOCK_VARIABLE));
+
+  if (Variable == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Variable->Signature  = MOCK_VARIABLE_SIGNATURE;
+  Variable->Name       = AllocateCopyPool (StrSize (VariableName), VariableName);
+  Variable->Data       = AllocateCopyPool (DataSize, Data);
+  Variable->DataSize   = DataSize;
+  Variable->Attributes = Attributes;
+  CopyGuid (&Variable->VendorGuid, VendorGuid);
+
+  if (Variable->Name == NULL || Variable->Data == NULL) {
+    if (Variable->Name != NULL) {
+      FreePool (Variable->Name);
+    }
+
+    if (Variable->Data != NULL) {
+      FreePool (Variable->Data);
+    }
+
+    FreePool (Variable);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  InsertTailList (&mMockVariables, &Variable->Link);
+  return EFI_SUCCESS;
+}
+
+/**
+  Reports the in-memory store's sizes.
+
+  @param  Attributes                   Attributes of the variables asked about.
+  @param  MaximumVariableStorageSize   On output, the size of the storage.
+  @param  RemainingVariableStorageSize On output, the storage left.
+  @param  MaximumVariableSize          On output, the largest variable.
+
+  @retval EFI_SUCCESS The sizes were returned.
+
+**/
+EFI_STATUS
+EFIAPI
+MockQueryVariableInfo (
+  IN  UINT32 Attributes,
+  OUT UINT64 *MaximumVariableStorageSize,
+  OUT UINT64 *RemainingVariableStorageSize,
+  OUT UINT64 *MaximumVariableSize
+  )
+{
+  *MaximumVariableStorageSize   = MOCK_VARIABLE_STORAGE_SIZE;
+  *RemainingVariableStorageSize = MOCK_VARIABLE_STORAGE_SIZE;
+  *MaximumVariableSize          = MOCK_MAX_VARIABLE_SIZE;
+
+  return EFI_SUCCESS;
+}
+
+//
+// Global data
+//
+
+///
+/// The mock runtime services. Those a host test has no use for are NULL.
+///
+EFI_RUNTIME_SERVICES mMockRuntimeServices = {
+  {
+    EFI_RUNTIME_SERVICES_SIGNATURE,
+    EFI_RUNTIME_SERVICES_REVISION,
+    sizeof (EFI_RUNTIME_SERVICES),
+    0,
+    0
+  },
+  MockGetTime,                             // GetTime
+  NULL,                                    // SetTime
+  NULL,                                    // GetWakeupTime
+  NULL,                                    // SetWakeupTime
+  NULL,                                    // SetVirtualAddressMap
+  NULL,                                    // ConvertPointer
+  MockGetVariable,                         // GetVariable
+  NULL,                                    // GetNextVariableName
+  MockSetVariable,                         // SetVariable
+  NULL,                                    // GetNextHighMonotonicCount
+  NULL,                                    // ResetSystem
+  NULL,                                    // UpdateCapsule
+  NULL,                                    // QueryCapsuleCapabilities
+  MockQueryVariableInfo                    // QueryVariableInfo
+};
+
+///
+/// The global UefiRuntimeServicesTableLib provides.
+///
+EFI_RUNTIME_SERVICES *gRT = &mMockRuntimeServices;